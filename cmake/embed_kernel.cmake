@@ -0,0 +1,29 @@
+# Writes the OpenCL kernel source into a C header as a byte array, so that
+# the executables do not depend on where direct_fourier_transform.cl lives.
+#
+# Usage: cmake -DINPUT=<kernel.cl> -DOUTPUT=<header.h> -P embed_kernel.cmake
+
+file(READ "${INPUT}" hex HEX)
+string(LENGTH "${hex}" hex_length)
+math(EXPR size "${hex_length} / 2")
+
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+# Sixteen bytes per line (CMake regular expressions have no {n} repetition)
+set(line_pattern "")
+foreach(column RANGE 15)
+    set(line_pattern "${line_pattern}0x[0-9a-f][0-9a-f],")
+endforeach()
+string(REGEX REPLACE "(${line_pattern})" "\\1\n\t" bytes "${bytes}")
+
+file(WRITE "${OUTPUT}.tmp"
+"// Generated from direct_fourier_transform.cl by cmake/embed_kernel.cmake, do not edit\n\n"
+"#ifndef DFT_KERNEL_SOURCE_H_\n"
+"#define DFT_KERNEL_SOURCE_H_\n\n"
+"#include <stddef.h>\n\n"
+"static const unsigned char dft_kernel_source[] = {\n\t${bytes}0x00\n};\n\n"
+"static const size_t dft_kernel_source_size = ${size};\n\n"
+"#endif /* DFT_KERNEL_SOURCE_H_ */\n")
+
+# Only touch the header when the kernel changed, to avoid needless rebuilds
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different "${OUTPUT}.tmp" "${OUTPUT}")
+file(REMOVE "${OUTPUT}.tmp")
@@ -0,0 +1,197 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "direct_fourier_transform.h"
+#include "dft_api.h"
+
+//=========================//
+//        Structures       //
+//=========================//
+
+struct DFT_Handle {
+	Config config;
+	DFT_Engine *engine;
+	Source *sources;
+	int numSources;
+	int sourceCapacity;
+};
+
+//=========================//
+//        Functions        //
+//=========================//
+
+void dft_default_config(Config *config)
+{
+	initConfig(config);
+	config->numSources = 0;
+	config->numVisibilities = 0;
+	config->source_file = NULL;
+	config->vis_src_file = NULL;
+	config->vis_file = NULL;
+	config->synthetic_sources = 0;
+	config->synthetic_visibilities = 0;
+	config->enable_messages = 0;
+	config->stream_chunk_size = 0;
+	config->trace_file = NULL;
+	config->batch_manifest = NULL;
+	config->batch_report = NULL;
+	config->channel_file = NULL;
+	config->image_file = NULL;
+	config->sky_prune_tolerance = 0.0;
+	config->kernel_cache_dir = NULL;
+	config->tune_profile_dir = NULL;
+}
+
+int dft_create(DFT_Handle **handle, const Config *config)
+{
+	if (handle == NULL || config == NULL)
+		return DFT_ERROR_INVALID_ARGUMENT;
+
+	*handle = (DFT_Handle*) calloc(1, sizeof(DFT_Handle));
+	if (*handle == NULL)
+		return DFT_ERROR_OUT_OF_MEMORY;
+
+	int status = dft_configure(*handle, config);
+	if (status != DFT_SUCCESS)
+	{
+		free(*handle);
+		*handle = NULL;
+	}
+	return status;
+}
+
+int dft_configure(DFT_Handle *handle, const Config *config)
+{
+	if (handle == NULL || config == NULL)
+		return DFT_ERROR_INVALID_ARGUMENT;
+
+	Config next = *config;
+	DFT_Engine *engine = NULL;
+	int status = try_create_dft_engine(&next, &engine);
+	if (status != DFT_SUCCESS)
+		return status;
+
+	destroy_dft_engine(handle->engine);
+	handle->engine = engine;
+	handle->config = next;
+	return DFT_SUCCESS;
+}
+
+int dft_set_sources(DFT_Handle *handle, const Source *sources, int numSources)
+{
+	if (handle == NULL || numSources < 0 || (sources == NULL && numSources > 0))
+		return DFT_ERROR_INVALID_ARGUMENT;
+
+	if (numSources > handle->sourceCapacity)
+	{
+		Source *grown = (Source*) malloc(numSources * sizeof(Source));
+		if (grown == NULL)
+			return DFT_ERROR_OUT_OF_MEMORY;
+		free(handle->sources);
+		handle->sources = grown;
+		handle->sourceCapacity = numSources;
+	}
+	if (numSources > 0)
+		memcpy(handle->sources, sources, numSources * sizeof(Source));
+	handle->numSources = numSources;
+	return DFT_SUCCESS;
+}
+
+int dft_predict(DFT_Handle *handle, const Visibility *visibilities, int numVisibilities, Complex *visIntensity)
+{
+	if (handle == NULL || numVisibilities < 0
+		|| (numVisibilities > 0 && (visibilities == NULL || visIntensity == NULL)))
+		return DFT_ERROR_INVALID_ARGUMENT;
+
+	if (numVisibilities > 0)
+		memset(visIntensity, 0, numVisibilities * sizeof(Complex));
+
+	// The engine only reads the visibilities
+	handle->config.numSources = handle->numSources;
+	handle->config.numVisibilities = numVisibilities;
+	return extract_visibilities(handle->engine, &handle->config, handle->sources, (Visibility*) visibilities,
+		visIntensity, numVisibilities);
+}
+
+int dft_image(DFT_Handle *handle, const Visibility *visibilities, const Complex *visIntensity,
+	const double *weights, int numVisibilities, double *image)
+{
+	if (handle == NULL || image == NULL || numVisibilities < 0
+		|| (numVisibilities > 0 && (visibilities == NULL || visIntensity == NULL)))
+		return DFT_ERROR_INVALID_ARGUMENT;
+
+	handle->config.numVisibilities = numVisibilities;
+	return extract_image(handle->engine, &handle->config, (Visibility*) visibilities, (Complex*) visIntensity,
+		weights, numVisibilities, image);
+}
+
+int dft_precision_error(DFT_Handle *handle, const Visibility *visibilities, const Complex *visIntensity,
+	int numVisibilities, double *error)
+{
+	if (handle == NULL || error == NULL || numVisibilities < 0
+		|| (numVisibilities > 0 && (visibilities == NULL || visIntensity == NULL)))
+		return DFT_ERROR_INVALID_ARGUMENT;
+
+	*error = 0.0;
+	if (handle->engine->precision == DFT_PRECISION_DOUBLE || numVisibilities == 0)
+		return DFT_SUCCESS;
+
+	handle->config.numSources = handle->numSources;
+	*error = measure_precision_error(handle->engine, &handle->config, (Visibility*) visibilities,
+		(Complex*) visIntensity, numVisibilities);
+	return (*error == DBL_MAX) ? DFT_ERROR_OUT_OF_MEMORY : DFT_SUCCESS;
+}
+
+void dft_destroy(DFT_Handle *handle)
+{
+	if (handle == NULL)
+		return;
+
+	destroy_dft_engine(handle->engine);
+	free(handle->sources);
+	free(handle);
+}
+
+const char* dft_status_string(int status)
+{
+	switch (status)
+	{
+		case DFT_SUCCESS:                return "success";
+		case DFT_ERROR_INVALID_ARGUMENT: return "invalid argument";
+		case DFT_ERROR_OUT_OF_MEMORY:    return "out of host memory";
+		case DFT_ERROR_NO_DEVICE:        return "no OpenCL device";
+		case DFT_ERROR_PROGRAM:          return "kernel program failed to build";
+		case DFT_ERROR_DEVICE:           return "OpenCL call failed";
+		case DFT_ERROR_IO:               return "file could not be read or written";
+		default:                         return "unknown status";
+	}
+}
@@ -0,0 +1,95 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DFT_API_H_
+#define DFT_API_H_
+
+#include "dft_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================//
+//        Structures       //
+//=========================//
+
+/* In-process prediction engine
+
+The handle owns an engine (see create_dft_engine), a copy of its Config
+and a copy of the sky model. Every buffer a call reads or writes belongs
+to the caller and is only used for the duration of the call; nothing is
+read from or written to a file. Visibilities are in wavelengths. A handle
+may be used by one thread at a time.
+
+Every call returning int returns a DFT_Status.
+*/
+typedef struct DFT_Handle DFT_Handle;
+
+//=========================//
+//     Function Headers    //
+//=========================//
+
+// Defaults of initConfig without any input or output file, message or
+// kernel cache; the file, synthetic input and pruning fields are ignored by
+// the calls below
+void dft_default_config(Config *config);
+
+// Creates the engine. A non-zero config->numSources lets the OpenCL kernels
+// specialize to a sky model of that size.
+int dft_create(DFT_Handle **handle, const Config *config);
+
+// Replaces the configuration and recreates the engine; the handle keeps its
+// previous engine and configuration when that fails
+int dft_configure(DFT_Handle *handle, const Config *config);
+
+// Copies the sky model into the handle
+int dft_set_sources(DFT_Handle *handle, const Source *sources, int numSources);
+
+// Overwrites visIntensity with the prediction of the sky model
+int dft_predict(DFT_Handle *handle, const Visibility *visibilities, int numVisibilities, Complex *visIntensity);
+
+// Dirty image of grid_size x grid_size pixels (see extract_image); weights may be NULL
+int dft_image(DFT_Handle *handle, const Visibility *visibilities, const Complex *visIntensity,
+	const double *weights, int numVisibilities, double *image);
+
+// Largest error of a reduced precision prediction against the native
+// double precision one (see measure_precision_error); 0 in double precision
+int dft_precision_error(DFT_Handle *handle, const Visibility *visibilities, const Complex *visIntensity,
+	int numVisibilities, double *error);
+
+void dft_destroy(DFT_Handle *handle);
+
+// Short description of a DFT_Status
+const char* dft_status_string(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFT_API_H_ */
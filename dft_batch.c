@@ -0,0 +1,487 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "dft_batch.h"
+#include "dft_binary_io.h"
+#include "dft_trace.h"
+
+//=========================//
+//        Structures       //
+//=========================//
+
+// One manifest line and what became of it
+typedef struct BatchJob {
+	int line;
+	char *sourceFile;
+	char *visFile;
+	char *outputFile;
+	double frequency;
+	Config config;
+	Source *sources;
+	Visibility *visibilities;
+	Complex *visIntensity;
+	DFT_Mapping mapping;
+	int loaded;
+	int status; // DFT_Status of the prediction
+	double loadSeconds;
+	double computeSeconds;
+	double saveSeconds;
+} BatchJob;
+
+// Bounded hand-over between two pipeline stages
+typedef struct BatchQueue {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	BatchJob *jobs[BATCH_QUEUE_DEPTH];
+	int head;
+	int count;
+	int closed;
+} BatchQueue;
+
+typedef struct BatchPipeline {
+	BatchJob *jobs;
+	int numJobs;
+	BatchQueue loaded;
+	BatchQueue computed;
+} BatchPipeline;
+
+//=========================//
+//        Functions        //
+//=========================//
+
+static double batch_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void queue_init(BatchQueue *queue)
+{
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->changed, NULL);
+	queue->head = 0;
+	queue->count = 0;
+	queue->closed = 0;
+}
+
+static void queue_destroy(BatchQueue *queue)
+{
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->changed);
+}
+
+// Blocks while the queue is full
+static void queue_push(BatchQueue *queue, BatchJob *job)
+{
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == BATCH_QUEUE_DEPTH)
+		pthread_cond_wait(&queue->changed, &queue->lock);
+	queue->jobs[(queue->head + queue->count) % BATCH_QUEUE_DEPTH] = job;
+	queue->count++;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+// Blocks while the queue is empty; NULL once it is closed and drained
+static BatchJob* queue_pop(BatchQueue *queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == 0 && !queue->closed)
+		pthread_cond_wait(&queue->changed, &queue->lock);
+
+	BatchJob *job = NULL;
+	if (queue->count > 0)
+	{
+		job = queue->jobs[queue->head];
+		queue->head = (queue->head + 1) % BATCH_QUEUE_DEPTH;
+		queue->count--;
+		pthread_cond_broadcast(&queue->changed);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return job;
+}
+
+static void queue_close(BatchQueue *queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = 1;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+// NULL when out of memory
+static char* copy_field(const char *field)
+{
+	char *copy = (char*) malloc(strlen(field) + 1);
+	if (copy != NULL)
+		strcpy(copy, field);
+	return copy;
+}
+
+static void free_jobs(BatchJob *jobs, int count)
+{
+	for (int j = 0; j < count; ++j)
+	{
+		free(jobs[j].sourceFile);
+		free(jobs[j].visFile);
+		free(jobs[j].outputFile);
+	}
+	free(jobs);
+}
+
+/* Read the job manifest
+
+Each line holds a source file, a visibility file, an output file and the
+observing frequency in Hz, separated by commas or whitespace. Blank lines
+and lines starting with '#' are skipped. Returns the job count, or -1
+when the manifest is missing, a line is malformed or memory runs out.
+*/
+static int read_manifest(const char *path, BatchJob **jobs)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		printf(">>> ERROR: Unable to open batch manifest %s...\n\n", path);
+		return -1;
+	}
+
+	int count = 0;
+	int capacity = 0;
+	int line_number = 0;
+	char line[BATCH_MAX_LINE];
+	int out_of_memory = 0;
+	*jobs = NULL;
+
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		line_number++;
+		char *fields[5];
+		int numFields = 0;
+		char *save = NULL;
+		for (char *field = strtok_r(line, " ,\t\r\n", &save); field != NULL && numFields < 5;
+			field = strtok_r(NULL, " ,\t\r\n", &save))
+			fields[numFields++] = field;
+
+		if (numFields == 0 || fields[0][0] == '#')
+			continue;
+
+		char *end = NULL;
+		double frequency = (numFields == 4) ? strtod(fields[3], &end) : 0.0;
+		if (numFields != 4 || end == fields[3] || *end != '\0' || frequency <= 0.0)
+		{
+			printf(">>> ERROR: Malformed batch manifest line %d in %s, expected "
+				"<sources> <visibilities> <output> <frequency_hz>...\n\n", line_number, path);
+			fclose(file);
+			free_jobs(*jobs, count);
+			*jobs = NULL;
+			return -1;
+		}
+
+		if (count == capacity)
+		{
+			int grown = (capacity > 0) ? 2 * capacity : 16;
+			BatchJob *resized = (BatchJob*) realloc(*jobs, grown * sizeof(BatchJob));
+			if (resized == NULL)
+			{
+				out_of_memory = 1;
+				break;
+			}
+			*jobs = resized;
+			capacity = grown;
+		}
+
+		BatchJob *job = &(*jobs)[count++];
+		memset(job, 0, sizeof(BatchJob));
+		job->line = line_number;
+		job->sourceFile = copy_field(fields[0]);
+		job->visFile = copy_field(fields[1]);
+		job->outputFile = copy_field(fields[2]);
+		job->frequency = frequency;
+		if (job->sourceFile == NULL || job->visFile == NULL || job->outputFile == NULL)
+		{
+			out_of_memory = 1;
+			break;
+		}
+	}
+
+	if (out_of_memory)
+	{
+		perror("Couldn't allocate the manifest");
+		fclose(file);
+		free_jobs(*jobs, count);
+		*jobs = NULL;
+		return -1;
+	}
+
+	fclose(file);
+	return count;
+}
+
+static void release_job_data(BatchJob *job)
+{
+	if (job->visibilities && job->mapping.address == NULL) free(job->visibilities);
+	unmap_file(&job->mapping);
+	if (job->visIntensity) free(job->visIntensity);
+	if (job->sources)      free(job->sources);
+	job->visibilities = NULL;
+	job->visIntensity = NULL;
+	job->sources = NULL;
+}
+
+// Loads a job's inputs the way main does, binary containers included
+static void load_job(BatchJob *job)
+{
+	Config *config = &job->config;
+	double started = batch_now();
+
+	if (is_binary_file(config->source_file))
+		load_binary_sources(config, config->source_file, &job->sources);
+	else
+		loadSources(config, &job->sources);
+
+	if (job->sources != NULL)
+	{
+		if (is_binary_file(config->vis_src_file))
+			load_binary_visibilities(config, config->vis_src_file, &job->mapping, &job->visibilities,
+				&job->visIntensity);
+		else
+			loadVisibilities(config, &job->visibilities, &job->visIntensity);
+	}
+
+	job->loaded = job->sources != NULL && job->visibilities != NULL && job->visIntensity != NULL;
+	if (!job->loaded)
+		release_job_data(job);
+	job->loadSeconds = batch_now() - started;
+}
+
+// First stage: parses jobs ahead of the prediction
+static void* batch_loader(void *arg)
+{
+	BatchPipeline *pipeline = (BatchPipeline*) arg;
+	for (int j = 0; j < pipeline->numJobs; ++j)
+	{
+		load_job(&pipeline->jobs[j]);
+		queue_push(&pipeline->loaded, &pipeline->jobs[j]);
+	}
+	queue_close(&pipeline->loaded);
+	return NULL;
+}
+
+// Writes a predicted job out and frees its data
+static void save_job(BatchJob *job)
+{
+	if (job->loaded && job->status == DFT_SUCCESS)
+	{
+		double started = batch_now();
+		if (job->config.binary_output)
+			saveVisibilitiesBinary(&job->config, job->visibilities, job->visIntensity);
+		else
+			saveVisibilities(&job->config, job->visibilities, job->visIntensity);
+		job->saveSeconds = batch_now() - started;
+		trace_host("save visibilities", TRACE_IO, started);
+	}
+	release_job_data(job);
+}
+
+// Last stage: writes jobs out behind the prediction
+static void* batch_writer(void *arg)
+{
+	BatchPipeline *pipeline = (BatchPipeline*) arg;
+	BatchJob *job;
+	while ((job = queue_pop(&pipeline->computed)) != NULL)
+		save_job(job);
+	return NULL;
+}
+
+static int write_report(const char *path, BatchJob *jobs, int numJobs)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+		return 0;
+
+	fprintf(file, "line,source_file,visibility_file,output_file,frequency_hz,status,sources,visibilities,"
+		"load_seconds,compute_seconds,save_seconds,pairs_per_second\n");
+	for (int j = 0; j < numJobs; ++j)
+	{
+		BatchJob *job = &jobs[j];
+		double pairs = (double) job->config.numVisibilities * job->config.numSources;
+		fprintf(file, "%d,%s,%s,%s,%.9g,%s,%d,%d,%.6f,%.6f,%.6f,%.6g\n", job->line, job->sourceFile,
+			job->visFile, job->outputFile, job->frequency,
+			!job->loaded ? "load failed" : (job->status != DFT_SUCCESS) ? "compute failed" : "ok",
+			job->loaded ? job->config.numSources : 0, job->loaded ? job->config.numVisibilities : 0,
+			job->loadSeconds, job->computeSeconds, job->saveSeconds,
+			(job->loaded && job->computeSeconds > 0.0) ? pairs / job->computeSeconds : 0.0);
+	}
+
+	return fclose(file) == 0;
+}
+
+int run_batch(Config *config)
+{
+	BatchPipeline pipeline;
+	pipeline.numJobs = read_manifest(config->batch_manifest, &pipeline.jobs);
+	if (pipeline.numJobs < 0)
+		return -1;
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Running %d batch jobs from %s...\n\n", pipeline.numJobs, config->batch_manifest);
+
+	// Every job runs with the base configuration, its own files and frequency
+	for (int j = 0; j < pipeline.numJobs; ++j)
+	{
+		BatchJob *job = &pipeline.jobs[j];
+		job->config = *config;
+		job->config.source_file = job->sourceFile;
+		job->config.vis_src_file = job->visFile;
+		job->config.vis_file = job->outputFile;
+		job->config.frequency_hz = job->frequency;
+		job->config.synthetic_sources = 0;
+		job->config.synthetic_visibilities = 0;
+		job->config.enable_messages = 0;
+	}
+
+	queue_init(&pipeline.loaded);
+	queue_init(&pipeline.computed);
+	double started = batch_now();
+
+	// Without threads the stages run one after another on this thread
+	pthread_t loader, writer;
+	int writing = pthread_create(&writer, NULL, batch_writer, &pipeline) == 0;
+	int loading = writing && pthread_create(&loader, NULL, batch_loader, &pipeline) == 0;
+	if (!loading)
+		printf(">>> WARNING: Unable to start the batch pipeline, running the jobs one at a time...\n\n");
+
+	// The engine is created for the first job's sky model and reused by the
+	// rest; its sky model cache notices when consecutive jobs share sources
+	DFT_Engine *engine = NULL;
+	int failed = 0;
+	BatchJob *job;
+	for (int next = 0; ; ++next)
+	{
+		if (loading)
+			job = queue_pop(&pipeline.loaded);
+		else if (next < pipeline.numJobs)
+		{
+			job = &pipeline.jobs[next];
+			load_job(job);
+		}
+		else
+			job = NULL;
+		if (job == NULL)
+			break;
+
+		if (job->loaded)
+		{
+			job->status = DFT_SUCCESS;
+			if (engine == NULL)
+			{
+				job->config.enable_messages = config->enable_messages;
+				job->status = try_create_dft_engine(&job->config, &engine);
+				job->config.enable_messages = 0;
+			}
+
+			double computing = batch_now();
+			if (job->status == DFT_SUCCESS)
+				job->status = extract_visibilities(engine, &job->config, job->sources, job->visibilities,
+					job->visIntensity, job->config.numVisibilities);
+			job->computeSeconds = batch_now() - computing;
+			if (job->status != DFT_SUCCESS)
+			{
+				printf(">>> ERROR: Unable to predict batch job on line %d (status %d)...\n\n", job->line,
+					job->status);
+				failed++;
+			}
+		}
+		else
+		{
+			printf(">>> ERROR: Unable to load batch job on line %d (%s, %s)...\n\n", job->line,
+				job->sourceFile, job->visFile);
+			failed++;
+		}
+
+		if(config->enable_messages && job->loaded && job->status == DFT_SUCCESS)
+			printf(">>> UPDATE: Job %d: %d visibilities x %d sources, load %.3fs, compute %.3fs...\n\n",
+				job->line, job->config.numVisibilities, job->config.numSources, job->loadSeconds,
+				job->computeSeconds);
+		if (writing)
+			queue_push(&pipeline.computed, job);
+		else
+			save_job(job);
+	}
+	queue_close(&pipeline.computed);
+
+	if (loading)
+		pthread_join(loader, NULL);
+	if (writing)
+		pthread_join(writer, NULL);
+	double wall = batch_now() - started;
+	if (engine != NULL)
+		destroy_dft_engine(engine);
+	queue_destroy(&pipeline.loaded);
+	queue_destroy(&pipeline.computed);
+
+	// Stage times adding up to more than the wall time is the overlap won
+	double load = 0.0, compute = 0.0, save = 0.0, pairs = 0.0;
+	long long visibilities = 0;
+	for (int j = 0; j < pipeline.numJobs; ++j)
+	{
+		BatchJob *done = &pipeline.jobs[j];
+		load += done->loadSeconds;
+		compute += done->computeSeconds;
+		save += done->saveSeconds;
+		if (done->loaded && done->status == DFT_SUCCESS)
+		{
+			visibilities += done->config.numVisibilities;
+			pairs += (double) done->config.numVisibilities * done->config.numSources;
+		}
+	}
+
+	printf(">>> INFO: Batch of %d jobs (%d failed) in %.3fs: load %.3fs, compute %.3fs, save %.3fs, "
+		"overlap %.2fx...\n\n", pipeline.numJobs, failed, wall, load, compute, save,
+		(wall > 0.0) ? (load + compute + save) / wall : 0.0);
+	printf(">>> INFO: Aggregate throughput %.4g visibilities/s, %.4g visibility x source pairs/s...\n\n",
+		(wall > 0.0) ? visibilities / wall : 0.0, (wall > 0.0) ? pairs / wall : 0.0);
+
+	if (config->batch_report != NULL)
+	{
+		if (write_report(config->batch_report, pipeline.jobs, pipeline.numJobs))
+			printf(">>> INFO: Wrote batch report to %s...\n\n", config->batch_report);
+		else
+			printf(">>> ERROR: Unable to write batch report to %s...\n\n", config->batch_report);
+	}
+
+	free_jobs(pipeline.jobs, pipeline.numJobs);
+	return failed;
+}
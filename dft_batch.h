@@ -0,0 +1,64 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DFT_BATCH_H_
+#define DFT_BATCH_H_
+
+#include "direct_fourier_transform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+// Jobs waiting between two pipeline stages. Up to 2 * BATCH_QUEUE_DEPTH + 3
+// jobs hold their data at once: one loading, BATCH_QUEUE_DEPTH loaded, one
+// computing, BATCH_QUEUE_DEPTH computed and one writing; five with one.
+#define BATCH_QUEUE_DEPTH 1
+
+// Longest manifest line
+#define BATCH_MAX_LINE 4096
+
+//=========================//
+//     Function Headers    //
+//=========================//
+
+// Runs every job of config->batch_manifest on one engine, overlapping the
+// loading of the next job and the saving of the previous one with the
+// prediction of the current one. Returns the number of jobs that failed,
+// or -1 when the manifest cannot be read.
+int run_batch(Config *config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFT_BATCH_H_ */
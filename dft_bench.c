@@ -0,0 +1,441 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "direct_fourier_transform.h"
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+// Floating point operations counted per visibility and source pair: three
+// FMAs for the phase, two for the accumulation, and sin and cos at one each
+#define BENCH_FLOPS_PER_PAIR 12
+
+// Most benchmark cases and baseline rows held at once
+#define BENCH_MAX_CASES 16
+#define BENCH_MAX_RESULTS 4096
+
+// Length of the backend, variant and precision labels
+#define BENCH_LABEL 16
+
+//=========================//
+//        Structures       //
+//=========================//
+
+// One backend, kernel variant and precision combination
+typedef struct BenchCase {
+	int backend;
+	int kernelVariant;
+	int precision;
+} BenchCase;
+
+typedef struct BenchResult {
+	char backend[BENCH_LABEL];
+	char variant[BENCH_LABEL];
+	char precision[BENCH_LABEL];
+	int visibilities;
+	int sources;
+	double wallSeconds;
+	double kernelSeconds;
+	double pairsPerSecond;
+	double gflops;
+} BenchResult;
+
+typedef struct BenchOptions {
+	int minVisibilities;
+	int maxVisibilities;
+	int minSources;
+	int maxSources;
+	int step;
+	int repeats;
+	int numThreads;
+	const char *jsonFile;
+	const char *csvFile;
+	const char *baselineFile;
+	double tolerance;
+} BenchOptions;
+
+//=========================//
+//        Functions        //
+//=========================//
+
+static void usage(const char *program)
+{
+	printf(">>> INFO: Usage: %s [--min-vis N] [--max-vis N] [--min-sources N] [--max-sources N]\n"
+		"          [--step N] [--repeats N] [--threads N] [--json out.json] [--csv out.csv]\n"
+		"          [--compare baseline.(json|csv)] [--tolerance fraction]\n\n", program);
+}
+
+static double bench_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static const char* backend_label(int backend)
+{
+	return (backend == DFT_BACKEND_CPU) ? "cpu" : (backend == DFT_BACKEND_MULTI) ? "multi" : "opencl";
+}
+
+static const char* variant_label(BenchCase *bench)
+{
+	if (bench->backend == DFT_BACKEND_CPU)
+		return "native";
+	return (bench->kernelVariant == DFT_KERNEL_BASIC) ? "basic" : "tiled";
+}
+
+static const char* precision_label(int precision)
+{
+	return (precision == DFT_PRECISION_SINGLE) ? "single"
+		: (precision == DFT_PRECISION_DOUBLE_SINGLE) ? "double-single" : "double";
+}
+
+static int parse_options(int argc, char **argv, BenchOptions *options)
+{
+	options->minVisibilities = 1024;
+	options->maxVisibilities = 262144;
+	options->minSources = 16;
+	options->maxSources = 4096;
+	options->step = 4;
+	options->repeats = 3;
+	options->numThreads = 0;
+	options->jsonFile = NULL;
+	options->csvFile = NULL;
+	options->baselineFile = NULL;
+	options->tolerance = 0.10;
+
+	for (int a = 1; a < argc; ++a)
+	{
+		if (a + 1 >= argc)
+			return 0;
+		const char *value = argv[++a];
+		const char *name = argv[a - 1];
+
+		if (strcmp(name, "--min-vis") == 0)          options->minVisibilities = atoi(value);
+		else if (strcmp(name, "--max-vis") == 0)     options->maxVisibilities = atoi(value);
+		else if (strcmp(name, "--min-sources") == 0) options->minSources = atoi(value);
+		else if (strcmp(name, "--max-sources") == 0) options->maxSources = atoi(value);
+		else if (strcmp(name, "--step") == 0)        options->step = atoi(value);
+		else if (strcmp(name, "--repeats") == 0)     options->repeats = atoi(value);
+		else if (strcmp(name, "--threads") == 0)     options->numThreads = atoi(value);
+		else if (strcmp(name, "--json") == 0)        options->jsonFile = value;
+		else if (strcmp(name, "--csv") == 0)         options->csvFile = value;
+		else if (strcmp(name, "--compare") == 0)     options->baselineFile = value;
+		else if (strcmp(name, "--tolerance") == 0)   options->tolerance = atof(value);
+		else return 0;
+	}
+
+	return options->minVisibilities > 0 && options->maxVisibilities >= options->minVisibilities
+		&& options->minSources > 0 && options->maxSources >= options->minSources
+		&& options->step > 1 && options->repeats > 0;
+}
+
+/* List the cases this host can run
+
+The native CPU backend is always measured. Each OpenCL kernel variant and
+precision is added when a device is found, together with the multi-device
+backend that combines the devices with the CPU.
+*/
+static int find_cases(Config *config, BenchCase *cases)
+{
+	int count = 0;
+	cases[count++] = (BenchCase) { DFT_BACKEND_CPU, DFT_KERNEL_TILED, DFT_PRECISION_DOUBLE };
+
+	Config probe = *config;
+	probe.compute_backend = DFT_BACKEND_AUTO;
+	DFT_Engine *engine = create_dft_engine(&probe);
+	int have_device = engine != NULL && engine->backend == DFT_BACKEND_OPENCL;
+	destroy_dft_engine(engine);
+
+	if (!have_device)
+	{
+		printf(">>> INFO: No OpenCL device found, measuring the native CPU backend only...\n\n");
+		return count;
+	}
+
+	for (int variant = DFT_KERNEL_BASIC; variant <= DFT_KERNEL_TILED; ++variant)
+		for (int precision = DFT_PRECISION_DOUBLE; precision <= DFT_PRECISION_DOUBLE_SINGLE; ++precision)
+			cases[count++] = (BenchCase) { DFT_BACKEND_OPENCL, variant, precision };
+	cases[count++] = (BenchCase) { DFT_BACKEND_MULTI, DFT_KERNEL_TILED, DFT_PRECISION_DOUBLE };
+	return count;
+}
+
+/* Time one case at one visibility and source count
+
+A first untimed call absorbs buffer allocation and sky model upload. The
+fastest of the timed repeats is kept, as the least disturbed by the rest
+of the system. Throughput is derived from the compute time.
+*/
+static void run_case(DFT_Engine *engine, Config *config, BenchCase *bench, Source *sources,
+	Visibility *visibilities, Complex *visIntensity, int repeats, BenchResult *result)
+{
+	int count = config->numVisibilities;
+	extract_visibilities(engine, config, sources, visibilities, visIntensity, count);
+
+	result->wallSeconds = 0.0;
+	result->kernelSeconds = 0.0;
+	for (int r = 0; r < repeats; ++r)
+	{
+		memset(visIntensity, 0, count * sizeof(Complex));
+		double started = bench_now();
+		extract_visibilities(engine, config, sources, visibilities, visIntensity, count);
+		double wall = bench_now() - started;
+
+		if (r == 0 || wall < result->wallSeconds)
+			result->wallSeconds = wall;
+		if (r == 0 || engine->kernelSeconds < result->kernelSeconds)
+			result->kernelSeconds = engine->kernelSeconds;
+	}
+
+	double pairs = (double) count * config->numSources;
+	double seconds = (result->kernelSeconds > 0.0) ? result->kernelSeconds : result->wallSeconds;
+	snprintf(result->backend, BENCH_LABEL, "%s", backend_label(bench->backend));
+	snprintf(result->variant, BENCH_LABEL, "%s", variant_label(bench));
+	// A device without fp64 runs the double case as double-single
+	snprintf(result->precision, BENCH_LABEL, "%s", precision_label(engine->precision));
+	result->visibilities = count;
+	result->sources = config->numSources;
+	result->pairsPerSecond = (seconds > 0.0) ? pairs / seconds : 0.0;
+	result->gflops = result->pairsPerSecond * BENCH_FLOPS_PER_PAIR * 1e-9;
+}
+
+static int write_json(const char *path, BenchResult *results, int count)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+		return 0;
+
+	// One result per line, which is also how --compare reads it back
+	fprintf(file, "{\n\t\"benchmark\": \"dft_bench\",\n\t\"flops_per_pair\": %d,\n\t\"results\": [\n",
+		BENCH_FLOPS_PER_PAIR);
+	for (int r = 0; r < count; ++r)
+		fprintf(file, "\t\t{\"backend\": \"%s\", \"variant\": \"%s\", \"precision\": \"%s\", "
+			"\"visibilities\": %d, \"sources\": %d, \"wall_seconds\": %.9g, \"kernel_seconds\": %.9g, "
+			"\"pairs_per_second\": %.9g, \"gflops\": %.9g}%s\n",
+			results[r].backend, results[r].variant, results[r].precision, results[r].visibilities,
+			results[r].sources, results[r].wallSeconds, results[r].kernelSeconds,
+			results[r].pairsPerSecond, results[r].gflops, (r + 1 < count) ? "," : "");
+	fprintf(file, "\t]\n}\n");
+
+	return fclose(file) == 0;
+}
+
+static int write_csv(const char *path, BenchResult *results, int count)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+		return 0;
+
+	fprintf(file, "backend,variant,precision,visibilities,sources,wall_seconds,kernel_seconds,"
+		"pairs_per_second,gflops\n");
+	for (int r = 0; r < count; ++r)
+		fprintf(file, "%s,%s,%s,%d,%d,%.9g,%.9g,%.9g,%.9g\n",
+			results[r].backend, results[r].variant, results[r].precision, results[r].visibilities,
+			results[r].sources, results[r].wallSeconds, results[r].kernelSeconds,
+			results[r].pairsPerSecond, results[r].gflops);
+
+	return fclose(file) == 0;
+}
+
+// Reads one result from a line written by write_json or write_csv
+static int parse_result(const char *line, BenchResult *result)
+{
+	while (*line == ' ' || *line == '\t')
+		line++;
+
+	if (*line == '{')
+		return sscanf(line, "{\"backend\": \"%15[^\"]\", \"variant\": \"%15[^\"]\", \"precision\": \"%15[^\"]\", "
+			"\"visibilities\": %d, \"sources\": %d, \"wall_seconds\": %lf, \"kernel_seconds\": %lf, "
+			"\"pairs_per_second\": %lf, \"gflops\": %lf",
+			result->backend, result->variant, result->precision, &result->visibilities, &result->sources,
+			&result->wallSeconds, &result->kernelSeconds, &result->pairsPerSecond, &result->gflops) == 9;
+
+	return sscanf(line, "%15[^,],%15[^,],%15[^,],%d,%d,%lf,%lf,%lf,%lf",
+		result->backend, result->variant, result->precision, &result->visibilities, &result->sources,
+		&result->wallSeconds, &result->kernelSeconds, &result->pairsPerSecond, &result->gflops) == 9;
+}
+
+/* Flag every case whose throughput fell below the baseline's by more than
+the tolerance; returns the number of regressions, or -1 when the baseline
+cannot be read. Cases missing from either side are not compared.
+*/
+static int compare_with_baseline(const char *path, double tolerance, BenchResult *results, int count)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return -1;
+
+	int regressions = 0;
+	int compared = 0;
+	char line[512];
+	BenchResult baseline;
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		if (!parse_result(line, &baseline))
+			continue;
+
+		for (int r = 0; r < count; ++r)
+		{
+			BenchResult *current = &results[r];
+			if (strcmp(current->backend, baseline.backend) != 0 || strcmp(current->variant, baseline.variant) != 0
+				|| strcmp(current->precision, baseline.precision) != 0
+				|| current->visibilities != baseline.visibilities || current->sources != baseline.sources)
+				continue;
+
+			compared++;
+			double ratio = (baseline.pairsPerSecond > 0.0) ? current->pairsPerSecond / baseline.pairsPerSecond : 1.0;
+			if (ratio < 1.0 - tolerance)
+			{
+				printf(">>> WARNING: Regression in %s/%s/%s at %d visibilities x %d sources: "
+					"%.4g -> %.4g pairs/s (%.1f%%)\n", current->backend, current->variant, current->precision,
+					current->visibilities, current->sources, baseline.pairsPerSecond,
+					current->pairsPerSecond, (ratio - 1.0) * 100.0);
+				regressions++;
+			}
+		}
+	}
+	fclose(file);
+
+	printf("\n>>> INFO: Compared %d cases against %s, %d regressions beyond %.0f%%...\n\n",
+		compared, path, regressions, tolerance * 100.0);
+	return regressions;
+}
+
+/* Sweep visibility and source counts over log-spaced grids for every
+backend, kernel variant and precision, on synthetic data
+*/
+int main(int argc, char **argv)
+{
+	BenchOptions options;
+	if (!parse_options(argc, argv, &options))
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Fixed seed so every run measures the same inputs
+	srand(1);
+
+	Config config;
+	initConfig(&config);
+	config.enable_messages = 0;
+	config.synthetic_sources = 1;
+	config.synthetic_visibilities = 1;
+	config.num_threads = options.numThreads;
+	// The sweep measures the exact kernels, never the gridded approximation
+	config.prediction_mode = DFT_PREDICT_EXACT;
+	// and each case the variant it names, whatever a tuning profile prefers
+	config.tune_profile_dir = NULL;
+
+	BenchCase cases[BENCH_MAX_CASES];
+	int numCases = find_cases(&config, cases);
+
+	BenchResult *results = (BenchResult*) calloc(BENCH_MAX_RESULTS, sizeof(BenchResult));
+	if (results == NULL) {
+		perror("Couldn't allocate the results");
+		exit(1);
+	}
+	int numResults = 0;
+
+	printf(">>> INFO: %-8s %-8s %-14s %10s %8s %12s %12s %14s %10s\n", "backend", "variant", "precision",
+		"vis", "sources", "wall (s)", "kernel (s)", "pairs/s", "GFLOP/s");
+
+	for (int c = 0; c < numCases; ++c)
+	{
+		config.compute_backend = cases[c].backend;
+		config.kernel_variant = cases[c].kernelVariant;
+		config.precision_mode = cases[c].precision;
+
+		for (long long n_src = options.minSources; n_src <= options.maxSources; n_src *= options.step)
+		{
+			// Each engine is created for its sky model size, as dft would be
+			config.numSources = (int) n_src;
+			Source *sources = NULL;
+			loadSources(&config, &sources);
+			DFT_Engine *engine = create_dft_engine(&config);
+			if (engine == NULL)
+			{
+				printf(">>> ERROR: Unable to create the %s engine...\n\n", backend_label(cases[c].backend));
+				exit(1);
+			}
+
+			for (long long n_vis = options.minVisibilities; n_vis <= options.maxVisibilities
+				&& numResults < BENCH_MAX_RESULTS; n_vis *= options.step)
+			{
+				config.numVisibilities = (int) n_vis;
+				Visibility *visibilities = NULL;
+				Complex *visIntensity = NULL;
+				loadVisibilities(&config, &visibilities, &visIntensity);
+				if (sources == NULL || visibilities == NULL || visIntensity == NULL)
+				{
+					printf(">>> ERROR: Unable to allocate %d visibilities and %d sources...\n\n",
+						config.numVisibilities, config.numSources);
+					exit(1);
+				}
+
+				BenchResult *result = &results[numResults++];
+				run_case(engine, &config, &cases[c], sources, visibilities, visIntensity, options.repeats, result);
+				printf(">>> INFO: %-8s %-8s %-14s %10d %8d %12.6f %12.6f %14.4g %10.2f\n", result->backend,
+					result->variant, result->precision, result->visibilities, result->sources,
+					result->wallSeconds, result->kernelSeconds, result->pairsPerSecond, result->gflops);
+
+				free(visibilities);
+				free(visIntensity);
+			}
+
+			destroy_dft_engine(engine);
+			free(sources);
+		}
+	}
+	printf("\n");
+
+	if (options.jsonFile != NULL && !write_json(options.jsonFile, results, numResults))
+		printf(">>> ERROR: Unable to write %s...\n\n", options.jsonFile);
+	if (options.csvFile != NULL && !write_csv(options.csvFile, results, numResults))
+		printf(">>> ERROR: Unable to write %s...\n\n", options.csvFile);
+
+	int status = EXIT_SUCCESS;
+	if (options.baselineFile != NULL)
+	{
+		int regressions = compare_with_baseline(options.baselineFile, options.tolerance, results, numResults);
+		if (regressions < 0)
+			printf(">>> ERROR: Unable to read baseline %s...\n\n", options.baselineFile);
+		if (regressions != 0)
+			status = EXIT_FAILURE;
+	}
+
+	free(results);
+	printf(">>> INFO: Benchmark complete, exiting...\n\n");
+	return status;
+}
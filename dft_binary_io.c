@@ -0,0 +1,401 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dft_binary_io.h"
+
+static uint64_t align_offset(uint64_t offset)
+{
+	return (offset + DFT_BINARY_ALIGNMENT - 1) & ~((uint64_t) DFT_BINARY_ALIGNMENT - 1);
+}
+
+static uint32_t swap32(uint32_t value)
+{
+	return __builtin_bswap32(value);
+}
+
+static uint64_t swap64(uint64_t value)
+{
+	return __builtin_bswap64(value);
+}
+
+static double swap_double(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	bits = swap64(bits);
+	memcpy(&value, &bits, sizeof(bits));
+	return value;
+}
+
+/* Convert a header written on a host of the opposite byte order */
+static void swap_header(DFT_BinaryHeader *header)
+{
+	header->version = swap32(header->version);
+	header->endian = swap32(header->endian);
+	header->kind = swap32(header->kind);
+	header->layout = swap32(header->layout);
+	header->count = swap64(header->count);
+	header->frequency_hz = swap_double(header->frequency_hz);
+	header->cell_size = swap_double(header->cell_size);
+	header->records_offset = swap64(header->records_offset);
+	header->intensities_offset = swap64(header->intensities_offset);
+	header->width = swap32(header->width);
+	header->height = swap32(header->height);
+}
+
+static int write_padding(FILE *file, uint64_t from, uint64_t to)
+{
+	static const char zeros[64] = { 0 };
+	while (from < to)
+	{
+		size_t chunk = (to - from < sizeof(zeros)) ? (size_t) (to - from) : sizeof(zeros);
+		if (fwrite(zeros, 1, chunk, file) != chunk)
+			return 0;
+		from += chunk;
+	}
+	return 1;
+}
+
+/* Write a header followed by page-aligned record and intensity arrays */
+static int write_container(const char *path, DFT_BinaryHeader *header, const void *records,
+	size_t recordBytes, const void *intensities, size_t intensityBytes)
+{
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+		return 0;
+
+	header->records_offset = align_offset(sizeof(DFT_BinaryHeader));
+	header->intensities_offset = (intensities != NULL)
+		? align_offset(header->records_offset + recordBytes) : 0;
+
+	int ok = fwrite(header, sizeof(DFT_BinaryHeader), 1, file) == 1
+		&& write_padding(file, sizeof(DFT_BinaryHeader), header->records_offset)
+		&& (recordBytes == 0 || fwrite(records, recordBytes, 1, file) == 1);
+
+	if (ok && intensities != NULL)
+		ok = write_padding(file, header->records_offset + recordBytes, header->intensities_offset)
+			&& (intensityBytes == 0 || fwrite(intensities, intensityBytes, 1, file) == 1);
+
+	if (fclose(file) != 0)
+		ok = 0;
+	return ok;
+}
+
+static void init_header(DFT_BinaryHeader *header, Config *config, DFT_BinaryKind kind, int count)
+{
+	memset(header, 0, sizeof(DFT_BinaryHeader));
+	memcpy(header->magic, DFT_BINARY_MAGIC, sizeof(header->magic));
+	header->version = DFT_BINARY_VERSION;
+	header->endian = DFT_BINARY_ENDIAN_MARKER;
+	header->kind = kind;
+	header->layout = DFT_LAYOUT_AOS;
+	header->count = (uint64_t) count;
+	header->frequency_hz = config->frequency_hz;
+	header->cell_size = config->cell_size;
+}
+
+int write_binary_visibilities(const char *path, Config *config, DFT_BinaryKind kind,
+	Visibility *visibilities, Complex *intensities, int count)
+{
+	DFT_BinaryHeader header;
+	init_header(&header, config, kind, count);
+	return write_container(path, &header, visibilities, count * sizeof(Visibility),
+		intensities, count * sizeof(Complex));
+}
+
+int write_binary_sources(const char *path, Config *config, Source *sources, int count)
+{
+	DFT_BinaryHeader header;
+	init_header(&header, config, DFT_BINARY_SOURCES, count);
+	return write_container(path, &header, sources, count * sizeof(Source), NULL, 0);
+}
+
+int write_binary_image(const char *path, Config *config, double *image, int width, int height)
+{
+	DFT_BinaryHeader header;
+	init_header(&header, config, DFT_BINARY_IMAGE, width * height);
+	header.width = (uint32_t) width;
+	header.height = (uint32_t) height;
+	return write_container(path, &header, image, (size_t) width * height * sizeof(double), NULL, 0);
+}
+
+int is_binary_file(const char *path)
+{
+	char magic[8];
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return 0;
+
+	int matches = fread(magic, sizeof(magic), 1, file) == 1
+		&& memcmp(magic, DFT_BINARY_MAGIC, sizeof(magic)) == 0;
+	fclose(file);
+	return matches;
+}
+
+void unmap_file(DFT_Mapping *mapping)
+{
+	if (mapping->address != NULL)
+		munmap(mapping->address, mapping->length);
+	mapping->address = NULL;
+	mapping->length = 0;
+}
+
+// Whether `count` records of `size` bytes at `offset` lie within `length`
+// bytes, without computing an end that could wrap around
+static int section_fits(uint64_t offset, uint64_t count, size_t size, uint64_t length)
+{
+	return offset <= length && count <= (length - offset) / size;
+}
+
+/* Map a container read-only and validate its header
+
+On success the header is returned in host byte order and `swapped` tells
+whether the arrays still need converting.
+*/
+static int map_container(const char *path, DFT_Mapping *mapping, DFT_BinaryHeader *header,
+	size_t recordSize, int *swapped)
+{
+	mapping->address = NULL;
+	mapping->length = 0;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(DFT_BinaryHeader))
+	{
+		close(fd);
+		return 0;
+	}
+
+	void *address = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (address == MAP_FAILED)
+		return 0;
+	mapping->address = address;
+	mapping->length = info.st_size;
+
+	memcpy(header, address, sizeof(DFT_BinaryHeader));
+	*swapped = 0;
+	if (header->endian == swap32(DFT_BINARY_ENDIAN_MARKER))
+	{
+		swap_header(header);
+		*swapped = 1;
+	}
+
+	if (memcmp(header->magic, DFT_BINARY_MAGIC, sizeof(header->magic)) != 0
+		|| header->endian != DFT_BINARY_ENDIAN_MARKER
+		|| header->version > DFT_BINARY_VERSION
+		|| header->layout != DFT_LAYOUT_AOS
+		|| header->count > INT_MAX
+		|| !section_fits(header->records_offset, header->count, recordSize, mapping->length)
+		|| (header->intensities_offset != 0
+			&& !section_fits(header->intensities_offset, header->count, sizeof(Complex), mapping->length)))
+	{
+		unmap_file(mapping);
+		return 0;
+	}
+
+	// The arrays are consumed front to back by every caller
+	madvise(mapping->address, mapping->length, MADV_SEQUENTIAL);
+	return 1;
+}
+
+/* Load visibilities from a binary container
+
+When the container was written for the configured frequency, holds
+native-endian data and w is not being discarded, the returned array points
+straight into the mapping and `mapping` must be released with unmap_file
+instead of freeing the array. Otherwise the records are converted into a
+heap copy and `mapping->address` is left NULL. visIntensity is always a
+fresh zeroed allocation. Returns the number of visibilities, or -1.
+*/
+int load_binary_visibilities(Config *config, const char *path, DFT_Mapping *mapping,
+	Visibility **visibilities, Complex **visIntensity)
+{
+	DFT_BinaryHeader header;
+	int swapped;
+
+	*visibilities = NULL;
+	*visIntensity = NULL;
+
+	// The coordinates are rescaled by the frequency they were written for
+	if (!map_container(path, mapping, &header, sizeof(Visibility), &swapped)
+		|| (header.kind != DFT_BINARY_VISIBILITIES && header.kind != DFT_BINARY_PREDICTED)
+		|| !(header.frequency_hz > 0.0))
+	{
+		printf(">>> ERROR: Unable to load visibilities from binary file...\n\n");
+		unmap_file(mapping);
+		return -1;
+	}
+
+	int count = (int) header.count;
+	Visibility *records = (Visibility*) ((char*) mapping->address + header.records_offset);
+
+	*visIntensity = (Complex*) calloc(count > 0 ? count : 1, sizeof(Complex));
+	if (*visIntensity == NULL)
+	{
+		unmap_file(mapping);
+		return -1;
+	}
+
+	if (!swapped && header.frequency_hz == config->frequency_hz && !config->force_zero_w_term)
+	{
+		*visibilities = records;
+	}
+	else
+	{
+		double rescale = config->frequency_hz / header.frequency_hz;
+		*visibilities = (Visibility*) malloc((count > 0 ? count : 1) * sizeof(Visibility));
+		if (*visibilities == NULL)
+		{
+			free(*visIntensity);
+			*visIntensity = NULL;
+			unmap_file(mapping);
+			return -1;
+		}
+
+		for (int i = 0; i < count; ++i)
+		{
+			Visibility record = records[i];
+			if (swapped)
+			{
+				record.u = swap_double(record.u);
+				record.v = swap_double(record.v);
+				record.w = swap_double(record.w);
+			}
+			(*visibilities)[i].u = record.u * rescale;
+			(*visibilities)[i].v = record.v * rescale;
+			(*visibilities)[i].w = (config->force_zero_w_term) ? 0.0 : record.w * rescale;
+		}
+		unmap_file(mapping);
+	}
+
+	config->numVisibilities = count;
+	if(config->enable_messages)
+		printf(">>> UPDATE: Successfully loaded %d visibilities from binary file (%s)...\n\n",
+			count, (mapping->address != NULL) ? "mapped" : "converted");
+	return count;
+}
+
+/* Load sources from a binary container into a heap copy
+
+Sources are packed by the engine anyway, so they are always copied and
+the mapping is released before returning. Returns the count, or -1.
+*/
+int load_binary_sources(Config *config, const char *path, Source **sources)
+{
+	DFT_BinaryHeader header;
+	DFT_Mapping mapping;
+	int swapped;
+
+	*sources = NULL;
+	// The positions are rescaled by the cell size they were written for
+	if (!map_container(path, &mapping, &header, sizeof(Source), &swapped)
+		|| header.kind != DFT_BINARY_SOURCES || !(header.cell_size > 0.0))
+	{
+		printf(">>> ERROR: Unable to load sources from binary file...\n\n");
+		unmap_file(&mapping);
+		return -1;
+	}
+
+	int count = (int) header.count;
+	Source *records = (Source*) ((char*) mapping.address + header.records_offset);
+	double rescale = config->cell_size / header.cell_size;
+
+	*sources = (Source*) malloc((count > 0 ? count : 1) * sizeof(Source));
+	if (*sources == NULL)
+	{
+		unmap_file(&mapping);
+		return -1;
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		Source record = records[i];
+		if (swapped)
+		{
+			record.l = swap_double(record.l);
+			record.m = swap_double(record.m);
+			record.intensity = swap_double(record.intensity);
+		}
+		(*sources)[i].l = record.l * rescale;
+		(*sources)[i].m = record.m * rescale;
+		(*sources)[i].intensity = record.intensity;
+	}
+	unmap_file(&mapping);
+
+	config->numSources = count;
+	if(config->enable_messages)
+		printf(">>> UPDATE: Successfully loaded %d sources from binary file..\n\n", count);
+	return count;
+}
+
+void saveVisibilitiesBinary(Config *config, Visibility *visibilities, Complex *visIntensity)
+{
+	if(config->enable_messages)
+		printf(">>> UPDATE: Writing visibilities to binary file...\n\n");
+
+	if (!write_binary_visibilities(config->vis_file, config, DFT_BINARY_PREDICTED,
+		visibilities, visIntensity, config->numVisibilities))
+	{
+		printf(">>> ERROR: Unable to save visibilities to file...\n\n");
+		return;
+	}
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Completed writing of visibilities to file...\n\n");
+}
+
+/* Write the grid_size x grid_size dirty image made by extract_image */
+void saveImage(Config *config, double *image)
+{
+	int gridSize = (int) config->grid_size;
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Writing %d x %d image to binary file...\n\n", gridSize, gridSize);
+
+	if (!write_binary_image(config->image_file, config, image, gridSize, gridSize))
+	{
+		printf(">>> ERROR: Unable to save image to file...\n\n");
+		return;
+	}
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Completed writing of image to file...\n\n");
+}
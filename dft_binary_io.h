@@ -0,0 +1,112 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DFT_BINARY_IO_H_
+#define DFT_BINARY_IO_H_
+
+#include <stdint.h>
+#include "direct_fourier_transform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+#define DFT_BINARY_MAGIC "DFTBIN\0"
+#define DFT_BINARY_VERSION 1
+#define DFT_BINARY_ENDIAN_MARKER 0x01020304u
+
+// Arrays start on page boundaries so a mapping can be handed straight to
+// the compute path with the same alignment as an aligned allocation
+#define DFT_BINARY_ALIGNMENT 4096
+
+//=========================//
+//        Structures       //
+//=========================//
+
+typedef enum DFT_BinaryKind {
+	DFT_BINARY_VISIBILITIES = 1, // Visibility records, optional brightness as Complex
+	DFT_BINARY_SOURCES,          // Source records
+	DFT_BINARY_PREDICTED,        // Visibility records and predicted Complex intensities
+	DFT_BINARY_IMAGE             // width x height double pixels, row by row
+} DFT_BinaryKind;
+
+typedef enum DFT_BinaryLayout {
+	DFT_LAYOUT_AOS = 0 // arrays of Visibility/Source/Complex records as in memory
+} DFT_BinaryLayout;
+
+// Fixed 128 byte header at the start of every container. Visibility
+// coordinates are stored already scaled for frequency_hz and source
+// coordinates already scaled by cell_size, exactly as the loaders produce
+// them, so a matching configuration needs no conversion at all.
+typedef struct DFT_BinaryHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t kind;
+	uint32_t layout;
+	uint64_t count;
+	double frequency_hz;
+	double cell_size;
+	uint64_t records_offset;
+	uint64_t intensities_offset; // 0 when the container holds no intensities
+	uint32_t width;              // image dimensions, 0 for other kinds
+	uint32_t height;
+	uint8_t reserved[48];
+} DFT_BinaryHeader;
+
+// A read-only file mapping; address is NULL when nothing is mapped
+typedef struct DFT_Mapping {
+	void *address;
+	size_t length;
+} DFT_Mapping;
+
+//=========================//
+//     Function Headers    //
+//=========================//
+
+int write_binary_image(const char *path, Config *config, double *image, int width, int height);
+int is_binary_file(const char *path);
+int write_binary_visibilities(const char *path, Config *config, DFT_BinaryKind kind,
+	Visibility *visibilities, Complex *intensities, int count);
+int write_binary_sources(const char *path, Config *config, Source *sources, int count);
+int load_binary_visibilities(Config *config, const char *path, DFT_Mapping *mapping,
+	Visibility **visibilities, Complex **visIntensity);
+int load_binary_sources(Config *config, const char *path, Source **sources);
+void saveVisibilitiesBinary(Config *config, Visibility *visibilities, Complex *visIntensity);
+void saveImage(Config *config, double *image);
+void unmap_file(DFT_Mapping *mapping);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFT_BINARY_IO_H_ */
@@ -0,0 +1,97 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "direct_fourier_transform.h"
+#include "dft_binary_io.h"
+
+static void usage(const char *program)
+{
+	printf(">>> INFO: Usage: %s visibilities|sources <input.csv> <output.bin>\n\n", program);
+}
+
+/* Convert a CSV source or visibility file into the binary container
+
+Coordinates are scaled by the loaders using initConfig's frequency and
+cell size, which are recorded in the header for later conversion.
+*/
+int main(int argc, char **argv)
+{
+	if(argc != 4)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	Config config;
+	initConfig(&config);
+	int written = 0;
+
+	if(strcmp(argv[1], "visibilities") == 0)
+	{
+		config.vis_src_file = argv[2];
+		Visibility *visibilities = NULL;
+		Complex *visIntensity = NULL;
+		loadVisibilities(&config, &visibilities, &visIntensity);
+		if(visibilities == NULL)
+			return EXIT_FAILURE;
+
+		written = write_binary_visibilities(argv[3], &config, DFT_BINARY_VISIBILITIES,
+			visibilities, NULL, config.numVisibilities);
+		free(visibilities);
+		free(visIntensity);
+	}
+	else if(strcmp(argv[1], "sources") == 0)
+	{
+		config.source_file = argv[2];
+		Source *sources = NULL;
+		loadSources(&config, &sources);
+		if(sources == NULL)
+			return EXIT_FAILURE;
+
+		written = write_binary_sources(argv[3], &config, sources, config.numSources);
+		free(sources);
+	}
+	else
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(!written)
+	{
+		printf(">>> ERROR: Unable to write binary file %s...\n\n", argv[3]);
+		return EXIT_FAILURE;
+	}
+
+	printf(">>> INFO: Wrote %s, exiting...\n\n", argv[3]);
+	return EXIT_SUCCESS;
+}
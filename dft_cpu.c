@@ -0,0 +1,883 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+	#define DFT_CPU_X86
+#endif
+
+#include "dft_cpu.h"
+#include "dft_storage.h"
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+// Visibilities handed to a worker at a time; small enough that the
+// block's coordinates and accumulators stay resident in L1
+#define CPU_VIS_BLOCK 256
+
+// Sources processed per pass over a block of visibilities
+#define CPU_SOURCE_TILE 512
+
+// Visibilities claimed at a time by the channelized workers
+#define CPU_CHANNEL_VIS_BLOCK 16
+
+// Channels between exact re-evaluations of a recurred phasor, bounding the
+// rounding error the recurrence accumulates
+#define CPU_CHANNEL_RESYNC 64
+
+// Pixels handed to an imaging worker at a time
+#define CPU_PIXEL_BLOCK 256
+
+// Two-part Cody-Waite split of pi/2 used for vector range reduction
+#define CPU_PIO2_A 1.57079632679489655800e+00
+#define CPU_PIO2_B 6.12323399573676603587e-17
+#define CPU_TWO_OVER_PI 6.36619772367581382433e-01
+
+// Minimax coefficients for sin and cos on [-pi/4, pi/4] (Cephes)
+#define CPU_SIN_0  1.58962301576546568060e-10
+#define CPU_SIN_1 -2.50507477628578072866e-08
+#define CPU_SIN_2  2.75573136213857245213e-06
+#define CPU_SIN_3 -1.98412698295895385996e-04
+#define CPU_SIN_4  8.33333333332211858878e-03
+#define CPU_SIN_5 -1.66666666666666307295e-01
+
+#define CPU_COS_0 -1.13585365213876817300e-11
+#define CPU_COS_1  2.08757008419747316778e-09
+#define CPU_COS_2 -2.75573141792967388112e-07
+#define CPU_COS_3  2.48015872888517045348e-05
+#define CPU_COS_4 -1.38888888888730564116e-03
+#define CPU_COS_5  4.16666666666665929218e-02
+
+//=========================//
+//        Structures       //
+//=========================//
+
+// View of up to CPU_SOURCE_TILE packed sources in the call's SourceArrays
+typedef struct CpuSourceTile {
+	const double *l;
+	const double *m;
+	const double *n;
+	const double *flux;
+	int count;
+} CpuSourceTile;
+
+// Structure-of-arrays copy of one block of visibilities
+typedef struct CpuVisBlock {
+	double u[CPU_VIS_BLOCK] __attribute__((aligned(64)));
+	double v[CPU_VIS_BLOCK] __attribute__((aligned(64)));
+	double w[CPU_VIS_BLOCK] __attribute__((aligned(64)));
+	double re[CPU_VIS_BLOCK] __attribute__((aligned(64)));
+	double im[CPU_VIS_BLOCK] __attribute__((aligned(64)));
+} CpuVisBlock;
+
+typedef void (*CpuBlockFunc)(CpuVisBlock *block, int padded, CpuSourceTile *tile);
+
+typedef struct CpuTask {
+	const SourceArrays *sources;
+	int numSources;
+	Visibility *visibilities;
+	Complex *visIntensity;
+	int numVisibilities;
+	int numBlocks;
+	int nextBlock;
+	CpuBlockFunc blockFunc;
+	int lanes;
+	int failed;  // a worker could not allocate its block
+} CpuTask;
+
+// One channelized prediction, shared by its workers
+typedef struct CpuChannelTask {
+	const SourceArrays *sources;
+	int numSources;
+	Visibility *visibilities;
+	int numVisibilities;
+	const double *channelScale;
+	int numChannels;
+	double channelStep;
+	Complex *visIntensity;
+	size_t channelStride;
+	int numBlocks;
+	int nextBlock;
+	int failed;  // a worker could not allocate its channel sums
+} CpuChannelTask;
+
+// Per-worker phasors of a source tile, and the channel sums of one visibility
+typedef struct CpuChannelScratch {
+	double theta[CPU_SOURCE_TILE];
+	double zr[CPU_SOURCE_TILE];
+	double zi[CPU_SOURCE_TILE];
+	double dr[CPU_SOURCE_TILE];
+	double di[CPU_SOURCE_TILE];
+	double *re;
+	double *im;
+} CpuChannelScratch;
+
+// Structure-of-arrays block of image pixels: position, w correction and sum
+typedef struct CpuPixelBlock {
+	double l[CPU_PIXEL_BLOCK] __attribute__((aligned(64)));
+	double m[CPU_PIXEL_BLOCK] __attribute__((aligned(64)));
+	double n[CPU_PIXEL_BLOCK] __attribute__((aligned(64)));
+	double sum[CPU_PIXEL_BLOCK] __attribute__((aligned(64)));
+} CpuPixelBlock;
+
+// Visibilities imaged per pass over a block of pixels, u, v and w scaled by 2*pi
+typedef struct CpuImageTile {
+	double u[CPU_SOURCE_TILE] __attribute__((aligned(64)));
+	double v[CPU_SOURCE_TILE];
+	double w[CPU_SOURCE_TILE];
+	double re[CPU_SOURCE_TILE];
+	double im[CPU_SOURCE_TILE];
+	int count;
+} CpuImageTile;
+
+typedef void (*CpuImageFunc)(CpuPixelBlock *block, int padded, CpuImageTile *tile);
+
+// One dirty image, shared by its workers
+typedef struct CpuImageTask {
+	Visibility *visibilities;
+	Complex *values;
+	int numVisibilities;
+	double *image;
+	int gridSize;
+	double cellSize;
+	double normalisation;
+	int numBlocks;
+	int nextBlock;
+	CpuImageFunc imageFunc;
+	int lanes;
+	int failed;  // a worker could not allocate its pixel block
+} CpuImageTask;
+
+//=========================//
+//      Block kernels      //
+//=========================//
+
+static void cpu_block_scalar(CpuVisBlock *block, int padded, CpuSourceTile *tile)
+{
+	for (int i = 0; i < padded; ++i)
+	{
+		double re = block->re[i];
+		double im = block->im[i];
+		for (int s = 0; s < tile->count; ++s)
+		{
+			double theta = block->u[i] * tile->l[s] + block->v[i] * tile->m[s]
+				+ block->w[i] * tile->n[s];
+			re += cos(theta) * tile->flux[s];
+			im += -sin(theta) * tile->flux[s];
+		}
+		block->re[i] = re;
+		block->im[i] = im;
+	}
+}
+
+// Inverse of cpu_block_scalar: pixels accumulate the real part of each
+// visibility's value rotated by the pixel's phase
+static void cpu_image_scalar(CpuPixelBlock *block, int padded, CpuImageTile *tile)
+{
+	for (int p = 0; p < padded; ++p)
+	{
+		double sum = block->sum[p];
+		for (int k = 0; k < tile->count; ++k)
+		{
+			double theta = tile->u[k] * block->l[p] + tile->v[k] * block->m[p]
+				+ tile->w[k] * block->n[p];
+			sum += tile->re[k] * cos(theta) - tile->im[k] * sin(theta);
+		}
+		block->sum[p] = sum;
+	}
+}
+
+#ifdef DFT_CPU_X86
+
+__attribute__((target("avx2,fma")))
+static inline void sincos_avx2(__m256d x, __m256d *s, __m256d *c)
+{
+	const __m256d q = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(CPU_TWO_OVER_PI)),
+		_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d r = _mm256_fnmadd_pd(q, _mm256_set1_pd(CPU_PIO2_A), x);
+	r = _mm256_fnmadd_pd(q, _mm256_set1_pd(CPU_PIO2_B), r);
+	const __m256d r2 = _mm256_mul_pd(r, r);
+
+	__m256d ps = _mm256_set1_pd(CPU_SIN_0);
+	ps = _mm256_fmadd_pd(ps, r2, _mm256_set1_pd(CPU_SIN_1));
+	ps = _mm256_fmadd_pd(ps, r2, _mm256_set1_pd(CPU_SIN_2));
+	ps = _mm256_fmadd_pd(ps, r2, _mm256_set1_pd(CPU_SIN_3));
+	ps = _mm256_fmadd_pd(ps, r2, _mm256_set1_pd(CPU_SIN_4));
+	ps = _mm256_fmadd_pd(ps, r2, _mm256_set1_pd(CPU_SIN_5));
+	const __m256d sin_r = _mm256_fmadd_pd(_mm256_mul_pd(ps, r2), r, r);
+
+	__m256d pc = _mm256_set1_pd(CPU_COS_0);
+	pc = _mm256_fmadd_pd(pc, r2, _mm256_set1_pd(CPU_COS_1));
+	pc = _mm256_fmadd_pd(pc, r2, _mm256_set1_pd(CPU_COS_2));
+	pc = _mm256_fmadd_pd(pc, r2, _mm256_set1_pd(CPU_COS_3));
+	pc = _mm256_fmadd_pd(pc, r2, _mm256_set1_pd(CPU_COS_4));
+	pc = _mm256_fmadd_pd(pc, r2, _mm256_set1_pd(CPU_COS_5));
+	const __m256d cos_r = _mm256_fmadd_pd(_mm256_mul_pd(pc, r2), r2,
+		_mm256_fnmadd_pd(_mm256_set1_pd(0.5), r2, _mm256_set1_pd(1.0)));
+
+	// Quadrant selection: odd quadrants swap sin and cos, bit 1 flips sign
+	const __m256i qi = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(q));
+	const __m256i one = _mm256_set1_epi64x(1);
+	const __m256i two = _mm256_set1_epi64x(2);
+	const __m256d swap = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(qi, one), one));
+	const __m256d sin_sign = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(qi, two), 62));
+	const __m256d cos_sign = _mm256_castsi256_pd(_mm256_slli_epi64(
+		_mm256_and_si256(_mm256_add_epi64(qi, one), two), 62));
+
+	*s = _mm256_xor_pd(_mm256_blendv_pd(sin_r, cos_r, swap), sin_sign);
+	*c = _mm256_xor_pd(_mm256_blendv_pd(cos_r, sin_r, swap), cos_sign);
+}
+
+__attribute__((target("avx2,fma")))
+static void cpu_block_avx2(CpuVisBlock *block, int padded, CpuSourceTile *tile)
+{
+	for (int i = 0; i < padded; i += 4)
+	{
+		const __m256d u = _mm256_load_pd(&block->u[i]);
+		const __m256d v = _mm256_load_pd(&block->v[i]);
+		const __m256d w = _mm256_load_pd(&block->w[i]);
+		__m256d re = _mm256_load_pd(&block->re[i]);
+		__m256d im = _mm256_load_pd(&block->im[i]);
+
+		for (int s = 0; s < tile->count; ++s)
+		{
+			__m256d theta = _mm256_mul_pd(u, _mm256_set1_pd(tile->l[s]));
+			theta = _mm256_fmadd_pd(v, _mm256_set1_pd(tile->m[s]), theta);
+			theta = _mm256_fmadd_pd(w, _mm256_set1_pd(tile->n[s]), theta);
+
+			__m256d sin_theta, cos_theta;
+			sincos_avx2(theta, &sin_theta, &cos_theta);
+
+			const __m256d flux = _mm256_set1_pd(tile->flux[s]);
+			re = _mm256_fmadd_pd(cos_theta, flux, re);
+			im = _mm256_fnmadd_pd(sin_theta, flux, im);
+		}
+
+		_mm256_store_pd(&block->re[i], re);
+		_mm256_store_pd(&block->im[i], im);
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void cpu_image_avx2(CpuPixelBlock *block, int padded, CpuImageTile *tile)
+{
+	for (int p = 0; p < padded; p += 4)
+	{
+		const __m256d l = _mm256_load_pd(&block->l[p]);
+		const __m256d m = _mm256_load_pd(&block->m[p]);
+		const __m256d n = _mm256_load_pd(&block->n[p]);
+		__m256d sum = _mm256_load_pd(&block->sum[p]);
+
+		for (int k = 0; k < tile->count; ++k)
+		{
+			__m256d theta = _mm256_mul_pd(l, _mm256_set1_pd(tile->u[k]));
+			theta = _mm256_fmadd_pd(m, _mm256_set1_pd(tile->v[k]), theta);
+			theta = _mm256_fmadd_pd(n, _mm256_set1_pd(tile->w[k]), theta);
+
+			__m256d sin_theta, cos_theta;
+			sincos_avx2(theta, &sin_theta, &cos_theta);
+
+			sum = _mm256_fmadd_pd(cos_theta, _mm256_set1_pd(tile->re[k]), sum);
+			sum = _mm256_fnmadd_pd(sin_theta, _mm256_set1_pd(tile->im[k]), sum);
+		}
+
+		_mm256_store_pd(&block->sum[p], sum);
+	}
+}
+
+__attribute__((target("avx512f")))
+static inline void sincos_avx512(__m512d x, __m512d *s, __m512d *c)
+{
+	const __m512d q = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(CPU_TWO_OVER_PI)),
+		_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512d r = _mm512_fnmadd_pd(q, _mm512_set1_pd(CPU_PIO2_A), x);
+	r = _mm512_fnmadd_pd(q, _mm512_set1_pd(CPU_PIO2_B), r);
+	const __m512d r2 = _mm512_mul_pd(r, r);
+
+	__m512d ps = _mm512_set1_pd(CPU_SIN_0);
+	ps = _mm512_fmadd_pd(ps, r2, _mm512_set1_pd(CPU_SIN_1));
+	ps = _mm512_fmadd_pd(ps, r2, _mm512_set1_pd(CPU_SIN_2));
+	ps = _mm512_fmadd_pd(ps, r2, _mm512_set1_pd(CPU_SIN_3));
+	ps = _mm512_fmadd_pd(ps, r2, _mm512_set1_pd(CPU_SIN_4));
+	ps = _mm512_fmadd_pd(ps, r2, _mm512_set1_pd(CPU_SIN_5));
+	const __m512d sin_r = _mm512_fmadd_pd(_mm512_mul_pd(ps, r2), r, r);
+
+	__m512d pc = _mm512_set1_pd(CPU_COS_0);
+	pc = _mm512_fmadd_pd(pc, r2, _mm512_set1_pd(CPU_COS_1));
+	pc = _mm512_fmadd_pd(pc, r2, _mm512_set1_pd(CPU_COS_2));
+	pc = _mm512_fmadd_pd(pc, r2, _mm512_set1_pd(CPU_COS_3));
+	pc = _mm512_fmadd_pd(pc, r2, _mm512_set1_pd(CPU_COS_4));
+	pc = _mm512_fmadd_pd(pc, r2, _mm512_set1_pd(CPU_COS_5));
+	const __m512d cos_r = _mm512_fmadd_pd(_mm512_mul_pd(pc, r2), r2,
+		_mm512_fnmadd_pd(_mm512_set1_pd(0.5), r2, _mm512_set1_pd(1.0)));
+
+	// Quadrant selection: odd quadrants swap sin and cos, bit 1 flips sign
+	const __m512i qi = _mm512_cvtepi32_epi64(_mm512_cvtpd_epi32(q));
+	const __m512i one = _mm512_set1_epi64(1);
+	const __m512i two = _mm512_set1_epi64(2);
+	const __mmask8 swap = _mm512_test_epi64_mask(qi, one);
+	const __m512i sin_sign = _mm512_slli_epi64(_mm512_and_si512(qi, two), 62);
+	const __m512i cos_sign = _mm512_slli_epi64(_mm512_and_si512(_mm512_add_epi64(qi, one), two), 62);
+
+	*s = _mm512_castsi512_pd(_mm512_xor_si512(
+		_mm512_castpd_si512(_mm512_mask_blend_pd(swap, sin_r, cos_r)), sin_sign));
+	*c = _mm512_castsi512_pd(_mm512_xor_si512(
+		_mm512_castpd_si512(_mm512_mask_blend_pd(swap, cos_r, sin_r)), cos_sign));
+}
+
+__attribute__((target("avx512f")))
+static void cpu_block_avx512(CpuVisBlock *block, int padded, CpuSourceTile *tile)
+{
+	for (int i = 0; i < padded; i += 8)
+	{
+		const __m512d u = _mm512_load_pd(&block->u[i]);
+		const __m512d v = _mm512_load_pd(&block->v[i]);
+		const __m512d w = _mm512_load_pd(&block->w[i]);
+		__m512d re = _mm512_load_pd(&block->re[i]);
+		__m512d im = _mm512_load_pd(&block->im[i]);
+
+		for (int s = 0; s < tile->count; ++s)
+		{
+			__m512d theta = _mm512_mul_pd(u, _mm512_set1_pd(tile->l[s]));
+			theta = _mm512_fmadd_pd(v, _mm512_set1_pd(tile->m[s]), theta);
+			theta = _mm512_fmadd_pd(w, _mm512_set1_pd(tile->n[s]), theta);
+
+			__m512d sin_theta, cos_theta;
+			sincos_avx512(theta, &sin_theta, &cos_theta);
+
+			const __m512d flux = _mm512_set1_pd(tile->flux[s]);
+			re = _mm512_fmadd_pd(cos_theta, flux, re);
+			im = _mm512_fnmadd_pd(sin_theta, flux, im);
+		}
+
+		_mm512_store_pd(&block->re[i], re);
+		_mm512_store_pd(&block->im[i], im);
+	}
+}
+
+__attribute__((target("avx512f")))
+static void cpu_image_avx512(CpuPixelBlock *block, int padded, CpuImageTile *tile)
+{
+	for (int p = 0; p < padded; p += 8)
+	{
+		const __m512d l = _mm512_load_pd(&block->l[p]);
+		const __m512d m = _mm512_load_pd(&block->m[p]);
+		const __m512d n = _mm512_load_pd(&block->n[p]);
+		__m512d sum = _mm512_load_pd(&block->sum[p]);
+
+		for (int k = 0; k < tile->count; ++k)
+		{
+			__m512d theta = _mm512_mul_pd(l, _mm512_set1_pd(tile->u[k]));
+			theta = _mm512_fmadd_pd(m, _mm512_set1_pd(tile->v[k]), theta);
+			theta = _mm512_fmadd_pd(n, _mm512_set1_pd(tile->w[k]), theta);
+
+			__m512d sin_theta, cos_theta;
+			sincos_avx512(theta, &sin_theta, &cos_theta);
+
+			sum = _mm512_fmadd_pd(cos_theta, _mm512_set1_pd(tile->re[k]), sum);
+			sum = _mm512_fnmadd_pd(sin_theta, _mm512_set1_pd(tile->im[k]), sum);
+		}
+
+		_mm512_store_pd(&block->sum[p], sum);
+	}
+}
+
+#endif /* DFT_CPU_X86 */
+
+//=========================//
+//     Dispatch/threads    //
+//=========================//
+
+// Widest vector the kernels may use, lowered by cpu_limit_simd_level
+static int cpu_lane_limit = 8;
+
+// Lanes of the widest instruction set the host supports
+static int cpu_host_lanes(void)
+{
+#ifdef DFT_CPU_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return 8;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return 4;
+#endif
+	return 1;
+}
+
+static CpuBlockFunc cpu_select_block_func(int *lanes)
+{
+	int host = cpu_host_lanes();
+	*lanes = (host < cpu_lane_limit) ? host : cpu_lane_limit;
+#ifdef DFT_CPU_X86
+	if (*lanes == 8)
+		return cpu_block_avx512;
+	if (*lanes == 4)
+		return cpu_block_avx2;
+#endif
+	*lanes = 1;
+	return cpu_block_scalar;
+}
+
+int cpu_limit_simd_level(const char *level)
+{
+	int lanes = (level == NULL) ? 8 : (strcmp(level, "avx512") == 0) ? 8
+		: (strcmp(level, "avx2") == 0) ? 4 : (strcmp(level, "scalar") == 0) ? 1 : 0;
+	if (lanes == 0 || (level != NULL && lanes > cpu_host_lanes()))
+		return 0;
+	cpu_lane_limit = lanes;
+	return 1;
+}
+
+// Imaging counterpart of cpu_select_block_func, for the same instruction set
+static CpuImageFunc cpu_select_image_func(int *lanes)
+{
+	cpu_select_block_func(lanes);
+#ifdef DFT_CPU_X86
+	if (*lanes == 8)
+		return cpu_image_avx512;
+	if (*lanes == 4)
+		return cpu_image_avx2;
+#endif
+	return cpu_image_scalar;
+}
+
+const char* cpu_simd_level(void)
+{
+	int lanes;
+	cpu_select_block_func(&lanes);
+	return (lanes == 8) ? "avx512" : (lanes == 4) ? "avx2" : "scalar";
+}
+
+int cpu_default_thread_count(void)
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cores > 0) ? (int) cores : 1;
+}
+
+static void cpu_load_source_tile(CpuSourceTile *tile, const SourceArrays *sources, int first, int count)
+{
+	tile->l = sources->l + first;
+	tile->m = sources->m + first;
+	tile->n = sources->n + first;
+	tile->flux = sources->flux + first;
+	tile->count = count;
+}
+
+// The sky model as structure-of-arrays, gathered once per call so that the
+// workers' tiles are views into it rather than copies
+static int cpu_gather_sources(SourceArrays *arrays, PackedSource *sources, int numSources)
+{
+	if (!create_source_arrays(arrays, numSources)) {
+		perror("Couldn't allocate the source arrays");
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+	gather_packed_sources(arrays, sources, numSources);
+	return DFT_SUCCESS;
+}
+
+static void cpu_process_block(CpuTask *task, int blockIndex, CpuVisBlock *block, CpuSourceTile *tile)
+{
+	int first = blockIndex * CPU_VIS_BLOCK;
+	int count = task->numVisibilities - first;
+	if (count > CPU_VIS_BLOCK)
+		count = CPU_VIS_BLOCK;
+	int padded = ((count + task->lanes - 1) / task->lanes) * task->lanes;
+
+	// Transpose into SoA; padding lanes are computed but never written back
+	for (int i = 0; i < padded; ++i)
+	{
+		int in_range = i < count;
+		block->u[i] = in_range ? task->visibilities[first + i].u : 0.0;
+		block->v[i] = in_range ? task->visibilities[first + i].v : 0.0;
+		block->w[i] = in_range ? task->visibilities[first + i].w : 0.0;
+		block->re[i] = in_range ? task->visIntensity[first + i].real : 0.0;
+		block->im[i] = in_range ? task->visIntensity[first + i].imaginary : 0.0;
+	}
+
+	for (int s = 0; s < task->numSources; s += CPU_SOURCE_TILE)
+	{
+		int tile_count = task->numSources - s;
+		if (tile_count > CPU_SOURCE_TILE)
+			tile_count = CPU_SOURCE_TILE;
+		cpu_load_source_tile(tile, task->sources, s, tile_count);
+		task->blockFunc(block, padded, tile);
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		task->visIntensity[first + i].real = block->re[i];
+		task->visIntensity[first + i].imaginary = block->im[i];
+	}
+}
+
+static void* cpu_worker(void *arg)
+{
+	CpuTask *task = (CpuTask*) arg;
+	CpuVisBlock *block = (CpuVisBlock*) aligned_alloc(64, sizeof(CpuVisBlock));
+	CpuSourceTile tile;
+
+	if (block == NULL)
+	{
+		__atomic_store_n(&task->failed, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	// Blocks are claimed dynamically so faster threads take more of them
+	int b;
+	while ((b = __atomic_fetch_add(&task->nextBlock, 1, __ATOMIC_RELAXED)) < task->numBlocks)
+		cpu_process_block(task, b, block, &tile);
+
+	free(block);
+	return NULL;
+}
+
+int cpu_extract_visibilities(PackedSource *sources, int numSources, Visibility *visibilities,
+	Complex *visIntensity, int numVisibilities, int numThreads)
+{
+	if (numVisibilities <= 0 || numSources <= 0)
+		return DFT_SUCCESS;
+
+	SourceArrays arrays;
+	int status = cpu_gather_sources(&arrays, sources, numSources);
+	if (status != DFT_SUCCESS)
+		return status;
+
+	CpuTask task;
+	task.sources = &arrays;
+	task.numSources = numSources;
+	task.visibilities = visibilities;
+	task.visIntensity = visIntensity;
+	task.numVisibilities = numVisibilities;
+	task.numBlocks = (numVisibilities + CPU_VIS_BLOCK - 1) / CPU_VIS_BLOCK;
+	task.nextBlock = 0;
+	task.blockFunc = cpu_select_block_func(&task.lanes);
+	task.failed = 0;
+
+	if (numThreads <= 0)
+		numThreads = cpu_default_thread_count();
+	if (numThreads > task.numBlocks)
+		numThreads = task.numBlocks;
+
+	// The calling thread is always one of the workers
+	pthread_t *threads = NULL;
+	int spawned = 0;
+	if (numThreads > 1)
+	{
+		threads = (pthread_t*) malloc((numThreads - 1) * sizeof(pthread_t));
+		for (int t = 0; threads != NULL && t < numThreads - 1; ++t)
+			if (pthread_create(&threads[spawned], NULL, cpu_worker, &task) == 0)
+				spawned++;
+	}
+
+	cpu_worker(&task);
+
+	for (int t = 0; t < spawned; ++t)
+		pthread_join(threads[t], NULL);
+	free(threads);
+	destroy_source_arrays(&arrays);
+
+	// The other workers may have covered its blocks, but the call still fails
+	if (task.failed) {
+		perror("Couldn't allocate a worker's visibility block");
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+	return DFT_SUCCESS;
+}
+
+/* Accumulate every channel of one visibility over one tile of sources
+
+With regular channels each source's phasor is rotated from one channel to
+the next by a fixed step, so the inner loop over the tile is a complex
+multiply-add the compiler can vectorize. The phasors are re-evaluated
+exactly every CPU_CHANNEL_RESYNC channels.
+*/
+static void cpu_channel_tile(CpuChannelTask *task, Visibility *vis, CpuSourceTile *tile,
+	CpuChannelScratch *scratch)
+{
+	const int count = tile->count;
+	for (int s = 0; s < count; ++s)
+		scratch->theta[s] = vis->u * tile->l[s] + vis->v * tile->m[s] + vis->w * tile->n[s];
+
+	if (task->channelStep != 0.0)
+		for (int s = 0; s < count; ++s)
+		{
+			scratch->dr[s] = cos(scratch->theta[s] * task->channelStep);
+			scratch->di[s] = -sin(scratch->theta[s] * task->channelStep);
+		}
+
+	for (int k = 0; k < task->numChannels; ++k)
+	{
+		if (task->channelStep == 0.0 || k % CPU_CHANNEL_RESYNC == 0)
+			for (int s = 0; s < count; ++s)
+			{
+				double phase = scratch->theta[s] * task->channelScale[k];
+				scratch->zr[s] = cos(phase) * tile->flux[s];
+				scratch->zi[s] = -sin(phase) * tile->flux[s];
+			}
+
+		double re = 0.0;
+		double im = 0.0;
+		for (int s = 0; s < count; ++s)
+		{
+			re += scratch->zr[s];
+			im += scratch->zi[s];
+		}
+		scratch->re[k] += re;
+		scratch->im[k] += im;
+
+		if (task->channelStep != 0.0)
+			for (int s = 0; s < count; ++s)
+			{
+				double zr = scratch->zr[s];
+				scratch->zr[s] = zr * scratch->dr[s] - scratch->zi[s] * scratch->di[s];
+				scratch->zi[s] = zr * scratch->di[s] + scratch->zi[s] * scratch->dr[s];
+			}
+	}
+}
+
+static void* cpu_channel_worker(void *arg)
+{
+	CpuChannelTask *task = (CpuChannelTask*) arg;
+	CpuSourceTile tile;
+	CpuChannelScratch *scratch = (CpuChannelScratch*) malloc(sizeof(CpuChannelScratch));
+	double *sums = (double*) malloc(2 * task->numChannels * sizeof(double));
+
+	if (scratch == NULL || sums == NULL)
+		__atomic_store_n(&task->failed, 1, __ATOMIC_RELAXED);
+	else
+	{
+		scratch->re = sums;
+		scratch->im = sums + task->numChannels;
+
+		int b;
+		while ((b = __atomic_fetch_add(&task->nextBlock, 1, __ATOMIC_RELAXED)) < task->numBlocks)
+		{
+			int last = (b + 1) * CPU_CHANNEL_VIS_BLOCK;
+			if (last > task->numVisibilities)
+				last = task->numVisibilities;
+
+			for (int i = b * CPU_CHANNEL_VIS_BLOCK; i < last; ++i)
+			{
+				memset(sums, 0, 2 * task->numChannels * sizeof(double));
+				for (int s = 0; s < task->numSources; s += CPU_SOURCE_TILE)
+				{
+					int tile_count = task->numSources - s;
+					if (tile_count > CPU_SOURCE_TILE)
+						tile_count = CPU_SOURCE_TILE;
+					cpu_load_source_tile(&tile, task->sources, s, tile_count);
+					cpu_channel_tile(task, &task->visibilities[i], &tile, scratch);
+				}
+
+				for (int k = 0; k < task->numChannels; ++k)
+				{
+					task->visIntensity[k * task->channelStride + i].real += scratch->re[k];
+					task->visIntensity[k * task->channelStride + i].imaginary += scratch->im[k];
+				}
+			}
+		}
+	}
+
+	free(scratch);
+	free(sums);
+	return NULL;
+}
+
+int cpu_extract_channel_visibilities(PackedSource *sources, int numSources, Visibility *visibilities,
+	int numVisibilities, const double *channelScale, int numChannels, double channelStep,
+	Complex *visIntensity, size_t channelStride, int numThreads)
+{
+	if (numVisibilities <= 0 || numSources <= 0 || numChannels <= 0)
+		return DFT_SUCCESS;
+
+	SourceArrays arrays;
+	int status = cpu_gather_sources(&arrays, sources, numSources);
+	if (status != DFT_SUCCESS)
+		return status;
+
+	CpuChannelTask task;
+	task.sources = &arrays;
+	task.numSources = numSources;
+	task.visibilities = visibilities;
+	task.numVisibilities = numVisibilities;
+	task.channelScale = channelScale;
+	task.numChannels = numChannels;
+	task.channelStep = channelStep;
+	task.visIntensity = visIntensity;
+	task.channelStride = channelStride;
+	task.numBlocks = (numVisibilities + CPU_CHANNEL_VIS_BLOCK - 1) / CPU_CHANNEL_VIS_BLOCK;
+	task.nextBlock = 0;
+	task.failed = 0;
+
+	if (numThreads <= 0)
+		numThreads = cpu_default_thread_count();
+	if (numThreads > task.numBlocks)
+		numThreads = task.numBlocks;
+
+	// The calling thread is always one of the workers
+	pthread_t *threads = NULL;
+	int spawned = 0;
+	if (numThreads > 1)
+	{
+		threads = (pthread_t*) malloc((numThreads - 1) * sizeof(pthread_t));
+		for (int t = 0; threads != NULL && t < numThreads - 1; ++t)
+			if (pthread_create(&threads[spawned], NULL, cpu_channel_worker, &task) == 0)
+				spawned++;
+	}
+
+	cpu_channel_worker(&task);
+
+	for (int t = 0; t < spawned; ++t)
+		pthread_join(threads[t], NULL);
+	free(threads);
+	destroy_source_arrays(&arrays);
+
+	if (task.failed) {
+		perror("Couldn't allocate a worker's channel sums");
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+	return DFT_SUCCESS;
+}
+
+static void cpu_image_block(CpuImageTask *task, int blockIndex, CpuPixelBlock *block, CpuImageTile *tile)
+{
+	const double two_PI = 3.14159265358979323846 + 3.14159265358979323846;
+	int first = blockIndex * CPU_PIXEL_BLOCK;
+	int count = task->gridSize * task->gridSize - first;
+	if (count > CPU_PIXEL_BLOCK)
+		count = CPU_PIXEL_BLOCK;
+	int padded = ((count + task->lanes - 1) / task->lanes) * task->lanes;
+
+	// Padding lanes image the last pixel again and are never written back
+	for (int p = 0; p < padded; ++p)
+	{
+		int pixel = first + ((p < count) ? p : count - 1);
+		double l = (pixel % task->gridSize - task->gridSize / 2) * task->cellSize;
+		double m = (pixel / task->gridSize - task->gridSize / 2) * task->cellSize;
+		block->l[p] = l;
+		block->m[p] = m;
+		block->n[p] = -0.5 * (l * l + m * m);
+		block->sum[p] = 0.0;
+	}
+
+	for (int k = 0; k < task->numVisibilities; k += CPU_SOURCE_TILE)
+	{
+		int tile_count = task->numVisibilities - k;
+		if (tile_count > CPU_SOURCE_TILE)
+			tile_count = CPU_SOURCE_TILE;
+		for (int t = 0; t < tile_count; ++t)
+		{
+			tile->u[t] = task->visibilities[k + t].u * two_PI;
+			tile->v[t] = task->visibilities[k + t].v * two_PI;
+			tile->w[t] = task->visibilities[k + t].w * two_PI;
+			tile->re[t] = task->values[k + t].real;
+			tile->im[t] = task->values[k + t].imaginary;
+		}
+		tile->count = tile_count;
+		task->imageFunc(block, padded, tile);
+	}
+
+	// n holds minus the image correction's departure from one
+	for (int p = 0; p < count; ++p)
+		task->image[first + p] = block->sum[p] * task->normalisation * (1.0 + block->n[p]);
+}
+
+static void* cpu_image_worker(void *arg)
+{
+	CpuImageTask *task = (CpuImageTask*) arg;
+	CpuPixelBlock *block = (CpuPixelBlock*) aligned_alloc(64, sizeof(CpuPixelBlock));
+	CpuImageTile *tile = (CpuImageTile*) aligned_alloc(64, sizeof(CpuImageTile));
+
+	if (block == NULL || tile == NULL)
+		__atomic_store_n(&task->failed, 1, __ATOMIC_RELAXED);
+	else
+	{
+		int b;
+		while ((b = __atomic_fetch_add(&task->nextBlock, 1, __ATOMIC_RELAXED)) < task->numBlocks)
+			cpu_image_block(task, b, block, tile);
+	}
+
+	free(block);
+	free(tile);
+	return NULL;
+}
+
+int cpu_extract_image(Visibility *visibilities, Complex *values, int numVisibilities, double *image,
+	int gridSize, double cellSize, double normalisation, int numThreads)
+{
+	if (gridSize <= 0)
+		return DFT_SUCCESS;
+
+	CpuImageTask task;
+	task.visibilities = visibilities;
+	task.values = values;
+	task.numVisibilities = (numVisibilities > 0) ? numVisibilities : 0;
+	task.image = image;
+	task.gridSize = gridSize;
+	task.cellSize = cellSize;
+	task.normalisation = normalisation;
+	task.numBlocks = (gridSize * gridSize + CPU_PIXEL_BLOCK - 1) / CPU_PIXEL_BLOCK;
+	task.nextBlock = 0;
+	task.imageFunc = cpu_select_image_func(&task.lanes);
+	task.failed = 0;
+
+	if (numThreads <= 0)
+		numThreads = cpu_default_thread_count();
+	if (numThreads > task.numBlocks)
+		numThreads = task.numBlocks;
+
+	// The calling thread is always one of the workers
+	pthread_t *threads = NULL;
+	int spawned = 0;
+	if (numThreads > 1)
+	{
+		threads = (pthread_t*) malloc((numThreads - 1) * sizeof(pthread_t));
+		for (int t = 0; threads != NULL && t < numThreads - 1; ++t)
+			if (pthread_create(&threads[spawned], NULL, cpu_image_worker, &task) == 0)
+				spawned++;
+	}
+
+	cpu_image_worker(&task);
+
+	for (int t = 0; t < spawned; ++t)
+		pthread_join(threads[t], NULL);
+	free(threads);
+
+	if (task.failed) {
+		perror("Couldn't allocate a worker's pixel block");
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+	return DFT_SUCCESS;
+}
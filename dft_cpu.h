@@ -0,0 +1,77 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DFT_CPU_H_
+#define DFT_CPU_H_
+
+#include "direct_fourier_transform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================//
+//     Function Headers    //
+//=========================//
+
+// Name of the widest SIMD instruction set the host supports ("avx512", "avx2" or "scalar")
+const char* cpu_simd_level(void);
+
+// Caps the instruction set of later calls at "avx512", "avx2" or "scalar",
+// or lifts the cap when NULL. Returns 0, leaving the cap, when the host lacks
+// the instruction set. Meant for tests; not to be changed during a call.
+int cpu_limit_simd_level(const char *level);
+
+// Number of worker threads used when num_threads is 0 (all online cores)
+int cpu_default_thread_count(void);
+
+// Native equivalent of the DFT_OpenCL kernel over a packed sky model (see
+// packSources); accumulates into visIntensity. Returns a DFT_Status.
+int cpu_extract_visibilities(PackedSource *sources, int numSources, Visibility *visibilities,
+	Complex *visIntensity, int numVisibilities, int numThreads);
+
+// Channelized prediction over visibilities in metres: channel k of
+// visibility i accumulates into visIntensity[k * channelStride + i], its
+// phase scaled by channelScale[k] (frequency over the speed of light).
+// A non-zero channelStep marks regularly spaced channels, whose phasors
+// are then recurred rather than evaluated afresh. Returns a DFT_Status.
+int cpu_extract_channel_visibilities(PackedSource *sources, int numSources, Visibility *visibilities,
+	int numVisibilities, const double *channelScale, int numChannels, double channelStep,
+	Complex *visIntensity, size_t channelStride, int numThreads);
+
+// Native equivalent of the DFT_OpenCL_Image kernel: overwrites the
+// gridSize x gridSize image with the dirty image of the (already weighted)
+// values, scaled by normalisation; returns a DFT_Status
+int cpu_extract_image(Visibility *visibilities, Complex *values, int numVisibilities, double *image,
+	int gridSize, double cellSize, double normalisation, int numThreads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFT_CPU_H_ */
@@ -0,0 +1,541 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "dft_grid.h"
+#include "dft_cpu.h"
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+#define GRID_PI 3.14159265358979323846
+
+// Kernel shape for a grid oversampled by two (sources within the central
+// half of the image, visibilities within the central half of the uv grid)
+#define GRID_BETA_PER_CELL 2.30
+
+// Gauss-Legendre nodes used to integrate the kernel's Fourier transform
+#define GRID_QUADRATURE_NODES 64
+
+// Visibilities degridded per task
+#define GRID_VIS_BLOCK 1024
+
+// Cells per side of the blocks the grid is transposed in
+#define GRID_TRANSPOSE_BLOCK 32
+
+// Operation counts behind the cost estimates: a visibility and source pair
+// of the exact DFT (phase, sincos and accumulation) and one kernel tap
+#define GRID_EXACT_FLOPS_PER_PAIR 32.0
+#define GRID_FLOPS_PER_KERNEL 30.0
+
+//=========================//
+//        Structures       //
+//=========================//
+
+// The kernel with the quadrature of its Fourier transform
+typedef struct GridKernel {
+	int support;
+	double beta;
+	double offsets[GRID_QUADRATURE_NODES];
+	double weights[GRID_QUADRATURE_NODES];
+} GridKernel;
+
+// State shared by the tasks of one plane
+typedef struct GridPass {
+	GridPlan *plan;
+	const GridKernel *kernel;
+	Complex *grid;
+	const char *occupied;
+	const Complex *twiddles;
+	const double *inverseTransform;
+	Visibility *visibilities;
+	Complex *visIntensity;
+	int numVisibilities;
+	int plane;
+} GridPass;
+
+typedef void (*GridTaskFunc)(void *context, int task);
+
+typedef struct GridJob {
+	GridTaskFunc func;
+	void *context;
+	int count;
+	int next;
+} GridJob;
+
+//=========================//
+//          Kernel         //
+//=========================//
+
+// Exponential of semicircle at x grid cells from its centre
+static double grid_kernel_value(const GridKernel *kernel, double x)
+{
+	double t = 2.0 * x / kernel->support;
+	if (t <= -1.0 || t >= 1.0)
+		return 0.0;
+	return exp(kernel->beta * (sqrt(1.0 - t * t) - 1.0));
+}
+
+// Nodes and weights of n point Gauss-Legendre quadrature on [-1, 1]
+static void gauss_legendre(int n, double *nodes, double *weights)
+{
+	for (int i = 0; i < (n + 1) / 2; ++i)
+	{
+		double x = cos(GRID_PI * (i + 0.75) / (n + 0.5));
+		double derivative = 1.0;
+		for (int iteration = 0; iteration < 100; ++iteration)
+		{
+			double previous = 1.0, current = x;
+			for (int k = 2; k <= n; ++k)
+			{
+				double next = ((2 * k - 1) * x * current - (k - 1) * previous) / k;
+				previous = current;
+				current = next;
+			}
+			derivative = n * (x * current - previous) / (x * x - 1.0);
+			double step = current / derivative;
+			x -= step;
+			if (fabs(step) < 1e-16)
+				break;
+		}
+		nodes[i] = -x;
+		nodes[n - 1 - i] = x;
+		weights[i] = weights[n - 1 - i] = 2.0 / ((1.0 - x * x) * derivative * derivative);
+	}
+}
+
+static void grid_kernel_init(GridKernel *kernel, GridPlan *plan)
+{
+	double nodes[GRID_QUADRATURE_NODES];
+	double weights[GRID_QUADRATURE_NODES];
+
+	kernel->support = plan->support;
+	kernel->beta = plan->beta;
+	gauss_legendre(GRID_QUADRATURE_NODES, nodes, weights);
+	for (int q = 0; q < GRID_QUADRATURE_NODES; ++q)
+	{
+		kernel->offsets[q] = 0.5 * plan->support * nodes[q];
+		kernel->weights[q] = 0.5 * plan->support * weights[q] * grid_kernel_value(kernel, kernel->offsets[q]);
+	}
+}
+
+// Fourier transform of the kernel at xi cycles per grid cell
+static double grid_kernel_transform(const GridKernel *kernel, double xi)
+{
+	double sum = 0.0;
+	for (int q = 0; q < GRID_QUADRATURE_NODES; ++q)
+		sum += kernel->weights[q] * cos(2.0 * GRID_PI * xi * kernel->offsets[q]);
+	return sum;
+}
+
+// The support kernel taps around x: first cell and weights
+static int grid_kernel_taps(const GridKernel *kernel, double x, double *taps)
+{
+	int first = (int) ceil(x - 0.5 * kernel->support);
+	for (int t = 0; t < kernel->support; ++t)
+		taps[t] = grid_kernel_value(kernel, first + t - x);
+	return first;
+}
+
+//=========================//
+//           FFT           //
+//=========================//
+
+// In-place radix-2 transform with twiddles[k] = exp(-2 pi i k / n)
+static void fft(Complex *data, int n, const Complex *twiddles)
+{
+	for (int i = 1, j = 0; i < n; ++i)
+	{
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
+		{
+			Complex swap = data[i];
+			data[i] = data[j];
+			data[j] = swap;
+		}
+	}
+
+	for (int length = 2; length <= n; length <<= 1)
+	{
+		int half = length / 2;
+		int stride = n / length;
+		for (int i = 0; i < n; i += length)
+			for (int k = 0; k < half; ++k)
+			{
+				Complex w = twiddles[k * stride];
+				Complex a = data[i + k];
+				Complex b = data[i + k + half];
+				Complex rotated = { b.real * w.real - b.imaginary * w.imaginary,
+					b.real * w.imaginary + b.imaginary * w.real };
+				data[i + k] = (Complex) { a.real + rotated.real, a.imaginary + rotated.imaginary };
+				data[i + k + half] = (Complex) { a.real - rotated.real, a.imaginary - rotated.imaginary };
+			}
+	}
+}
+
+// In-place transpose, a pair of blocks at a time to stay in cache
+static void transpose(Complex *grid, int n)
+{
+	for (int bi = 0; bi < n; bi += GRID_TRANSPOSE_BLOCK)
+		for (int bj = bi; bj < n; bj += GRID_TRANSPOSE_BLOCK)
+			for (int i = bi; i < bi + GRID_TRANSPOSE_BLOCK && i < n; ++i)
+				for (int j = (bi == bj) ? i + 1 : bj; j < bj + GRID_TRANSPOSE_BLOCK && j < n; ++j)
+				{
+					Complex swap = grid[(size_t) i * n + j];
+					grid[(size_t) i * n + j] = grid[(size_t) j * n + i];
+					grid[(size_t) j * n + i] = swap;
+				}
+}
+
+//=========================//
+//          Tasks          //
+//=========================//
+
+static void* grid_worker(void *arg)
+{
+	GridJob *job = (GridJob*) arg;
+	int task;
+	while ((task = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count)
+		job->func(job->context, task);
+	return NULL;
+}
+
+// Runs func over count tasks claimed by numThreads threads, the caller included
+static void grid_run(GridTaskFunc func, void *context, int count, int numThreads)
+{
+	GridJob job = { func, context, count, 0 };
+
+	if (numThreads > count)
+		numThreads = count;
+
+	pthread_t *threads = NULL;
+	int spawned = 0;
+	if (numThreads > 1)
+	{
+		threads = (pthread_t*) malloc((numThreads - 1) * sizeof(pthread_t));
+		for (int t = 0; threads != NULL && t < numThreads - 1; ++t)
+			if (pthread_create(&threads[spawned], NULL, grid_worker, &job) == 0)
+				spawned++;
+	}
+
+	grid_worker(&job);
+
+	for (int t = 0; t < spawned; ++t)
+		pthread_join(threads[t], NULL);
+	free(threads);
+}
+
+// Rows no source was spread onto stay zero and are skipped
+static void grid_fft_row(void *context, int row)
+{
+	GridPass *pass = (GridPass*) context;
+	int n = pass->plan->size;
+	if (pass->occupied == NULL || pass->occupied[row])
+		fft(pass->grid + (size_t) row * n, n, pass->twiddles);
+}
+
+/* Interpolate the plane's uv grid at one block of visibilities
+
+The taps are divided by the transform of the spreading kernel at their
+cell, undoing its taper on the uv grid. Off-centre planes are weighted by
+the kernel in w.
+*/
+static void grid_degrid_block(void *context, int block)
+{
+	GridPass *pass = (GridPass*) context;
+	GridPlan *plan = pass->plan;
+	const GridKernel *kernel = pass->kernel;
+	const int n = plan->size;
+	const double scale = n * plan->cellSize;
+	double taps_u[GRID_MAX_SUPPORT];
+	double taps_v[GRID_MAX_SUPPORT];
+
+	int last = (block + 1) * GRID_VIS_BLOCK;
+	if (last > pass->numVisibilities)
+		last = pass->numVisibilities;
+
+	for (int i = block * GRID_VIS_BLOCK; i < last; ++i)
+	{
+		Visibility *vis = &pass->visibilities[i];
+		double plane_weight = 1.0;
+		if (plan->numPlanes > 1)
+		{
+			double z = (vis->w - plan->wFirst) / plan->wStep;
+			plane_weight = grid_kernel_value(kernel, z - pass->plane);
+			if (plane_weight == 0.0)
+				continue;
+		}
+
+		int first_u = grid_kernel_taps(kernel, vis->u * scale, taps_u);
+		int first_v = grid_kernel_taps(kernel, vis->v * scale, taps_v);
+		for (int t = 0; t < kernel->support; ++t)
+		{
+			taps_u[t] *= pass->inverseTransform[((first_u + t) % n + n) % n];
+			taps_v[t] *= pass->inverseTransform[((first_v + t) % n + n) % n];
+		}
+
+		double real = 0.0;
+		double imaginary = 0.0;
+		for (int b = 0; b < kernel->support; ++b)
+		{
+			const Complex *row = pass->grid + (size_t) (((first_v + b) % n + n) % n) * n;
+			double row_real = 0.0;
+			double row_imaginary = 0.0;
+			for (int a = 0; a < kernel->support; ++a)
+			{
+				const Complex *cell = &row[((first_u + a) % n + n) % n];
+				row_real += taps_u[a] * cell->real;
+				row_imaginary += taps_u[a] * cell->imaginary;
+			}
+			real += taps_v[b] * row_real;
+			imaginary += taps_v[b] * row_imaginary;
+		}
+
+		pass->visIntensity[i].real += plane_weight * real;
+		pass->visIntensity[i].imaginary += plane_weight * imaginary;
+	}
+}
+
+//=========================//
+//        Functions        //
+//=========================//
+
+/* Choose the kernel, grid and w planes for a prediction
+
+With the grid oversampled by two, the support follows from the accuracy
+(one cell per digit, plus one) and beta from the support. The cell size
+puts every visibility's kernel footprint inside the central half of the
+uv grid, and the grid is the smallest power of two that also keeps every
+source inside the central half of the image. w planes are spaced so that
+no source's w correction turns by more than a quarter turn between them.
+*/
+int grid_plan(GridPlan *plan, PackedSource *sources, int numSources, Visibility *visibilities,
+	int numVisibilities, double accuracy)
+{
+	if (accuracy < 1e-14)
+		accuracy = 1e-14;
+	if (accuracy > 1e-1)
+		accuracy = 1e-1;
+
+	int support = (int) ceil(-log10(accuracy)) + 2;
+	if (support < 2)
+		support = 2;
+	if (support > GRID_MAX_SUPPORT)
+		support = GRID_MAX_SUPPORT;
+
+	double l_max = 0.0, n_max = 0.0;
+	for (int s = 0; s < numSources; ++s)
+	{
+		l_max = fmax(l_max, fmax(fabs(sources[s].l), fabs(sources[s].m)) / (2.0 * GRID_PI));
+		n_max = fmax(n_max, fabs(sources[s].n) / (2.0 * GRID_PI));
+	}
+	double u_max = 0.0;
+	double w_min = (numVisibilities > 0) ? visibilities[0].w : 0.0;
+	double w_max = w_min;
+	for (int i = 0; i < numVisibilities; ++i)
+	{
+		u_max = fmax(u_max, fmax(fabs(visibilities[i].u), fabs(visibilities[i].v)));
+		w_min = fmin(w_min, visibilities[i].w);
+		w_max = fmax(w_max, visibilities[i].w);
+	}
+
+	double extent = 16.0 * l_max * u_max + 2.0 * support + 4.0;
+	if (extent > GRID_MAX_SIZE)
+		return 0;
+	int size = 16;
+	while (size < extent)
+		size *= 2;
+
+	plan->size = size;
+	if (u_max > 0.0)
+		plan->cellSize = (size / 4.0 - support / 2.0 - 1.0) / (size * u_max);
+	else
+		plan->cellSize = (l_max > 0.0) ? 4.0 * l_max / size : 1.0;
+	plan->support = support;
+	plan->beta = GRID_BETA_PER_CELL * support;
+	plan->accuracy = accuracy;
+
+	if (n_max == 0.0 || w_max == w_min)
+	{
+		plan->numPlanes = 1;
+		plan->wFirst = w_min;
+		plan->wStep = 0.0;
+	}
+	else
+	{
+		plan->wStep = 1.0 / (4.0 * n_max);
+		double planes = ceil((w_max - w_min) / plan->wStep) + support + 1;
+		if (planes > GRID_MAX_SIZE)
+			return 0;
+		plan->numPlanes = (int) planes;
+		plan->wFirst = w_min - 0.5 * support * plan->wStep;
+	}
+	return 1;
+}
+
+double grid_exact_cost(int numSources, int numVisibilities)
+{
+	return GRID_EXACT_FLOPS_PER_PAIR * numSources * (double) numVisibilities;
+}
+
+double grid_gridded_cost(GridPlan *plan, int numSources, int numVisibilities)
+{
+	double support = plan->support;
+	double cells = (double) plan->size * plan->size;
+	double w_taps = (plan->numPlanes > 1) ? support : 1.0;
+
+	double spread = plan->numPlanes * numSources * (4.0 * support * support + 2.0 * support * GRID_FLOPS_PER_KERNEL);
+	double transform = plan->numPlanes * (10.0 * cells * log2((double) plan->size) + 2.0 * cells);
+	double degrid = numVisibilities * w_taps * (4.0 * support * support + 2.0 * support * GRID_FLOPS_PER_KERNEL);
+	return spread + transform + degrid;
+}
+
+/* Predict visibilities from a gridded sky model
+
+Every source is spread onto the image grid with its flux divided by the
+kernel's transform at its position (and at its w correction when w is
+stacked), undoing the taper degridding will apply. Each w plane turns the
+sources by the plane's w, is Fourier transformed and interpolated at the
+visibilities within the kernel's reach in w.
+*/
+int grid_extract_visibilities(GridPlan *plan, PackedSource *sources, int numSources, Visibility *visibilities,
+	Complex *visIntensity, int numVisibilities, int numThreads)
+{
+	if (numVisibilities <= 0 || numSources <= 0)
+		return DFT_SUCCESS;
+
+	const int n = plan->size;
+	GridKernel kernel;
+	grid_kernel_init(&kernel, plan);
+
+	Complex *grid = (Complex*) malloc((size_t) n * n * sizeof(Complex));
+	Complex *twiddles = (Complex*) malloc((n / 2) * sizeof(Complex));
+	double *inverseTransform = (double*) malloc(n * sizeof(double));
+	double *terms = (double*) malloc(4 * (size_t) numSources * sizeof(double));
+	char *occupied = (char*) malloc(n);
+	if (grid == NULL || twiddles == NULL || inverseTransform == NULL || terms == NULL || occupied == NULL) {
+		perror("Couldn't allocate the grid");
+		free(grid);
+		free(twiddles);
+		free(inverseTransform);
+		free(terms);
+		free(occupied);
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+
+	for (int k = 0; k < n / 2; ++k)
+		twiddles[k] = (Complex) { cos(2.0 * GRID_PI * k / n), -sin(2.0 * GRID_PI * k / n) };
+
+	// Cells far enough out to have no transform are never reached by degridding
+	for (int k = 0; k < n; ++k)
+	{
+		int frequency = (k < n / 2) ? k : k - n;
+		double transform = grid_kernel_transform(&kernel, (double) frequency / n);
+		inverseTransform[k] = (transform > 1e-300) ? 1.0 / transform : 0.0;
+	}
+
+	// Positions in image cells, w correction in wavelengths and corrected flux
+	double *x = terms;
+	double *y = terms + numSources;
+	double *w_correction = terms + 2 * (size_t) numSources;
+	double *amplitude = terms + 3 * (size_t) numSources;
+	for (int s = 0; s < numSources; ++s)
+	{
+		x[s] = sources[s].l / (2.0 * GRID_PI) / plan->cellSize;
+		y[s] = sources[s].m / (2.0 * GRID_PI) / plan->cellSize;
+		w_correction[s] = sources[s].n / (2.0 * GRID_PI);
+		double taper = grid_kernel_transform(&kernel, x[s] / n) * grid_kernel_transform(&kernel, y[s] / n);
+		if (plan->numPlanes > 1)
+			taper *= grid_kernel_transform(&kernel, w_correction[s] * plan->wStep);
+		amplitude[s] = sources[s].flux / taper;
+	}
+
+	if (numThreads <= 0)
+		numThreads = cpu_default_thread_count();
+
+	GridPass pass = { plan, &kernel, grid, occupied, twiddles, inverseTransform, visibilities, visIntensity,
+		numVisibilities, 0 };
+	for (int p = 0; p < plan->numPlanes; ++p)
+	{
+		double w_plane = plan->wFirst + p * plan->wStep;
+		pass.plane = p;
+
+		// Spread the sources, turned by this plane's w
+		memset(grid, 0, (size_t) n * n * sizeof(Complex));
+		memset(occupied, 0, n);
+		double taps_x[GRID_MAX_SUPPORT];
+		double taps_y[GRID_MAX_SUPPORT];
+		for (int s = 0; s < numSources; ++s)
+		{
+			double phase = -2.0 * GRID_PI * w_plane * w_correction[s];
+			double real = amplitude[s] * cos(phase);
+			double imaginary = amplitude[s] * sin(phase);
+			int first_x = grid_kernel_taps(&kernel, x[s], taps_x);
+			int first_y = grid_kernel_taps(&kernel, y[s], taps_y);
+			for (int b = 0; b < kernel.support; ++b)
+			{
+				int y_cell = ((first_y + b) % n + n) % n;
+				Complex *row = grid + (size_t) y_cell * n;
+				occupied[y_cell] = 1;
+				for (int a = 0; a < kernel.support; ++a)
+				{
+					double tap = taps_y[b] * taps_x[a];
+					Complex *cell = &row[((first_x + a) % n + n) % n];
+					cell->real += tap * real;
+					cell->imaginary += tap * imaginary;
+				}
+			}
+		}
+
+		// Two dimensional transform, rows then columns
+		pass.occupied = occupied;
+		grid_run(grid_fft_row, &pass, n, numThreads);
+		transpose(grid, n);
+		pass.occupied = NULL;
+		grid_run(grid_fft_row, &pass, n, numThreads);
+		transpose(grid, n);
+
+		grid_run(grid_degrid_block, &pass, (numVisibilities + GRID_VIS_BLOCK - 1) / GRID_VIS_BLOCK, numThreads);
+	}
+
+	free(grid);
+	free(twiddles);
+	free(inverseTransform);
+	free(terms);
+	free(occupied);
+	return DFT_SUCCESS;
+}
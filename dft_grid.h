@@ -0,0 +1,96 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DFT_GRID_H_
+#define DFT_GRID_H_
+
+#include "direct_fourier_transform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+// Largest grid (per side) the gridded prediction plans before deferring to
+// the exact DFT
+#define GRID_MAX_SIZE 8192
+
+// Widest exponential of semicircle kernel, in grid cells
+#define GRID_MAX_SUPPORT 16
+
+//=========================//
+//        Structures       //
+//=========================//
+
+/* Geometry and kernel of one gridded prediction
+
+Sources are spread onto a size x size image grid of cellSize radians,
+which is Fourier transformed and degridded at each visibility. Both
+spreading and degridding use the exponential of semicircle kernel
+exp(beta * (sqrt(1 - (2x / support)^2) - 1)). The w term is stacked over
+numPlanes planes of wStep wavelengths from wFirst, interpolated with the
+same kernel; a single plane at wFirst is exact when every w is equal.
+*/
+typedef struct GridPlan {
+	int size;
+	double cellSize;
+	int support;
+	double beta;
+	int numPlanes;
+	double wFirst;
+	double wStep;
+	double accuracy;
+} GridPlan;
+
+//=========================//
+//     Function Headers    //
+//=========================//
+
+// Plans the grid for a packed sky model (see packSources) and visibilities
+// within `accuracy` of the exact prediction, relative to the summed flux.
+// Returns 0 when the grid would exceed GRID_MAX_SIZE.
+int grid_plan(GridPlan *plan, PackedSource *sources, int numSources, Visibility *visibilities,
+	int numVisibilities, double accuracy);
+
+// Estimated floating point operations of the exact and gridded predictions
+double grid_exact_cost(int numSources, int numVisibilities);
+double grid_gridded_cost(GridPlan *plan, int numSources, int numVisibilities);
+
+// Gridded counterpart of cpu_extract_visibilities; accumulates into visIntensity
+// and returns a DFT_Status
+int grid_extract_visibilities(GridPlan *plan, PackedSource *sources, int numSources, Visibility *visibilities,
+	Complex *visIntensity, int numVisibilities, int numThreads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFT_GRID_H_ */
@@ -0,0 +1,284 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dft_kernel_cache.h"
+
+// Header of a cache entry, followed by `size` bytes of program binary
+typedef struct KernelCacheEntry {
+	char magic[8];
+	uint64_t key;
+	uint64_t size;
+} KernelCacheEntry;
+
+static unsigned long long fnv1a(unsigned long long hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char*) data;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	// Separate consecutive fields so that "ab" + "c" differs from "a" + "bc"
+	hash ^= 0xff;
+	hash *= 1099511628211ULL;
+	return hash;
+}
+
+static unsigned long long hash_device_string(unsigned long long hash, cl_device_id dev,
+	cl_device_info param)
+{
+	char value[1024] = { 0 };
+	clGetDeviceInfo(dev, param, sizeof(value) - 1, value, NULL);
+	return fnv1a(hash, value, strlen(value));
+}
+
+static unsigned long long hash_platform_string(unsigned long long hash, cl_platform_id platform,
+	cl_platform_info param)
+{
+	char value[1024] = { 0 };
+	clGetPlatformInfo(platform, param, sizeof(value) - 1, value, NULL);
+	return fnv1a(hash, value, strlen(value));
+}
+
+/* Identify a program binary by everything that can change it
+
+The kernel source, the build options, the platform and device names and
+the driver version all feed the key, so a driver update or a different
+device simply misses the cache rather than loading an unsuitable binary.
+*/
+unsigned long long kernel_cache_key(cl_device_id dev, const char *source, size_t source_size,
+	const char *options)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	hash = fnv1a(hash, KERNEL_CACHE_MAGIC, strlen(KERNEL_CACHE_MAGIC));
+	hash = fnv1a(hash, source, source_size);
+	hash = fnv1a(hash, options, strlen(options));
+
+	cl_platform_id platform = NULL;
+	clGetDeviceInfo(dev, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+	hash = hash_platform_string(hash, platform, CL_PLATFORM_NAME);
+	hash = hash_platform_string(hash, platform, CL_PLATFORM_VERSION);
+
+	hash = hash_device_string(hash, dev, CL_DEVICE_NAME);
+	hash = hash_device_string(hash, dev, CL_DEVICE_VENDOR);
+	hash = hash_device_string(hash, dev, CL_DEVICE_VERSION);
+	hash = hash_device_string(hash, dev, CL_DRIVER_VERSION);
+	return hash;
+}
+
+static void entry_path(char *path, size_t size, const char *cache_dir, unsigned long long key)
+{
+	snprintf(path, size, "%s/%016llx.bin", cache_dir, key);
+}
+
+/* Build the program from a cached binary
+
+Returns NULL when there is no entry (a miss) or when the entry is corrupt
+or rejected by the driver (stale); the caller then compiles from source
+and stores a fresh entry over the old one.
+*/
+cl_program kernel_cache_load(const char *cache_dir, unsigned long long key, cl_context ctx,
+	cl_device_id dev, const char *options, KernelCacheStats *stats)
+{
+	char path[4096];
+	entry_path(path, sizeof(path), cache_dir, key);
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		stats->misses++;
+		return NULL;
+	}
+
+	KernelCacheEntry entry;
+	unsigned char *binary = NULL;
+	cl_program program = NULL;
+
+	if (fread(&entry, sizeof(entry), 1, file) == 1
+		&& memcmp(entry.magic, KERNEL_CACHE_MAGIC, sizeof(entry.magic)) == 0
+		&& entry.key == key && entry.size > 0)
+	{
+		binary = (unsigned char*) malloc(entry.size);
+		if (binary != NULL && fread(binary, 1, entry.size, file) == entry.size)
+		{
+			size_t size = entry.size;
+			const unsigned char *binaries[1] = { binary };
+			cl_int status = CL_SUCCESS;
+			cl_int err;
+
+			program = clCreateProgramWithBinary(ctx, 1, &dev, &size, binaries, &status, &err);
+			if (err < 0 || status != CL_SUCCESS)
+			{
+				if (program != NULL)
+					clReleaseProgram(program);
+				program = NULL;
+			}
+			else if (clBuildProgram(program, 1, &dev, options, NULL, NULL) < 0)
+			{
+				clReleaseProgram(program);
+				program = NULL;
+			}
+		}
+	}
+	free(binary);
+	fclose(file);
+
+	if (program == NULL)
+		stats->stale++;
+	else
+		stats->hits++;
+	return program;
+}
+
+/* Save the binary of a freshly built program for later runs
+
+Entries are written to a temporary file and renamed into place, so that
+concurrent jobs never read a partially written binary. Failures only cost
+the next run a compilation and are otherwise ignored.
+*/
+void kernel_cache_store(const char *cache_dir, unsigned long long key, cl_program program,
+	cl_device_id dev, KernelCacheStats *stats)
+{
+	cl_uint num_devices = 0;
+	if (clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(num_devices), &num_devices, NULL) < 0
+		|| num_devices == 0)
+		return;
+
+	cl_device_id *devices = (cl_device_id*) calloc(num_devices, sizeof(cl_device_id));
+	size_t *sizes = (size_t*) calloc(num_devices, sizeof(size_t));
+	unsigned char **binaries = (unsigned char**) calloc(num_devices, sizeof(unsigned char*));
+	if (devices == NULL || sizes == NULL || binaries == NULL)
+		goto cleanup;
+
+	clGetProgramInfo(program, CL_PROGRAM_DEVICES, num_devices * sizeof(cl_device_id), devices, NULL);
+	clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, num_devices * sizeof(size_t), sizes, NULL);
+
+	cl_uint index = 0;
+	while (index < num_devices && devices[index] != dev)
+		index++;
+	if (index == num_devices || sizes[index] == 0)
+		goto cleanup;
+
+	// Only the entry for our device is filled in, the others are skipped
+	binaries[index] = (unsigned char*) malloc(sizes[index]);
+	if (binaries[index] == NULL
+		|| clGetProgramInfo(program, CL_PROGRAM_BINARIES, num_devices * sizeof(unsigned char*),
+			binaries, NULL) < 0)
+		goto cleanup;
+
+	mkdir(cache_dir, 0755);
+
+	char path[4096];
+	char temporary[4200];
+	entry_path(path, sizeof(path), cache_dir, key);
+	snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", path, (long) getpid());
+
+	FILE *file = fopen(temporary, "wb");
+	if (file == NULL)
+		goto cleanup;
+
+	KernelCacheEntry entry;
+	memcpy(entry.magic, KERNEL_CACHE_MAGIC, sizeof(entry.magic));
+	entry.key = key;
+	entry.size = sizes[index];
+
+	int written = fwrite(&entry, sizeof(entry), 1, file) == 1
+		&& fwrite(binaries[index], 1, sizes[index], file) == sizes[index];
+	if (fclose(file) != 0)
+		written = 0;
+
+	if (written && rename(temporary, path) == 0)
+		stats->stores++;
+	else
+		remove(temporary);
+
+cleanup:
+	if (binaries != NULL)
+		for (cl_uint d = 0; d < num_devices; ++d)
+			free(binaries[d]);
+	free(binaries);
+	free(sizes);
+	free(devices);
+}
+
+/* Add this run's lookups to the lifetime counters and report them
+
+The counters are read and rewritten under an exclusive lock on the stats
+file, so that runs finishing together do not lose each other's counts.
+*/
+void kernel_cache_report(const char *cache_dir, KernelCacheStats *stats, int enable_messages)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%s", cache_dir, KERNEL_CACHE_STATS_FILE);
+
+	KernelCacheStats total = { 0, 0, 0, 0 };
+	mkdir(cache_dir, 0755);
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	FILE *file = (fd >= 0) ? fdopen(fd, "r+") : NULL;
+	if (file == NULL && fd >= 0)
+		close(fd);
+	if (file != NULL && flock(fd, LOCK_EX) == 0)
+	{
+		if (fscanf(file, "hits %d misses %d stale %d stores %d", &total.hits, &total.misses,
+			&total.stale, &total.stores) != 4)
+			memset(&total, 0, sizeof(total));
+
+		total.hits += stats->hits;
+		total.misses += stats->misses;
+		total.stale += stats->stale;
+		total.stores += stats->stores;
+
+		rewind(file);
+		if (ftruncate(fd, 0) == 0)
+			fprintf(file, "hits %d misses %d stale %d stores %d\n", total.hits, total.misses,
+				total.stale, total.stores);
+		fflush(file);
+	}
+	else
+	{
+		// Unlocked, the lifetime counters are only reported as this run's
+		total = *stats;
+	}
+	if (file != NULL)
+		fclose(file);
+
+	if(enable_messages)
+		printf(">>> INFO: Kernel binary cache %s (%d hits, %d misses, %d stale over all runs)...\n\n",
+			(stats->hits > 0) ? "hit" : (stats->stale > 0) ? "stale, rebuilt" : "miss, compiled",
+			total.hits, total.misses, total.stale);
+}
@@ -0,0 +1,64 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DFT_KERNEL_CACHE_H_
+#define DFT_KERNEL_CACHE_H_
+
+#include "direct_fourier_transform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+// Tags every cache entry; bump when the entry layout changes
+#define KERNEL_CACHE_MAGIC "DFTKBIN1"
+
+// Lifetime hit/miss counters kept alongside the entries
+#define KERNEL_CACHE_STATS_FILE "stats.txt"
+
+//=========================//
+//     Function Headers    //
+//=========================//
+
+unsigned long long kernel_cache_key(cl_device_id dev, const char *source, size_t source_size,
+	const char *options);
+cl_program kernel_cache_load(const char *cache_dir, unsigned long long key, cl_context ctx,
+	cl_device_id dev, const char *options, KernelCacheStats *stats);
+void kernel_cache_store(const char *cache_dir, unsigned long long key, cl_program program,
+	cl_device_id dev, KernelCacheStats *stats);
+void kernel_cache_report(const char *cache_dir, KernelCacheStats *stats, int enable_messages);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFT_KERNEL_CACHE_H_ */
@@ -0,0 +1,301 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "dft_scheduler.h"
+#include "dft_trace.h"
+
+//=========================//
+//        Structures       //
+//=========================//
+
+// Chunks still owned by one worker; the owner takes from the front and
+// thieves take from the back
+typedef struct ChunkQueue {
+	pthread_mutex_t lock;
+	int next;
+	int end;
+} ChunkQueue;
+
+// One worker engine and what it got through
+typedef struct SchedulerWorker {
+	struct Scheduler *scheduler;
+	int index;
+	DFT_Engine *engine;
+	ChunkQueue queue;
+	int visibilities;
+	int chunks;
+	int stolen;
+	double seconds;
+	int status; // first failure of this worker's chunks, DFT_SUCCESS if none
+} SchedulerWorker;
+
+typedef struct Scheduler {
+	Config config; // copy with messages silenced for the per-chunk calls
+	Source *sources;
+	Visibility *visibilities;
+	Complex *visIntensity;
+	int numVisibilities;
+	const double *frequencies; // channelized predictions only, otherwise NULL
+	int numChannels;
+	size_t channelStride;
+	int chunkSize;
+	int numWorkers;
+	SchedulerWorker *workers;
+} Scheduler;
+
+//=========================//
+//        Functions        //
+//=========================//
+
+static double scheduler_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Takes the next chunk from the worker's own queue, -1 when it is empty
+static int take_own_chunk(SchedulerWorker *worker)
+{
+	int chunk = -1;
+	pthread_mutex_lock(&worker->queue.lock);
+	if (worker->queue.next < worker->queue.end)
+		chunk = worker->queue.next++;
+	pthread_mutex_unlock(&worker->queue.lock);
+	return chunk;
+}
+
+/* Refill an empty queue with the back half of the fullest other queue
+
+Taking half rather than one chunk keeps the number of steals logarithmic
+in the imbalance. Returns 0 once no queue has any chunk left.
+*/
+static int steal_chunks(SchedulerWorker *worker)
+{
+	Scheduler *scheduler = worker->scheduler;
+
+	for (;;)
+	{
+		SchedulerWorker *victim = NULL;
+		int most = 0;
+		for (int w = 0; w < scheduler->numWorkers; ++w)
+		{
+			SchedulerWorker *other = &scheduler->workers[w];
+			pthread_mutex_lock(&other->queue.lock);
+			int left = other->queue.end - other->queue.next;
+			pthread_mutex_unlock(&other->queue.lock);
+			if (other != worker && left > most)
+			{
+				victim = other;
+				most = left;
+			}
+		}
+		if (victim == NULL)
+			return 0;
+
+		// The victim may have drained its queue since it was inspected
+		int first = 0;
+		int last = 0;
+		pthread_mutex_lock(&victim->queue.lock);
+		int left = victim->queue.end - victim->queue.next;
+		if (left > 0)
+		{
+			last = victim->queue.end;
+			first = last - (left + 1) / 2;
+			victim->queue.end = first;
+		}
+		pthread_mutex_unlock(&victim->queue.lock);
+
+		if (last > first)
+		{
+			pthread_mutex_lock(&worker->queue.lock);
+			worker->queue.next = first;
+			worker->queue.end = last;
+			pthread_mutex_unlock(&worker->queue.lock);
+			worker->stolen += last - first;
+			return 1;
+		}
+	}
+}
+
+static void* scheduler_worker(void *arg)
+{
+	SchedulerWorker *worker = (SchedulerWorker*) arg;
+	Scheduler *scheduler = worker->scheduler;
+	double started = scheduler_now();
+
+	// Each worker gets its own rows in the trace, after the main thread's
+	trace_set_thread_tracks((worker->index + 1) * TRACE_TRACKS_PER_THREAD);
+
+	for (;;)
+	{
+		int chunk = take_own_chunk(worker);
+		if (chunk < 0)
+		{
+			if (!steal_chunks(worker))
+				break;
+			continue;
+		}
+
+		int first = chunk * scheduler->chunkSize;
+		int count = scheduler->numVisibilities - first;
+		if (count > scheduler->chunkSize)
+			count = scheduler->chunkSize;
+
+		// Each chunk is a disjoint slice of the shared arrays, so workers
+		// read and write them in place
+		int status;
+		if (scheduler->frequencies != NULL)
+			status = extract_channel_visibilities(worker->engine, &scheduler->config, scheduler->sources,
+				scheduler->visibilities + first, count, scheduler->frequencies, scheduler->numChannels,
+				scheduler->visIntensity + first, scheduler->channelStride);
+		else
+			status = extract_visibilities(worker->engine, &scheduler->config, scheduler->sources,
+				scheduler->visibilities + first, scheduler->visIntensity + first, count);
+		if (worker->status == DFT_SUCCESS)
+			worker->status = status;
+		worker->visibilities += count;
+		worker->chunks++;
+	}
+
+	worker->seconds = scheduler_now() - started;
+	trace_set_thread_tracks(0);
+	return NULL;
+}
+
+// Expects the scheduler's inputs to be set; runs every chunk on the workers
+// and returns the first failure of any of them
+static int run_scheduler(DFT_Engine *engine, Config *config, Scheduler *scheduler)
+{
+	int numVisibilities = scheduler->numVisibilities;
+	scheduler->config = *config;
+	scheduler->config.enable_messages = 0;
+	scheduler->chunkSize = (config->multi_chunk_size > 0) ? config->multi_chunk_size : numVisibilities;
+	scheduler->numWorkers = engine->numWorkers;
+	scheduler->workers = (SchedulerWorker*) calloc(engine->numWorkers, sizeof(SchedulerWorker));
+	if (scheduler->workers == NULL) {
+		perror("Couldn't allocate the scheduler");
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+
+	// Deal the chunks out evenly; stealing corrects for unequal devices
+	int numChunks = (numVisibilities + scheduler->chunkSize - 1) / scheduler->chunkSize;
+	for (int w = 0; w < scheduler->numWorkers; ++w)
+	{
+		SchedulerWorker *worker = &scheduler->workers[w];
+		worker->scheduler = scheduler;
+		worker->index = w;
+		worker->engine = engine->workers[w];
+		pthread_mutex_init(&worker->queue.lock, NULL);
+		worker->queue.next = (int) ((long long) numChunks * w / scheduler->numWorkers);
+		worker->queue.end = (int) ((long long) numChunks * (w + 1) / scheduler->numWorkers);
+	}
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Scheduling %d chunks of up to %d visibilities over %d devices...\n\n",
+			numChunks, scheduler->chunkSize, scheduler->numWorkers);
+
+	// The calling thread drives the last worker, the native CPU backend
+	pthread_t *threads = (pthread_t*) malloc(scheduler->numWorkers * sizeof(pthread_t));
+	int *spawned = (int*) calloc(scheduler->numWorkers, sizeof(int));
+	for (int w = 0; threads != NULL && spawned != NULL && w < scheduler->numWorkers - 1; ++w)
+		spawned[w] = pthread_create(&threads[w], NULL, scheduler_worker, &scheduler->workers[w]) == 0;
+
+	scheduler_worker(&scheduler->workers[scheduler->numWorkers - 1]);
+
+	for (int w = 0; threads != NULL && spawned != NULL && w < scheduler->numWorkers - 1; ++w)
+		if (spawned[w])
+			pthread_join(threads[w], NULL);
+
+	// A worker whose thread could not be started left its chunks for the
+	// others to steal, so every chunk has been computed by now
+	if(config->enable_messages)
+	{
+		for (int w = 0; w < scheduler->numWorkers; ++w)
+		{
+			SchedulerWorker *worker = &scheduler->workers[w];
+			printf(">>> INFO: %-40s %10d visibilities, %6d chunks (%d stolen), %10.2f Mvis/s\n",
+				worker->engine->deviceName, worker->visibilities, worker->chunks, worker->stolen,
+				(worker->seconds > 0.0) ? worker->visibilities / worker->seconds * 1e-6 : 0.0);
+		}
+		printf("\n");
+	}
+
+	int status = DFT_SUCCESS;
+	for (int w = 0; w < scheduler->numWorkers; ++w)
+	{
+		if (status == DFT_SUCCESS)
+			status = scheduler->workers[w].status;
+		pthread_mutex_destroy(&scheduler->workers[w].queue.lock);
+	}
+	free(spawned);
+	free(threads);
+	free(scheduler->workers);
+	return status;
+}
+
+int multi_extract_visibilities(DFT_Engine *engine, Config *config, Source *sources, Visibility *visibilities,
+	Complex *visIntensity, int numVisibilities)
+{
+	if (numVisibilities <= 0 || engine->numWorkers <= 0)
+		return DFT_SUCCESS;
+
+	Scheduler scheduler;
+	scheduler.sources = sources;
+	scheduler.visibilities = visibilities;
+	scheduler.visIntensity = visIntensity;
+	scheduler.numVisibilities = numVisibilities;
+	scheduler.frequencies = NULL;
+	scheduler.numChannels = 0;
+	scheduler.channelStride = 0;
+	return run_scheduler(engine, config, &scheduler);
+}
+
+int multi_extract_channel_visibilities(DFT_Engine *engine, Config *config, Source *sources,
+	Visibility *visibilities, int numVisibilities, const double *frequencies, int numChannels,
+	Complex *visIntensity, size_t channelStride)
+{
+	if (numVisibilities <= 0 || numChannels <= 0 || engine->numWorkers <= 0)
+		return DFT_SUCCESS;
+
+	Scheduler scheduler;
+	scheduler.sources = sources;
+	scheduler.visibilities = visibilities;
+	scheduler.visIntensity = visIntensity;
+	scheduler.numVisibilities = numVisibilities;
+	scheduler.frequencies = frequencies;
+	scheduler.numChannels = numChannels;
+	scheduler.channelStride = channelStride;
+	return run_scheduler(engine, config, &scheduler);
+}
@@ -0,0 +1,144 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dft_storage.h"
+
+//=========================//
+//        Functions        //
+//=========================//
+
+void* dft_aligned_alloc(size_t bytes)
+{
+	size_t alignment = (bytes >= DFT_STORAGE_PAGE) ? DFT_STORAGE_PAGE : DFT_STORAGE_ALIGNMENT;
+	size_t rounded = ((bytes + alignment - 1) / alignment) * alignment;
+	void *block = NULL;
+
+	if (posix_memalign(&block, alignment, (rounded > 0) ? rounded : alignment) != 0)
+		return NULL;
+	memset(block, 0, (rounded > 0) ? rounded : alignment);
+	return block;
+}
+
+int dft_padded_count(int count)
+{
+	if (count <= 0)
+		return 0;
+	return ((count + DFT_STORAGE_PAD - 1) / DFT_STORAGE_PAD) * DFT_STORAGE_PAD;
+}
+
+size_t visibility_arrays_bytes(int count)
+{
+	return 3 * (size_t) dft_padded_count(count) * sizeof(double);
+}
+
+size_t intensity_arrays_bytes(int count)
+{
+	return 2 * (size_t) dft_padded_count(count) * sizeof(double);
+}
+
+void visibility_arrays_view(VisibilityArrays *arrays, double *block, int count)
+{
+	arrays->count = count;
+	arrays->padded = dft_padded_count(count);
+	arrays->u = block;
+	arrays->v = block + arrays->padded;
+	arrays->w = block + 2 * (size_t) arrays->padded;
+}
+
+void intensity_arrays_view(IntensityArrays *arrays, double *block, int count)
+{
+	arrays->count = count;
+	arrays->padded = dft_padded_count(count);
+	arrays->real = block;
+	arrays->imaginary = block + arrays->padded;
+}
+
+int create_source_arrays(SourceArrays *arrays, int count)
+{
+	int padded = dft_padded_count(count);
+	double *block = (double*) dft_aligned_alloc(4 * (size_t) padded * sizeof(double));
+
+	memset(arrays, 0, sizeof(SourceArrays));
+	if (block == NULL)
+		return 0;
+	arrays->count = count;
+	arrays->padded = padded;
+	arrays->l = block;
+	arrays->m = block + padded;
+	arrays->n = block + 2 * (size_t) padded;
+	arrays->flux = block + 3 * (size_t) padded;
+	return 1;
+}
+
+void destroy_source_arrays(SourceArrays *arrays)
+{
+	free(arrays->l);
+	memset(arrays, 0, sizeof(SourceArrays));
+}
+
+void gather_visibilities(VisibilityArrays *arrays, const Visibility *visibilities, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		arrays->u[i] = visibilities[i].u;
+		arrays->v[i] = visibilities[i].v;
+		arrays->w[i] = visibilities[i].w;
+	}
+	for (int i = count; i < arrays->padded; ++i)
+		arrays->u[i] = arrays->v[i] = arrays->w[i] = 0.0;
+}
+
+void gather_packed_sources(SourceArrays *arrays, const PackedSource *sources, int count)
+{
+	for (int s = 0; s < count; ++s)
+	{
+		arrays->l[s] = sources[s].l;
+		arrays->m[s] = sources[s].m;
+		arrays->n[s] = sources[s].n;
+		arrays->flux[s] = sources[s].flux;
+	}
+	for (int s = count; s < arrays->padded; ++s)
+		arrays->l[s] = arrays->m[s] = arrays->n[s] = arrays->flux[s] = 0.0;
+}
+
+void clear_intensities(IntensityArrays *arrays)
+{
+	memset(arrays->real, 0, intensity_arrays_bytes(arrays->count));
+}
+
+void add_intensities(const IntensityArrays *arrays, Complex *visIntensity, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		visIntensity[i].real += arrays->real[i];
+		visIntensity[i].imaginary += arrays->imaginary[i];
+	}
+}
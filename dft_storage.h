@@ -0,0 +1,126 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DFT_STORAGE_H_
+#define DFT_STORAGE_H_
+
+#include <stddef.h>
+
+#include "direct_fourier_transform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+// Alignment of every storage array: a cache line, and one AVX-512 vector
+#define DFT_STORAGE_ALIGNMENT 64
+
+// Arrays of at least a page are page aligned, as DMA engines prefer
+#define DFT_STORAGE_PAGE 4096
+
+// Element counts are padded to a multiple of this many doubles (a cache
+// line) so that every field array of a structure-of-arrays block starts
+// aligned and vector loops need no remainder; the kernels derive the same
+// stride through the DFT_SOA_PAD build option
+#define DFT_STORAGE_PAD 8
+
+//=========================//
+//        Structures       //
+//=========================//
+
+/* Structure-of-arrays storage
+
+Each container is a single aligned allocation holding its fields one after
+another, every field `padded` elements long, so that a field is
+`base + k * padded` and the whole block can be copied to a device buffer
+in one transfer. Padding elements are zero. The AoS structs (Visibility,
+Complex, PackedSource) remain the public interface and are converted at
+the boundary with the functions below.
+*/
+typedef struct VisibilityArrays {
+	double *u;
+	double *v;
+	double *w;
+	int count;
+	int padded;
+} VisibilityArrays;
+
+typedef struct IntensityArrays {
+	double *real;
+	double *imaginary;
+	int count;
+	int padded;
+} IntensityArrays;
+
+typedef struct SourceArrays {
+	double *l;
+	double *m;
+	double *n;
+	double *flux;
+	int count;
+	int padded;
+} SourceArrays;
+
+//=========================//
+//     Function Headers    //
+//=========================//
+
+// Zeroed allocation aligned to DFT_STORAGE_ALIGNMENT (DFT_STORAGE_PAGE for
+// page-sized and larger blocks); released with free. NULL when out of memory.
+void* dft_aligned_alloc(size_t bytes);
+
+// `count` rounded up to a multiple of DFT_STORAGE_PAD
+int dft_padded_count(int count);
+
+// Bytes of the single block behind `count` elements of each container
+size_t visibility_arrays_bytes(int count);
+size_t intensity_arrays_bytes(int count);
+
+// Point a container at a block of the size above; the block is not cleared
+void visibility_arrays_view(VisibilityArrays *arrays, double *block, int count);
+void intensity_arrays_view(IntensityArrays *arrays, double *block, int count);
+
+// Containers owning their block; release with the matching destroy
+int create_source_arrays(SourceArrays *arrays, int count);
+void destroy_source_arrays(SourceArrays *arrays);
+
+// Conversions from and to the AoS views. The gathers zero the padding.
+void gather_visibilities(VisibilityArrays *arrays, const Visibility *visibilities, int count);
+void gather_packed_sources(SourceArrays *arrays, const PackedSource *sources, int count);
+void clear_intensities(IntensityArrays *arrays);
+void add_intensities(const IntensityArrays *arrays, Complex *visIntensity, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFT_STORAGE_H_ */
@@ -0,0 +1,1053 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <locale.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dft_text_io.h"
+#include "dft_cpu.h"
+
+// Longest token handed to the strtod fallback
+#define TEXT_MAX_TOKEN 512
+
+typedef struct TextChunk {
+	const char *begin;
+	const char *end;
+	int lines;      // newline terminated or final lines in the chunk
+	int rows;       // lines holding data (not blank)
+	int firstLine;  // 1 based file line number of the chunk's first line
+	int firstRow;   // index of the chunk's first data row
+	int errorLine;  // first malformed line, 0 when none
+} TextChunk;
+
+typedef struct TextTask {
+	TextChunk *chunks;
+	int numChunks;
+	int nextChunk;
+	int counting;
+	int fields;
+	int count;
+	TextRowStore store;
+	void *context;
+} TextTask;
+
+// Powers of ten which are exact in a double
+static const double exact_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static int is_separator(char c)
+{
+	return c == ' ' || c == '\t' || c == ',' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static int is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+/* Hand a token the fast path cannot round exactly to the C library
+
+strtod is correctly rounded, as is the fscanf the text loaders used to call,
+but it honours the locale's decimal point, so the copy is rewritten to use
+it before parsing.
+*/
+static int parse_double_fallback(const char *begin, const char *end, double *value)
+{
+	char token[TEXT_MAX_TOKEN];
+	size_t length = end - begin;
+	if (length == 0 || length >= sizeof(token))
+		return 0;
+
+	memcpy(token, begin, length);
+	token[length] = '\0';
+
+	char point = localeconv()->decimal_point[0];
+	if (point != '.')
+		for (size_t i = 0; i < length; ++i)
+			if (token[i] == '.')
+				token[i] = point;
+
+	char *parsed = NULL;
+	*value = strtod(token, &parsed);
+	return parsed == token + length;
+}
+
+/* Parse one number at *cursor and advance past it
+
+Decimal values with at most 19 significant digits, a mantissa below 2^53
+and a power of ten exactly representable in a double are computed with a
+single correctly rounded multiply or divide, which gives the same bits as
+strtod. Everything else (long mantissas, large exponents, inf, nan, hex)
+goes to parse_double_fallback. Returns 0 if the token is not a number.
+*/
+int parse_text_double(const char **cursor, const char *end, double *value)
+{
+	const char *begin = *cursor;
+	const char *p = begin;
+	int negative = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = (*p++ == '-');
+
+	uint64_t mantissa = 0;
+	int significant = 0;
+	int exponent = 0;
+	int digits = 0;
+	int exact = 1;
+
+	for (; p < end && is_digit(*p); ++p, ++digits)
+	{
+		if (significant < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			significant += (mantissa != 0);
+		}
+		else
+		{
+			exact = 0;
+			exponent++;
+		}
+	}
+
+	if (p < end && *p == '.')
+	{
+		for (++p; p < end && is_digit(*p); ++p, ++digits)
+		{
+			if (significant < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				significant += (mantissa != 0);
+				exponent--;
+			}
+			else
+				exact = 0;
+		}
+	}
+
+	if (digits > 0 && p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char *marker = p++;
+		int exponentNegative = 0;
+		if (p < end && (*p == '-' || *p == '+'))
+			exponentNegative = (*p++ == '-');
+
+		if (p < end && is_digit(*p))
+		{
+			int written = 0;
+			for (; p < end && is_digit(*p); ++p)
+				if (written < 100000)
+					written = written * 10 + (*p - '0');
+			exponent += exponentNegative ? -written : written;
+		}
+		else
+			p = marker; // "1e" parses as 1 followed by garbage, as strtod does
+	}
+
+	const char *tokenEnd = p;
+	while (tokenEnd < end && !is_separator(*tokenEnd) && *tokenEnd != '\n')
+		tokenEnd++;
+
+	if (digits == 0 || tokenEnd != p)
+	{
+		// Not a plain decimal: inf, nan, hex floats or garbage
+		if (!parse_double_fallback(begin, tokenEnd, value))
+			return 0;
+		*cursor = tokenEnd;
+		return 1;
+	}
+
+	if (exact && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double result = (double) mantissa;
+		result = (exponent < 0) ? result / exact_powers_of_ten[-exponent]
+			: result * exact_powers_of_ten[exponent];
+		*value = negative ? -result : result;
+	}
+	else if (!parse_double_fallback(begin, p, value))
+		return 0;
+
+	*cursor = p;
+	return 1;
+}
+
+static int is_blank_line(const char *begin, const char *end)
+{
+	for (; begin < end; ++begin)
+		if (!is_separator(*begin))
+			return 0;
+	return 1;
+}
+
+// Parse exactly `fields` numbers from one line, with nothing else on it
+static int parse_line(const char *p, const char *end, double *values, int fields)
+{
+	for (int f = 0; f < fields; ++f)
+	{
+		while (p < end && is_separator(*p))
+			p++;
+		if (p == end || !parse_text_double(&p, end, &values[f]))
+			return 0;
+		if (p < end && !is_separator(*p))
+			return 0;
+	}
+	return is_blank_line(p, end);
+}
+
+static const char* line_end(const char *p, const char *end)
+{
+	const char *newline = (const char*) memchr(p, '\n', end - p);
+	return (newline != NULL) ? newline : end;
+}
+
+static const char* next_line(const char *eol, const char *end)
+{
+	return (eol < end) ? eol + 1 : end;
+}
+
+static void count_chunk(TextChunk *chunk)
+{
+	chunk->lines = 0;
+	chunk->rows = 0;
+	for (const char *p = chunk->begin; p < chunk->end;)
+	{
+		const char *eol = line_end(p, chunk->end);
+		chunk->lines++;
+		chunk->rows += !is_blank_line(p, eol);
+		p = next_line(eol, chunk->end);
+	}
+}
+
+static void parse_chunk(TextTask *task, TextChunk *chunk)
+{
+	double values[TEXT_MAX_FIELDS];
+	int line = chunk->firstLine;
+	int row = chunk->firstRow;
+
+	chunk->errorLine = 0;
+	for (const char *p = chunk->begin; p < chunk->end && row < task->count; ++line)
+	{
+		const char *eol = line_end(p, chunk->end);
+		if (!is_blank_line(p, eol))
+		{
+			if (!parse_line(p, eol, values, task->fields))
+			{
+				chunk->errorLine = line;
+				return;
+			}
+			task->store(task->context, row++, values);
+		}
+		p = next_line(eol, chunk->end);
+	}
+}
+
+static void* text_worker(void *arg)
+{
+	TextTask *task = (TextTask*) arg;
+	for (;;)
+	{
+		int c = __atomic_fetch_add(&task->nextChunk, 1, __ATOMIC_RELAXED);
+		if (c >= task->numChunks)
+			break;
+		if (task->counting)
+			count_chunk(&task->chunks[c]);
+		else
+			parse_chunk(task, &task->chunks[c]);
+	}
+	return NULL;
+}
+
+static void run_text_task(TextTask *task, int numThreads)
+{
+	task->nextChunk = 0;
+
+	// The calling thread is always one of the workers
+	pthread_t *threads = NULL;
+	int spawned = 0;
+	if (numThreads > 1)
+	{
+		threads = (pthread_t*) malloc((numThreads - 1) * sizeof(pthread_t));
+		for (int t = 0; threads != NULL && t < numThreads - 1; ++t)
+			if (pthread_create(&threads[spawned], NULL, text_worker, task) == 0)
+				spawned++;
+	}
+
+	text_worker(task);
+
+	for (int t = 0; t < spawned; ++t)
+		pthread_join(threads[t], NULL);
+	free(threads);
+}
+
+/* Map a text input and read its leading row count
+
+Returns 0 if the file cannot be opened or does not start with a count.
+*/
+int open_text_file(const char *path, TextFile *file)
+{
+	memset(file, 0, sizeof(TextFile));
+	file->path = path;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	void *address = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (address == MAP_FAILED)
+		return 0;
+	file->data = (char*) address;
+	file->length = info.st_size;
+	madvise(file->data, file->length, MADV_SEQUENTIAL);
+
+	const char *p = file->data;
+	const char *end = file->data + file->length;
+	while (p < end && (is_separator(*p) || *p == '\n'))
+		p++;
+
+	long count = 0;
+	int digits = 0;
+	for (; p < end && is_digit(*p) && count <= 0x7fffffff; ++p, ++digits)
+		count = count * 10 + (*p - '0');
+
+	const char *eol = line_end(p, end);
+	if (digits == 0 || count > 0x7fffffff || !is_blank_line(p, eol))
+	{
+		close_text_file(file);
+		return 0;
+	}
+
+	file->count = (int) count;
+	file->bodyOffset = (eol < end) ? (size_t) (eol + 1 - file->data) : file->length;
+	file->bodyLine = 1;
+	for (const char *c = file->data; c < file->data + file->bodyOffset; ++c)
+		file->bodyLine += (*c == '\n');
+	return 1;
+}
+
+void close_text_file(TextFile *file)
+{
+	if (file->data != NULL)
+		munmap(file->data, file->length);
+	file->data = NULL;
+	file->length = 0;
+}
+
+/* Parse the rows of an opened text input in parallel
+
+The body is split into newline aligned chunks which are first counted, to
+give every chunk its starting row and line number, and then parsed, each
+row being passed to `store` as soon as it is read. Rows past the count in
+the header are ignored. Returns 0 after reporting the first malformed line,
+or a file with fewer rows than its count.
+*/
+int parse_text_rows(TextFile *file, int fields, TextRowStore store, void *context,
+	int numThreads, const char *description)
+{
+	file->errorLine = 0;
+	if (fields > TEXT_MAX_FIELDS)
+		return 0;
+
+	const char *begin = file->data + file->bodyOffset;
+	const char *end = file->data + file->length;
+	size_t bodyLength = end - begin;
+
+	if (numThreads <= 0)
+		numThreads = cpu_default_thread_count();
+	if ((size_t) numThreads > bodyLength / TEXT_MIN_CHUNK_BYTES)
+		numThreads = (int) (bodyLength / TEXT_MIN_CHUNK_BYTES);
+	if (numThreads < 1)
+		numThreads = 1;
+
+	int numChunks = numThreads * ((numThreads > 1) ? TEXT_CHUNKS_PER_THREAD : 1);
+	TextChunk *chunks = (TextChunk*) calloc(numChunks, sizeof(TextChunk));
+	if (chunks == NULL)
+		return 0;
+
+	// Cut at even offsets, then move every cut to just after the next newline
+	const char *cut = begin;
+	for (int c = 0; c < numChunks; ++c)
+	{
+		const char *target = begin + (bodyLength * (c + 1)) / numChunks;
+		if (target < cut)
+			target = cut;
+		chunks[c].begin = cut;
+		chunks[c].end = (c == numChunks - 1) ? end : next_line(line_end(target, end), end);
+		if (chunks[c].end < cut)
+			chunks[c].end = cut;
+		cut = chunks[c].end;
+	}
+
+	TextTask task;
+	task.chunks = chunks;
+	task.numChunks = numChunks;
+	task.fields = fields;
+	task.count = file->count;
+	task.store = store;
+	task.context = context;
+
+	task.counting = 1;
+	run_text_task(&task, numThreads);
+
+	int rows = 0;
+	int line = file->bodyLine;
+	for (int c = 0; c < numChunks; ++c)
+	{
+		chunks[c].firstRow = rows;
+		chunks[c].firstLine = line;
+		rows += chunks[c].rows;
+		line += chunks[c].lines;
+	}
+
+	task.counting = 0;
+	run_text_task(&task, numThreads);
+
+	// Chunks are in file order, so the first error found is the earliest
+	for (int c = 0; c < numChunks && file->errorLine == 0; ++c)
+		file->errorLine = chunks[c].errorLine;
+	free(chunks);
+
+	if (file->errorLine != 0)
+	{
+		printf(">>> ERROR: Malformed %s on line %d of %s...\n\n", description,
+			file->errorLine, file->path);
+		return 0;
+	}
+
+	if (rows < file->count)
+	{
+		printf(">>> ERROR: %s expects %d %ss but only holds %d...\n\n", file->path,
+			file->count, description, rows);
+		return 0;
+	}
+
+	return 1;
+}
+
+//=========================//
+//      Text Output        //
+//=========================//
+
+// A double as f * 2^e with a 64 bit significand
+typedef struct DiyFp {
+	uint64_t f;
+	int e;
+} DiyFp;
+
+// Normalized approximation f * 2^e of 10^k
+typedef struct CachedPower {
+	uint64_t f;
+	int e;
+	int k;
+} CachedPower;
+
+// Correctly rounded 10^k for k = -300, -292, ..., 324
+static const CachedPower cached_powers[] = {
+	{ 0xAB70FE17C79AC6CAULL, -1060, -300 },
+	{ 0xFF77B1FCBEBCDC4FULL, -1034, -292 },
+	{ 0xBE5691EF416BD60CULL, -1007, -284 },
+	{ 0x8DD01FAD907FFC3CULL, -980, -276 },
+	{ 0xD3515C2831559A83ULL, -954, -268 },
+	{ 0x9D71AC8FADA6C9B5ULL, -927, -260 },
+	{ 0xEA9C227723EE8BCBULL, -901, -252 },
+	{ 0xAECC49914078536DULL, -874, -244 },
+	{ 0x823C12795DB6CE57ULL, -847, -236 },
+	{ 0xC21094364DFB5637ULL, -821, -228 },
+	{ 0x9096EA6F3848984FULL, -794, -220 },
+	{ 0xD77485CB25823AC7ULL, -768, -212 },
+	{ 0xA086CFCD97BF97F4ULL, -741, -204 },
+	{ 0xEF340A98172AACE5ULL, -715, -196 },
+	{ 0xB23867FB2A35B28EULL, -688, -188 },
+	{ 0x84C8D4DFD2C63F3BULL, -661, -180 },
+	{ 0xC5DD44271AD3CDBAULL, -635, -172 },
+	{ 0x936B9FCEBB25C996ULL, -608, -164 },
+	{ 0xDBAC6C247D62A584ULL, -582, -156 },
+	{ 0xA3AB66580D5FDAF6ULL, -555, -148 },
+	{ 0xF3E2F893DEC3F126ULL, -529, -140 },
+	{ 0xB5B5ADA8AAFF80B8ULL, -502, -132 },
+	{ 0x87625F056C7C4A8BULL, -475, -124 },
+	{ 0xC9BCFF6034C13053ULL, -449, -116 },
+	{ 0x964E858C91BA2655ULL, -422, -108 },
+	{ 0xDFF9772470297EBDULL, -396, -100 },
+	{ 0xA6DFBD9FB8E5B88FULL, -369, -92 },
+	{ 0xF8A95FCF88747D94ULL, -343, -84 },
+	{ 0xB94470938FA89BCFULL, -316, -76 },
+	{ 0x8A08F0F8BF0F156BULL, -289, -68 },
+	{ 0xCDB02555653131B6ULL, -263, -60 },
+	{ 0x993FE2C6D07B7FACULL, -236, -52 },
+	{ 0xE45C10C42A2B3B06ULL, -210, -44 },
+	{ 0xAA242499697392D3ULL, -183, -36 },
+	{ 0xFD87B5F28300CA0EULL, -157, -28 },
+	{ 0xBCE5086492111AEBULL, -130, -20 },
+	{ 0x8CBCCC096F5088CCULL, -103, -12 },
+	{ 0xD1B71758E219652CULL, -77, -4 },
+	{ 0x9C40000000000000ULL, -50, 4 },
+	{ 0xE8D4A51000000000ULL, -24, 12 },
+	{ 0xAD78EBC5AC620000ULL, 3, 20 },
+	{ 0x813F3978F8940984ULL, 30, 28 },
+	{ 0xC097CE7BC90715B3ULL, 56, 36 },
+	{ 0x8F7E32CE7BEA5C70ULL, 83, 44 },
+	{ 0xD5D238A4ABE98068ULL, 109, 52 },
+	{ 0x9F4F2726179A2245ULL, 136, 60 },
+	{ 0xED63A231D4C4FB27ULL, 162, 68 },
+	{ 0xB0DE65388CC8ADA8ULL, 189, 76 },
+	{ 0x83C7088E1AAB65DBULL, 216, 84 },
+	{ 0xC45D1DF942711D9AULL, 242, 92 },
+	{ 0x924D692CA61BE758ULL, 269, 100 },
+	{ 0xDA01EE641A708DEAULL, 295, 108 },
+	{ 0xA26DA3999AEF774AULL, 322, 116 },
+	{ 0xF209787BB47D6B85ULL, 348, 124 },
+	{ 0xB454E4A179DD1877ULL, 375, 132 },
+	{ 0x865B86925B9BC5C2ULL, 402, 140 },
+	{ 0xC83553C5C8965D3DULL, 428, 148 },
+	{ 0x952AB45CFA97A0B3ULL, 455, 156 },
+	{ 0xDE469FBD99A05FE3ULL, 481, 164 },
+	{ 0xA59BC234DB398C25ULL, 508, 172 },
+	{ 0xF6C69A72A3989F5CULL, 534, 180 },
+	{ 0xB7DCBF5354E9BECEULL, 561, 188 },
+	{ 0x88FCF317F22241E2ULL, 588, 196 },
+	{ 0xCC20CE9BD35C78A5ULL, 614, 204 },
+	{ 0x98165AF37B2153DFULL, 641, 212 },
+	{ 0xE2A0B5DC971F303AULL, 667, 220 },
+	{ 0xA8D9D1535CE3B396ULL, 694, 228 },
+	{ 0xFB9B7CD9A4A7443CULL, 720, 236 },
+	{ 0xBB764C4CA7A44410ULL, 747, 244 },
+	{ 0x8BAB8EEFB6409C1AULL, 774, 252 },
+	{ 0xD01FEF10A657842CULL, 800, 260 },
+	{ 0x9B10A4E5E9913129ULL, 827, 268 },
+	{ 0xE7109BFBA19C0C9DULL, 853, 276 },
+	{ 0xAC2820D9623BF429ULL, 880, 284 },
+	{ 0x80444B5E7AA7CF85ULL, 907, 292 },
+	{ 0xBF21E44003ACDD2DULL, 933, 300 },
+	{ 0x8E679C2F5E44FF8FULL, 960, 308 },
+	{ 0xD433179D9C8CB841ULL, 986, 316 },
+	{ 0x9E19DB92B4E31BA9ULL, 1013, 324 }
+};
+
+static DiyFp diyfp_sub(DiyFp x, DiyFp y)
+{
+	DiyFp r = { x.f - y.f, x.e };
+	return r;
+}
+
+// Rounded product of two significands
+static DiyFp diyfp_mul(DiyFp x, DiyFp y)
+{
+	unsigned __int128 product = (unsigned __int128) x.f * y.f;
+	uint64_t high = (uint64_t) (product >> 64);
+	uint64_t low = (uint64_t) product;
+	DiyFp r = { high + (low >> 63), x.e + y.e + 64 };
+	return r;
+}
+
+static DiyFp diyfp_normalize(DiyFp x)
+{
+	while ((x.f >> 63) == 0)
+	{
+		x.f <<= 1;
+		x.e--;
+	}
+	return x;
+}
+
+/* Digits of the shortest decimal in the rounding interval of a positive value
+
+Grisu2 (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+with Integers"): the value and its rounding boundaries are scaled by a
+cached power of ten into a window where the digits fall out of integer
+arithmetic. The result always reads back as the same double and is the
+shortest such decimal in all but a tiny fraction of inputs, where it is one
+digit longer. Writes up to 17 digits and returns the count, with the value
+being digits * 10^exponent.
+*/
+static int grisu2(double value, char *digits, int *exponent)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	const uint64_t hidden = 1ULL << 52;
+	int biased = (int) (bits >> 52);
+	uint64_t fraction = bits & (hidden - 1);
+
+	DiyFp v = (biased == 0) ? (DiyFp) { fraction, 1 - 1075 } : (DiyFp) { fraction + hidden, biased - 1075 };
+	int lower_closer = fraction == 0 && biased > 1;
+
+	DiyFp plus = diyfp_normalize((DiyFp) { 2 * v.f + 1, v.e - 1 });
+	DiyFp minus = lower_closer ? (DiyFp) { 4 * v.f - 1, v.e - 2 } : (DiyFp) { 2 * v.f - 1, v.e - 1 };
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+	v = diyfp_normalize(v);
+
+	// Pick the power that brings the scaled exponent into [-60, -32]
+	int f = -60 - plus.e - 1;
+	int k = (f * 78913) / (1 << 18) + (f > 0);
+	CachedPower cached = cached_powers[(300 + k + 7) / 8];
+	DiyFp c = { cached.f, cached.e };
+
+	DiyFp w = diyfp_mul(v, c);
+	DiyFp w_minus = diyfp_mul(minus, c);
+	DiyFp w_plus = diyfp_mul(plus, c);
+	w_minus.f += 1;
+	w_plus.f -= 1;
+	*exponent = -cached.k;
+
+	uint64_t delta = diyfp_sub(w_plus, w_minus).f;
+	uint64_t dist = diyfp_sub(w_plus, w).f;
+	int shift = -w_plus.e;
+	uint64_t one = 1ULL << shift;
+	uint32_t p1 = (uint32_t) (w_plus.f >> shift);
+	uint64_t p2 = w_plus.f & (one - 1);
+
+	uint32_t pow10 = 1;
+	int n = 1;
+	while (n < 10 && p1 / pow10 >= 10)
+	{
+		pow10 *= 10;
+		n++;
+	}
+
+	int length = 0;
+	uint64_t rest;
+	uint64_t ten;
+
+	// Integral digits
+	for (;;)
+	{
+		digits[length++] = (char) ('0' + p1 / pow10);
+		p1 %= pow10;
+		n--;
+		rest = ((uint64_t) p1 << shift) + p2;
+		if (rest <= delta)
+		{
+			*exponent += n;
+			ten = (uint64_t) pow10 << shift;
+			goto round;
+		}
+		if (n == 0)
+			break;
+		pow10 /= 10;
+	}
+
+	// Fractional digits
+	for (;;)
+	{
+		p2 *= 10;
+		digits[length++] = (char) ('0' + (p2 >> shift));
+		p2 &= one - 1;
+		delta *= 10;
+		dist *= 10;
+		(*exponent)--;
+		if (p2 <= delta)
+			break;
+	}
+	rest = p2;
+	ten = one;
+
+round:
+	// Move the last digit towards the value while it stays in the interval
+	while (rest < dist && delta - rest >= ten
+		&& (rest + ten < dist || dist - rest > rest + ten - dist))
+	{
+		digits[length - 1]--;
+		rest += ten;
+	}
+	return length;
+}
+
+/* Write a value in the shortest form that reads back exactly
+
+Uses plain notation for decimal exponents between -5 and 16 and
+scientific notation otherwise. Returns the number of characters written.
+*/
+static int format_shortest(char *out, double value)
+{
+	char *p = out;
+	if (signbit(value))
+	{
+		*p++ = '-';
+		value = -value;
+	}
+
+	if (value == 0.0)
+	{
+		*p++ = '0';
+		return (int) (p - out);
+	}
+	if (!isfinite(value))
+	{
+		memcpy(p, isnan(value) ? "nan" : "inf", 3);
+		return (int) (p - out) + 3;
+	}
+
+	char digits[32];
+	int exponent;
+	int length = grisu2(value, digits, &exponent);
+	int point = length + exponent; // digits before the decimal point
+
+	if (exponent >= 0 && point <= 17)
+	{
+		// Integer: 123 or 1200
+		memcpy(p, digits, length);
+		p += length;
+		memset(p, '0', exponent);
+		p += exponent;
+	}
+	else if (point > 0 && point <= 17)
+	{
+		// 12.34
+		memcpy(p, digits, point);
+		p += point;
+		*p++ = '.';
+		memcpy(p, digits + point, length - point);
+		p += length - point;
+	}
+	else if (point > -5 && point <= 0)
+	{
+		// 0.001234
+		*p++ = '0';
+		*p++ = '.';
+		memset(p, '0', -point);
+		p += -point;
+		memcpy(p, digits, length);
+		p += length;
+	}
+	else
+	{
+		// 1.234e-20
+		*p++ = digits[0];
+		if (length > 1)
+		{
+			*p++ = '.';
+			memcpy(p, digits + 1, length - 1);
+			p += length - 1;
+		}
+		int scientific = point - 1;
+		*p++ = 'e';
+		*p++ = (scientific < 0) ? '-' : '+';
+		if (scientific < 0)
+			scientific = -scientific;
+		if (scientific >= 100)
+			*p++ = (char) ('0' + scientific / 100);
+		*p++ = (char) ('0' + (scientific / 10) % 10);
+		*p++ = (char) ('0' + scientific % 10);
+	}
+	return (int) (p - out);
+}
+
+/* Write a value with `precision` significant digits, or the shortest exact
+form when precision is 0
+
+Fixed precision goes through snprintf's %g, so the decimal point is put
+back to '.' whatever the locale. Returns the number of characters written.
+*/
+int format_text_double(char *out, double value, int precision)
+{
+	if (precision <= 0)
+		return format_shortest(out, value);
+
+	if (precision > 17)
+		precision = 17;
+	int length = snprintf(out, TEXT_MAX_NUMBER, "%.*g", precision, value);
+
+	char point = localeconv()->decimal_point[0];
+	if (point != '.')
+		for (int i = 0; i < length; ++i)
+			if (out[i] == point)
+				out[i] = '.';
+	return length;
+}
+
+typedef struct TextFormatTask {
+	Visibility *visibilities;
+	Complex *visIntensity;
+	int count;
+	int firstBlock;
+	int numBlocks;
+	int nextBlock;
+	char **buffers;
+	size_t *lengths;
+	double wavelengthScalar;
+	int precision;
+} TextFormatTask;
+
+static void format_block(TextFormatTask *task, int block)
+{
+	int begin = (task->firstBlock + block) * TEXT_WRITE_BLOCK_ROWS;
+	int end = begin + TEXT_WRITE_BLOCK_ROWS;
+	if (end > task->count)
+		end = task->count;
+
+	char *p = task->buffers[block];
+	for (int n = begin; n < end; ++n)
+	{
+		// u, v, w, real, imag, weight
+		p += format_text_double(p, task->visibilities[n].u / task->wavelengthScalar, task->precision);
+		*p++ = ' ';
+		p += format_text_double(p, task->visibilities[n].v / task->wavelengthScalar, task->precision);
+		*p++ = ' ';
+		p += format_text_double(p, task->visibilities[n].w / task->wavelengthScalar, task->precision);
+		*p++ = ' ';
+		p += format_text_double(p, task->visIntensity[n].real, task->precision);
+		*p++ = ' ';
+		p += format_text_double(p, task->visIntensity[n].imaginary, task->precision);
+		*p++ = ' ';
+		*p++ = '1';
+		*p++ = '\n';
+	}
+	task->lengths[block] = p - task->buffers[block];
+}
+
+static void* format_worker(void *arg)
+{
+	TextFormatTask *task = (TextFormatTask*) arg;
+	for (;;)
+	{
+		int block = __atomic_fetch_add(&task->nextBlock, 1, __ATOMIC_RELAXED);
+		if (block >= task->numBlocks)
+			break;
+		format_block(task, block);
+	}
+	return NULL;
+}
+
+/* Write visibility rows as text, formatting them in parallel
+
+Rows are formatted in blocks of TEXT_WRITE_BLOCK_ROWS into per-block
+buffers, a group of blocks at a time, and each group is written in file
+order with one fwrite per block. Returns 0 if a write failed.
+*/
+int write_visibility_text(Config *config, FILE *file, Visibility *visibilities, Complex *visIntensity,
+	int count)
+{
+	if (count <= 0)
+		return 1;
+
+	int numThreads = (config->num_threads > 0) ? config->num_threads : cpu_default_thread_count();
+	int totalBlocks = (count + TEXT_WRITE_BLOCK_ROWS - 1) / TEXT_WRITE_BLOCK_ROWS;
+	int groupBlocks = numThreads * TEXT_CHUNKS_PER_THREAD;
+	if (groupBlocks > totalBlocks)
+		groupBlocks = totalBlocks;
+	if (numThreads > groupBlocks)
+		numThreads = groupBlocks;
+
+	TextFormatTask task;
+	task.visibilities = visibilities;
+	task.visIntensity = visIntensity;
+	task.count = count;
+	task.wavelengthScalar = config->frequency_hz / C;
+	task.precision = config->output_precision;
+	task.buffers = (char**) calloc(groupBlocks, sizeof(char*));
+	task.lengths = (size_t*) calloc(groupBlocks, sizeof(size_t));
+
+	int ok = task.buffers != NULL && task.lengths != NULL;
+	for (int b = 0; ok && b < groupBlocks; ++b)
+	{
+		task.buffers[b] = (char*) malloc(TEXT_WRITE_BLOCK_ROWS * TEXT_MAX_ROW);
+		ok = task.buffers[b] != NULL;
+	}
+
+	for (int first = 0; ok && first < totalBlocks; first += groupBlocks)
+	{
+		task.firstBlock = first;
+		task.numBlocks = (totalBlocks - first < groupBlocks) ? totalBlocks - first : groupBlocks;
+		task.nextBlock = 0;
+
+		// The calling thread is always one of the workers
+		pthread_t *threads = NULL;
+		int spawned = 0;
+		if (numThreads > 1)
+		{
+			threads = (pthread_t*) malloc((numThreads - 1) * sizeof(pthread_t));
+			for (int t = 0; threads != NULL && t < numThreads - 1; ++t)
+				if (pthread_create(&threads[spawned], NULL, format_worker, &task) == 0)
+					spawned++;
+		}
+
+		format_worker(&task);
+
+		for (int t = 0; t < spawned; ++t)
+			pthread_join(threads[t], NULL);
+		free(threads);
+
+		for (int b = 0; ok && b < task.numBlocks; ++b)
+			ok = fwrite(task.buffers[b], 1, task.lengths[b], file) == task.lengths[b];
+	}
+
+	for (int b = 0; task.buffers != NULL && b < groupBlocks; ++b)
+		free(task.buffers[b]);
+	free(task.buffers);
+	free(task.lengths);
+	return ok;
+}
+
+//=========================//
+//   Background Writer     //
+//=========================//
+
+static void* text_writer_thread(void *arg)
+{
+	TextWriter *writer = (TextWriter*) arg;
+
+	pthread_mutex_lock(&writer->lock);
+	for (;;)
+	{
+		while (!writer->pending && !writer->stopping)
+			pthread_cond_wait(&writer->changed, &writer->lock);
+		if (!writer->pending)
+			break;
+		pthread_mutex_unlock(&writer->lock);
+
+		int ok = write_visibility_text(writer->config, writer->file, writer->visibilities,
+			writer->visIntensity, writer->count);
+
+		pthread_mutex_lock(&writer->lock);
+		writer->failed |= !ok;
+		writer->pending = 0;
+		pthread_cond_broadcast(&writer->changed);
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return NULL;
+}
+
+/* Prepare a writer appending visibility rows to `file`
+
+With `background` set the rows are formatted and written on a separate
+thread, so that the caller can compute the next chunk meanwhile; if the
+thread cannot be started the writer quietly works synchronously.
+*/
+void text_writer_start(TextWriter *writer, Config *config, FILE *file, int background)
+{
+	memset(writer, 0, sizeof(TextWriter));
+	writer->config = config;
+	writer->file = file;
+
+	if (background)
+	{
+		pthread_mutex_init(&writer->lock, NULL);
+		pthread_cond_init(&writer->changed, NULL);
+		writer->threaded = pthread_create(&writer->thread, NULL, text_writer_thread, writer) == 0;
+		if (!writer->threaded)
+		{
+			pthread_mutex_destroy(&writer->lock);
+			pthread_cond_destroy(&writer->changed);
+		}
+	}
+}
+
+/* Queue rows for writing
+
+The rows are copied, so the caller may reuse its arrays as soon as this
+returns. Waits for the previously queued rows to be written first. Returns
+a DFT_Status, DFT_ERROR_IO once any write has failed.
+*/
+int text_writer_submit(TextWriter *writer, Visibility *visibilities, Complex *visIntensity, int count)
+{
+	if (!writer->threaded)
+	{
+		writer->failed |= !write_visibility_text(writer->config, writer->file, visibilities,
+			visIntensity, count);
+		return writer->failed ? DFT_ERROR_IO : DFT_SUCCESS;
+	}
+
+	pthread_mutex_lock(&writer->lock);
+	while (writer->pending)
+		pthread_cond_wait(&writer->changed, &writer->lock);
+
+	if ((size_t) count > writer->capacity)
+	{
+		free(writer->visibilities);
+		free(writer->visIntensity);
+		writer->visibilities = (Visibility*) malloc(count * sizeof(Visibility));
+		writer->visIntensity = (Complex*) malloc(count * sizeof(Complex));
+		writer->capacity = count;
+		if (writer->visibilities == NULL || writer->visIntensity == NULL)
+		{
+			perror("Couldn't allocate the output buffers");
+			free(writer->visibilities);
+			free(writer->visIntensity);
+			writer->visibilities = NULL;
+			writer->visIntensity = NULL;
+			writer->capacity = 0;
+			writer->failed = 1;
+			pthread_mutex_unlock(&writer->lock);
+			return DFT_ERROR_OUT_OF_MEMORY;
+		}
+	}
+	memcpy(writer->visibilities, visibilities, count * sizeof(Visibility));
+	memcpy(writer->visIntensity, visIntensity, count * sizeof(Complex));
+	writer->count = count;
+	writer->pending = 1;
+	int failed = writer->failed;
+	pthread_cond_broadcast(&writer->changed);
+	pthread_mutex_unlock(&writer->lock);
+	return failed ? DFT_ERROR_IO : DFT_SUCCESS;
+}
+
+/* Wait for every queued row to be written and release the writer
+
+Returns 0 if any write failed.
+*/
+int text_writer_finish(TextWriter *writer)
+{
+	if (writer->threaded)
+	{
+		pthread_mutex_lock(&writer->lock);
+		writer->stopping = 1;
+		pthread_cond_broadcast(&writer->changed);
+		pthread_mutex_unlock(&writer->lock);
+
+		pthread_join(writer->thread, NULL);
+		pthread_mutex_destroy(&writer->lock);
+		pthread_cond_destroy(&writer->changed);
+		writer->threaded = 0;
+	}
+
+	free(writer->visibilities);
+	free(writer->visIntensity);
+	writer->visibilities = NULL;
+	writer->visIntensity = NULL;
+	writer->capacity = 0;
+	return !writer->failed;
+}
@@ -0,0 +1,117 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DFT_TEXT_IO_H_
+#define DFT_TEXT_IO_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "direct_fourier_transform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+// Smallest share of a file given to one parsing thread; smaller files are
+// parsed by the calling thread alone
+#define TEXT_MIN_CHUNK_BYTES (256 * 1024)
+
+// Chunks per thread, so that threads finishing early can claim more work
+#define TEXT_CHUNKS_PER_THREAD 4
+
+// Most values on one row of any supported file
+#define TEXT_MAX_FIELDS 8
+
+// Longest number written by format_text_double, and longest output row
+#define TEXT_MAX_NUMBER 32
+#define TEXT_MAX_ROW (6 * TEXT_MAX_NUMBER)
+
+// Visibility rows formatted per output buffer
+#define TEXT_WRITE_BLOCK_ROWS 4096
+
+//=========================//
+//        Structures       //
+//=========================//
+
+// A mapped text input: a leading row count followed by one row per line
+typedef struct TextFile {
+	const char *path;
+	char *data;
+	size_t length;
+	size_t bodyOffset; // first byte after the count line
+	int bodyLine;      // 1 based line number at bodyOffset
+	int count;
+	int errorLine;     // first malformed line found by parse_text_rows, 0 when none
+} TextFile;
+
+// Appends visibility rows to a text file, optionally from a background thread
+typedef struct TextWriter {
+	Config *config;
+	FILE *file;
+	int threaded;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	Visibility *visibilities; // private copy of the queued rows
+	Complex *visIntensity;
+	size_t capacity;
+	int count;
+	int pending;
+	int stopping;
+	int failed;
+} TextWriter;
+
+// Receives the parsed values of data row `row` (0 based)
+typedef void (*TextRowStore)(void *context, int row, const double *values);
+
+//=========================//
+//     Function Headers    //
+//=========================//
+
+int open_text_file(const char *path, TextFile *file);
+int parse_text_rows(TextFile *file, int fields, TextRowStore store, void *context,
+	int numThreads, const char *description);
+void close_text_file(TextFile *file);
+int parse_text_double(const char **cursor, const char *end, double *value);
+int format_text_double(char *out, double value, int precision);
+int write_visibility_text(Config *config, FILE *file, Visibility *visibilities, Complex *visIntensity,
+	int count);
+void text_writer_start(TextWriter *writer, Config *config, FILE *file, int background);
+int text_writer_submit(TextWriter *writer, Visibility *visibilities, Complex *visIntensity, int count);
+int text_writer_finish(TextWriter *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFT_TEXT_IO_H_ */
@@ -0,0 +1,370 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "dft_trace.h"
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+// Distinct stage names totalled in the summary
+#define TRACE_MAX_STAGES 64
+
+//=========================//
+//        Structures       //
+//=========================//
+
+typedef struct TraceEvent {
+	const char *name;
+	const char *category;
+	int track;
+	double start; // seconds since trace_start
+	double duration;
+} TraceEvent;
+
+// A device event waiting for trace_sync
+typedef struct PendingEvent {
+	const char *name;
+	const char *category;
+	int track;
+	cl_event event;
+	int ready; // completed, as of the current trace_sync
+} PendingEvent;
+
+typedef struct Trace {
+	int enabled;
+	const char *path;
+	double origin;
+	pthread_mutex_t lock;
+	TraceEvent *events;
+	int count;
+	int capacity;
+	PendingEvent *pending;
+	int pendingCount;
+	int pendingCapacity;
+	int maxTrack;
+} Trace;
+
+static Trace trace = { 0, NULL, 0.0, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, NULL, 0, 0, 0 };
+
+// First track of the calling thread's rows
+static __thread int trace_base = 0;
+
+//=========================//
+//        Functions        //
+//=========================//
+
+double trace_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void trace_start(const char *path)
+{
+	pthread_mutex_lock(&trace.lock);
+	trace.enabled = 1;
+	trace.path = path;
+	trace.origin = trace_now();
+	trace.count = 0;
+	trace.pendingCount = 0;
+	trace.maxTrack = 0;
+	pthread_mutex_unlock(&trace.lock);
+}
+
+int trace_enabled(void)
+{
+	return trace.enabled;
+}
+
+void trace_set_thread_tracks(int base)
+{
+	trace_base = base;
+}
+
+// Expects trace.lock to be held
+static void record_event(const char *name, const char *category, int track, double start, double duration)
+{
+	if (trace.count == trace.capacity)
+	{
+		int capacity = (trace.capacity > 0) ? 2 * trace.capacity : 1024;
+		TraceEvent *events = (TraceEvent*) realloc(trace.events, capacity * sizeof(TraceEvent));
+		if (events == NULL)
+			return;
+		trace.events = events;
+		trace.capacity = capacity;
+	}
+
+	trace.events[trace.count++] = (TraceEvent) { name, category, track, start, duration };
+	if (track > trace.maxTrack)
+		trace.maxTrack = track;
+}
+
+void trace_host(const char *name, const char *category, double start)
+{
+	if (!trace.enabled)
+		return;
+
+	double end = trace_now();
+	pthread_mutex_lock(&trace.lock);
+	record_event(name, category, trace_base + TRACE_TRACK_HOST, start - trace.origin, end - start);
+	pthread_mutex_unlock(&trace.lock);
+}
+
+void trace_device(const char *name, const char *category, cl_event event, int track)
+{
+	if (!trace.enabled || event == NULL)
+		return;
+
+	pthread_mutex_lock(&trace.lock);
+	if (trace.pendingCount == trace.pendingCapacity)
+	{
+		int capacity = (trace.pendingCapacity > 0) ? 2 * trace.pendingCapacity : 64;
+		PendingEvent *pending = (PendingEvent*) realloc(trace.pending, capacity * sizeof(PendingEvent));
+		if (pending == NULL)
+		{
+			pthread_mutex_unlock(&trace.lock);
+			return;
+		}
+		trace.pending = pending;
+		trace.pendingCapacity = capacity;
+	}
+
+	clRetainEvent(event);
+	trace.pending[trace.pendingCount++] = (PendingEvent) { name, category, trace_base + track, event, 0 };
+	pthread_mutex_unlock(&trace.lock);
+}
+
+// Whether a held event belongs to the calling thread and has completed
+static int ready_to_sync(PendingEvent *pending)
+{
+	if (pending->track - pending->track % TRACE_TRACKS_PER_THREAD != trace_base)
+		return 0;
+
+	cl_int status = -1;
+	clGetEventInfo(pending->event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+	return status == CL_COMPLETE;
+}
+
+/* Place the calling thread's completed device events on the host timeline
+
+OpenCL 1.x offers no mapping from device to host time, so the latest
+event end is taken to be now; callers sync right after waiting on their
+last event. Events are therefore drawn early by however long the host
+took to notice, but their spacing is exact. Events still in flight, and
+other threads' events, are kept for a later sync, as each thread drives
+a different device with its own clock.
+*/
+void trace_sync(void)
+{
+	if (!trace.enabled)
+		return;
+
+	double now = trace_now();
+	pthread_mutex_lock(&trace.lock);
+
+	cl_ulong latest = 0;
+	for (int e = 0; e < trace.pendingCount; ++e)
+	{
+		cl_ulong end = 0;
+		trace.pending[e].ready = ready_to_sync(&trace.pending[e]);
+		if (!trace.pending[e].ready)
+			continue;
+		clGetEventProfilingInfo(trace.pending[e].event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+		if (end > latest)
+			latest = end;
+	}
+
+	int kept = 0;
+	for (int e = 0; e < trace.pendingCount; ++e)
+	{
+		PendingEvent *pending = &trace.pending[e];
+		if (!pending->ready)
+		{
+			trace.pending[kept++] = *pending;
+			continue;
+		}
+
+		cl_ulong start = 0, end = 0;
+		clGetEventProfilingInfo(pending->event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+		clGetEventProfilingInfo(pending->event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+		if (end >= start && latest > 0)
+			record_event(pending->name, pending->category, pending->track,
+				now - trace.origin - (latest - start) * 1e-9, (end - start) * 1e-9);
+		clReleaseEvent(pending->event);
+	}
+	trace.pendingCount = kept;
+
+	pthread_mutex_unlock(&trace.lock);
+}
+
+static void track_name(int track, char *name, size_t size)
+{
+	static const char *rows[TRACE_TRACKS_PER_THREAD] = { "host", "compute queue", "upload queue", "readback queue" };
+	int thread = track / TRACE_TRACKS_PER_THREAD;
+	if (thread == 0)
+		snprintf(name, size, "%s", rows[track % TRACE_TRACKS_PER_THREAD]);
+	else
+		snprintf(name, size, "worker %d %s", thread - 1, rows[track % TRACE_TRACKS_PER_THREAD]);
+}
+
+// Chrome trace-event format, viewable in chrome://tracing or Perfetto
+static int write_trace_file(const char *path)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+		return 0;
+
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	for (int track = 0; track <= trace.maxTrack; ++track)
+	{
+		char name[64];
+		track_name(track, name, sizeof(name));
+		fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+			"\"args\": {\"name\": \"%s\"}},\n", track, name);
+		fprintf(file, "{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+			"\"args\": {\"sort_index\": %d}},\n", track, track);
+	}
+	for (int e = 0; e < trace.count; ++e)
+		fprintf(file, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+			"\"ts\": %.3f, \"dur\": %.3f}%s\n", trace.events[e].name, trace.events[e].category,
+			trace.events[e].track, trace.events[e].start * 1e6, trace.events[e].duration * 1e6,
+			(e + 1 < trace.count) ? "," : "");
+	fprintf(file, "]}\n");
+
+	return fclose(file) == 0;
+}
+
+/* Total the stages by name and by category
+
+Shares are of the span from the first stage to the last, so overlapping
+stages (streaming, multiple devices) can add up to more than 100%.
+*/
+static void print_summary(void)
+{
+	const char *names[TRACE_MAX_STAGES];
+	const char *categories[TRACE_MAX_STAGES];
+	double totals[TRACE_MAX_STAGES];
+	int counts[TRACE_MAX_STAGES];
+	int stages = 0;
+	double first = 0.0, last = 0.0;
+
+	for (int e = 0; e < trace.count; ++e)
+	{
+		TraceEvent *event = &trace.events[e];
+		if (e == 0 || event->start < first)
+			first = event->start;
+		if (e == 0 || event->start + event->duration > last)
+			last = event->start + event->duration;
+
+		int s = 0;
+		while (s < stages && strcmp(names[s], event->name) != 0)
+			s++;
+		if (s == stages)
+		{
+			if (stages == TRACE_MAX_STAGES)
+				continue;
+			names[s] = event->name;
+			categories[s] = event->category;
+			totals[s] = 0.0;
+			counts[s] = 0;
+			stages++;
+		}
+		totals[s] += event->duration;
+		counts[s]++;
+	}
+
+	double span = last - first;
+	if (stages == 0 || span <= 0.0)
+		return;
+
+	printf(">>> INFO: %-28s %-10s %8s %12s %8s\n", "Stage", "Category", "Count", "Total (ms)", "Share");
+	for (int s = 0; s < stages; ++s)
+		printf(">>> INFO: %-28s %-10s %8d %12.3f %7.1f%%\n", names[s], categories[s], counts[s],
+			totals[s] * 1e3, 100.0 * totals[s] / span);
+
+	static const char *groups[] = { TRACE_IO, TRACE_HOST, TRACE_TRANSFER, TRACE_COMPUTE };
+	const char *bound = NULL;
+	double most = 0.0;
+	for (int g = 0; g < 4; ++g)
+	{
+		double total = 0.0;
+		for (int s = 0; s < stages; ++s)
+			if (strcmp(categories[s], groups[g]) == 0)
+				total += totals[s];
+		printf(">>> INFO: %-28s %-10s %8s %12.3f %7.1f%%\n", "total", groups[g], "", total * 1e3, 100.0 * total / span);
+		if (total > most)
+		{
+			most = total;
+			bound = groups[g];
+		}
+	}
+	printf(">>> INFO: %-28s %-10s %8s %12.3f\n\n", "wall", "", "", span * 1e3);
+
+	if (bound != NULL)
+		printf(">>> INFO: Run is %s bound...\n\n", bound);
+}
+
+void trace_finish(void)
+{
+	if (!trace.enabled)
+		return;
+
+	trace_sync();
+	pthread_mutex_lock(&trace.lock);
+	trace.enabled = 0;
+
+	// Events of threads which never synced cannot be placed
+	for (int e = 0; e < trace.pendingCount; ++e)
+		clReleaseEvent(trace.pending[e].event);
+	trace.pendingCount = 0;
+
+	print_summary();
+	if (trace.path != NULL)
+	{
+		if (write_trace_file(trace.path))
+			printf(">>> INFO: Wrote %d trace events to %s...\n\n", trace.count, trace.path);
+		else
+			printf(">>> ERROR: Unable to write trace to %s...\n\n", trace.path);
+	}
+
+	free(trace.events);
+	free(trace.pending);
+	trace.events = NULL;
+	trace.pending = NULL;
+	trace.count = trace.capacity = 0;
+	trace.pendingCapacity = 0;
+	pthread_mutex_unlock(&trace.lock);
+}
@@ -0,0 +1,87 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DFT_TRACE_H_
+#define DFT_TRACE_H_
+
+#include "direct_fourier_transform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+// Trace rows of a thread: its host stages, then the engine's compute,
+// upload and readback queues
+#define TRACE_TRACK_HOST     0
+#define TRACE_TRACK_QUEUE    1
+#define TRACE_TRACK_UPLOAD   2
+#define TRACE_TRACK_READBACK 3
+#define TRACE_TRACKS_PER_THREAD 4
+
+// Stage categories, which the summary totals to tell I/O, transfer and
+// compute bound runs apart
+#define TRACE_IO       "io"
+#define TRACE_HOST     "host"
+#define TRACE_TRANSFER "transfer"
+#define TRACE_COMPUTE  "compute"
+
+//=========================//
+//     Function Headers    //
+//=========================//
+
+// Starts recording; every other call is a no-op until then
+void trace_start(const char *path);
+int trace_enabled(void);
+
+// Host time in seconds, to pass as the start of trace_host
+double trace_now(void);
+
+// Rows of the calling thread begin at `base` (see TRACE_TRACKS_PER_THREAD)
+void trace_set_thread_tracks(int base);
+
+// Records a host stage which began at `start` and ends now
+void trace_host(const char *name, const char *category, double start);
+
+// Holds a profiled OpenCL event until a trace_sync after it has completed
+void trace_device(const char *name, const char *category, cl_event event, int track);
+
+// Converts the calling thread's completed events to host time
+void trace_sync(void);
+
+// Writes the Chrome trace-event file, prints the summary table and stops recording
+void trace_finish(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFT_TRACE_H_ */
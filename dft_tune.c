@@ -0,0 +1,433 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dft_tune.h"
+#include "dft_kernel_cache.h"
+#include "dft_trace.h"
+
+// Most devices tuned in one run
+#define TUNE_MAX_DEVICES 16
+
+// Fields a profile file must hold to be applied
+#define TUNE_FIELD_PRECISION  0x1
+#define TUNE_FIELD_VARIANT    0x2
+#define TUNE_FIELD_WORK_GROUP 0x4
+#define TUNE_FIELD_SPLIT      0x8
+#define TUNE_FIELDS_REQUIRED  0xf
+
+static const int tune_work_groups[TUNE_MAX_WORK_GROUPS] = { 32, 64, 128, 256, 512, 1024 };
+
+//=========================//
+//     Profile files       //
+//=========================//
+
+void tune_profile_path(char *path, size_t size, const char *profile_dir, cl_device_id dev, int precision)
+{
+	// The kernel cache key over the profile tag alone identifies the
+	// platform, device and driver; the precision is passed as the options
+	char options[32];
+	snprintf(options, sizeof(options), "precision=%d", precision);
+	unsigned long long key = kernel_cache_key(dev, TUNE_PROFILE_MAGIC, strlen(TUNE_PROFILE_MAGIC), options);
+	snprintf(path, size, "%s/%016llx.txt", profile_dir, key);
+}
+
+int tune_profile_read(const char *path, TuneProfile *profile)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return 0;
+
+	memset(profile, 0, sizeof(TuneProfile));
+	char line[512];
+	int found = 0;
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		char name[32];
+		int offset = 0;
+		if (line[0] == '#' || sscanf(line, "%31s %n", name, &offset) != 1)
+			continue;
+		const char *value = line + offset;
+
+		if (strcmp(name, "device") == 0)
+		{
+			snprintf(profile->device, sizeof(profile->device), "%s", value);
+			profile->device[strcspn(profile->device, "\r\n")] = '\0';
+		}
+		else if (strcmp(name, "precision") == 0 && sscanf(value, "%d", &profile->precision) == 1)
+			found |= TUNE_FIELD_PRECISION;
+		else if (strcmp(name, "kernel_variant") == 0 && sscanf(value, "%d", &profile->kernelVariant) == 1)
+			found |= TUNE_FIELD_VARIANT;
+		else if (strcmp(name, "work_group_size") == 0 && sscanf(value, "%d", &profile->workGroupSize) == 1
+			&& profile->workGroupSize > 0)
+			found |= TUNE_FIELD_WORK_GROUP;
+		else if (strcmp(name, "source_split") == 0 && sscanf(value, "%d", &profile->sourceSplit) == 1)
+			found |= TUNE_FIELD_SPLIT;
+		else if (strcmp(name, "seconds") == 0)
+			sscanf(value, "%lf", &profile->seconds);
+		else if (strcmp(name, "error") == 0)
+			sscanf(value, "%lf", &profile->error);
+	}
+	fclose(file);
+
+	return found == TUNE_FIELDS_REQUIRED
+		&& (profile->kernelVariant == DFT_KERNEL_BASIC || profile->kernelVariant == DFT_KERNEL_TILED);
+}
+
+/* Write a profile through a temporary file renamed into place, so that a
+concurrent run never applies a partially written profile */
+int tune_profile_write(const char *path, const TuneProfile *profile)
+{
+	char temporary[4200];
+	snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", path, (long) getpid());
+
+	FILE *file = fopen(temporary, "w");
+	if (file == NULL)
+		return 0;
+
+	fprintf(file, "# %s launch parameters written by dft --tune\n", TUNE_PROFILE_MAGIC);
+	fprintf(file, "device %s\n", profile->device);
+	fprintf(file, "precision %d\n", profile->precision);
+	fprintf(file, "kernel_variant %d\n", profile->kernelVariant);
+	fprintf(file, "work_group_size %d\n", profile->workGroupSize);
+	fprintf(file, "source_split %d\n", profile->sourceSplit);
+	fprintf(file, "seconds %.9g\n", profile->seconds);
+	fprintf(file, "error %.9g\n", profile->error);
+
+	int written = !ferror(file);
+	if (fclose(file) != 0)
+		written = 0;
+	if (written && rename(temporary, path) == 0)
+		return 1;
+	remove(temporary);
+	return 0;
+}
+
+int tune_profile_load(const char *profile_dir, cl_device_id dev, int precision, TuneProfile *profile)
+{
+	char path[4096];
+	tune_profile_path(path, sizeof(path), profile_dir, dev, precision);
+	return tune_profile_read(path, profile) && profile->precision == precision;
+}
+
+//=========================//
+//         Search          //
+//=========================//
+
+// Largest difference from the reference, relative to the summed flux
+static double relative_error(Complex *predicted, Complex *reference, int count, double flux)
+{
+	double largest = 0.0;
+	for (int i = 0; i < count; ++i)
+	{
+		double difference = hypot(predicted[i].real - reference[i].real,
+			predicted[i].imaginary - reference[i].imaginary);
+		if (difference > largest)
+			largest = difference;
+	}
+	return (flux > 0.0) ? largest / flux : largest;
+}
+
+/* Time one set of launch parameters on a device
+
+The engine is created for the candidate, as a normal run would be, so
+that the tiled kernels are compiled for its work-group size. A first
+untimed call absorbs buffer allocation and the sky model upload, and the
+fastest of the timed calls is kept. Only the first `count` visibilities
+are predicted. The work-group size is replaced by the one the engine
+settled on within the device's limits.
+*/
+static int measure_candidate(Config *config, cl_device_id device, Source *sources, Visibility *visibilities,
+	int count, Complex *reference, Complex *predicted, double flux, TuneProfile *candidate)
+{
+	Config trial = *config;
+	trial.kernel_variant = candidate->kernelVariant;
+	trial.work_group_size = candidate->workGroupSize;
+	trial.source_split = candidate->sourceSplit;
+
+	DFT_Engine *engine = NULL;
+	int status = create_device_engine(&trial, device, &engine);
+	if (status != DFT_SUCCESS)
+		return status;
+	candidate->workGroupSize = (int) engine->tileSize;
+	candidate->precision = engine->precision;
+	snprintf(candidate->device, sizeof(candidate->device), "%s", engine->deviceName);
+
+	for (int r = 0; r <= TUNE_REPEATS && status == DFT_SUCCESS; ++r)
+	{
+		memset(predicted, 0, count * sizeof(Complex));
+		double started = trace_now();
+		status = extract_visibilities(engine, &trial, sources, visibilities, predicted, count);
+		double elapsed = trace_now() - started;
+		if (r == 1 || (r > 1 && elapsed < candidate->seconds))
+			candidate->seconds = elapsed;
+	}
+	destroy_dft_engine(engine);
+
+	candidate->error = relative_error(predicted, reference, count, flux);
+	return status;
+}
+
+// Whether a candidate's parameters, as settled by the engine, were measured already
+static int already_measured(TuneProfile *measured, int count, TuneProfile *candidate)
+{
+	for (int c = 0; c < count; ++c)
+		if (measured[c].kernelVariant == candidate->kernelVariant
+			&& measured[c].workGroupSize == candidate->workGroupSize
+			&& measured[c].sourceSplit == candidate->sourceSplit)
+			return 1;
+	return 0;
+}
+
+/* Search the launch parameters of one device
+
+The configured parameters are measured first and set the error every
+other candidate is held to. Then both kernel variants are tried at every
+work-group size the device allows, with the configured source split. The
+basic kernel only uses the work-group size when it splits, so with the
+split disabled it is measured once.
+
+The full workload has too many visibilities for the engine to split on
+most devices, so for fp64 the winner is then timed again on
+TUNE_SPLIT_VISIBILITIES_PER_UNIT visibilities per compute unit, with the
+source split chosen automatically and disabled. The split is only
+disabled when that is faster where it actually fires.
+*/
+static int tune_device(Config *config, cl_device_id device, Source *sources, Visibility *visibilities,
+	Complex *reference, Complex *predicted, double flux, int enable_messages, TuneProfile *best)
+{
+	size_t max_work_group = 0;
+	cl_uint compute_units = 0;
+	clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &max_work_group, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &compute_units, NULL);
+
+	TuneProfile measured[1 + 2 * TUNE_MAX_WORK_GROUPS];
+	int num_measured = 0;
+	double limit = 0.0;
+	int status = DFT_ERROR_DEVICE;
+
+	for (int c = -1; c < 2 * TUNE_MAX_WORK_GROUPS; ++c)
+	{
+		TuneProfile candidate;
+		memset(&candidate, 0, sizeof(candidate));
+		candidate.sourceSplit = config->source_split;
+		if (c < 0)
+		{
+			candidate.kernelVariant = config->kernel_variant;
+			candidate.workGroupSize = config->work_group_size;
+		}
+		else
+		{
+			candidate.kernelVariant = (c / TUNE_MAX_WORK_GROUPS == 0) ? DFT_KERNEL_BASIC : DFT_KERNEL_TILED;
+			candidate.workGroupSize = tune_work_groups[c % TUNE_MAX_WORK_GROUPS];
+			if (max_work_group > 0 && (size_t) candidate.workGroupSize > max_work_group)
+				continue;
+			if (candidate.kernelVariant == DFT_KERNEL_BASIC && candidate.sourceSplit < 0
+				&& candidate.workGroupSize != config->work_group_size)
+				continue;
+		}
+		if (already_measured(measured, num_measured, &candidate))
+			continue;
+
+		int measuredStatus = measure_candidate(config, device, sources, visibilities, TUNE_VISIBILITIES,
+			reference, predicted, flux, &candidate);
+		if (measuredStatus != DFT_SUCCESS)
+		{
+			if (c < 0)
+				status = measuredStatus;
+			continue;
+		}
+
+		// The first candidate to run sets the error bound
+		if (num_measured == 0)
+		{
+			limit = fmax(TUNE_ERROR_FACTOR * candidate.error, TUNE_ERROR_FLOOR);
+			*best = candidate;
+			status = DFT_SUCCESS;
+		}
+		int accurate = candidate.error <= limit;
+		if (accurate && candidate.seconds < best->seconds)
+			*best = candidate;
+		measured[num_measured++] = candidate;
+
+		if(enable_messages)
+			printf(">>> INFO: %-6s work-group %4d split %-5s %12.6f s  error %.3e%s\n",
+				(candidate.kernelVariant == DFT_KERNEL_BASIC) ? "basic" : "tiled", candidate.workGroupSize,
+				(candidate.sourceSplit < 0) ? "never" : (candidate.sourceSplit > 0) ? "always" : "auto",
+				candidate.seconds, candidate.error, accurate ? "" : "  (rejected)");
+	}
+
+	if (num_measured == 0 || config->precision_mode != DFT_PRECISION_DOUBLE)
+		return (num_measured > 0) ? DFT_SUCCESS : status;
+
+	// Automatic first, so that an equally fast launch keeps the split enabled
+	long split_count = (long) ((compute_units > 0) ? compute_units : 1) * TUNE_SPLIT_VISIBILITIES_PER_UNIT;
+	int count = (split_count < TUNE_VISIBILITIES) ? (int) split_count : TUNE_VISIBILITIES;
+	const int splits[2] = { 0, -1 };
+	double auto_seconds = -1.0;
+	for (int k = 0; k < 2; ++k)
+	{
+		TuneProfile candidate = *best;
+		candidate.sourceSplit = splits[k];
+		if (measure_candidate(config, device, sources, visibilities, count, reference, predicted, flux,
+			&candidate) != DFT_SUCCESS)
+			break;
+
+		int accurate = candidate.error <= limit;
+		if(enable_messages)
+			printf(">>> INFO: %-6s work-group %4d split %-5s %12.6f s  error %.3e on %d visibilities%s\n",
+				(candidate.kernelVariant == DFT_KERNEL_BASIC) ? "basic" : "tiled", candidate.workGroupSize,
+				(candidate.sourceSplit < 0) ? "never" : "auto", candidate.seconds, candidate.error, count,
+				accurate ? "" : "  (rejected)");
+		if (!accurate)
+			continue;
+		if (k == 0)
+		{
+			auto_seconds = candidate.seconds;
+			best->sourceSplit = 0;
+		}
+		else if (auto_seconds < 0.0 || candidate.seconds < auto_seconds)
+			best->sourceSplit = -1;
+	}
+
+	return DFT_SUCCESS;
+}
+
+/* Tune every device of the configured backend
+
+Every device is timed on the same synthetic sky and visibilities, drawn
+like the synthetic inputs of loadSources and loadVisibilities, and checked
+against a prediction by the native CPU backend. Candidates run exact and
+silent, without any existing profile.
+*/
+int autotune_devices(Config *config)
+{
+	if (config->tune_profile_dir == NULL || config->tune_profile_dir[0] == '\0')
+	{
+		printf(">>> ERROR: No tuning profile directory is configured...\n\n");
+		return DFT_ERROR_INVALID_ARGUMENT;
+	}
+
+	cl_device_id devices[TUNE_MAX_DEVICES];
+	int num_devices = find_backend_devices(config, devices, TUNE_MAX_DEVICES);
+	if (num_devices == 0)
+	{
+		printf(">>> ERROR: No OpenCL device to tune...\n\n");
+		return DFT_ERROR_NO_DEVICE;
+	}
+
+	Config tuning = *config;
+	tuning.numSources = TUNE_SOURCES;
+	tuning.numVisibilities = TUNE_VISIBILITIES;
+	tuning.enable_messages = 0;
+	tuning.trace_file = NULL;
+	tuning.prediction_mode = DFT_PREDICT_EXACT;
+	tuning.grid_cross_check = 0;
+	tuning.tune_profile_dir = NULL;
+
+	Source *sources = (Source*) calloc(TUNE_SOURCES, sizeof(Source));
+	Visibility *visibilities = (Visibility*) calloc(TUNE_VISIBILITIES, sizeof(Visibility));
+	Complex *reference = (Complex*) calloc(TUNE_VISIBILITIES, sizeof(Complex));
+	Complex *predicted = (Complex*) calloc(TUNE_VISIBILITIES, sizeof(Complex));
+	if (sources == NULL || visibilities == NULL || reference == NULL || predicted == NULL)
+	{
+		printf(">>> ERROR: Tuning memory was unable to be allocated...\n\n");
+		free(sources);
+		free(visibilities);
+		free(reference);
+		free(predicted);
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+
+	double flux = 0.0;
+	for (int s = 0; s < TUNE_SOURCES; ++s)
+	{
+		sources[s] = (Source) {
+			.l = randomInRange(config->min_u, config->max_u) * config->cell_size,
+			.m = randomInRange(config->min_v, config->max_v) * config->cell_size,
+			.intensity = 1.0
+		};
+		flux += sources[s].intensity;
+	}
+	for (int i = 0; i < TUNE_VISIBILITIES; ++i)
+	{
+		double w = randomInRange(config->min_v / 10.0, config->max_v / 10.0);
+		visibilities[i] = (Visibility) {
+			.u = randomInRange(config->min_u, config->max_u) / config->uv_scale,
+			.v = randomInRange(config->min_v, config->max_v) / config->uv_scale,
+			.w = (config->force_zero_w_term) ? 0.0 : w / config->uv_scale
+		};
+	}
+
+	DFT_Engine *cpu = NULL;
+	int status = create_device_engine(&tuning, NULL, &cpu);
+	if (status == DFT_SUCCESS)
+		status = extract_visibilities(cpu, &tuning, sources, visibilities, reference, TUNE_VISIBILITIES);
+	destroy_dft_engine(cpu);
+
+	mkdir(config->tune_profile_dir, 0755);
+	for (int d = 0; d < num_devices && status == DFT_SUCCESS; ++d)
+	{
+		char name[256] = { 0 };
+		clGetDeviceInfo(devices[d], CL_DEVICE_NAME, sizeof(name) - 1, name, NULL);
+		if(config->enable_messages)
+			printf(">>> UPDATE: Tuning %s on %d visibilities and %d sources...\n\n", name,
+				TUNE_VISIBILITIES, TUNE_SOURCES);
+
+		TuneProfile best;
+		status = tune_device(&tuning, devices[d], sources, visibilities, reference, predicted, flux,
+			config->enable_messages, &best);
+		if (status != DFT_SUCCESS)
+		{
+			printf(">>> ERROR: Unable to tune %s...\n\n", name);
+			break;
+		}
+
+		char path[4096];
+		tune_profile_path(path, sizeof(path), config->tune_profile_dir, devices[d], best.precision);
+		if (!tune_profile_write(path, &best))
+			printf(">>> WARNING: Unable to store the tuning profile %s...\n\n", path);
+		else if(config->enable_messages)
+			printf("\n>>> UPDATE: %s uses the %s kernel with work-group size %d (%.6f s), stored in %s...\n\n",
+				name, (best.kernelVariant == DFT_KERNEL_BASIC) ? "basic" : "tiled", best.workGroupSize,
+				best.seconds, path);
+	}
+
+	free(sources);
+	free(visibilities);
+	free(reference);
+	free(predicted);
+	return status;
+}
@@ -0,0 +1,105 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DFT_TUNE_H_
+#define DFT_TUNE_H_
+
+#include "direct_fourier_transform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================//
+// Algorithm Configurables //
+//=========================//
+
+// Tags the profile key and file; bump when the kernels change enough to
+// invalidate earlier measurements
+#define TUNE_PROFILE_MAGIC "DFTTUNE1"
+
+// Synthetic workload each candidate is timed on
+#define TUNE_VISIBILITIES 16384
+#define TUNE_SOURCES 2048
+
+// Visibilities per compute unit the source split is timed on, few enough
+// for the engine to split automatically (capped at TUNE_VISIBILITIES)
+#define TUNE_SPLIT_VISIBILITIES_PER_UNIT 128
+
+// Timed calls per candidate, after one untimed call; the fastest is kept
+#define TUNE_REPEATS 3
+
+// Work-group sizes tried, up to the device's limit
+#define TUNE_MAX_WORK_GROUPS 6
+
+// A candidate is rejected when its largest error, relative to the summed
+// flux, exceeds TUNE_ERROR_FACTOR times that of the configured parameters
+// (and TUNE_ERROR_FLOOR, so that an exact baseline does not reject all)
+#define TUNE_ERROR_FACTOR 4.0
+#define TUNE_ERROR_FLOOR 1e-12
+
+//=========================//
+//        Structures       //
+//=========================//
+
+// Winning launch parameters of one device and precision
+typedef struct TuneProfile {
+	char device[256];
+	int precision;
+	int kernelVariant;
+	int workGroupSize;
+	int sourceSplit;
+	double seconds;  // best wall time on the synthetic workload
+	double error;    // largest error against the CPU reference, relative to the summed flux
+} TuneProfile;
+
+//=========================//
+//     Function Headers    //
+//=========================//
+
+// Profile files are named after a key of the platform, device, driver and
+// precision, so that a driver update or another device is simply untuned
+void tune_profile_path(char *path, size_t size, const char *profile_dir, cl_device_id dev, int precision);
+
+// Text profile files; read returns 0 when the file is missing or incomplete
+int tune_profile_read(const char *path, TuneProfile *profile);
+int tune_profile_write(const char *path, const TuneProfile *profile);
+
+// The profile of a device, as applied by create_device_engine
+int tune_profile_load(const char *profile_dir, cl_device_id dev, int precision, TuneProfile *profile);
+
+// Searches the launch parameters of every device the configured backend
+// drives and stores each winner under config->tune_profile_dir. Returns a
+// DFT_Status, DFT_ERROR_NO_DEVICE when there is no OpenCL device to tune.
+int autotune_devices(Config *config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFT_TUNE_H_ */
@@ -0,0 +1,145 @@
+// Copyright 2019 Compucon New Zealand
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+// contributors may be used to endorse or promote products derived from this
+// software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DFT_TYPES_H_
+#define DFT_TYPES_H_
+
+/* Types shared by the engine and the library API
+
+Kept free of OpenCL so that dft_api.h can be included without the OpenCL
+headers; the engine itself is declared in direct_fourier_transform.h.
+*/
+
+//=========================//
+//        Structures       //
+//=========================//
+
+// Compute path used by extract_visibilities
+typedef enum DFT_Backend {
+	DFT_BACKEND_AUTO = 0, // OpenCL when a device is available, otherwise native CPU
+	DFT_BACKEND_OPENCL,
+	DFT_BACKEND_CPU,
+	DFT_BACKEND_MULTI     // every GPU and accelerator plus the native CPU, sharing chunks
+} DFT_Backend;
+
+// OpenCL kernel used by extract_visibilities
+typedef enum DFT_KernelVariant {
+	DFT_KERNEL_BASIC = 0, // one work-item per visibility, sources read from global memory
+	DFT_KERNEL_TILED      // sources staged through local memory per work-group
+} DFT_KernelVariant;
+
+// Arithmetic used by the OpenCL kernels; the CPU backend always uses double
+typedef enum DFT_Precision {
+	DFT_PRECISION_DOUBLE = 0,    // native fp64, requires cl_khr_fp64
+	DFT_PRECISION_SINGLE,        // fp32 with the phase reduced in turns
+	DFT_PRECISION_DOUBLE_SINGLE  // emulated ~48-bit precision from pairs of floats
+} DFT_Precision;
+
+// How extract_visibilities evaluates the prediction
+typedef enum DFT_PredictionMode {
+	DFT_PREDICT_EXACT = 0, // direct DFT over every visibility and source pair
+	DFT_PREDICT_GRIDDED,   // sources gridded, Fourier transformed and degridded, within grid_accuracy
+	DFT_PREDICT_AUTO       // gridded whenever its estimated cost is lower
+} DFT_PredictionMode;
+
+// Outcome of the calls that report failure rather than exit; failures are negative
+typedef enum DFT_Status {
+	DFT_SUCCESS = 0,
+	DFT_ERROR_INVALID_ARGUMENT = -1, // NULL handle or buffer, or a negative count
+	DFT_ERROR_OUT_OF_MEMORY = -2,    // a host allocation failed
+	DFT_ERROR_NO_DEVICE = -3,        // DFT_BACKEND_OPENCL requested without an OpenCL device
+	DFT_ERROR_PROGRAM = -4,          // kernel source missing, or failed to build
+	DFT_ERROR_DEVICE = -5,           // an OpenCL call failed
+	DFT_ERROR_IO = -6                // an input file could not be read or the output written
+} DFT_Status;
+
+typedef struct Config {
+	int numVisibilities;
+	int numSources;
+	const char *source_file;
+	const char *vis_src_file;
+	const char *vis_file;
+	int force_zero_w_term;
+	int synthetic_sources;
+	int synthetic_visibilities;
+	int gaussian_distribution_sources;
+	double min_u;
+	double max_u;
+	double min_v;
+	double max_v;
+	double grid_size;
+	double cell_size;
+	double uv_scale;
+	double frequency_hz;
+	int enable_messages;
+	int compute_backend;
+	int num_threads;
+	int kernel_variant;
+	int work_group_size;
+	int precision_mode;
+	int stream_chunk_size;
+	int multi_chunk_size;
+	const char *trace_file;
+	const char *batch_manifest;
+	const char *batch_report;
+	const char *channel_file;
+	const char *image_file;
+	int prediction_mode;
+	double grid_accuracy;
+	int grid_cross_check;
+	double sky_prune_tolerance;
+	int sky_update_recompute_interval;
+	double sky_update_max_fraction;
+	int binary_output;
+	int output_precision;
+	int async_output;
+	const char *kernel_cache_dir;
+	const char *kernel_source_file;
+	int zero_copy;
+	int source_split;
+	const char *tune_profile_dir;
+} Config;
+
+typedef struct Complex {
+	double real;
+	double imaginary;
+} Complex;
+
+typedef struct Source {
+	double l;
+	double m;
+	double intensity;
+} Source;
+
+typedef struct Visibility {
+	double u;
+	double v;
+	double w;
+} Visibility;
+
+#endif /* DFT_TYPES_H_ */
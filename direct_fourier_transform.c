@@ -26,8 +26,37 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
-#define PROGRAM_FILE "../direct_fourier_transform.cl"
 #define KERNEL_FUNC "DFT_OpenCL"
+#define TILED_KERNEL_FUNC "DFT_OpenCL_Tiled"
+#define SINGLE_KERNEL_FUNC "DFT_OpenCL_Single"
+#define DOUBLE_SINGLE_KERNEL_FUNC "DFT_OpenCL_DoubleSingle"
+#define CHANNEL_KERNEL_FUNC "DFT_OpenCL_Channels"
+#define IMAGE_KERNEL_FUNC "DFT_OpenCL_Image"
+#define SPLIT_KERNEL_FUNC "DFT_OpenCL_Split"
+#define REDUCE_KERNEL_FUNC "DFT_Reduce_Slices"
+
+// Chunks in flight when streaming: one uploading, one computing, one reading back
+#define STREAM_SLOTS 3
+
+// Largest sky model given a kernel specialized to its exact size
+#define SPECIALIZE_SOURCE_LIMIT 64
+
+// Most OpenCL devices driven by one multi-device engine
+#define MULTI_MAX_DEVICES 16
+
+// Channels per work-item of the channelized kernel (DFT_CHANNEL_BLOCK)
+#define CHANNEL_BLOCK 16
+
+// Largest relative departure from an even spacing for which channels are
+// treated as regular and their phasors recurred
+#define CHANNEL_REGULAR_TOLERANCE 1e-12
+
+// Width and height of the pixel tile of one imaging work-group (DFT_IMAGE_TILE)
+#define IMAGE_TILE 8
+
+// Work-items per compute unit a launch needs to hide latency; below half of
+// that many visibilities the source axis is split across work-groups too
+#define SPLIT_ITEMS_PER_UNIT 1024
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,11 +64,40 @@
 #include <string.h>
 #include <time.h>
 #include "direct_fourier_transform.h"
-#ifdef MAC
-#include <OpenCL/cl.h>
-#else
-#include <CL/cl.h>
-#endif
+#include "dft_cpu.h"
+#include "dft_text_io.h"
+#include "dft_kernel_cache.h"
+#include "dft_tune.h"
+#include "dft_scheduler.h"
+#include "dft_grid.h"
+#include "dft_storage.h"
+#include "dft_trace.h"
+#include "dft_kernel_source.h"
+
+// Kernel selected for the engine's precision and variant, with the size in
+// bytes of one element of each of its buffers. The double kernels take
+// structure-of-arrays blocks (see dft_storage.h), padded beyond count.
+typedef struct KernelLayout {
+	cl_kernel kernel;
+	int tiled;
+	int soa;
+	size_t visibilitySize;
+	size_t intensitySize;
+	size_t tileSize;
+} KernelLayout;
+
+// Host and device buffers for one chunk of a streamed observation
+typedef struct StreamSlot {
+	Visibility *visibilities;
+	Complex *visIntensity;
+	void *staged;
+	void *sums;
+	cl_mem deviceVisibilities;
+	cl_mem deviceIntensities;
+	cl_event readback;
+	int count;
+	int busy;
+} StreamSlot;
 
 /* Find a GPU or CPU associated with the first available platform
 
@@ -50,6 +108,9 @@ may have an NVIDIA platform and an AMD platform.
 The `device` structure corresponds to the first accessible device
 associated with the platform. Because the second parameter is
 `CL_DEVICE_TYPE_GPU`, this device must be a GPU.
+
+Returns NULL when no platform or device exists, so that callers may fall
+back to the native CPU backend.
 */
 cl_device_id create_device() {
 
@@ -61,7 +122,7 @@ cl_device_id create_device() {
 	err = clGetPlatformIDs(1, &platform, NULL);
 	if (err < 0) {
 		perror("Couldn't identify a platform");
-		exit(1);
+		return NULL;
 	}
 
 	// Access a device
@@ -73,14 +134,40 @@ cl_device_id create_device() {
 	}
 	if (err < 0) {
 		perror("Couldn't access any devices");
-		exit(1);
+		return NULL;
 	}
 
 	return dev;
 }
 
-/* Create program from a file and compile it */
-cl_program build_program(cl_context ctx, cl_device_id dev, const char* filename) {
+/* Report whether a device can run the native double precision kernels */
+static int device_supports_fp64(cl_device_id dev)
+{
+	size_t extensions_size = 0;
+	if (clGetDeviceInfo(dev, CL_DEVICE_EXTENSIONS, 0, NULL, &extensions_size) < 0)
+		return 0;
+
+	char *extensions = (char*)malloc(extensions_size + 1);
+	if (extensions == NULL)
+		return 0;
+	extensions[extensions_size] = '\0';
+	clGetDeviceInfo(dev, CL_DEVICE_EXTENSIONS, extensions_size, extensions, NULL);
+
+	int supported = strstr(extensions, "cl_khr_fp64") != NULL;
+	free(extensions);
+	return supported;
+}
+
+/* Create program from a file (or the embedded source when NULL) and compile
+it with the given build options; NULL when the source cannot be read or
+does not build, after printing the reason (and the build log)
+
+When `cache_dir` is set the compiled binary is looked up in, or saved to,
+the kernel binary cache, keyed on the source, options, device and driver.
+A missing or stale entry falls back to compiling from source.
+*/
+cl_program build_program(cl_context ctx, cl_device_id dev, const char* filename, const char* options,
+	const char *cache_dir, KernelCacheStats *stats) {
 
 	cl_program program;
 	FILE *program_handle;
@@ -88,19 +175,45 @@ cl_program build_program(cl_context ctx, cl_device_id dev, const char* filename)
 	size_t program_size, log_size;
 	int err;
 
-	/* Read program file and place content into buffer */
-	program_handle = fopen(filename, "r");
-	if (program_handle == NULL) {
-		perror("Couldn't find the program file");
-		exit(1);
+	/* Read program file and place content into buffer
+
+	Without a file the kernel source embedded at build time is used, so the
+	executable does not depend on where it is run from.
+	*/
+	if (filename == NULL) {
+		program_size = dft_kernel_source_size;
+		program_buffer = (char*)malloc(program_size + 1);
+		memcpy(program_buffer, dft_kernel_source, program_size);
+		program_buffer[program_size] = '\0';
+	}
+	else {
+		program_handle = fopen(filename, "r");
+		if (program_handle == NULL) {
+			perror("Couldn't find the program file");
+			return NULL;
+		}
+		fseek(program_handle, 0, SEEK_END);
+		program_size = ftell(program_handle);
+		rewind(program_handle);
+		program_buffer = (char*)malloc(program_size + 1);
+		program_buffer[program_size] = '\0';
+		fread(program_buffer, sizeof(char), program_size, program_handle);
+		fclose(program_handle);
+	}
+
+	/* Look for a binary built by an earlier run */
+	int use_cache = cache_dir != NULL && cache_dir[0] != '\0';
+	unsigned long long key = 0;
+	if (use_cache)
+	{
+		key = kernel_cache_key(dev, program_buffer, program_size, options);
+		program = kernel_cache_load(cache_dir, key, ctx, dev, options, stats);
+		if (program != NULL)
+		{
+			free(program_buffer);
+			return program;
+		}
 	}
-	fseek(program_handle, 0, SEEK_END);
-	program_size = ftell(program_handle);
-	rewind(program_handle);
-	program_buffer = (char*)malloc(program_size + 1);
-	program_buffer[program_size] = '\0';
-	fread(program_buffer, sizeof(char), program_size, program_handle);
-	fclose(program_handle);
 
 	/* Create program from file
 
@@ -110,11 +223,11 @@ cl_program build_program(cl_context ctx, cl_device_id dev, const char* filename)
 	*/
 	program = clCreateProgramWithSource(ctx, 1,
 		(const char**)&program_buffer, &program_size, &err);
+	free(program_buffer);
 	if (err < 0) {
 		perror("Couldn't create the program");
-		exit(1);
+		return NULL;
 	}
-	free(program_buffer);
 
 	/* Build program
 
@@ -123,7 +236,7 @@ cl_program build_program(cl_context ctx, cl_device_id dev, const char* filename)
 	define a macro with the option -DMACRO=VALUE and turn off optimization
 	with -cl-opt-disable.
 	*/
-	err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+	err = clBuildProgram(program, 0, NULL, options, NULL, NULL);
 	if (err < 0) {
 
 		/* Find size of log and print to std output */
@@ -135,9 +248,13 @@ cl_program build_program(cl_context ctx, cl_device_id dev, const char* filename)
 			log_size + 1, program_log, NULL);
 		printf("%s\n", program_log);
 		free(program_log);
-		exit(1);
+		clReleaseProgram(program);
+		return NULL;
 	}
 
+	if (use_cache)
+		kernel_cache_store(cache_dir, key, program, dev, stats);
+
 	return program;
 }
 
@@ -191,8 +308,166 @@ void initConfig(Config *config)
 	config->max_v = config->grid_size / 2.0;
 
 	config->enable_messages = 1;
+
+	// OpenCL when a device is available, otherwise the native CPU backend
+	config->compute_backend = DFT_BACKEND_AUTO;
+
+	// Worker threads for the CPU backend (0 uses every online core)
+	config->num_threads = 0;
+
+	// Stage sources through local memory, one tile per work-group
+	config->kernel_variant = DFT_KERNEL_TILED;
+
+	// Work-items per work-group (and sources per tile) for the tiled kernel
+	config->work_group_size = 128;
+
+	// Kernel arithmetic: double, single or emulated double-single
+	config->precision_mode = DFT_PRECISION_DOUBLE;
+
+	// Visibilities per chunk when streaming from file (0 loads everything at once)
+	config->stream_chunk_size = 0;
+
+	// Visibilities handed to a device at a time by the multi-device scheduler
+	config->multi_chunk_size = 8192;
+
+	// Chrome trace-event file of per-stage timings, with a summary table (NULL disables tracing)
+	config->trace_file = NULL;
+
+	// Manifest of jobs run in one process by the batch driver (NULL runs the single job above)
+	config->batch_manifest = NULL;
+
+	// Per-job timings of a batch run
+	config->batch_report = "../batch_report.csv";
+
+	// Channel frequencies in Hz for a channelized prediction (NULL predicts frequency_hz alone)
+	config->channel_file = NULL;
+
+	// Dirty image of the predicted visibilities, written as a binary container (NULL skips imaging)
+	config->image_file = NULL;
+
+	// Exact DFT, gridded approximation, or whichever is estimated to be cheaper. The
+	// estimate counts operations alone and ignores how much faster a GPU runs the DFT,
+	// so the exact DFT stays the default
+	config->prediction_mode = DFT_PREDICT_EXACT;
+
+	// Largest error of a gridded prediction, relative to the summed flux of the sky model
+	config->grid_accuracy = 1e-6;
+
+	// Visibilities of each gridded prediction checked against the exact DFT (0 skips the check)
+	config->grid_cross_check = 64;
+
+	// Error allowed from dropping and merging faint sources, relative to the summed flux (0 keeps every source)
+	config->sky_prune_tolerance = 0.0;
+
+	// Incremental sky model updates between full recomputes, bounding accumulated rounding (0 never recomputes)
+	config->sky_update_recompute_interval = 16;
+
+	// Updates touching more than this fraction of the sky model recompute it in full
+	config->sky_update_max_fraction = 0.5;
+
+	// Write predicted visibilities as a binary container instead of text
+	config->binary_output = 0;
+
+	// Significant digits of written values (0 writes the shortest form that reads back exactly)
+	config->output_precision = 0;
+
+	// Format and write streamed chunks on a background thread
+	config->async_output = 1;
+
+	// Directory of compiled kernel binaries reused across runs (NULL disables the cache)
+	config->kernel_cache_dir = "../kernel_cache";
+
+	// Kernel source read at runtime (NULL uses the copy embedded at build time)
+	config->kernel_source_file = NULL;
+
+	// Split the source axis of fp64 predictions across work-groups: 0 when too
+	// few visibilities would leave the device idle, 1 always, -1 never
+	config->source_split = 0;
+
+	// Per-device launch parameters written by `dft --tune` and applied to every
+	// engine (NULL keeps kernel_variant, work_group_size and source_split)
+	config->tune_profile_dir = "../tuning";
+
+	// Map device buffers in place on devices sharing host memory, and stage
+	// through pinned memory on the rest (0 copies through pageable memory)
+	config->zero_copy = 1;
+}
+
+/* Read up to `count` visibility rows from an open visibility file
+
+Returns the number of rows read, which is less than `count` only at the
+end of the file.
+*/
+int readVisibilityRows(Config *config, FILE *file, Visibility *visibilities, int count)
+{
+	double u = 0.0;
+	double v = 0.0;
+	double w = 0.0;
+	Complex brightness;
+	double intensity = 0.0;
+
+	// Used to scale visibility coordinates from wavelengths to meters
+
+	double wavelength_to_meters = config->frequency_hz / C;
+
+	int vis_indx = 0;
+	for (; vis_indx < count; ++vis_indx)
+	{
+		// Read in provided visibility attributes
+		// u, v, w, brightness (real), brightness (imag), intensity
+		if (fscanf(file, "%lf %lf %lf %lf %lf %lf\n", &u, &v, &w,
+			&(brightness.real), &(brightness.imaginary), &intensity) != 6)
+			break;
+
+		visibilities[vis_indx] = (Visibility) {
+			.u = u * wavelength_to_meters,
+				.v = v * wavelength_to_meters,
+				.w = (config->force_zero_w_term) ? 0.0 : w * wavelength_to_meters
+		};
+	}
+
+	return vis_indx;
+}
+
+// Destination of rows parsed by parse_text_rows
+typedef struct VisibilityRowContext {
+	Config *config;
+	Visibility *visibilities;
+	double wavelength_to_meters;
+} VisibilityRowContext;
+
+typedef struct SourceRowContext {
+	Config *config;
+	Source *sources;
+} SourceRowContext;
+
+// u, v, w, brightness (real), brightness (imag), intensity
+static void store_visibility_row(void *context, int row, const double *values)
+{
+	VisibilityRowContext *rows = (VisibilityRowContext*) context;
+	rows->visibilities[row] = (Visibility) {
+		.u = values[0] * rows->wavelength_to_meters,
+			.v = values[1] * rows->wavelength_to_meters,
+			.w = (rows->config->force_zero_w_term) ? 0.0 : values[2] * rows->wavelength_to_meters
+	};
+}
+
+// l, m, intensity
+static void store_source_row(void *context, int row, const double *values)
+{
+	SourceRowContext *rows = (SourceRowContext*) context;
+	rows->sources[row] = (Source) {
+		.l = values[0] * rows->config->cell_size,
+			.m = values[1] * rows->config->cell_size,
+			.intensity = values[2]
+	};
 }
 
+/* Load or synthesize the visibilities
+
+The arrays are aligned and padded (see dft_aligned_alloc) and zeroed
+beyond numVisibilities; release them with free.
+*/
 void loadVisibilities(Config *config, Visibility **visibilities, Complex **visIntensity)
 {
 	if (config->synthetic_visibilities)
@@ -200,10 +475,10 @@ void loadVisibilities(Config *config, Visibility **visibilities, Complex **visIn
 		if(config->enable_messages)
 			printf(">>> UPDATE: Using synthetic Visibilities...\n\n");
 
-		*visibilities = (Visibility*)calloc(config->numVisibilities, sizeof(Visibility));
+		*visibilities = (Visibility*)dft_aligned_alloc(dft_padded_count(config->numVisibilities) * sizeof(Visibility));
 		if (*visibilities == NULL)  return;
 
-		*visIntensity = (Complex*)calloc(config->numVisibilities, sizeof(Complex));
+		*visIntensity = (Complex*)dft_aligned_alloc(dft_padded_count(config->numVisibilities) * sizeof(Complex));
 		if (*visIntensity == NULL)
 		{
 			if (*visibilities) free(*visibilities);
@@ -223,10 +498,12 @@ void loadVisibilities(Config *config, Visibility **visibilities, Complex **visIn
 			double u = randomInRange(config->min_u, config->max_u) * gU;
 			double v = randomInRange(config->min_v, config->max_v) * gV;
 			double w = randomInRange(config->min_v / 10.0, config->max_v / 10.0) * gV;
-			(*visibilities)[i] = (Visibility) { .u = u / config->uv_scale, .v = v / config->uv_scale, .w = w / config->uv_scale };
+			(*visibilities)[i] = (Visibility) { .u = u / config->uv_scale, .v = v / config->uv_scale,
+				.w = (config->force_zero_w_term) ? 0.0 : w / config->uv_scale };
 		}
 
-		printf("Total vis: %d\n ", config->numVisibilities);
+		if(config->enable_messages)
+			printf("Total vis: %d\n ", config->numVisibilities);
 
 	}
 	else // Reading visibilities from file
@@ -234,56 +511,51 @@ void loadVisibilities(Config *config, Visibility **visibilities, Complex **visIn
 		if(config->enable_messages)
 			printf(">>> UPDATE: Using Visibilities from file...\n\n");
 
-		FILE *file = fopen(config->vis_src_file, "r");
-		if (file == NULL)
+		TextFile file;
+		double mapped = trace_now();
+		if (!open_text_file(config->vis_src_file, &file))
 		{
 			printf(">>> ERROR: Unable to locate visibilities file...\n\n");
 			return;
 		}
 
+		trace_host("map visibilities", TRACE_IO, mapped);
+
 		// Reading in the counter for number of visibilities
-		fscanf(file, "%d\n", &(config->numVisibilities));
+		config->numVisibilities = file.count;
 
-		*visibilities = (Visibility*)calloc(config->numVisibilities, sizeof(Visibility));
-		*visIntensity = (Complex*)calloc(config->numVisibilities, sizeof(Complex));
+		*visibilities = (Visibility*)dft_aligned_alloc(dft_padded_count(config->numVisibilities) * sizeof(Visibility));
+		*visIntensity = (Complex*)dft_aligned_alloc(dft_padded_count(config->numVisibilities) * sizeof(Complex));
 
 		// File found, but was memory allocated?
 		if (*visibilities == NULL || *visIntensity == NULL)
 		{
 			printf(">>> ERROR: Unable to allocate memory for visibilities...\n\n");
-			if (file) fclose(file);
+			close_text_file(&file);
 			if (*visibilities) free(*visibilities);
 			if (*visIntensity) free(*visIntensity);
+			*visibilities = NULL;
+			*visIntensity = NULL;
 			return;
 		}
 
-		double u = 0.0;
-		double v = 0.0;
-		double w = 0.0;
-		Complex brightness;
-		double intensity = 0.0;
-
-		// Used to scale visibility coordinates from wavelengths to meters
-
-		double wavelength_to_meters = config->frequency_hz / C;
+		// Read in n number of visibilities across every core
+		VisibilityRowContext context = { config, *visibilities, config->frequency_hz / C };
+		double parsing = trace_now();
+		int parsed = parse_text_rows(&file, 6, store_visibility_row, &context,
+			config->num_threads, "visibility");
+		trace_host("parse visibilities", TRACE_HOST, parsing);
 
-		// Read in n number of visibilities
-		for (int vis_indx = 0; vis_indx < config->numVisibilities; ++vis_indx)
+		// Clean up
+		close_text_file(&file);
+		if (!parsed)
 		{
-			// Read in provided visibility attributes
-			// u, v, w, brightness (real), brightness (imag), intensity
-			fscanf(file, "%lf %lf %lf %lf %lf %lf\n", &u, &v, &w,
-				&(brightness.real), &(brightness.imaginary), &intensity);
-
-			(*visibilities)[vis_indx] = (Visibility) {
-				.u = u * wavelength_to_meters,
-					.v = v * wavelength_to_meters,
-					.w = (config->force_zero_w_term) ? 0.0 : w * wavelength_to_meters
-			};
+			free(*visibilities);
+			free(*visIntensity);
+			*visibilities = NULL;
+			*visIntensity = NULL;
+			return;
 		}
-
-		// Clean up
-		fclose(file);
 		if(config->enable_messages)
 			printf(">>> UPDATE: Successfully loaded %d visibilities from file...\n\n", config->numVisibilities);
 	}
@@ -294,7 +566,7 @@ void loadSources(Config *config, Source **sources)
 	{
 		if(config->enable_messages)
 			printf(">>> UPDATE: Using synthetic Sources...\n\n");
-		*sources = (Source*)calloc(config->numSources, sizeof(Source));
+		*sources = (Source*)dft_aligned_alloc(dft_padded_count(config->numSources) * sizeof(Source));
 		if (*sources == NULL) return;
 		for (int n = 0; n < config->numSources; ++n)
 		{
@@ -312,226 +584,2895 @@ void loadSources(Config *config, Source **sources)
 		if(config->enable_messages)
 			printf(">>> UPDATE: Using Sources from file...\n\n");
 
-		FILE *file = fopen(config->source_file, "r");
+		TextFile file;
 
 		// Unable to open file
-		if (!file)
+		double mapped = trace_now();
+		if (!open_text_file(config->source_file, &file))
 		{
 			printf(">>> ERROR: Unable to load sources from file...\n\n");
 			return;
 		}
+		trace_host("map sources", TRACE_IO, mapped);
 
-		fscanf(file, "%d\n", &(config->numSources));
-		*sources = (Source*)calloc(config->numSources, sizeof(Source));
-		if (*sources == NULL) return;
-		double l, m, intensity;
-		for (int i = 0; i < config->numSources; ++i)
-		{
-			fscanf(file, "%lf %lf %lf\n", &l, &m, &intensity);
-			(*sources)[i] = (Source) {
-				.l = l * config->cell_size,
-					.m = m * config->cell_size,
-					.intensity = intensity
-			};
+		config->numSources = file.count;
+		*sources = (Source*)dft_aligned_alloc(dft_padded_count(config->numSources) * sizeof(Source));
+		if (*sources == NULL)
+		{
+			close_text_file(&file);
+			return;
+		}
+
+		SourceRowContext context = { config, *sources };
+		double parsing = trace_now();
+		int parsed = parse_text_rows(&file, 3, store_source_row, &context,
+			config->num_threads, "source");
+		trace_host("parse sources", TRACE_HOST, parsing);
+		close_text_file(&file);
+		if (!parsed)
+		{
+			free(*sources);
+			*sources = NULL;
+			return;
 		}
-		fclose(file);
 		if(config->enable_messages)
 			printf(">>> UPDATE: Successfully loaded %d sources from file..\n\n", config->numSources);
 
 	}
 }
 
-void extract_visibilities(Config *config, Source *sources, Visibility *visibilities, 
-	Complex *visIntensity, int numVisibilities)
-{
-
-	/* OpenCL structures */
-	cl_device_id device;
-	cl_context context;
-	cl_program program;
-	cl_kernel kernel;
-	cl_command_queue queue;
-	cl_int err;
-	size_t global_size;
+/* Compute the visibility-independent terms of every source
 
-	/* Create device and context
+l and m are scaled by 2*pi, n is the w correction -(l^2 + m^2) / 2 scaled
+likewise, and the flux is the intensity over the image correction
+1 - (l^2 + m^2) / 2. Packed once per sky model, these leave the kernels'
+inner loop with one dot product, a sincos and the flux multiply.
+*/
+void packSources(Source *sources, PackedSource *packed, int numSources)
+{
+	const double two_PI = 3.14159265358979323846 + 3.14159265358979323846;
 
-	Creates a context containing only one device — the device structure
-	created earlier.
-	*/
-	device = create_device();
-	context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
-	if (err < 0) {
-		perror("Couldn't create a context");
-		exit(1);
+	for (int s = 0; s < numSources; ++s)
+	{
+		double term = 0.5 * (sources[s].l * sources[s].l + sources[s].m * sources[s].m);
+		double w_correction = -term;
+		double image_correction = 1.0 - term;
+
+		packed[s] = (PackedSource) {
+			.l = sources[s].l * two_PI,
+			.m = sources[s].m * two_PI,
+			.n = w_correction * two_PI,
+			.flux = sources[s].intensity / image_correction
+		};
 	}
+}
 
-	/* Build program */
-	program = build_program(context, device, PROGRAM_FILE);
+// Flux of a source as the kernels see it, after the image correction
+static double source_flux(Source *source)
+{
+	return fabs(source->intensity / (1.0 - 0.5 * (source->l * source->l + source->m * source->m)));
+}
 
-	/* Create a command queue
+typedef struct RankedSource {
+	double flux;
+	int index;
+} RankedSource;
 
-	Does not support profiling or out-of-order-execution
-	*/
-	queue = clCreateCommandQueue(context, device, 0, &err);
-	if (err < 0) {
-		perror("Couldn't create a command queue");
-		exit(1);
-	};
+static int compare_ranked_sources(const void *a, const void *b)
+{
+	double fa = ((const RankedSource*) a)->flux;
+	double fb = ((const RankedSource*) b)->flux;
+	return (fa < fb) - (fa > fb);
+}
 
+/* Bound on the visibility error of one source moved to a merged centroid
 
-	/* Create data buffer
+|f e^{-i theta} - f' e^{-i theta'}| is at most |f| min(2, |theta - theta'|)
+plus the change in flux from the centroid's image correction. The phase
+difference is bounded through the largest |u|, |v| and |w| (extent).
+*/
+static double merge_error(Source *member, double l, double m, const double *extent)
+{
+	const double two_PI = 3.14159265358979323846 + 3.14159265358979323846;
+	double term = 0.5 * (member->l * member->l + member->m * member->m);
+	double centroid_term = 0.5 * (l * l + m * m);
+	double flux = source_flux(member);
+
+	double phase = two_PI * (extent[0] * fabs(member->l - l) + extent[1] * fabs(member->m - m)
+		+ extent[2] * fabs(term - centroid_term));
+	return flux * fmin(2.0, phase)
+		+ fabs(member->intensity / (1.0 - term) - member->intensity / (1.0 - centroid_term));
+}
 
-	• `global_size`: total number of work items that will be
-	   executed on the GPU (e.g. total size of your array)
-	• `local_size`: size of local workgroup. Each workgroup contains
-	   several work items and goes to a compute unit
+/* Uniform l/m grid bucketing the surviving groups of pruneSources
 
-	  Notes:
-	• Intel recommends workgroup size of 64-128. Often 128 is minimum to
-	get good performance on GPU
-	• On NVIDIA Fermi, workgroup size must be at least 192 for full
-	utilization of cores
-	• Optimal workgroup size differs across applications
-	*/
+Each cell holds a doubly linked list of the group leaders whose centroid
+falls in it, so the nearest group is found by searching the cells outward
+from a source rather than scanning the whole sky model.
+*/
+typedef struct PruneGrid {
+	int size;          // cells per side
+	double l0, m0;     // lower corner of the sky model
+	double cellL, cellM;
+	int *head;         // first group in each cell, -1 when empty
+	int *next;         // next and previous group in the same cell
+	int *prev;
+	int *cell;         // cell of each group
+} PruneGrid;
+
+// Grid of about two sources per cell over the sky model; returns a DFT_Status
+static int create_prune_grid(PruneGrid *grid, Source *sources, int numSources)
+{
+	double l1 = sources[0].l, m1 = sources[0].m;
+	grid->l0 = l1;
+	grid->m0 = m1;
+	for (int s = 1; s < numSources; ++s)
+	{
+		grid->l0 = fmin(grid->l0, sources[s].l);
+		grid->m0 = fmin(grid->m0, sources[s].m);
+		l1 = fmax(l1, sources[s].l);
+		m1 = fmax(m1, sources[s].m);
+	}
+	grid->size = (int) sqrt(0.5 * numSources);
+	if (grid->size < 1)
+		grid->size = 1;
+	grid->cellL = (l1 > grid->l0) ? (l1 - grid->l0) / grid->size : 1.0;
+	grid->cellM = (m1 > grid->m0) ? (m1 - grid->m0) / grid->size : 1.0;
+
+	size_t cells = (size_t) grid->size * grid->size;
+	grid->head = (int*) malloc((cells + 3 * (size_t) numSources) * sizeof(int));
+	if (grid->head == NULL)
+		return DFT_ERROR_OUT_OF_MEMORY;
+	grid->next = grid->head + cells;
+	grid->prev = grid->next + numSources;
+	grid->cell = grid->prev + numSources;
+	for (size_t c = 0; c < cells; ++c)
+		grid->head[c] = -1;
+	return DFT_SUCCESS;
+}
 
-	//Allocating GPU memory for visibility intensity
-	cl_mem deviceSources;
-	cl_mem deviceVisibilities;
-	cl_mem deviceIntensities;
+// Column or row of a coordinate, clamped to the grid
+static int prune_grid_index(const PruneGrid *grid, double offset, double cell)
+{
+	int index = (int) (offset / cell);
+	return (index < 0) ? 0 : (index >= grid->size) ? grid->size - 1 : index;
+}
 
-	if(config->enable_messages)
-		printf(">>> UPDATE: Allocating GPU MEMORY...\n\n");
+static void prune_grid_insert(PruneGrid *grid, int group, double l, double m)
+{
+	int c = prune_grid_index(grid, m - grid->m0, grid->cellM) * grid->size
+		+ prune_grid_index(grid, l - grid->l0, grid->cellL);
+	grid->cell[group] = c;
+	grid->prev[group] = -1;
+	grid->next[group] = grid->head[c];
+	if (grid->head[c] >= 0)
+		grid->prev[grid->head[c]] = group;
+	grid->head[c] = group;
+}
 
-	//copy the visibilities to the GPU
-	deviceVisibilities = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, numVisibilities * sizeof(double_3), visibilities, &err); // <=====INPUT
+static void prune_grid_remove(PruneGrid *grid, int group)
+{
+	if (grid->prev[group] >= 0)
+		grid->next[grid->prev[group]] = grid->next[group];
+	else
+		grid->head[grid->cell[group]] = grid->next[group];
+	if (grid->next[group] >= 0)
+		grid->prev[grid->next[group]] = grid->prev[group];
+}
 
-	//copy the sources to the GPU.
-	deviceSources = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(double_3) * config->numSources, sources, &err); // <=====INPUT
+/* Nearest other group to group s by extent[0] |dl| + extent[1] |dm|
 
-	deviceIntensities = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, numVisibilities * sizeof(double_2), visIntensity, &err); // <=====OUTPUT
+Searches square rings of cells outward from the cell of s. A group in ring
+R lies at least R - 1 whole cells away along l or m, so the search stops
+once that bound reaches the closest group found. Returns -1 when s is the
+only group.
+*/
+static int prune_grid_nearest(const PruneGrid *grid, int s, const double *l, const double *m,
+	const double *extent)
+{
+	int column = grid->cell[s] % grid->size;
+	int row = grid->cell[s] / grid->size;
+	int rings = grid->size - 1 - column;
+	rings = (column > rings) ? column : rings;
+	rings = (row > rings) ? row : rings;
+	rings = (grid->size - 1 - row > rings) ? grid->size - 1 - row : rings;
+
+	int nearest = -1;
+	double closest = INFINITY;
+	for (int ring = 0; ring <= rings; ++ring)
+	{
+		double reach = (ring > 0) ? (ring - 1) * fmin(extent[0] * grid->cellL, extent[1] * grid->cellM) : 0.0;
+		if (nearest >= 0 && closest <= reach)
+			break;
 
-	if (err < 0) {
-		perror("Couldn't create a buffer");
-		exit(1);
-	};
+		int top = (row + ring < grid->size) ? row + ring : grid->size - 1;
+		for (int y = (row - ring > 0) ? row - ring : 0; y <= top; ++y)
+		{
+			// Whole rows on the ring's edge, otherwise only its two ends
+			int edge = (y == row - ring || y == row + ring);
+			int step = (edge || ring == 0) ? 1 : 2 * ring;
+			for (int x = column - ring; x <= column + ring; x += step)
+			{
+				if (x < 0 || x >= grid->size)
+					continue;
+				for (int j = grid->head[y * grid->size + x]; j >= 0; j = grid->next[j])
+				{
+					if (j == s)
+						continue;
+					double distance = extent[0] * fabs(l[j] - l[s]) + extent[1] * fabs(m[j] - m[s]);
+					if (distance < closest)
+					{
+						closest = distance;
+						nearest = j;
+					}
+				}
+			}
+		}
+	}
+	return nearest;
+}
 
-	/* Create a kernel */
-	kernel = clCreateKernel(program, KERNEL_FUNC, &err);
-	if (err < 0) {
-		perror("Couldn't create a kernel");
-		exit(1);
-	};
-	/* Create kernel arguments */
+/* Drop and merge the faint tail of the sky model within an error budget
+
+Sources are visited from the faintest up. Each is either dropped, which
+costs at most its flux on any visibility, or merged with the nearest
+remaining source (or merged group) into their centroid weighted by |flux|,
+costing the bound of merge_error over the group's members. The cheaper
+action is taken while the summed bounds stay within sky_prune_tolerance
+of the total flux, and the pass ends once the budget is spent. The nearest
+group is looked up on a PruneGrid, so the pass stays close to linear in
+the number of sources. Merging needs the visibilities for the phase bound;
+with none only dropping is considered. The survivors are compacted in file
+order and config->numSources updated. `bound` receives the bound on the
+error of any predicted visibility. Returns a DFT_Status; out of memory the
+sky model is left whole.
+*/
+int pruneSources(Config *config, Source *sources, Visibility *visibilities, int numVisibilities, double *bound)
+{
+	int numSources = config->numSources;
+	*bound = 0.0;
+	if (config->sky_prune_tolerance <= 0.0 || numSources < 2)
+		return DFT_SUCCESS;
 
-	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&deviceVisibilities);
-	err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&deviceIntensities);
-	err |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &numVisibilities);
-	err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), (void *)&deviceSources);
-	err |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &config->numSources);
-	if (err < 0) {
-		perror("Couldn't create a kernel argument");
-		exit(1);
+	double extent[3] = { 0.0, 0.0, 0.0 };
+	for (int i = 0; i < numVisibilities; ++i)
+	{
+		extent[0] = fmax(extent[0], fabs(visibilities[i].u));
+		extent[1] = fmax(extent[1], fabs(visibilities[i].v));
+		extent[2] = fmax(extent[2], fabs(visibilities[i].w));
 	}
-	if(config->enable_messages)
-		printf(">>> UPDATE: Calling DFT GPU Kernel...\n\n");
-
-	/* Enqueue kernel
+	int can_merge = (visibilities != NULL && numVisibilities > 0);
+
+	// Per group, led by the surviving source: its members as a linked list,
+	// the |flux| weighted centroid, summed intensity and current error bound
+	RankedSource *ranked = (RankedSource*) malloc(numSources * sizeof(RankedSource));
+	int *next = (int*) malloc(numSources * sizeof(int));
+	char *alive = (char*) malloc(numSources);
+	double *group = (double*) malloc(6 * (size_t) numSources * sizeof(double));
+	PruneGrid grid;
+	grid.head = NULL;
+	if (ranked == NULL || next == NULL || alive == NULL || group == NULL
+		|| (can_merge && create_prune_grid(&grid, sources, numSources) != DFT_SUCCESS)) {
+		perror("Couldn't allocate the sky model pruning");
+		free(ranked);
+		free(next);
+		free(alive);
+		free(group);
+		free(grid.head);
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+	double *l = group;
+	double *m = group + numSources;
+	double *weight = group + 2 * (size_t) numSources;
+	double *intensity = group + 3 * (size_t) numSources;
+	double *groupBound = group + 4 * (size_t) numSources;
+	double *groupFlux = group + 5 * (size_t) numSources;
+
+	double total = 0.0;
+	for (int s = 0; s < numSources; ++s)
+	{
+		ranked[s] = (RankedSource) { source_flux(&sources[s]), s };
+		total += ranked[s].flux;
+		next[s] = -1;
+		alive[s] = 1;
+		l[s] = sources[s].l;
+		m[s] = sources[s].m;
+		weight[s] = fabs(sources[s].intensity);
+		intensity[s] = sources[s].intensity;
+		groupBound[s] = 0.0;
+		groupFlux[s] = ranked[s].flux;
+		if (can_merge)
+			prune_grid_insert(&grid, s, l[s], m[s]);
+	}
+	qsort(ranked, numSources, sizeof(RankedSource), compare_ranked_sources);
 
-	   At this point, the application has created all the data structures
-	   (device, kernel, program, command queue, and context) needed by an
-	   OpenCL host application. Now, it deploys the kernel to a device.
+	double budget = config->sky_prune_tolerance * total;
+	double spent = 0.0;
+	int dropped = 0, merged = 0;
 
-	   Of the OpenCL functions that run on the host, clEnqueueNDRangeKernel
-	   is probably the most important to understand. Not only does it deploy
-	   kernels to devices, it also identifies how many work-items should
-	   be generated to execute the kernel (global_size) and the number of
-	   work-items in each work-group (local_size).
-	   */
+	for (int k = numSources - 1; k >= 0 && spent < budget; --k)
+	{
+		int s = ranked[k].index;
+		if (!alive[s])
+			continue;
 
-	global_size = numVisibilities;
+		// Dropping the group takes its members' flux, in place of its bound
+		double drop_cost = groupFlux[s] - groupBound[s];
 
-	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size,
-		NULL, 0, NULL, NULL);
+		// Nearest other group by the phase bound between their centroids
+		int nearest = can_merge ? prune_grid_nearest(&grid, s, l, m, extent) : -1;
+		double merge_cost = INFINITY, merged_l = 0.0, merged_m = 0.0;
+		if (nearest >= 0)
+		{
+			double total_weight = weight[s] + weight[nearest];
+			merged_l = (total_weight > 0.0) ? (weight[s] * l[s] + weight[nearest] * l[nearest]) / total_weight
+				: 0.5 * (l[s] + l[nearest]);
+			merged_m = (total_weight > 0.0) ? (weight[s] * m[s] + weight[nearest] * m[nearest]) / total_weight
+				: 0.5 * (m[s] + m[nearest]);
+			double merged_bound = 0.0;
+			for (int member = s; member >= 0; member = next[member])
+				merged_bound += merge_error(&sources[member], merged_l, merged_m, extent);
+			for (int member = nearest; member >= 0; member = next[member])
+				merged_bound += merge_error(&sources[member], merged_l, merged_m, extent);
+			merge_cost = merged_bound - groupBound[s] - groupBound[nearest];
+		}
 
-	if (err < 0) {
-		perror("Couldn't enqueue the kernel");
-		exit(1);
+		if (merge_cost < drop_cost && spent + merge_cost <= budget)
+		{
+			// The nearest group leads the merged one
+			int tail = nearest;
+			while (next[tail] >= 0)
+				tail = next[tail];
+			next[tail] = s;
+			prune_grid_remove(&grid, s);
+			prune_grid_remove(&grid, nearest);
+			prune_grid_insert(&grid, nearest, merged_l, merged_m);
+			l[nearest] = merged_l;
+			m[nearest] = merged_m;
+			weight[nearest] += weight[s];
+			intensity[nearest] += intensity[s];
+			groupBound[nearest] += groupBound[s] + merge_cost;
+			groupFlux[nearest] += groupFlux[s];
+			alive[s] = 0;
+			spent += merge_cost;
+			merged++;
+		}
+		else if (spent + drop_cost <= budget)
+		{
+			if (can_merge)
+				prune_grid_remove(&grid, s);
+			alive[s] = 0;
+			spent += drop_cost;
+			dropped++;
+		}
 	}
-	if(config->enable_messages)
-		printf(">>> UPDATE: DFT GPU Kernel Completed...\n\n");
 
-	/* Read the kernel's output    */
-	err = clEnqueueReadBuffer(queue, deviceIntensities, CL_TRUE, 0, numVisibilities * sizeof(double_2), visIntensity, 0, NULL, NULL); // <=====GET OUTPUT
-	if (err < 0) {
-		perror("Couldn't read the buffer");
-		exit(1);
-	}
+	int kept = 0;
+	for (int s = 0; s < numSources; ++s)
+		if (alive[s])
+			sources[kept++] = (Source) { l[s], m[s], intensity[s] };
+	config->numSources = kept;
 
 	if(config->enable_messages)
-		printf(">>> UPDATE: Copied Visibility Data back to Host - Completed...\n\n");
-
-	/* Deallocate resources */
-	clReleaseKernel(kernel);
-	clReleaseMemObject(deviceSources);
-	clReleaseMemObject(deviceVisibilities);
-	clReleaseMemObject(deviceIntensities);
-	clReleaseCommandQueue(queue);
-	clReleaseProgram(program);
-	clReleaseContext(context);
+		printf(">>> INFO: Pruned sky model from %d to %d sources (%d dropped, %d merged) within %.3g of the "
+			"flux, projected speedup %.2fx...\n\n", numSources, kept, dropped, merged,
+			(total > 0.0) ? spent / total : 0.0, (kept > 0) ? (double) numSources / kept : 0.0);
+
+	free(ranked);
+	free(next);
+	free(alive);
+	free(group);
+	free(grid.head);
+	*bound = spent;
+	return DFT_SUCCESS;
 }
 
-void saveVisibilities(Config *config, Visibility *visibilities, Complex *visIntensity)
+static void release_engine_kernels(DFT_Engine *engine);
+
+/* Build the program for the engine and create its kernels
+
+The program is specialized through build options (see the top of
+direct_fourier_transform.cl): the tile loops are compiled for
+engine->tileSize, the w term is dropped when w is disregarded and, when
+`numSources` is not 0, the source loops are compiled for exactly that many
+sources. Should a tiled kernel not fit the requested work-group size on
+this device, the program is rebuilt for the largest size that does.
+Returns a DFT_Status; on failure the engine is left without kernels.
+*/
+static int build_engine_kernels(DFT_Engine *engine, Config *config, int numSources)
 {
-	// Save visibilities to file
-	FILE *file = fopen(config->vis_file, "w");
+	cl_int err;
+	char options[256];
 
-	// Unable to open file
-	if (!file)
+	for (;;)
 	{
-		printf(">>> ERROR: Unable to save visibilities to file...\n\n");
-		return;
-	}
-	if(config->enable_messages)
-		printf(">>> UPDATE: Writing visibilities to file...\n\n");
-
-	// Record number of visibilities
-	fprintf(file, "%d\n", config->numVisibilities);
+		snprintf(options, sizeof(options),
+			"%s%s-D DFT_TILE_SIZE=%zu -D DFT_CHANNEL_BLOCK=%d -D DFT_IMAGE_TILE=%d -D DFT_SOA_PAD=%d",
+			engine->fp64 ? "-D DFT_ENABLE_FP64 " : "",
+			engine->zeroW ? "-D DFT_ZERO_W " : "",
+			engine->tileSize, CHANNEL_BLOCK, IMAGE_TILE, DFT_STORAGE_PAD);
+		if (numSources > 0)
+			snprintf(options + strlen(options), sizeof(options) - strlen(options),
+				" -D DFT_NUM_SOURCES=%d", numSources);
+
+		double building = trace_now();
+		engine->program = build_program(engine->context, engine->device, config->kernel_source_file,
+			options, config->kernel_cache_dir, &engine->kernelCache);
+		trace_host("build program", TRACE_HOST, building);
+		engine->specializedSources = numSources;
+		if (engine->program == NULL)
+			return DFT_ERROR_PROGRAM;
+
+		/* Create the kernels */
+		if (engine->fp64)
+		{
+			engine->kernel = clCreateKernel(engine->program, KERNEL_FUNC, &err);
+			if (err >= 0)
+				engine->tiledKernel = clCreateKernel(engine->program, TILED_KERNEL_FUNC, &err);
+			if (err >= 0)
+				engine->channelKernel = clCreateKernel(engine->program, CHANNEL_KERNEL_FUNC, &err);
+			if (err >= 0)
+				engine->imageKernel = clCreateKernel(engine->program, IMAGE_KERNEL_FUNC, &err);
+			if (err >= 0)
+				engine->splitKernel = clCreateKernel(engine->program, SPLIT_KERNEL_FUNC, &err);
+			if (err >= 0)
+				engine->reduceKernel = clCreateKernel(engine->program, REDUCE_KERNEL_FUNC, &err);
+		}
+		else
+			err = CL_SUCCESS;
+		if (err >= 0)
+			engine->singleKernel = clCreateKernel(engine->program, SINGLE_KERNEL_FUNC, &err);
+		if (err >= 0)
+			engine->doubleSingleKernel = clCreateKernel(engine->program, DOUBLE_SINGLE_KERNEL_FUNC, &err);
+		if (err < 0) {
+			perror("Couldn't create a kernel");
+			release_engine_kernels(engine);
+			return DFT_ERROR_PROGRAM;
+		};
 
-	// Scalar from meters to wavelengths
-	double wavelengthScalar = config->frequency_hz / C;
+		// Largest work-group every tiled kernel may be launched with on this device
+		cl_kernel tiled_kernels[4] = { engine->tiledKernel, engine->singleKernel, engine->doubleSingleKernel,
+			engine->splitKernel };
+		size_t fit = engine->tileSize;
+		for (int k = 0; k < 4; ++k)
+		{
+			size_t limit = 0;
+			if (tiled_kernels[k] == NULL)
+				continue;
+			err = clGetKernelWorkGroupInfo(tiled_kernels[k], engine->device, CL_KERNEL_WORK_GROUP_SIZE,
+				sizeof(size_t), &limit, NULL);
+			if (err < 0 || limit == 0)
+				limit = 1;
+			if (limit < fit)
+				fit = limit;
+		}
+		if (fit == engine->tileSize)
+			break;
 
-	// Record individual visibilities
-	for (int n = 0; n < config->numVisibilities; ++n)
-	{
-		// u, v, w, real, imag
-		fprintf(file, "%f %f %f %f %f %f\n", visibilities[n].u / wavelengthScalar,
-			visibilities[n].v / wavelengthScalar,
-			visibilities[n].w / wavelengthScalar,
-			visIntensity[n].real,
-			visIntensity[n].imaginary,
-			1.0);
+		printf(">>> WARNING: Tiled kernels support at most %zu work-items, rebuilding...\n\n", fit);
+		release_engine_kernels(engine);
+		engine->tileSize = fit;
 	}
 
-	// Clean up
-	fclose(file);
+	// The counters cover this build only, so each is added to the lifetime totals once
+	if (config->kernel_cache_dir != NULL && config->kernel_cache_dir[0] != '\0')
+		kernel_cache_report(config->kernel_cache_dir, &engine->kernelCache, config->enable_messages);
+	memset(&engine->kernelCache, 0, sizeof(engine->kernelCache));
+
 	if(config->enable_messages)
-		printf(">>> UPDATE: Completed writing of visibilities to file...\n\n");
+		printf(">>> UPDATE: Built kernels (%s)...\n\n", options);
+	return DFT_SUCCESS;
 }
-double randomInRange(double min, double max)
+
+/* Release the program and kernels created by build_engine_kernels */
+static void release_engine_kernels(DFT_Engine *engine)
 {
-	double range = (max - min);
-	double div = RAND_MAX / range;
-	return min + (rand() / div);
+	if (engine->kernel)             clReleaseKernel(engine->kernel);
+	if (engine->tiledKernel)        clReleaseKernel(engine->tiledKernel);
+	if (engine->singleKernel)       clReleaseKernel(engine->singleKernel);
+	if (engine->doubleSingleKernel) clReleaseKernel(engine->doubleSingleKernel);
+	if (engine->channelKernel)      clReleaseKernel(engine->channelKernel);
+	if (engine->imageKernel)        clReleaseKernel(engine->imageKernel);
+	if (engine->splitKernel)        clReleaseKernel(engine->splitKernel);
+	if (engine->reduceKernel)       clReleaseKernel(engine->reduceKernel);
+	if (engine->program)            clReleaseProgram(engine->program);
+	engine->kernel = NULL;
+	engine->tiledKernel = NULL;
+	engine->singleKernel = NULL;
+	engine->doubleSingleKernel = NULL;
+	engine->channelKernel = NULL;
+	engine->imageKernel = NULL;
+	engine->splitKernel = NULL;
+	engine->reduceKernel = NULL;
+	engine->program = NULL;
 }
 
-double sampleNormal()
+/* Find every GPU and accelerator on every platform
+
+OpenCL CPU devices are left out: the native backend already drives every
+core and the two would only compete for them. Returns the device count.
+*/
+static int enumerate_devices(cl_device_id *devices, int max_devices)
 {
-	double u = ((double)rand() / RAND_MAX) * 2 - 1;
-	double v = ((double)rand() / RAND_MAX) * 2 - 1;
-	double r = u*u + v*v;
-	if (r <= 0 || r > 1)
-		return sampleNormal();
+	cl_uint num_platforms = 0;
+	if (clGetPlatformIDs(0, NULL, &num_platforms) < 0 || num_platforms == 0)
+		return 0;
+
+	cl_platform_id *platforms = (cl_platform_id*)malloc(num_platforms * sizeof(cl_platform_id));
+	if (platforms == NULL)
+		return 0;
+	clGetPlatformIDs(num_platforms, platforms, NULL);
+
+	int count = 0;
+	for (cl_uint p = 0; p < num_platforms && count < max_devices; ++p)
+	{
+		cl_uint found = 0;
+		if (clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_GPU | CL_DEVICE_TYPE_ACCELERATOR,
+			max_devices - count, devices + count, &found) < 0)
+			continue;
+		count += ((int) found < max_devices - count) ? (int) found : max_devices - count;
+	}
+
+	free(platforms);
+	return count;
+}
+
+/* OpenCL devices the configured backend would drive
+
+Every GPU and accelerator for DFT_BACKEND_MULTI, the device create_device
+finds for DFT_BACKEND_OPENCL and DFT_BACKEND_AUTO, and none for
+DFT_BACKEND_CPU. Returns the device count.
+*/
+int find_backend_devices(Config *config, cl_device_id *devices, int max_devices)
+{
+	if (config->compute_backend == DFT_BACKEND_CPU || max_devices <= 0)
+		return 0;
+	if (config->compute_backend == DFT_BACKEND_MULTI)
+		return enumerate_devices(devices, max_devices);
+
+	devices[0] = create_device();
+	return (devices[0] != NULL) ? 1 : 0;
+}
+
+/* Create an engine driving a single OpenCL device, or the native CPU
+backend when `device` is NULL
+
+Returns a DFT_Status; on failure whatever was created is released and
+*created is NULL.
+*/
+int create_device_engine(Config *config, cl_device_id device, DFT_Engine **created)
+{
+	cl_int err;
+
+	*created = NULL;
+	DFT_Engine *engine = (DFT_Engine*)calloc(1, sizeof(DFT_Engine));
+	if (engine == NULL) {
+		perror("Couldn't allocate the engine");
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+	engine->numThreads = config->num_threads;
+	engine->device = device;
+
+	if (engine->device == NULL) {
+		engine->backend = DFT_BACKEND_CPU;
+		engine->precision = DFT_PRECISION_DOUBLE;
+		snprintf(engine->deviceName, sizeof(engine->deviceName), "native CPU (%s, %d threads)",
+			cpu_simd_level(), (engine->numThreads > 0) ? engine->numThreads : cpu_default_thread_count());
+		if(config->enable_messages)
+			printf(">>> UPDATE: DFT engine using %s backend...\n\n", engine->deviceName);
+		*created = engine;
+		return DFT_SUCCESS;
+	}
+	engine->backend = DFT_BACKEND_OPENCL;
+	clGetDeviceInfo(engine->device, CL_DEVICE_NAME, sizeof(engine->deviceName) - 1, engine->deviceName, NULL);
+
+	/* Create device and context
+
+	Creates a context containing only one device — the device structure
+	created earlier.
+	*/
+	engine->context = clCreateContext(NULL, 1, &engine->device, NULL, NULL, &err);
+	if (err < 0) {
+		perror("Couldn't create a context");
+		destroy_dft_engine(engine);
+		return DFT_ERROR_DEVICE;
+	}
+
+	/* Build program
+
+	Without cl_khr_fp64 only the reduced precision kernels are compiled, and
+	a request for double precision falls back to double-single.
+	*/
+	int fp64 = device_supports_fp64(engine->device);
+	size_t max_work_group = 0;
+	engine->precision = config->precision_mode;
+	if (!fp64 && engine->precision == DFT_PRECISION_DOUBLE)
+	{
+		printf(">>> WARNING: Device lacks cl_khr_fp64, using double-single precision...\n\n");
+		engine->precision = DFT_PRECISION_DOUBLE_SINGLE;
+	}
+	engine->fp64 = fp64;
+	engine->zeroW = config->force_zero_w_term;
+	engine->tileSize = (config->work_group_size > 0) ? (size_t) config->work_group_size : 1;
+	engine->kernelVariant = config->kernel_variant;
+	engine->sourceSplit = config->source_split;
+	clGetDeviceInfo(engine->device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &max_work_group, NULL);
+	clGetDeviceInfo(engine->device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &engine->computeUnits, NULL);
+
+	// Launch parameters found by `dft --tune` for this device replace the configured ones
+	TuneProfile profile;
+	if (config->tune_profile_dir != NULL && config->tune_profile_dir[0] != '\0'
+		&& tune_profile_load(config->tune_profile_dir, engine->device, engine->precision, &profile))
+	{
+		engine->tileSize = (size_t) profile.workGroupSize;
+		engine->kernelVariant = profile.kernelVariant;
+		engine->sourceSplit = profile.sourceSplit;
+		if(config->enable_messages)
+			printf(">>> UPDATE: Using the tuning profile of %s (%s kernel, work-group size %d)...\n\n",
+				engine->deviceName, (profile.kernelVariant == DFT_KERNEL_BASIC) ? "basic" : "tiled",
+				profile.workGroupSize);
+	}
+	if (max_work_group > 0 && engine->tileSize > max_work_group)
+		engine->tileSize = max_work_group;
+
+	int specialize = (config->numSources > 0 && config->numSources <= SPECIALIZE_SOURCE_LIMIT)
+		? config->numSources : 0;
+	int status = build_engine_kernels(engine, config, specialize);
+	if (status != DFT_SUCCESS) {
+		destroy_dft_engine(engine);
+		return status;
+	}
+
+	/* Create a command queue
+
+	Profiling is enabled so that kernel time can be reported; the queue does
+	not support out-of-order-execution
+	*/
+	engine->queue = clCreateCommandQueue(engine->context, engine->device, CL_QUEUE_PROFILING_ENABLE, &err);
+	if (err < 0) {
+		perror("Couldn't create a command queue");
+		engine->queue = NULL;
+		destroy_dft_engine(engine);
+		return DFT_ERROR_DEVICE;
+	};
+
+	/* Choose how data reaches the device
+
+	An integrated GPU or a CPU device reads host memory directly, so its
+	buffers are allocated host-accessible and mapped; a discrete device is
+	still copied to, but from pinned staging memory.
+	*/
+	cl_bool unified = CL_FALSE;
+	clGetDeviceInfo(engine->device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, NULL);
+	engine->zeroCopy = config->zero_copy && unified;
+	engine->pinnedStaging = config->zero_copy;
+
+	if(config->enable_messages && config->zero_copy)
+		printf(">>> UPDATE: Transfers use %s...\n\n", engine->zeroCopy ? "mapped device buffers" : "pinned staging memory");
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: DFT engine initialised...\n\n");
+
+	*created = engine;
+	return DFT_SUCCESS;
+}
+
+/* Create an engine spreading work over every device
+
+One worker engine is created per GPU or accelerator, plus one for the
+native CPU backend with the cores not needed to drive the devices.
+extract_visibilities then hands chunks of visibilities to the workers
+through the work-stealing scheduler in dft_scheduler.c.
+*/
+static int create_multi_engine(Config *config, DFT_Engine **created)
+{
+	cl_device_id devices[MULTI_MAX_DEVICES];
+	int num_devices = enumerate_devices(devices, MULTI_MAX_DEVICES);
+
+	*created = NULL;
+	DFT_Engine *engine = (DFT_Engine*)calloc(1, sizeof(DFT_Engine));
+	DFT_Engine **workers = (DFT_Engine**)calloc(num_devices + 1, sizeof(DFT_Engine*));
+	if (engine == NULL || workers == NULL) {
+		perror("Couldn't allocate the engine");
+		free(engine);
+		free(workers);
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+	engine->backend = DFT_BACKEND_MULTI;
+	engine->workers = workers;
+	engine->numThreads = config->num_threads;
+	snprintf(engine->deviceName, sizeof(engine->deviceName), "%d devices", num_devices + 1);
+
+	// Each device keeps one host thread busy feeding it
+	Config cpu_config = *config;
+	if (cpu_config.num_threads <= 0)
+		cpu_config.num_threads = cpu_default_thread_count() - num_devices;
+	if (cpu_config.num_threads < 1)
+		cpu_config.num_threads = 1;
+
+	int status = DFT_SUCCESS;
+	for (int d = 0; d <= num_devices && status == DFT_SUCCESS; ++d)
+	{
+		status = (d < num_devices) ? create_device_engine(config, devices[d], &engine->workers[d])
+			: create_device_engine(&cpu_config, NULL, &engine->workers[d]);
+		if (status == DFT_SUCCESS)
+			engine->numWorkers++;
+	}
+	if (status != DFT_SUCCESS) {
+		destroy_dft_engine(engine);
+		return status;
+	}
+
+	// Report the least precise arithmetic any worker uses
+	engine->precision = DFT_PRECISION_DOUBLE;
+	for (int w = 0; w < engine->numWorkers; ++w)
+		if (engine->workers[w]->precision != DFT_PRECISION_DOUBLE)
+			engine->precision = engine->workers[w]->precision;
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: DFT engine spreading work over %d OpenCL devices and the native CPU...\n\n",
+			num_devices);
+
+	*created = engine;
+	return DFT_SUCCESS;
+}
+
+/* Create the long-lived execution engine
+
+Performs the device discovery, context creation, program compilation and
+kernel creation once. Device buffers are allocated lazily by
+extract_visibilities and grown as larger inputs are presented. Returns a
+DFT_Status, with *engine NULL unless it is DFT_SUCCESS.
+*/
+int try_create_dft_engine(Config *config, DFT_Engine **engine)
+{
+	if (config->compute_backend == DFT_BACKEND_MULTI)
+		return create_multi_engine(config, engine);
+
+	cl_device_id device = NULL;
+	if (config->compute_backend != DFT_BACKEND_CPU)
+		device = create_device();
+	if (device == NULL && config->compute_backend == DFT_BACKEND_OPENCL)
+	{
+		*engine = NULL;
+		return DFT_ERROR_NO_DEVICE;
+	}
+
+	return create_device_engine(config, device, engine);
+}
+
+// As try_create_dft_engine, NULL on failure
+DFT_Engine* create_dft_engine(Config *config)
+{
+	DFT_Engine *engine = NULL;
+	try_create_dft_engine(config, &engine);
+	return engine;
+}
+
+void destroy_dft_engine(DFT_Engine *engine)
+{
+	if (engine == NULL)
+		return;
+
+	if (engine->backend == DFT_BACKEND_MULTI) {
+		for (int w = 0; w < engine->numWorkers; ++w)
+			destroy_dft_engine(engine->workers[w]);
+		free(engine->workers);
+		free(engine->packedSources);
+		free(engine->reducedSources);
+		free(engine->stagingVisibilities);
+		free(engine->stagingIntensities);
+		free(engine);
+		return;
+	}
+
+	if (engine->backend == DFT_BACKEND_CPU) {
+		free(engine->packedSources);
+		free(engine->reducedSources);
+		free(engine->stagingVisibilities);
+		free(engine->stagingIntensities);
+		free(engine);
+		return;
+	}
+
+	/* Deallocate resources
+
+	Also releases a partly created engine, whose queue or context may be NULL.
+	The queue is drained before the host arrays are freed, as a non-blocking
+	transfer that an error path never waited on may still be reading them.
+	*/
+	if (engine->pinnedVisibilities)
+		clEnqueueUnmapMemObject(engine->queue, engine->pinnedVisibilities, engine->stagingVisibilities, 0, NULL, NULL);
+	if (engine->pinnedIntensities)
+		clEnqueueUnmapMemObject(engine->queue, engine->pinnedIntensities, engine->stagingIntensities, 0, NULL, NULL);
+	if (engine->queue)
+		clFinish(engine->queue);
+	if (engine->sourceUpload) clReleaseEvent(engine->sourceUpload);
+	if (!engine->pinnedVisibilities) free(engine->stagingVisibilities);
+	if (!engine->pinnedIntensities)  free(engine->stagingIntensities);
+	free(engine->packedSources);
+	free(engine->reducedSources);
+	if (engine->pinnedVisibilities) clReleaseMemObject(engine->pinnedVisibilities);
+	if (engine->pinnedIntensities)  clReleaseMemObject(engine->pinnedIntensities);
+	if (engine->deviceSources)      clReleaseMemObject(engine->deviceSources);
+	if (engine->deviceVisibilities) clReleaseMemObject(engine->deviceVisibilities);
+	if (engine->deviceIntensities)  clReleaseMemObject(engine->deviceIntensities);
+	if (engine->deviceChannels)     clReleaseMemObject(engine->deviceChannels);
+	if (engine->deviceImage)        clReleaseMemObject(engine->deviceImage);
+	if (engine->devicePartials)     clReleaseMemObject(engine->devicePartials);
+	release_engine_kernels(engine);
+	if (engine->uploadQueue)   clReleaseCommandQueue(engine->uploadQueue);
+	if (engine->readbackQueue) clReleaseCommandQueue(engine->readbackQueue);
+	if (engine->queue)         clReleaseCommandQueue(engine->queue);
+	if (engine->context)       clReleaseContext(engine->context);
+	free(engine);
+}
+
+/* Ensure a device buffer can hold at least `required` bytes
+
+Buffers only ever grow, and grow geometrically, so that a sequence of
+predictions of similar size settles on a single allocation. Returns a
+DFT_Status.
+*/
+static int reserve_device_buffer(DFT_Engine *engine, cl_mem *buffer, size_t *capacity,
+	size_t required, cl_mem_flags flags)
+{
+	cl_int err;
+
+	if (*buffer != NULL && *capacity >= required)
+		return DFT_SUCCESS;
+
+	size_t new_capacity = (*capacity > 0) ? *capacity : required;
+	while (new_capacity < required)
+		new_capacity *= 2;
+
+	if (*buffer != NULL)
+		clReleaseMemObject(*buffer);
+
+	// Host-accessible so that a unified memory device's buffers map without a copy
+	if (engine->zeroCopy)
+		flags |= CL_MEM_ALLOC_HOST_PTR;
+
+	*buffer = clCreateBuffer(engine->context, flags, new_capacity, NULL, &err);
+	if (err < 0) {
+		perror("Couldn't create a buffer");
+		*buffer = NULL;
+		*capacity = 0;
+		return DFT_ERROR_DEVICE;
+	};
+	*capacity = new_capacity;
+	return DFT_SUCCESS;
+}
+
+/* Host-side counterpart of reserve_device_buffer for staging arrays, aligned
+for SIMD and DMA; NULL when out of memory */
+static void* reserve_host_buffer(void **buffer, size_t *capacity, size_t required)
+{
+	if (*buffer != NULL && *capacity >= required)
+		return *buffer;
+
+	free(*buffer);
+	*capacity = 0;
+	*buffer = dft_aligned_alloc(required);
+	if (*buffer == NULL) {
+		perror("Couldn't allocate a staging buffer");
+		return NULL;
+	}
+	*capacity = required;
+	return *buffer;
+}
+
+/* Source terms for the reduced precision kernels
+
+Computed in double exactly as in packSources, but with l, m and n left in
+turns, then rounded to the kernel's representation.
+*/
+static void pack_sources_single(Source *sources, PackedSourceSingle *packed, int numSources)
+{
+	for (int s = 0; s < numSources; ++s)
+	{
+		double term = 0.5 * (sources[s].l * sources[s].l + sources[s].m * sources[s].m);
+		packed[s].l = (float) sources[s].l;
+		packed[s].m = (float) sources[s].m;
+		packed[s].n = (float) -term;
+		packed[s].flux = (float) (sources[s].intensity / (1.0 - term));
+	}
+}
+
+static void pack_sources_double_single(Source *sources, PackedSourceDoubleSingle *packed, int numSources)
+{
+	for (int s = 0; s < numSources; ++s)
+	{
+		double term = 0.5 * (sources[s].l * sources[s].l + sources[s].m * sources[s].m);
+		packed[s].l_hi = (float) sources[s].l;
+		packed[s].m_hi = (float) sources[s].m;
+		packed[s].n_hi = (float) -term;
+		packed[s].l_lo = (float) (sources[s].l - packed[s].l_hi);
+		packed[s].m_lo = (float) (sources[s].m - packed[s].m_hi);
+		packed[s].n_lo = (float) (-term - packed[s].n_hi);
+		packed[s].flux = (float) (sources[s].intensity / (1.0 - term));
+		packed[s].pad = 0.0f;
+	}
+}
+
+/* FNV-1a over the raw source records, used to recognise an unchanged sky model */
+static unsigned long long source_checksum(Source *sources, int numSources)
+{
+	const unsigned char *bytes = (const unsigned char*) sources;
+	size_t length = numSources * sizeof(Source);
+	unsigned long long hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < length; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Monotonic host time in seconds
+static double engine_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* Pack and upload the sky model, unless the engine already holds these sources
+
+Repeated predictions against the same sources (e.g. calibration loops)
+therefore skip both the packing and the host to device transfer. Returns
+a DFT_Status; after a failure the engine holds no sky model.
+*/
+static int update_sky_model(DFT_Engine *engine, Config *config, Source *sources)
+{
+	cl_int err;
+	int numSources = config->numSources;
+	unsigned long long checksum = source_checksum(sources, numSources);
+
+	if (engine->skyModelValid && engine->numPackedSources == numSources
+		&& engine->skyModelChecksum == checksum)
+		return DFT_SUCCESS;
+
+	// A previous upload may still be reading the host arrays that are
+	// reallocated or repacked below, e.g. when the extract that followed it
+	// failed before anything waited on the queue
+	if (engine->sourceUpload != NULL)
+	{
+		clWaitForEvents(1, &engine->sourceUpload);
+		clReleaseEvent(engine->sourceUpload);
+		engine->sourceUpload = NULL;
+	}
+
+	engine->skyModelValid = 0;
+	if (numSources > engine->packedSourceCapacity)
+	{
+		free(engine->packedSources);
+		engine->packedSourceCapacity = 0;
+		engine->packedSources = (PackedSource*)malloc(numSources * sizeof(PackedSource));
+		if (engine->packedSources == NULL) {
+			perror("Couldn't allocate the packed sources");
+			return DFT_ERROR_OUT_OF_MEMORY;
+		}
+		engine->packedSourceCapacity = numSources;
+	}
+
+	double packing = trace_now();
+	packSources(sources, engine->packedSources, numSources);
+	trace_host("pack sky model", TRACE_HOST, packing);
+	engine->numPackedSources = numSources;
+	engine->skyModelChecksum = checksum;
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Packed sky model of %d sources...\n\n", numSources);
+
+	if (engine->backend != DFT_BACKEND_OPENCL)
+	{
+		engine->skyModelValid = 1;
+		return DFT_SUCCESS;
+	}
+
+	// A kernel specialized to another sky model size cannot run this one, so
+	// fall back to the general kernels for the rest of the engine's life
+	// (also retrying a rebuild that failed)
+	if (engine->program == NULL || (engine->specializedSources != 0 && engine->specializedSources != numSources))
+	{
+		if(config->enable_messages)
+			printf(">>> UPDATE: Sky model size changed, rebuilding general kernels...\n\n");
+		release_engine_kernels(engine);
+		int status = build_engine_kernels(engine, config, 0);
+		if (status != DFT_SUCCESS)
+			return status;
+	}
+
+	// The device copy uses the layout of the engine's precision
+	void *deviceLayout = engine->packedSources;
+	size_t sourceBytes = numSources * sizeof(PackedSource);
+	if (engine->precision == DFT_PRECISION_SINGLE)
+	{
+		sourceBytes = numSources * sizeof(PackedSourceSingle);
+		deviceLayout = reserve_host_buffer(&engine->reducedSources, &engine->reducedSourceCapacity, sourceBytes);
+		if (deviceLayout == NULL)
+			return DFT_ERROR_OUT_OF_MEMORY;
+		pack_sources_single(sources, (PackedSourceSingle*) deviceLayout, numSources);
+	}
+	else if (engine->precision == DFT_PRECISION_DOUBLE_SINGLE)
+	{
+		sourceBytes = numSources * sizeof(PackedSourceDoubleSingle);
+		deviceLayout = reserve_host_buffer(&engine->reducedSources, &engine->reducedSourceCapacity, sourceBytes);
+		if (deviceLayout == NULL)
+			return DFT_ERROR_OUT_OF_MEMORY;
+		pack_sources_double_single(sources, (PackedSourceDoubleSingle*) deviceLayout, numSources);
+	}
+
+	if (reserve_device_buffer(engine, &engine->deviceSources, &engine->sourceCapacity,
+		sourceBytes, CL_MEM_READ_ONLY) != DFT_SUCCESS)
+		return DFT_ERROR_DEVICE;
+
+	// The next update waits on this event before touching the host array
+	err = clEnqueueWriteBuffer(engine->queue, engine->deviceSources, CL_FALSE, 0,
+		sourceBytes, deviceLayout, 0, NULL, &engine->sourceUpload); // <=====INPUT
+	if (err < 0) {
+		perror("Couldn't write the buffers");
+		engine->sourceUpload = NULL;
+		return DFT_ERROR_DEVICE;
+	}
+	trace_device("upload sources", TRACE_TRANSFER, engine->sourceUpload, TRACE_TRACK_QUEUE);
+	engine->skyModelValid = 1;
+	return DFT_SUCCESS;
+}
+
+/* Kernel and element sizes for the engine's precision and kernel variant */
+static KernelLayout kernel_layout(DFT_Engine *engine)
+{
+	KernelLayout layout;
+
+	if (engine->precision == DFT_PRECISION_SINGLE)
+	{
+		layout.kernel = engine->singleKernel;
+		layout.visibilitySize = sizeof(VisibilitySingle);
+		layout.intensitySize = sizeof(cl_float2);
+		layout.tileSize = sizeof(PackedSourceSingle);
+	}
+	else if (engine->precision == DFT_PRECISION_DOUBLE_SINGLE)
+	{
+		layout.kernel = engine->doubleSingleKernel;
+		layout.visibilitySize = sizeof(VisibilityDoubleSingle);
+		layout.intensitySize = sizeof(cl_float4);
+		layout.tileSize = sizeof(PackedSourceDoubleSingle);
+	}
+	else
+	{
+		layout.kernel = (engine->kernelVariant == DFT_KERNEL_TILED) ? engine->tiledKernel : engine->kernel;
+		layout.visibilitySize = 3 * sizeof(double);
+		layout.intensitySize = 2 * sizeof(double);
+		layout.tileSize = sizeof(PackedSource);
+	}
+	layout.tiled = (layout.kernel != engine->kernel);
+	layout.soa = (engine->precision == DFT_PRECISION_DOUBLE);
+
+	return layout;
+}
+
+/* Bytes of `count` visibilities and intensities in the layout's buffers */
+static size_t layout_visibility_bytes(KernelLayout *layout, int count)
+{
+	return layout->soa ? visibility_arrays_bytes(count) : count * layout->visibilitySize;
+}
+
+static size_t layout_intensity_bytes(KernelLayout *layout, int count)
+{
+	return layout->soa ? intensity_arrays_bytes(count) : count * layout->intensitySize;
+}
+
+/* Convert visibilities into the layout of the engine's kernel
+
+Double precision gathers them into a structure-of-arrays block.
+*/
+static void stage_visibilities(int precision, Visibility *visibilities, void *staged, int count)
+{
+	if (precision == DFT_PRECISION_DOUBLE)
+	{
+		VisibilityArrays arrays;
+		visibility_arrays_view(&arrays, (double*) staged, count);
+		gather_visibilities(&arrays, visibilities, count);
+	}
+	else if (precision == DFT_PRECISION_SINGLE)
+	{
+		VisibilitySingle *out = (VisibilitySingle*) staged;
+		for (int i = 0; i < count; ++i)
+		{
+			out[i].u = (float) visibilities[i].u;
+			out[i].v = (float) visibilities[i].v;
+			out[i].w = (float) visibilities[i].w;
+			out[i].pad = 0.0f;
+		}
+	}
+	else if (precision == DFT_PRECISION_DOUBLE_SINGLE)
+	{
+		VisibilityDoubleSingle *out = (VisibilityDoubleSingle*) staged;
+		for (int i = 0; i < count; ++i)
+		{
+			out[i].u_hi = (float) visibilities[i].u;
+			out[i].v_hi = (float) visibilities[i].v;
+			out[i].w_hi = (float) visibilities[i].w;
+			out[i].u_lo = (float) (visibilities[i].u - out[i].u_hi);
+			out[i].v_lo = (float) (visibilities[i].v - out[i].v_hi);
+			out[i].w_lo = (float) (visibilities[i].w - out[i].w_hi);
+			out[i].pad_hi = 0.0f;
+			out[i].pad_lo = 0.0f;
+		}
+	}
+}
+
+/* Add the sums written by the kernel to the caller's totals */
+static void accumulate_sums(int precision, void *sums, Complex *visIntensity, int count)
+{
+	float *values = (float*) sums;
+
+	if (precision == DFT_PRECISION_DOUBLE)
+	{
+		IntensityArrays arrays;
+		intensity_arrays_view(&arrays, (double*) sums, count);
+		add_intensities(&arrays, visIntensity, count);
+	}
+	else if (precision == DFT_PRECISION_SINGLE)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			visIntensity[i].real += values[2 * i];
+			visIntensity[i].imaginary += values[2 * i + 1];
+		}
+	}
+	else if (precision == DFT_PRECISION_DOUBLE_SINGLE)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			visIntensity[i].real += (double) values[4 * i] + (double) values[4 * i + 1];
+			visIntensity[i].imaginary += (double) values[4 * i + 2] + (double) values[4 * i + 3];
+		}
+	}
+}
+
+/* Slices of the source axis for a two-dimensional launch, 0 for a 1D one
+
+A 1D launch runs one work-item per visibility, which leaves a device idle
+when there are fewer visibilities than it has lanes to fill. Below half
+of SPLIT_ITEMS_PER_UNIT work-items per compute unit, each visibility gets
+enough work-groups of `local` work-items to make up the difference, as
+long as every work-item still has a source to evaluate.
+*/
+static int choose_source_slices(int sourceSplit, cl_uint computeUnits, size_t local, int count, int numSources)
+{
+	if (sourceSplit < 0 || count <= 0 || numSources <= 0 || local == 0)
+		return 0;
+
+	size_t target = (size_t) ((computeUnits > 0) ? computeUnits : 1) * SPLIT_ITEMS_PER_UNIT;
+	if (sourceSplit == 0 && ((size_t) count * 2 >= target || (size_t) numSources < local))
+		return 0;
+
+	size_t wanted = (target + (size_t) count * local - 1) / ((size_t) count * local);
+	size_t most = ((size_t) numSources + local - 1) / local;
+	if (wanted > most)
+		wanted = most;
+	return (wanted > 0) ? (int) wanted : 1;
+}
+
+/* Enqueue DFT_OpenCL_Split and DFT_Reduce_Slices over `slices` slices
+
+Both run on `queue`, which is in-order, so the reduction follows the split
+kernel and the partial sums buffer is only reused once both have run.
+`event` is that of the reduction.
+*/
+static cl_int enqueue_split_kernel(DFT_Engine *engine, cl_command_queue queue, cl_mem deviceVisibilities,
+	cl_mem deviceIntensities, int count, int slices, cl_uint numWaitEvents, const cl_event *waitEvents,
+	cl_event *event)
+{
+	cl_int err;
+
+	if (reserve_device_buffer(engine, &engine->devicePartials, &engine->partialCapacity,
+		(size_t) slices * intensity_arrays_bytes(count), CL_MEM_READ_WRITE) != DFT_SUCCESS)
+		return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+
+	size_t local_size[2] = { engine->tileSize, 1 };
+	size_t global_size[2] = { (size_t) slices * engine->tileSize, (size_t) count };
+	int sliceSources = (engine->numPackedSources + slices - 1) / slices;
+
+	err = clSetKernelArg(engine->splitKernel, 0, sizeof(cl_mem), (void *)&deviceVisibilities);
+	err |= clSetKernelArg(engine->splitKernel, 1, sizeof(cl_mem), (void *)&engine->devicePartials);
+	err |= clSetKernelArg(engine->splitKernel, 2, sizeof(int), &count);
+	err |= clSetKernelArg(engine->splitKernel, 3, sizeof(cl_mem), (void *)&engine->deviceSources);
+	err |= clSetKernelArg(engine->splitKernel, 4, sizeof(int), &engine->numPackedSources);
+	err |= clSetKernelArg(engine->splitKernel, 5, engine->tileSize * sizeof(cl_double2), NULL);
+	err |= clSetKernelArg(engine->splitKernel, 6, sizeof(int), &sliceSources);
+	err |= clSetKernelArg(engine->reduceKernel, 0, sizeof(cl_mem), (void *)&engine->devicePartials);
+	err |= clSetKernelArg(engine->reduceKernel, 1, sizeof(cl_mem), (void *)&deviceIntensities);
+	err |= clSetKernelArg(engine->reduceKernel, 2, sizeof(int), &count);
+	err |= clSetKernelArg(engine->reduceKernel, 3, sizeof(int), &slices);
+	if (err < 0) {
+		perror("Couldn't create a kernel argument");
+		return err;
+	}
+
+	err = clEnqueueNDRangeKernel(queue, engine->splitKernel, 2, NULL, global_size, local_size,
+		numWaitEvents, waitEvents, NULL);
+	if (err < 0)
+		return err;
+
+	size_t reduce_size = count;
+	return clEnqueueNDRangeKernel(queue, engine->reduceKernel, 1, NULL, &reduce_size, NULL, 0, NULL, event);
+}
+
+/* Set the kernel arguments and enqueue the DFT over `count` visibilities
+
+The tiled kernels hold one source per work-item in local memory and need
+an explicit work-group size, so their global size is rounded up to a
+whole number of work-groups.
+*/
+static cl_int enqueue_dft_kernel(DFT_Engine *engine, KernelLayout *layout,
+	cl_command_queue queue, cl_mem deviceVisibilities, cl_mem deviceIntensities, int count,
+	cl_uint numWaitEvents, const cl_event *waitEvents, cl_event *event)
+{
+	cl_int err;
+	cl_kernel kernel = layout->kernel;
+
+	// Few visibilities spread over the source axis as well
+	int slices = (layout->soa && engine->splitKernel != NULL) ? choose_source_slices(engine->sourceSplit,
+		engine->computeUnits, engine->tileSize, count, engine->numPackedSources) : 0;
+	if (slices > 0)
+		return enqueue_split_kernel(engine, queue, deviceVisibilities, deviceIntensities, count, slices,
+			numWaitEvents, waitEvents, event);
+
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&deviceVisibilities);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&deviceIntensities);
+	err |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &count);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), (void *)&engine->deviceSources);
+	err |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &engine->numPackedSources);
+
+	// The tiled kernels are compiled for exactly this work-group size
+	size_t local_size = engine->tileSize;
+	if (layout->tiled)
+		err |= clSetKernelArg(kernel, 5, local_size * layout->tileSize, NULL);
+
+	if (err < 0) {
+		perror("Couldn't create a kernel argument");
+		return err;
+	}
+
+	/* Enqueue kernel
+
+	   At this point, the application has created all the data structures
+	   (device, kernel, program, command queue, and context) needed by an
+	   OpenCL host application. Now, it deploys the kernel to a device.
+
+	   Of the OpenCL functions that run on the host, clEnqueueNDRangeKernel
+	   is probably the most important to understand. Not only does it deploy
+	   kernels to devices, it also identifies how many work-items should
+	   be generated to execute the kernel (global_size) and the number of
+	   work-items in each work-group (local_size).
+	   */
+
+	size_t global_size = count;
+	if (layout->tiled)
+	{
+		global_size = ((count + local_size - 1) / local_size) * local_size;
+		return clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size,
+			&local_size, numWaitEvents, waitEvents, event);
+	}
+
+	return clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size,
+		NULL, numWaitEvents, waitEvents, event);
+}
+
+/* Staging memory a device can transfer from directly
+
+With pinned staging the host arrays are CL_MEM_ALLOC_HOST_PTR buffers kept
+mapped for the engine's life: the driver allocates them page-locked, so
+copies to and from the device go by DMA without a bounce through a driver
+buffer. Otherwise, or if the driver refuses, they are aligned pageable
+memory. NULL when even that cannot be allocated; the staging_ wrappers
+exit instead.
+*/
+static void* reserve_staging_buffer(DFT_Engine *engine, void **host, cl_mem *pinned, size_t *capacity,
+	size_t required)
+{
+	cl_int err;
+
+	if (*host != NULL && *capacity >= required)
+		return *host;
+
+	if (*pinned != NULL)
+	{
+		clEnqueueUnmapMemObject(engine->queue, *pinned, *host, 0, NULL, NULL);
+		clFinish(engine->queue);
+		clReleaseMemObject(*pinned);
+		*pinned = NULL;
+		*host = NULL;
+		*capacity = 0;
+	}
+
+	if (engine->pinnedStaging)
+	{
+		*pinned = clCreateBuffer(engine->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, required, NULL, &err);
+		if (err >= 0)
+		{
+			void *mapped = clEnqueueMapBuffer(engine->queue, *pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
+				required, 0, NULL, NULL, &err);
+			if (err >= 0)
+			{
+				free(*host);
+				*host = mapped;
+				*capacity = required;
+				return *host;
+			}
+			clReleaseMemObject(*pinned);
+		}
+		*pinned = NULL;
+		engine->pinnedStaging = 0;
+		printf(">>> WARNING: Couldn't map pinned staging memory, copying through pageable memory...\n\n");
+	}
+
+	return reserve_host_buffer(host, capacity, required);
+}
+
+// The engine's staging arrays; NULL when out of memory
+static void* staging_visibilities(DFT_Engine *engine, size_t required)
+{
+	return reserve_staging_buffer(engine, &engine->stagingVisibilities, &engine->pinnedVisibilities,
+		&engine->stagingVisibilityCapacity, required);
+}
+
+static void* staging_intensities(DFT_Engine *engine, size_t required)
+{
+	return reserve_staging_buffer(engine, &engine->stagingIntensities, &engine->pinnedIntensities,
+		&engine->stagingIntensityCapacity, required);
+}
+
+// Blocking map of the first `bytes` of a device buffer into host memory; NULL on failure
+static void* map_device_buffer(DFT_Engine *engine, cl_mem buffer, cl_map_flags flags, size_t bytes)
+{
+	cl_int err;
+	void *mapped = clEnqueueMapBuffer(engine->queue, buffer, CL_TRUE, flags, 0, bytes, 0, NULL, NULL, &err);
+	if (err < 0) {
+		perror("Couldn't map a buffer");
+		return NULL;
+	}
+	return mapped;
+}
+
+static int unmap_device_buffer(DFT_Engine *engine, cl_mem buffer, void *mapped)
+{
+	if (clEnqueueUnmapMemObject(engine->queue, buffer, mapped, 0, NULL, NULL) < 0) {
+		perror("Couldn't unmap a buffer");
+		return DFT_ERROR_DEVICE;
+	}
+	return DFT_SUCCESS;
+}
+
+/* extract_visibilities on a device sharing the host's memory
+
+The device buffers were allocated with CL_MEM_ALLOC_HOST_PTR, so mapping
+them costs no copy: the visibilities are staged straight into the buffer
+the kernel reads, and the sums are accumulated straight out of the one it
+wrote. Returns a DFT_Status.
+*/
+static int zero_copy_extract_visibilities(DFT_Engine *engine, Config *config, KernelLayout *layout,
+	Visibility *visibilities, Complex *visIntensity, int numVisibilities)
+{
+	cl_int err;
+	size_t visibilityBytes = layout_visibility_bytes(layout, numVisibilities);
+	size_t intensityBytes = layout_intensity_bytes(layout, numVisibilities);
+
+	double staging = trace_now();
+	void *mapped = map_device_buffer(engine, engine->deviceVisibilities, CL_MAP_WRITE, visibilityBytes);
+	if (mapped == NULL)
+		return DFT_ERROR_DEVICE;
+	stage_visibilities(engine->precision, visibilities, mapped, numVisibilities);
+	if (unmap_device_buffer(engine, engine->deviceVisibilities, mapped) != DFT_SUCCESS)
+		return DFT_ERROR_DEVICE;
+	if (layout->soa)
+	{
+		mapped = map_device_buffer(engine, engine->deviceIntensities, CL_MAP_WRITE, intensityBytes);
+		if (mapped == NULL)
+			return DFT_ERROR_DEVICE;
+		memset(mapped, 0, intensityBytes);
+		if (unmap_device_buffer(engine, engine->deviceIntensities, mapped) != DFT_SUCCESS)
+			return DFT_ERROR_DEVICE;
+	}
+	trace_host("stage visibilities in place", TRACE_HOST, staging);
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Calling DFT GPU Kernel...\n\n");
+
+	cl_event computed;
+	err = enqueue_dft_kernel(engine, layout, engine->queue, engine->deviceVisibilities,
+		engine->deviceIntensities, numVisibilities, 0, NULL, &computed);
+	if (err < 0) {
+		perror("Couldn't enqueue the kernel");
+		return DFT_ERROR_DEVICE;
+	}
+
+	// The in-order queue maps the sums once the kernel has written them
+	double accumulating = trace_now();
+	mapped = map_device_buffer(engine, engine->deviceIntensities, CL_MAP_READ, intensityBytes);
+	if (mapped == NULL) {
+		clReleaseEvent(computed);
+		return DFT_ERROR_DEVICE;
+	}
+	if (trace_enabled())
+	{
+		trace_device("dft kernel", TRACE_COMPUTE, computed, TRACE_TRACK_QUEUE);
+		trace_sync();
+	}
+	accumulate_sums(engine->precision, mapped, visIntensity, numVisibilities);
+	err = unmap_device_buffer(engine, engine->deviceIntensities, mapped);
+	clFinish(engine->queue);
+	trace_host("accumulate sums in place", TRACE_HOST, accumulating);
+
+	cl_ulong kernel_start = 0, kernel_end = 0;
+	clGetEventProfilingInfo(computed, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &kernel_start, NULL);
+	clGetEventProfilingInfo(computed, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &kernel_end, NULL);
+	engine->kernelSeconds = (kernel_end > kernel_start) ? (kernel_end - kernel_start) * 1e-9 : 0.0;
+	clReleaseEvent(computed);
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Read Visibility Data in place - Completed...\n\n");
+	return (err < 0) ? DFT_ERROR_DEVICE : DFT_SUCCESS;
+}
+
+/* Wait for a streamed chunk to come back and queue it for writing; returns
+a DFT_Status */
+static int finish_stream_slot(DFT_Engine *engine, StreamSlot *slot, TextWriter *writer)
+{
+	double waiting = trace_now();
+	clWaitForEvents(1, &slot->readback);
+	trace_host("wait for chunk", TRACE_HOST, waiting);
+	trace_device("read back chunk", TRACE_TRANSFER, slot->readback, TRACE_TRACK_READBACK);
+	trace_sync();
+	clReleaseEvent(slot->readback);
+	slot->readback = NULL;
+
+	accumulate_sums(engine->precision, slot->sums, slot->visIntensity, slot->count);
+
+	double submitting = trace_now();
+	int status = text_writer_submit(writer, slot->visibilities, slot->visIntensity, slot->count);
+	trace_host("queue chunk output", TRACE_IO, submitting);
+	slot->busy = 0;
+	return status;
+}
+
+/* Whether extract_visibilities should grid the prediction, planned in `plan`
+
+Needs the sky model packed. A forced gridded prediction whose grid would
+be too large falls back to the exact DFT.
+*/
+static int choose_gridded(DFT_Engine *engine, Config *config, Visibility *visibilities, int numVisibilities,
+	GridPlan *plan)
+{
+	if (config->prediction_mode == DFT_PREDICT_EXACT)
+		return 0;
+
+	if (!grid_plan(plan, engine->packedSources, engine->numPackedSources, visibilities, numVisibilities,
+		config->grid_accuracy))
+	{
+		if (config->prediction_mode == DFT_PREDICT_GRIDDED)
+			printf(">>> WARNING: Gridded prediction needs a grid beyond %d cells, using the DFT...\n\n",
+				GRID_MAX_SIZE);
+		return 0;
+	}
+
+	if (config->prediction_mode == DFT_PREDICT_GRIDDED)
+		return 1;
+	return grid_gridded_cost(plan, engine->numPackedSources, numVisibilities)
+		< grid_exact_cost(engine->numPackedSources, numVisibilities);
+}
+
+/* Compare a gridded prediction with the engine's DFT on a sample of visibilities
+
+grid_cross_check visibilities spread evenly over the prediction are
+evaluated exactly (by DFT_OpenCL on an OpenCL engine). Returns the
+largest difference relative to the summed flux of the sky model, and
+warns when it exceeds grid_accuracy.
+*/
+static double check_gridded_prediction(DFT_Engine *engine, Config *config, Source *sources,
+	Visibility *visibilities, Complex *gridded, int numVisibilities)
+{
+	int count = (config->grid_cross_check < numVisibilities) ? config->grid_cross_check : numVisibilities;
+	int stride = numVisibilities / count;
+	Visibility *sample = (Visibility*)malloc(count * sizeof(Visibility));
+	Complex *exact = (Complex*)calloc(count, sizeof(Complex));
+	if (sample == NULL || exact == NULL) {
+		printf(">>> WARNING: Couldn't allocate the gridding cross-check, skipping it...\n\n");
+		free(sample);
+		free(exact);
+		return 0.0;
+	}
+	for (int k = 0; k < count; ++k)
+		sample[k] = visibilities[k * stride];
+
+	Config reference = *config;
+	reference.prediction_mode = DFT_PREDICT_EXACT;
+	reference.enable_messages = 0;
+	if (extract_visibilities(engine, &reference, sources, sample, exact, count) != DFT_SUCCESS) {
+		printf(">>> WARNING: Couldn't compute the gridding cross-check, skipping it...\n\n");
+		free(sample);
+		free(exact);
+		return 0.0;
+	}
+
+	double flux = 0.0;
+	for (int s = 0; s < engine->numPackedSources; ++s)
+		flux += fabs(engine->packedSources[s].flux);
+
+	double difference = 0.0;
+	for (int k = 0; k < count; ++k)
+		difference = fmax(difference, hypot(gridded[k * stride].real - exact[k].real,
+			gridded[k * stride].imaginary - exact[k].imaginary));
+	double error = (flux > 0.0) ? difference / flux : difference;
+
+	if (error > config->grid_accuracy)
+		printf(">>> WARNING: Gridded prediction is %.3g of the flux from the DFT, above its %.3g target...\n\n",
+			error, config->grid_accuracy);
+	else if(config->enable_messages)
+		printf(">>> INFO: Gridded prediction is within %.3g of the flux of the DFT over %d visibilities...\n\n",
+			error, count);
+
+	free(sample);
+	free(exact);
+	return error;
+}
+
+/* Predict by gridding on host threads, adding the result to visIntensity */
+static int gridded_extract_visibilities(DFT_Engine *engine, Config *config, Source *sources,
+	Visibility *visibilities, Complex *visIntensity, int numVisibilities, GridPlan *plan)
+{
+	if(config->enable_messages)
+		printf(">>> UPDATE: Gridded prediction on %d x %d cells, %d w planes, kernel support %d...\n\n",
+			plan->size, plan->size, plan->numPlanes, plan->support);
+
+	Complex *gridded = (Complex*)calloc(numVisibilities, sizeof(Complex));
+	if (gridded == NULL) {
+		perror("Couldn't allocate the gridded prediction");
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+
+	double started = engine_now();
+	int status = grid_extract_visibilities(plan, engine->packedSources, engine->numPackedSources, visibilities,
+		gridded, numVisibilities, engine->numThreads);
+	engine->kernelSeconds = engine_now() - started;
+	trace_host("gridded prediction", TRACE_COMPUTE, started);
+	if (status != DFT_SUCCESS) {
+		free(gridded);
+		return status;
+	}
+
+	if (config->grid_cross_check > 0)
+	{
+		double checking = trace_now();
+		check_gridded_prediction(engine, config, sources, visibilities, gridded, numVisibilities);
+		trace_host("cross-check gridding", TRACE_COMPUTE, checking);
+	}
+
+	for (int i = 0; i < numVisibilities; ++i)
+	{
+		visIntensity[i].real += gridded[i].real;
+		visIntensity[i].imaginary += gridded[i].imaginary;
+	}
+	free(gridded);
+	return DFT_SUCCESS;
+}
+
+/* Add the predicted visibilities of the sky model to visIntensity
+
+Returns a DFT_Status. A failure leaves visIntensity partly updated and the
+engine usable; the sky model is uploaded again by the next call.
+*/
+int extract_visibilities(DFT_Engine *engine, Config *config, Source *sources, Visibility *visibilities,
+	Complex *visIntensity, int numVisibilities)
+{
+	cl_int err;
+
+	if (numVisibilities <= 0 || config->numSources <= 0)
+		return DFT_SUCCESS;
+
+	int status = update_sky_model(engine, config, sources);
+	if (status != DFT_SUCCESS)
+		return status;
+
+	GridPlan plan;
+	if (choose_gridded(engine, config, visibilities, numVisibilities, &plan))
+		return gridded_extract_visibilities(engine, config, sources, visibilities, visIntensity, numVisibilities,
+			&plan);
+
+	// Without device events the compute time is the host time of the call
+	if (engine->backend == DFT_BACKEND_MULTI)
+	{
+		double started = engine_now();
+		status = multi_extract_visibilities(engine, config, sources, visibilities, visIntensity, numVisibilities);
+		engine->kernelSeconds = engine_now() - started;
+		return status;
+	}
+
+	if (engine->backend == DFT_BACKEND_CPU)
+	{
+		if(config->enable_messages)
+			printf(">>> UPDATE: Calling DFT CPU backend...\n\n");
+		double started = engine_now();
+		status = cpu_extract_visibilities(engine->packedSources, engine->numPackedSources, visibilities,
+			visIntensity, numVisibilities, engine->numThreads);
+		engine->kernelSeconds = engine_now() - started;
+		trace_host("cpu dft", TRACE_COMPUTE, started);
+		return status;
+	}
+
+	/* Create data buffer
+
+	• `global_size`: total number of work items that will be
+	   executed on the GPU (e.g. total size of your array)
+	• `local_size`: size of local workgroup. Each workgroup contains
+	   several work items and goes to a compute unit
+
+	  Notes:
+	• Intel recommends workgroup size of 64-128. Often 128 is minimum to
+	get good performance on GPU
+	• On NVIDIA Fermi, workgroup size must be at least 192 for full
+	utilization of cores
+	• Optimal workgroup size differs across applications
+	*/
+
+	/* Stage the inputs in the layout of the engine's precision
+
+	Double precision gathers them into structure-of-arrays blocks and the
+	kernel accumulates onto zeroed sums; the reduced precision kernels write
+	fresh sums. Either way the sums are added to visIntensity on read back.
+	*/
+	KernelLayout layout = kernel_layout(engine);
+	size_t visibilityBytes = layout_visibility_bytes(&layout, numVisibilities);
+	size_t intensityBytes = layout_intensity_bytes(&layout, numVisibilities);
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Allocating GPU MEMORY...\n\n");
+
+	double allocating = trace_now();
+	if (reserve_device_buffer(engine, &engine->deviceVisibilities, &engine->visibilityCapacity,
+		visibilityBytes, CL_MEM_READ_ONLY) != DFT_SUCCESS
+		|| reserve_device_buffer(engine, &engine->deviceIntensities, &engine->intensityCapacity,
+		intensityBytes, CL_MEM_READ_WRITE) != DFT_SUCCESS)
+		return DFT_ERROR_DEVICE;
+	trace_host("create buffers", TRACE_HOST, allocating);
+
+	// A device sharing the host's memory is handed the inputs in place
+	if (engine->zeroCopy)
+		return zero_copy_extract_visibilities(engine, config, &layout, visibilities, visIntensity, numVisibilities);
+
+	double staging = trace_now();
+	void *hostVisibilities = reserve_staging_buffer(engine, &engine->stagingVisibilities,
+		&engine->pinnedVisibilities, &engine->stagingVisibilityCapacity, visibilityBytes);
+	void *hostIntensities = reserve_staging_buffer(engine, &engine->stagingIntensities,
+		&engine->pinnedIntensities, &engine->stagingIntensityCapacity, intensityBytes);
+	if (hostVisibilities == NULL || hostIntensities == NULL)
+		return DFT_ERROR_OUT_OF_MEMORY;
+	stage_visibilities(engine->precision, visibilities, hostVisibilities, numVisibilities);
+	if (layout.soa)
+		memset(hostIntensities, 0, intensityBytes);
+	trace_host("stage visibilities", TRACE_HOST, staging);
+
+	// The queue is in-order, so the copies below need not block: the kernel
+	// will not start until they have completed
+	int tracing = trace_enabled();
+	cl_event uploads[2] = { NULL, NULL };
+	err = clEnqueueWriteBuffer(engine->queue, engine->deviceVisibilities, CL_FALSE, 0,
+		visibilityBytes, hostVisibilities, 0, NULL, tracing ? &uploads[0] : NULL); // <=====INPUT
+	if (layout.soa)
+		err |= clEnqueueWriteBuffer(engine->queue, engine->deviceIntensities, CL_FALSE, 0,
+			intensityBytes, hostIntensities, 0, NULL, tracing ? &uploads[1] : NULL); // kernel accumulates into this
+	if (err < 0) {
+		perror("Couldn't write the buffers");
+		clFinish(engine->queue);
+		return DFT_ERROR_DEVICE;
+	}
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Calling DFT GPU Kernel...\n\n");
+
+	cl_event computed;
+	err = enqueue_dft_kernel(engine, &layout, engine->queue, engine->deviceVisibilities,
+		engine->deviceIntensities, numVisibilities, 0, NULL, &computed);
+	if (err < 0) {
+		perror("Couldn't enqueue the kernel");
+		clFinish(engine->queue);
+		return DFT_ERROR_DEVICE;
+	}
+	if(config->enable_messages)
+		printf(">>> UPDATE: DFT GPU Kernel Completed...\n\n");
+
+	/* Read the kernel's output    */
+	cl_event readback = NULL;
+	err = clEnqueueReadBuffer(engine->queue, engine->deviceIntensities, CL_TRUE, 0, intensityBytes, hostIntensities, 0, NULL, tracing ? &readback : NULL); // <=====GET OUTPUT
+	if (err < 0) {
+		perror("Couldn't read the buffer");
+		clFinish(engine->queue);
+		clReleaseEvent(computed);
+		return DFT_ERROR_DEVICE;
+	}
+
+	if (tracing)
+	{
+		trace_device("upload visibilities", TRACE_TRANSFER, uploads[0], TRACE_TRACK_QUEUE);
+		trace_device("upload intensities", TRACE_TRANSFER, uploads[1], TRACE_TRACK_QUEUE);
+		trace_device("dft kernel", TRACE_COMPUTE, computed, TRACE_TRACK_QUEUE);
+		trace_device("read back intensities", TRACE_TRANSFER, readback, TRACE_TRACK_QUEUE);
+		trace_sync();
+		for (int e = 0; e < 2; ++e)
+			if (uploads[e] != NULL)
+				clReleaseEvent(uploads[e]);
+		clReleaseEvent(readback);
+	}
+
+	double accumulating = trace_now();
+	accumulate_sums(engine->precision, hostIntensities, visIntensity, numVisibilities);
+	trace_host("accumulate sums", TRACE_HOST, accumulating);
+
+	cl_ulong kernel_start = 0, kernel_end = 0;
+	clGetEventProfilingInfo(computed, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &kernel_start, NULL);
+	clGetEventProfilingInfo(computed, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &kernel_end, NULL);
+	engine->kernelSeconds = (kernel_end > kernel_start) ? (kernel_end - kernel_start) * 1e-9 : 0.0;
+	clReleaseEvent(computed);
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Copied Visibility Data back to Host - Completed...\n\n");
+	return DFT_SUCCESS;
+}
+
+/* Stream visibilities from vis_src_file to vis_file in fixed-size chunks
+
+Host and device memory are bounded by STREAM_SLOTS chunks of
+stream_chunk_size visibilities, whatever the size of the observation.
+Each chunk is uploaded on its own queue, computed on the engine's queue
+once its upload event fires and read back on a third queue once its
+kernel event fires. While chunk N computes, chunk N+1 is parsed and
+uploaded and chunk N-1 is read back and written out. Returns the number of
+visibilities streamed, or a negative DFT_Status.
+*/
+int stream_visibilities(DFT_Engine *engine, Config *config, Source *sources)
+{
+	cl_int err;
+
+	FILE *input = fopen(config->vis_src_file, "r");
+	if (input == NULL)
+	{
+		printf(">>> ERROR: Unable to locate visibilities file...\n\n");
+		return DFT_ERROR_IO;
+	}
+	FILE *output = fopen(config->vis_file, "w");
+	if (output == NULL)
+	{
+		printf(">>> ERROR: Unable to save visibilities to file...\n\n");
+		fclose(input);
+		return DFT_ERROR_IO;
+	}
+
+	// Reading in the counter for number of visibilities
+	if (fscanf(input, "%d\n", &(config->numVisibilities)) != 1)
+		config->numVisibilities = 0;
+	fprintf(output, "%d\n", config->numVisibilities);
+
+	int chunk_size = (config->stream_chunk_size > 0) ? config->stream_chunk_size : config->numVisibilities;
+	if (chunk_size > config->numVisibilities)
+		chunk_size = config->numVisibilities;
+	if (chunk_size <= 0 || config->numSources <= 0)
+	{
+		fclose(input);
+		fclose(output);
+		return 0;
+	}
+
+	int status = update_sky_model(engine, config, sources);
+	if (status != DFT_SUCCESS)
+	{
+		fclose(input);
+		fclose(output);
+		return status;
+	}
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Streaming %d visibilities in chunks of %d...\n\n",
+			config->numVisibilities, chunk_size);
+
+	int remaining = config->numVisibilities;
+	int processed = 0;
+
+	// Chunks are written out while the following ones are computed
+	TextWriter writer;
+	text_writer_start(&writer, config, output, config->async_output);
+
+	// The CPU and multi-device backends are already parallel across the
+	// chunk, so they simply process one chunk at a time
+	if (engine->backend != DFT_BACKEND_OPENCL)
+	{
+		Visibility *visibilities = (Visibility*)malloc(chunk_size * sizeof(Visibility));
+		Complex *visIntensity = (Complex*)malloc(chunk_size * sizeof(Complex));
+		if (visibilities == NULL || visIntensity == NULL) {
+			perror("Couldn't allocate the stream buffers");
+			status = DFT_ERROR_OUT_OF_MEMORY;
+		}
+		while (status == DFT_SUCCESS && remaining > 0)
+		{
+			double reading = trace_now();
+			int count = readVisibilityRows(config, input, visibilities,
+				(remaining < chunk_size) ? remaining : chunk_size);
+			trace_host("read chunk", TRACE_IO, reading);
+			if (count <= 0)
+				break;
+			remaining -= count;
+
+			memset(visIntensity, 0, count * sizeof(Complex));
+			// The multi-device workers trace their own stages
+			if (engine->backend == DFT_BACKEND_MULTI)
+				status = multi_extract_visibilities(engine, config, sources, visibilities, visIntensity, count);
+			else
+			{
+				double computing = trace_now();
+				status = cpu_extract_visibilities(engine->packedSources, engine->numPackedSources, visibilities,
+					visIntensity, count, engine->numThreads);
+				trace_host("compute chunk", TRACE_COMPUTE, computing);
+			}
+			if (status != DFT_SUCCESS)
+				break;
+
+			double submitting = trace_now();
+			status = text_writer_submit(&writer, visibilities, visIntensity, count);
+			trace_host("queue chunk output", TRACE_IO, submitting);
+			processed += count;
+		}
+		free(visibilities);
+		free(visIntensity);
+	}
+	else
+	{
+		if (engine->uploadQueue == NULL)
+			engine->uploadQueue = clCreateCommandQueue(engine->context, engine->device, CL_QUEUE_PROFILING_ENABLE, &err);
+		if (engine->readbackQueue == NULL)
+			engine->readbackQueue = clCreateCommandQueue(engine->context, engine->device, CL_QUEUE_PROFILING_ENABLE, &err);
+		if (engine->uploadQueue == NULL || engine->readbackQueue == NULL) {
+			perror("Couldn't create a command queue");
+			status = DFT_ERROR_DEVICE;
+		}
+
+		KernelLayout layout = kernel_layout(engine);
+		StreamSlot slots[STREAM_SLOTS];
+		memset(slots, 0, sizeof(slots));
+
+		for (int k = 0; status == DFT_SUCCESS && k < STREAM_SLOTS; ++k)
+		{
+			StreamSlot *slot = &slots[k];
+			slot->visibilities = (Visibility*)malloc(chunk_size * sizeof(Visibility));
+			slot->visIntensity = (Complex*)malloc(chunk_size * sizeof(Complex));
+			slot->staged = dft_aligned_alloc(layout_visibility_bytes(&layout, chunk_size));
+			slot->sums = dft_aligned_alloc(layout_intensity_bytes(&layout, chunk_size));
+			if (slot->visibilities == NULL || slot->visIntensity == NULL
+				|| slot->staged == NULL || slot->sums == NULL) {
+				perror("Couldn't allocate the stream buffers");
+				status = DFT_ERROR_OUT_OF_MEMORY;
+				break;
+			}
+
+			slot->deviceVisibilities = clCreateBuffer(engine->context, CL_MEM_READ_ONLY,
+				layout_visibility_bytes(&layout, chunk_size), NULL, &err);
+			if (err >= 0)
+				slot->deviceIntensities = clCreateBuffer(engine->context, CL_MEM_READ_WRITE,
+					layout_intensity_bytes(&layout, chunk_size), NULL, &err);
+			if (err < 0) {
+				perror("Couldn't create a buffer");
+				status = DFT_ERROR_DEVICE;
+			}
+		}
+
+		int chunk = 0;
+		while (status == DFT_SUCCESS && remaining > 0)
+		{
+			StreamSlot *slot = &slots[chunk % STREAM_SLOTS];
+			if (slot->busy)
+			{
+				status = finish_stream_slot(engine, slot, &writer);
+				processed += slot->count;
+				if (status != DFT_SUCCESS)
+					break;
+			}
+
+			double reading = trace_now();
+			int count = readVisibilityRows(config, input, slot->visibilities,
+				(remaining < chunk_size) ? remaining : chunk_size);
+			trace_host("read chunk", TRACE_IO, reading);
+			if (count <= 0)
+				break;
+			remaining -= count;
+
+			// The sums are added to the chunk's intensities, so they start from
+			// zero; so do the double kernels' sums, which they accumulate into
+			memset(slot->visIntensity, 0, count * sizeof(Complex));
+			stage_visibilities(engine->precision, slot->visibilities, slot->staged, count);
+			if (layout.soa)
+				memset(slot->sums, 0, layout_intensity_bytes(&layout, count));
+
+			// Only the last upload's event is needed to order the kernel
+			cl_event uploaded = NULL;
+			cl_event computed = NULL;
+			cl_event uploadedVisibilities = NULL;
+			cl_event *visibilityEvent = !layout.soa ? &uploaded
+				: trace_enabled() ? &uploadedVisibilities : NULL;
+			err = clEnqueueWriteBuffer(engine->uploadQueue, slot->deviceVisibilities, CL_FALSE, 0,
+				layout_visibility_bytes(&layout, count), slot->staged, 0, NULL, visibilityEvent);
+			if (layout.soa)
+				err |= clEnqueueWriteBuffer(engine->uploadQueue, slot->deviceIntensities, CL_FALSE, 0,
+					layout_intensity_bytes(&layout, count), slot->sums, 0, NULL, &uploaded);
+			if (err < 0) {
+				perror("Couldn't write the buffers");
+				status = DFT_ERROR_DEVICE;
+			}
+
+			if (status == DFT_SUCCESS)
+			{
+				err = enqueue_dft_kernel(engine, &layout, engine->queue, slot->deviceVisibilities,
+					slot->deviceIntensities, count, 1, &uploaded, &computed);
+				if (err < 0) {
+					perror("Couldn't enqueue the kernel");
+					status = DFT_ERROR_DEVICE;
+				}
+			}
+
+			if (status == DFT_SUCCESS)
+			{
+				err = clEnqueueReadBuffer(engine->readbackQueue, slot->deviceIntensities, CL_FALSE, 0,
+					layout_intensity_bytes(&layout, count), slot->sums, 1, &computed, &slot->readback);
+				if (err < 0) {
+					perror("Couldn't read the buffer");
+					status = DFT_ERROR_DEVICE;
+				}
+			}
+
+			if (status == DFT_SUCCESS)
+			{
+				trace_device("upload chunk", TRACE_TRANSFER, uploadedVisibilities, TRACE_TRACK_UPLOAD);
+				trace_device("upload chunk", TRACE_TRANSFER, uploaded, TRACE_TRACK_UPLOAD);
+				trace_device("dft kernel", TRACE_COMPUTE, computed, TRACE_TRACK_QUEUE);
+			}
+			if (uploadedVisibilities != NULL)
+				clReleaseEvent(uploadedVisibilities);
+			if (uploaded != NULL)
+				clReleaseEvent(uploaded);
+			if (computed != NULL)
+				clReleaseEvent(computed);
+			if (status != DFT_SUCCESS)
+				break;
+			clFlush(engine->uploadQueue);
+			clFlush(engine->queue);
+			clFlush(engine->readbackQueue);
+
+			slot->count = count;
+			slot->busy = 1;
+			chunk++;
+		}
+
+		// Drain the chunks still in flight, oldest first, even after a failure
+		for (int k = 0; k < STREAM_SLOTS; ++k)
+		{
+			StreamSlot *slot = &slots[(chunk + k) % STREAM_SLOTS];
+			if (slot->busy)
+			{
+				int finished = finish_stream_slot(engine, slot, &writer);
+				processed += slot->count;
+				if (status == DFT_SUCCESS)
+					status = finished;
+			}
+		}
+
+		// The queues are finished before the buffers a failed chunk left queued are released
+		if (status != DFT_SUCCESS)
+		{
+			if (engine->uploadQueue != NULL)
+				clFinish(engine->uploadQueue);
+			clFinish(engine->queue);
+		}
+		for (int k = 0; k < STREAM_SLOTS; ++k)
+		{
+			if (slots[k].deviceVisibilities)
+				clReleaseMemObject(slots[k].deviceVisibilities);
+			if (slots[k].deviceIntensities)
+				clReleaseMemObject(slots[k].deviceIntensities);
+			free(slots[k].visibilities);
+			free(slots[k].visIntensity);
+			free(slots[k].staged);
+			free(slots[k].sums);
+		}
+	}
+
+	double finishing = trace_now();
+	if (!text_writer_finish(&writer))
+	{
+		printf(">>> ERROR: Unable to save visibilities to file...\n\n");
+		if (status == DFT_SUCCESS)
+			status = DFT_ERROR_IO;
+	}
+	trace_host("finish output", TRACE_IO, finishing);
+	fclose(input);
+	fclose(output);
+
+	if (status != DFT_SUCCESS)
+		return status;
+	if (processed != config->numVisibilities)
+		printf(">>> WARNING: Visibility file declared %d visibilities but %d were read...\n\n",
+			config->numVisibilities, processed);
+	else if(config->enable_messages)
+		printf(">>> UPDATE: Completed streaming of %d visibilities...\n\n", processed);
+
+	return processed;
+}
+
+// frequency
+static void store_channel_row(void *context, int row, const double *values)
+{
+	((double*) context)[row] = values[0];
+}
+
+/* Load the channel frequencies of a channelized prediction
+
+channel_file holds the channel count followed by one frequency in Hz per
+line. Returns the number of channels, or 0 when they could not be read.
+*/
+int loadChannels(Config *config, double **frequencies)
+{
+	*frequencies = NULL;
+	TextFile file;
+	if (config->channel_file == NULL || !open_text_file(config->channel_file, &file))
+	{
+		printf(">>> ERROR: Unable to load channels from file...\n\n");
+		return 0;
+	}
+
+	int count = file.count;
+	*frequencies = (double*)calloc((count > 0) ? count : 1, sizeof(double));
+	int parsed = *frequencies != NULL && parse_text_rows(&file, 1, store_channel_row, *frequencies,
+		config->num_threads, "channel");
+	close_text_file(&file);
+	if (!parsed || count <= 0)
+	{
+		free(*frequencies);
+		*frequencies = NULL;
+		return 0;
+	}
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Successfully loaded %d channels from file...\n\n", count);
+	return count;
+}
+
+// Spacing of evenly spaced channels, or 0 when the spacing is irregular
+static double channel_spacing(const double *frequencies, int numChannels)
+{
+	if (numChannels < 2)
+		return 0.0;
+
+	double spacing = (frequencies[numChannels - 1] - frequencies[0]) / (numChannels - 1);
+	for (int k = 0; k < numChannels; ++k)
+		if (fabs(frequencies[k] - (frequencies[0] + k * spacing)) > CHANNEL_REGULAR_TOLERANCE * fabs(frequencies[k]))
+			return 0.0;
+	return spacing;
+}
+
+/* The OpenCL path of extract_channel_visibilities, given the channels'
+scales from metres to wavelengths; returns a DFT_Status */
+static int opencl_extract_channel_visibilities(DFT_Engine *engine, Visibility *visibilities, int numVisibilities,
+	const double *channelScale, int numChannels, double channelStep, Complex *visIntensity, size_t channelStride)
+{
+	cl_int err;
+
+	// The kernel writes fresh channel-major sums, added to the caller's on read back
+	size_t visibilityBytes = visibility_arrays_bytes(numVisibilities);
+	size_t channelBytes = numChannels * sizeof(double);
+	size_t intensityBytes = (size_t) numChannels * numVisibilities * sizeof(Complex);
+	Complex *sums = (Complex*)staging_intensities(engine, intensityBytes);
+	if (sums == NULL)
+		return DFT_ERROR_OUT_OF_MEMORY;
+
+	double allocating = trace_now();
+	if (reserve_device_buffer(engine, &engine->deviceVisibilities, &engine->visibilityCapacity,
+		visibilityBytes, CL_MEM_READ_ONLY) != DFT_SUCCESS
+		|| reserve_device_buffer(engine, &engine->deviceIntensities, &engine->intensityCapacity,
+		intensityBytes, CL_MEM_READ_WRITE) != DFT_SUCCESS
+		|| reserve_device_buffer(engine, &engine->deviceChannels, &engine->channelCapacity,
+		channelBytes, CL_MEM_READ_ONLY) != DFT_SUCCESS)
+		return DFT_ERROR_DEVICE;
+	trace_host("create buffers", TRACE_HOST, allocating);
+
+	double staging = trace_now();
+	void *staged = staging_visibilities(engine, visibilityBytes);
+	if (staged == NULL)
+		return DFT_ERROR_OUT_OF_MEMORY;
+	stage_visibilities(DFT_PRECISION_DOUBLE, visibilities, staged, numVisibilities);
+	trace_host("stage visibilities", TRACE_HOST, staging);
+
+	int tracing = trace_enabled();
+	cl_event uploads[2] = { NULL, NULL };
+	err = clEnqueueWriteBuffer(engine->queue, engine->deviceVisibilities, CL_FALSE, 0,
+		visibilityBytes, staged, 0, NULL, tracing ? &uploads[0] : NULL);
+	err |= clEnqueueWriteBuffer(engine->queue, engine->deviceChannels, CL_FALSE, 0,
+		channelBytes, channelScale, 0, NULL, tracing ? &uploads[1] : NULL);
+	if (err < 0) {
+		perror("Couldn't write the buffers");
+		clFinish(engine->queue);
+		return DFT_ERROR_DEVICE;
+	}
+
+	cl_kernel kernel = engine->channelKernel;
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&engine->deviceVisibilities);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&engine->deviceIntensities);
+	err |= clSetKernelArg(kernel, 2, sizeof(int), &numVisibilities);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), (void *)&engine->deviceSources);
+	err |= clSetKernelArg(kernel, 4, sizeof(int), &engine->numPackedSources);
+	err |= clSetKernelArg(kernel, 5, sizeof(cl_mem), (void *)&engine->deviceChannels);
+	err |= clSetKernelArg(kernel, 6, sizeof(int), &numChannels);
+	err |= clSetKernelArg(kernel, 7, sizeof(double), &channelStep);
+	if (err < 0) {
+		perror("Couldn't create a kernel argument");
+		clFinish(engine->queue);
+		return DFT_ERROR_DEVICE;
+	}
+
+	// One work-item per visibility and block of CHANNEL_BLOCK channels
+	size_t global_size[2] = { (size_t) numVisibilities, (size_t) (numChannels + CHANNEL_BLOCK - 1) / CHANNEL_BLOCK };
+	cl_event computed;
+	err = clEnqueueNDRangeKernel(engine->queue, kernel, 2, NULL, global_size, NULL, 0, NULL, &computed);
+	if (err < 0) {
+		perror("Couldn't enqueue the kernel");
+		clFinish(engine->queue);
+		return DFT_ERROR_DEVICE;
+	}
+
+	cl_event readback = NULL;
+	err = clEnqueueReadBuffer(engine->queue, engine->deviceIntensities, CL_TRUE, 0, intensityBytes, sums,
+		0, NULL, tracing ? &readback : NULL);
+	if (err < 0) {
+		perror("Couldn't read the buffer");
+		clFinish(engine->queue);
+		clReleaseEvent(computed);
+		return DFT_ERROR_DEVICE;
+	}
+
+	cl_ulong kernel_start = 0, kernel_end = 0;
+	clGetEventProfilingInfo(computed, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &kernel_start, NULL);
+	clGetEventProfilingInfo(computed, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &kernel_end, NULL);
+	engine->kernelSeconds = (kernel_end > kernel_start) ? (kernel_end - kernel_start) * 1e-9 : 0.0;
+
+	if (tracing)
+	{
+		trace_device("upload visibilities", TRACE_TRANSFER, uploads[0], TRACE_TRACK_QUEUE);
+		trace_device("upload channels", TRACE_TRANSFER, uploads[1], TRACE_TRACK_QUEUE);
+		trace_device("channel kernel", TRACE_COMPUTE, computed, TRACE_TRACK_QUEUE);
+		trace_device("read back intensities", TRACE_TRANSFER, readback, TRACE_TRACK_QUEUE);
+		trace_sync();
+		clReleaseEvent(uploads[0]);
+		clReleaseEvent(uploads[1]);
+		clReleaseEvent(readback);
+	}
+	clReleaseEvent(computed);
+
+	double accumulating = trace_now();
+	for (int k = 0; k < numChannels; ++k)
+		for (int i = 0; i < numVisibilities; ++i)
+		{
+			visIntensity[k * channelStride + i].real += sums[(size_t) k * numVisibilities + i].real;
+			visIntensity[k * channelStride + i].imaginary += sums[(size_t) k * numVisibilities + i].imaginary;
+		}
+	trace_host("accumulate sums", TRACE_HOST, accumulating);
+	return DFT_SUCCESS;
+}
+
+/* Predict every channel of visibilities given in metres
+
+Channel k of visibility i is accumulated into
+visIntensity[k * channelStride + i]. Coordinates and packed source terms
+are shared by all channels: each source's phase per metre is computed
+once per visibility and scaled to every channel, and regularly spaced
+channels recur the phasor instead of evaluating sin and cos again. The
+OpenCL path needs fp64; devices without it use the native CPU code.
+Returns a DFT_Status.
+*/
+int extract_channel_visibilities(DFT_Engine *engine, Config *config, Source *sources, Visibility *visibilities,
+	int numVisibilities, const double *frequencies, int numChannels, Complex *visIntensity, size_t channelStride)
+{
+	if (numVisibilities <= 0 || numChannels <= 0 || config->numSources <= 0)
+		return DFT_SUCCESS;
+
+	int status = update_sky_model(engine, config, sources);
+	if (status != DFT_SUCCESS)
+		return status;
+
+	if (engine->backend == DFT_BACKEND_MULTI)
+	{
+		double started = engine_now();
+		status = multi_extract_channel_visibilities(engine, config, sources, visibilities, numVisibilities,
+			frequencies, numChannels, visIntensity, channelStride);
+		engine->kernelSeconds = engine_now() - started;
+		return status;
+	}
+
+	double *channelScale = (double*)malloc(numChannels * sizeof(double));
+	if (channelScale == NULL) {
+		perror("Couldn't allocate the channel scales");
+		return DFT_ERROR_OUT_OF_MEMORY;
+	}
+	for (int k = 0; k < numChannels; ++k)
+		channelScale[k] = frequencies[k] / C;
+	double channelStep = channel_spacing(frequencies, numChannels) / C;
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Predicting %d %s channels of %d visibilities...\n\n", numChannels,
+			(channelStep != 0.0) ? "regular" : "irregular", numVisibilities);
+
+	if (engine->backend == DFT_BACKEND_CPU || engine->channelKernel == NULL)
+	{
+		double started = engine_now();
+		status = cpu_extract_channel_visibilities(engine->packedSources, engine->numPackedSources, visibilities,
+			numVisibilities, channelScale, numChannels, channelStep, visIntensity, channelStride,
+			engine->numThreads);
+		engine->kernelSeconds = engine_now() - started;
+		trace_host("cpu channel dft", TRACE_COMPUTE, started);
+		free(channelScale);
+		return status;
+	}
+
+	status = opencl_extract_channel_visibilities(engine, visibilities, numVisibilities, channelScale, numChannels,
+		channelStep, visIntensity, channelStride);
+	free(channelScale);
+	return status;
+}
+
+// Sources compare by position, l first
+static int compare_source_position(const void *a, const void *b)
+{
+	const Source *x = (const Source*) a;
+	const Source *y = (const Source*) b;
+
+	if (x->l != y->l)
+		return (x->l < y->l) ? -1 : 1;
+	if (x->m != y->m)
+		return (x->m < y->m) ? -1 : 1;
+	return 0;
+}
+
+/* Copy sources sorted by position, merging co-located sources into one
+
+Returns the number of distinct positions.
+*/
+static int sort_sky_model(Source *sources, int numSources, Source *sorted)
+{
+	memcpy(sorted, sources, numSources * sizeof(Source));
+	qsort(sorted, numSources, sizeof(Source), compare_source_position);
+
+	int count = 0;
+	for (int s = 0; s < numSources; ++s)
+	{
+		if (count > 0 && compare_source_position(&sorted[count - 1], &sorted[s]) == 0)
+			sorted[count - 1].intensity += sorted[s].intensity;
+		else
+			sorted[count++] = sorted[s];
+	}
+	return count;
+}
+
+/* Add the contribution of `numSources` sources to the prediction
+
+The prediction is linear in each source's flux, so a source given a
+negative or partial flux subtracts or adjusts its earlier contribution.
+Returns a DFT_Status.
+*/
+static int predict_sources(DFT_Prediction *prediction, Config *config, Source *sources, int numSources)
+{
+	cl_int err;
+	DFT_Engine *engine = prediction->engine;
+	Config model = *config;
+	model.numSources = numSources;
+
+	if (numSources <= 0)
+		return DFT_SUCCESS;
+
+	if (!prediction->resident)
+		return extract_visibilities(engine, &model, sources, prediction->visibilities, prediction->visIntensity,
+			prediction->numVisibilities);
+
+	// Accumulate straight into the resident visibilities, no transfers but the sources
+	int status = update_sky_model(engine, &model, sources);
+	if (status != DFT_SUCCESS)
+		return status;
+	KernelLayout layout = kernel_layout(engine);
+	cl_event computed;
+	err = enqueue_dft_kernel(engine, &layout, engine->queue, prediction->deviceVisibilities,
+		prediction->deviceIntensities, prediction->numVisibilities, 0, NULL, &computed);
+	if (err < 0) {
+		perror("Couldn't enqueue the kernel");
+		return DFT_ERROR_DEVICE;
+	}
+
+	// The next update repacks the host sources this kernel's upload reads
+	clWaitForEvents(1, &computed);
+	prediction->deviceDirty = 1;
+
+	cl_ulong kernel_start = 0, kernel_end = 0;
+	clGetEventProfilingInfo(computed, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &kernel_start, NULL);
+	clGetEventProfilingInfo(computed, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &kernel_end, NULL);
+	engine->kernelSeconds = (kernel_end > kernel_start) ? (kernel_end - kernel_start) * 1e-9 : 0.0;
+	if (trace_enabled())
+	{
+		trace_device("dft kernel", TRACE_COMPUTE, computed, TRACE_TRACK_QUEUE);
+		trace_sync();
+	}
+	clReleaseEvent(computed);
+	return DFT_SUCCESS;
+}
+
+/* Discard the accumulated prediction and evaluate the whole sky model again
+
+Returns a DFT_Status; on failure the prediction stays stale and the next
+update recomputes it again.
+*/
+static int recompute_prediction(DFT_Prediction *prediction, Config *config)
+{
+	cl_int err;
+
+	prediction->stale = 1;
+	memset(prediction->visIntensity, 0, prediction->numVisibilities * sizeof(Complex));
+	if (prediction->resident)
+	{
+		DFT_Engine *engine = prediction->engine;
+		size_t intensityBytes = intensity_arrays_bytes(prediction->numVisibilities);
+		void *zeros = staging_intensities(engine, intensityBytes);
+		if (zeros == NULL)
+			return DFT_ERROR_OUT_OF_MEMORY;
+		memset(zeros, 0, intensityBytes);
+		err = clEnqueueWriteBuffer(engine->queue, prediction->deviceIntensities, CL_TRUE, 0,
+			intensityBytes, zeros, 0, NULL, NULL);
+		if (err < 0) {
+			perror("Couldn't write the buffers");
+			return DFT_ERROR_DEVICE;
+		}
+		prediction->deviceDirty = 0;
+	}
+
+	int status = predict_sources(prediction, config, prediction->sources, prediction->numSources);
+	if (status != DFT_SUCCESS)
+		return status;
+	prediction->stale = 0;
+	prediction->updatesSinceRecompute = 0;
+	return DFT_SUCCESS;
+}
+
+/* Predict visibilities which later sky model edits update incrementally
+
+The coordinates are used in place and must outlive the prediction. On an
+fp64 OpenCL engine they are uploaded once, and the predicted visibilities
+stay on the device until read_dft_prediction; other engines accumulate
+into a host array. Returns NULL on failure.
+*/
+DFT_Prediction* create_dft_prediction(DFT_Engine *engine, Config *config, Source *sources, Visibility *visibilities,
+	int numVisibilities)
+{
+	cl_int err;
+
+	DFT_Prediction *prediction = (DFT_Prediction*)calloc(1, sizeof(DFT_Prediction));
+	Complex *visIntensity = (Complex*)calloc((numVisibilities > 0) ? numVisibilities : 1, sizeof(Complex));
+	if (prediction == NULL || visIntensity == NULL) {
+		perror("Couldn't allocate the prediction");
+		free(prediction);
+		free(visIntensity);
+		return NULL;
+	}
+	prediction->engine = engine;
+	prediction->visibilities = visibilities;
+	prediction->visIntensity = visIntensity;
+	prediction->numVisibilities = numVisibilities;
+	prediction->resident = engine->backend == DFT_BACKEND_OPENCL && engine->precision == DFT_PRECISION_DOUBLE;
+
+	int numSources = (config->numSources > 0) ? config->numSources : 0;
+	Source *sorted = (Source*)reserve_host_buffer((void**) &prediction->sources, &prediction->sourceCapacity,
+		(numSources + 1) * sizeof(Source));
+	if (sorted == NULL)
+	{
+		destroy_dft_prediction(prediction);
+		return NULL;
+	}
+	prediction->numSources = sort_sky_model(sources, numSources, sorted);
+
+	if (prediction->resident && numVisibilities > 0)
+	{
+		size_t visibilityBytes = visibility_arrays_bytes(numVisibilities);
+		void *staged = NULL;
+		if (reserve_device_buffer(engine, &prediction->deviceVisibilities, &prediction->visibilityCapacity,
+				visibilityBytes, CL_MEM_READ_ONLY) != DFT_SUCCESS
+			|| reserve_device_buffer(engine, &prediction->deviceIntensities, &prediction->intensityCapacity,
+				intensity_arrays_bytes(numVisibilities), CL_MEM_READ_WRITE) != DFT_SUCCESS
+			|| (staged = staging_visibilities(engine, visibilityBytes)) == NULL)
+		{
+			destroy_dft_prediction(prediction);
+			return NULL;
+		}
+		stage_visibilities(DFT_PRECISION_DOUBLE, visibilities, staged, numVisibilities);
+		err = clEnqueueWriteBuffer(engine->queue, prediction->deviceVisibilities, CL_TRUE, 0,
+			visibilityBytes, staged, 0, NULL, NULL);
+		if (err < 0) {
+			perror("Couldn't write the buffers");
+			destroy_dft_prediction(prediction);
+			return NULL;
+		}
+	}
+
+	if (numVisibilities > 0 && recompute_prediction(prediction, config) != DFT_SUCCESS)
+	{
+		destroy_dft_prediction(prediction);
+		return NULL;
+	}
+	return prediction;
+}
+
+/* Bring the prediction up to date with a new sky model of config->numSources
+
+The new model is diffed by position against the one the prediction holds:
+added sources are evaluated with their flux, removed ones with the negated
+flux and re-fluxed ones with the change in flux. Every
+sky_update_recompute_interval updates, or when the diff covers more than
+sky_update_max_fraction of the model, everything is evaluated again from
+zero instead, so that rounding does not accumulate without bound. Returns
+the number of sources evaluated, or a negative DFT_Status on failure, after
+which the next update recomputes the prediction.
+*/
+int update_dft_prediction(DFT_Prediction *prediction, Config *config, Source *sources)
+{
+	double diffing = trace_now();
+	int numSources = (config->numSources > 0) ? config->numSources : 0;
+	Source *next = (Source*)reserve_host_buffer((void**) &prediction->nextSources,
+		&prediction->nextSourceCapacity, (numSources + 1) * sizeof(Source));
+	if (next == NULL)
+		return DFT_ERROR_OUT_OF_MEMORY;
+	int numNext = sort_sky_model(sources, numSources, next);
+
+	Source *held = prediction->sources;
+	int numHeld = prediction->numSources;
+	Source *delta = (Source*)reserve_host_buffer((void**) &prediction->delta, &prediction->deltaCapacity,
+		(numHeld + numNext + 1) * sizeof(Source));
+	if (delta == NULL)
+		return DFT_ERROR_OUT_OF_MEMORY;
+
+	// Merge the two sorted models
+	int numDelta = 0, added = 0, removed = 0, changed = 0;
+	int h = 0, n = 0;
+	while (h < numHeld || n < numNext)
+	{
+		int order = (h == numHeld) ? 1 : (n == numNext) ? -1 : compare_source_position(&held[h], &next[n]);
+		if (order < 0)
+		{
+			delta[numDelta] = held[h++];
+			delta[numDelta].intensity = -delta[numDelta].intensity;
+			numDelta++;
+			removed++;
+		}
+		else if (order > 0)
+		{
+			delta[numDelta++] = next[n++];
+			added++;
+		}
+		else
+		{
+			if (next[n].intensity != held[h].intensity)
+			{
+				delta[numDelta] = next[n];
+				delta[numDelta++].intensity = next[n].intensity - held[h].intensity;
+				changed++;
+			}
+			h++;
+			n++;
+		}
+	}
+	trace_host("diff sky model", TRACE_HOST, diffing);
+
+	// The incoming model becomes the held one
+	prediction->sources = next;
+	prediction->numSources = numNext;
+	prediction->nextSources = held;
+	size_t capacity = prediction->sourceCapacity;
+	prediction->sourceCapacity = prediction->nextSourceCapacity;
+	prediction->nextSourceCapacity = capacity;
+
+	if (numDelta == 0 && !prediction->stale)
+		return 0;
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Sky model update: %d added, %d removed, %d changed...\n\n", added, removed, changed);
+
+	prediction->updatesSinceRecompute++;
+	if (prediction->stale
+		|| (config->sky_update_recompute_interval > 0
+		&& prediction->updatesSinceRecompute >= config->sky_update_recompute_interval)
+		|| numDelta > config->sky_update_max_fraction * numNext)
+	{
+		if(config->enable_messages)
+			printf(">>> UPDATE: Recomputing the prediction from all %d sources...\n\n", numNext);
+		int status = recompute_prediction(prediction, config);
+		return (status == DFT_SUCCESS) ? numNext : status;
+	}
+
+	// A partly applied delta cannot be undone, so a failure recomputes next time
+	int status = predict_sources(prediction, config, delta, numDelta);
+	if (status != DFT_SUCCESS)
+	{
+		prediction->stale = 1;
+		return status;
+	}
+	return numDelta;
+}
+
+/* The predicted visibilities, read back from the device if needed; NULL
+when the read back fails or an earlier update left the prediction stale */
+Complex* read_dft_prediction(DFT_Prediction *prediction)
+{
+	cl_int err;
+
+	if (prediction->stale)
+		return NULL;
+
+	if (prediction->resident && prediction->deviceDirty)
+	{
+		double reading = trace_now();
+		DFT_Engine *engine = prediction->engine;
+		size_t intensityBytes = intensity_arrays_bytes(prediction->numVisibilities);
+		void *sums = staging_intensities(engine, intensityBytes);
+		if (sums == NULL)
+			return NULL;
+		err = clEnqueueReadBuffer(engine->queue, prediction->deviceIntensities, CL_TRUE, 0,
+			intensityBytes, sums, 0, NULL, NULL);
+		if (err < 0) {
+			perror("Couldn't read the buffer");
+			return NULL;
+		}
+		memset(prediction->visIntensity, 0, prediction->numVisibilities * sizeof(Complex));
+		accumulate_sums(DFT_PRECISION_DOUBLE, sums, prediction->visIntensity, prediction->numVisibilities);
+		trace_host("read back prediction", TRACE_TRANSFER, reading);
+		prediction->deviceDirty = 0;
+	}
+	return prediction->visIntensity;
+}
+
+void destroy_dft_prediction(DFT_Prediction *prediction)
+{
+	if (prediction == NULL)
+		return;
+
+	if (prediction->deviceVisibilities)
+		clReleaseMemObject(prediction->deviceVisibilities);
+	if (prediction->deviceIntensities)
+		clReleaseMemObject(prediction->deviceIntensities);
+	free(prediction->visIntensity);
+	free(prediction->sources);
+	free(prediction->nextSources);
+	free(prediction->delta);
+	free(prediction);
+}
+
+/* The OpenCL path of extract_image, given the weighted values staged in the
+engine's intensity staging array; returns a DFT_Status */
+static int opencl_extract_image(DFT_Engine *engine, Config *config, Visibility *visibilities, Complex *values,
+	size_t valueBytes, int numVisibilities, double normalisation, double *image)
+{
+	cl_int err;
+	int gridSize = (int) config->grid_size;
+
+	// Coordinates are pre-scaled by 2*pi as packSources does for the sources
+	const double two_PI = 3.14159265358979323846 + 3.14159265358979323846;
+	size_t coordinateBytes = ((numVisibilities > 0) ? numVisibilities : 1) * sizeof(cl_double4);
+	size_t imageBytes = (size_t) gridSize * gridSize * sizeof(double);
+	cl_double4 *coordinates = (cl_double4*)staging_visibilities(engine, coordinateBytes);
+	if (coordinates == NULL)
+		return DFT_ERROR_OUT_OF_MEMORY;
+	for (int k = 0; k < numVisibilities; ++k)
+	{
+		coordinates[k].s[0] = visibilities[k].u * two_PI;
+		coordinates[k].s[1] = visibilities[k].v * two_PI;
+		coordinates[k].s[2] = visibilities[k].w * two_PI;
+		coordinates[k].s[3] = 0.0;
+	}
+
+	double allocating = trace_now();
+	if (reserve_device_buffer(engine, &engine->deviceVisibilities, &engine->visibilityCapacity,
+		coordinateBytes, CL_MEM_READ_ONLY) != DFT_SUCCESS
+		|| reserve_device_buffer(engine, &engine->deviceIntensities, &engine->intensityCapacity,
+		valueBytes, CL_MEM_READ_WRITE) != DFT_SUCCESS
+		|| reserve_device_buffer(engine, &engine->deviceImage, &engine->imageCapacity,
+		imageBytes, CL_MEM_WRITE_ONLY) != DFT_SUCCESS)
+		return DFT_ERROR_DEVICE;
+	trace_host("create buffers", TRACE_HOST, allocating);
+
+	int tracing = trace_enabled();
+	cl_event uploads[2] = { NULL, NULL };
+	err = clEnqueueWriteBuffer(engine->queue, engine->deviceVisibilities, CL_FALSE, 0,
+		coordinateBytes, coordinates, 0, NULL, tracing ? &uploads[0] : NULL);
+	err |= clEnqueueWriteBuffer(engine->queue, engine->deviceIntensities, CL_FALSE, 0,
+		valueBytes, values, 0, NULL, tracing ? &uploads[1] : NULL);
+	if (err < 0) {
+		perror("Couldn't write the buffers");
+		clFinish(engine->queue);
+		return DFT_ERROR_DEVICE;
+	}
+
+	cl_kernel kernel = engine->imageKernel;
+	size_t tilePixels = IMAGE_TILE * IMAGE_TILE;
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&engine->deviceVisibilities);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&engine->deviceIntensities);
+	err |= clSetKernelArg(kernel, 2, sizeof(int), &numVisibilities);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), (void *)&engine->deviceImage);
+	err |= clSetKernelArg(kernel, 4, sizeof(int), &gridSize);
+	err |= clSetKernelArg(kernel, 5, sizeof(double), &config->cell_size);
+	err |= clSetKernelArg(kernel, 6, sizeof(double), &normalisation);
+	err |= clSetKernelArg(kernel, 7, tilePixels * sizeof(cl_double4), NULL);
+	err |= clSetKernelArg(kernel, 8, tilePixels * sizeof(cl_double2), NULL);
+	if (err < 0) {
+		perror("Couldn't create a kernel argument");
+		clFinish(engine->queue);
+		return DFT_ERROR_DEVICE;
+	}
+
+	// One work-group per tile of pixels, the grid rounded up to whole tiles
+	size_t tiles = (gridSize + IMAGE_TILE - 1) / IMAGE_TILE;
+	size_t global_size[2] = { tiles * IMAGE_TILE, tiles * IMAGE_TILE };
+	size_t local_size[2] = { IMAGE_TILE, IMAGE_TILE };
+	cl_event computed;
+	err = clEnqueueNDRangeKernel(engine->queue, kernel, 2, NULL, global_size, local_size, 0, NULL, &computed);
+	if (err < 0) {
+		perror("Couldn't enqueue the kernel");
+		clFinish(engine->queue);
+		return DFT_ERROR_DEVICE;
+	}
+
+	cl_event readback = NULL;
+	err = clEnqueueReadBuffer(engine->queue, engine->deviceImage, CL_TRUE, 0, imageBytes, image,
+		0, NULL, tracing ? &readback : NULL);
+	if (err < 0) {
+		perror("Couldn't read the buffer");
+		clFinish(engine->queue);
+		clReleaseEvent(computed);
+		return DFT_ERROR_DEVICE;
+	}
+
+	cl_ulong kernel_start = 0, kernel_end = 0;
+	clGetEventProfilingInfo(computed, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &kernel_start, NULL);
+	clGetEventProfilingInfo(computed, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &kernel_end, NULL);
+	engine->kernelSeconds = (kernel_end > kernel_start) ? (kernel_end - kernel_start) * 1e-9 : 0.0;
+
+	if (tracing)
+	{
+		trace_device("upload visibilities", TRACE_TRANSFER, uploads[0], TRACE_TRACK_QUEUE);
+		trace_device("upload values", TRACE_TRANSFER, uploads[1], TRACE_TRACK_QUEUE);
+		trace_device("image kernel", TRACE_COMPUTE, computed, TRACE_TRACK_QUEUE);
+		trace_device("read back image", TRACE_TRANSFER, readback, TRACE_TRACK_QUEUE);
+		trace_sync();
+		clReleaseEvent(uploads[0]);
+		clReleaseEvent(uploads[1]);
+		clReleaseEvent(readback);
+	}
+	clReleaseEvent(computed);
+	return DFT_SUCCESS;
+}
+
+/* Compute the dirty image of visibilities on the grid_size x grid_size grid
+
+The inverse of extract_visibilities: pixel (x, y), at
+l = (x - grid_size / 2) * cell_size and m likewise, receives the weighted
+mean over visibilities of the real part of each value rotated by its
+phase, with the image correction packSources divides out, so a point
+source of the sky model images at its flux. `weights` may be NULL for
+natural weighting. image is overwritten row by row (y major). OpenCL
+engines need fp64, otherwise the native CPU code is used; a multi-device
+engine images on its first device. Returns a DFT_Status.
+*/
+int extract_image(DFT_Engine *engine, Config *config, Visibility *visibilities, Complex *visIntensity,
+	const double *weights, int numVisibilities, double *image)
+{
+	int gridSize = (int) config->grid_size;
+
+	if (gridSize <= 0)
+		return DFT_SUCCESS;
+	if (engine->backend == DFT_BACKEND_MULTI)
+	{
+		int status = extract_image(engine->workers[0], config, visibilities, visIntensity, weights,
+			numVisibilities, image);
+		engine->kernelSeconds = engine->workers[0]->kernelSeconds;
+		return status;
+	}
+
+	// Weights are folded into the values once, and the image scaled by their sum
+	double staging = trace_now();
+	size_t valueBytes = ((numVisibilities > 0) ? numVisibilities : 1) * sizeof(Complex);
+	Complex *values = (Complex*)staging_intensities(engine, valueBytes);
+	if (values == NULL)
+		return DFT_ERROR_OUT_OF_MEMORY;
+	double weightSum = 0.0;
+	for (int k = 0; k < numVisibilities; ++k)
+	{
+		double weight = (weights != NULL) ? weights[k] : 1.0;
+		values[k].real = visIntensity[k].real * weight;
+		values[k].imaginary = visIntensity[k].imaginary * weight;
+		weightSum += weight;
+	}
+	double normalisation = (weightSum != 0.0) ? 1.0 / weightSum : 0.0;
+	trace_host("stage image values", TRACE_HOST, staging);
+
+	if(config->enable_messages)
+		printf(">>> UPDATE: Imaging %d visibilities onto %d x %d pixels...\n\n", numVisibilities,
+			gridSize, gridSize);
+
+	int status;
+	if (engine->backend == DFT_BACKEND_CPU || engine->imageKernel == NULL)
+	{
+		double started = engine_now();
+		status = cpu_extract_image(visibilities, values, numVisibilities, image, gridSize, config->cell_size,
+			normalisation, engine->numThreads);
+		engine->kernelSeconds = engine_now() - started;
+		trace_host("cpu image", TRACE_COMPUTE, started);
+	}
+	else
+		status = opencl_extract_image(engine, config, visibilities, values, valueBytes, numVisibilities,
+			normalisation, image);
+
+	if(status == DFT_SUCCESS && config->enable_messages && engine->kernelSeconds > 0.0)
+		printf(">>> INFO: Imaged in %.3f s (%.3f G pixel x visibility/s)...\n\n", engine->kernelSeconds,
+			(double) gridSize * gridSize * numVisibilities / engine->kernelSeconds * 1e-9);
+	return status;
+}
+
+/* Compare a reduced precision prediction against the double reference
+
+Re-evaluates an evenly spaced sample of at most 1024 visibilities with the
+native double precision path and returns the largest complex difference.
+Expects visIntensity to hold the result of a single prediction into zeroed
+totals, as produced by main.
+*/
+double measure_precision_error(DFT_Engine *engine, Config *config, Visibility *visibilities,
+	Complex *visIntensity, int numVisibilities)
+{
+	const int max_samples = 1024;
+
+	if (numVisibilities <= 0 || !engine->skyModelValid)
+		return 0.0;
+
+	int samples = (numVisibilities < max_samples) ? numVisibilities : max_samples;
+	int stride = numVisibilities / samples;
+
+	Visibility *sampled = (Visibility*)malloc(samples * sizeof(Visibility));
+	Complex *reference = (Complex*)calloc(samples, sizeof(Complex));
+	if (sampled == NULL || reference == NULL)
+	{
+		free(sampled);
+		free(reference);
+		return DBL_MAX;
+	}
+
+	for (int i = 0; i < samples; ++i)
+		sampled[i] = visibilities[i * stride];
+
+	if (cpu_extract_visibilities(engine->packedSources, engine->numPackedSources, sampled, reference,
+		samples, engine->numThreads) != DFT_SUCCESS)
+	{
+		free(sampled);
+		free(reference);
+		return DBL_MAX;
+	}
+
+	double difference = 0.0;
+	for (int i = 0; i < samples; ++i)
+	{
+		double current_difference = sqrt(pow(visIntensity[i * stride].real - reference[i].real, 2.0)
+			+ pow(visIntensity[i * stride].imaginary - reference[i].imaginary, 2.0));
+
+		if(current_difference > difference)
+			difference = current_difference;
+	}
+
+	free(sampled);
+	free(reference);
+
+	if(config->enable_messages)
+		printf(">>> INFO: Measured maximum difference against the double precision reference is %e (%d samples)\n\n",
+			difference, samples);
+
+	return difference;
+}
+
+/* Append `count` visibility rows to an open output file */
+void writeVisibilityRows(Config *config, FILE *file, Visibility *visibilities, Complex *visIntensity, int count)
+{
+	// u, v, w in wavelengths, real, imag, formatted across every core
+	if (!write_visibility_text(config, file, visibilities, visIntensity, count))
+		printf(">>> ERROR: Unable to save visibilities to file...\n\n");
+}
+
+void saveVisibilities(Config *config, Visibility *visibilities, Complex *visIntensity)
+{
+	// Save visibilities to file
+	FILE *file = fopen(config->vis_file, "w");
+
+	// Unable to open file
+	if (!file)
+	{
+		printf(">>> ERROR: Unable to save visibilities to file...\n\n");
+		return;
+	}
+	if(config->enable_messages)
+		printf(">>> UPDATE: Writing visibilities to file...\n\n");
+
+	// Record number of visibilities
+	fprintf(file, "%d\n", config->numVisibilities);
+
+	// Record individual visibilities
+	writeVisibilityRows(config, file, visibilities, visIntensity, config->numVisibilities);
+
+	// Clean up
+	fclose(file);
+	if(config->enable_messages)
+		printf(">>> UPDATE: Completed writing of visibilities to file...\n\n");
+}
+
+/* Save a channelized prediction
+
+Channels are written one after another in the format of saveVisibilities,
+preceded by the total row count, with each channel's coordinates scaled
+from metres to its own wavelengths.
+*/
+void saveChannelVisibilities(Config *config, Visibility *visibilities, const double *frequencies, int numChannels,
+	Complex *visIntensity)
+{
+	FILE *file = fopen(config->vis_file, "w");
+	Visibility *scaled = (Visibility*)malloc(config->numVisibilities * sizeof(Visibility));
+	if (!file || !scaled)
+	{
+		printf(">>> ERROR: Unable to save visibilities to file...\n\n");
+		if (file) fclose(file);
+		free(scaled);
+		return;
+	}
+	if(config->enable_messages)
+		printf(">>> UPDATE: Writing %d channels of visibilities to file...\n\n", numChannels);
+
+	fprintf(file, "%d\n", numChannels * config->numVisibilities);
+	for (int k = 0; k < numChannels; ++k)
+	{
+		double meters_to_wavelengths = frequencies[k] / C;
+		for (int i = 0; i < config->numVisibilities; ++i)
+			scaled[i] = (Visibility) {
+				.u = visibilities[i].u * meters_to_wavelengths,
+					.v = visibilities[i].v * meters_to_wavelengths,
+					.w = visibilities[i].w * meters_to_wavelengths
+			};
+		writeVisibilityRows(config, file, scaled, visIntensity + (size_t) k * config->numVisibilities,
+			config->numVisibilities);
+	}
+
+	free(scaled);
+	fclose(file);
+	if(config->enable_messages)
+		printf(">>> UPDATE: Completed writing of visibilities to file...\n\n");
+}
+double randomInRange(double min, double max)
+{
+	double range = (max - min);
+	double div = RAND_MAX / range;
+	return min + (rand() / div);
+}
+
+double sampleNormal()
+{
+	double u = ((double)rand() / RAND_MAX) * 2 - 1;
+	double v = ((double)rand() / RAND_MAX) * 2 - 1;
+	double r = u*u + v*v;
+	if (r <= 0 || r > 1)
+		return sampleNormal();
 	double c = sqrt(-2 * log(r) / r);
 	if ((u * v * c) > 1.0 || (u * v * c) < -1.0)
 		return sampleNormal();
@@ -559,15 +3500,42 @@ void unit_test_init_config(Config *config)
 	config->min_v = -(config->grid_size / 2.0);
 	config->max_v = config->grid_size / 2.0;
 	config->enable_messages=0;
+	config->compute_backend = DFT_BACKEND_AUTO;
+	config->num_threads = 0;
+	config->kernel_variant = DFT_KERNEL_TILED;
+	config->work_group_size = 128;
+	config->precision_mode = DFT_PRECISION_DOUBLE;
+	config->stream_chunk_size = 0;
+	config->multi_chunk_size = 8192;
+	config->trace_file = NULL;
+	config->batch_manifest = NULL;
+	config->batch_report = NULL;
+	config->channel_file = NULL;
+	config->image_file = NULL;
+	config->prediction_mode = DFT_PREDICT_EXACT;
+	config->grid_accuracy = 1e-6;
+	config->grid_cross_check = 64;
+	config->sky_prune_tolerance = 0.0;
+	config->sky_update_recompute_interval = 16;
+	config->sky_update_max_fraction = 0.5;
+	config->binary_output = 0;
+	config->output_precision = 0;
+	config->async_output = 1;
+	config->kernel_cache_dir = NULL;
+	config->kernel_source_file = NULL;
+	config->zero_copy = 1;
+	config->source_split = 0;
+	config->tune_profile_dir = NULL;
 }
 
-double unit_test_generate_approximate_visibilities(void)
+// Expects a configuration prepared by unit_test_init_config, optionally
+// adjusted by the caller to select the backend under test
+double unit_test_generate_approximate_visibilities(Config *test_config)
 {
 	// used to invalidate the unit test
 	double error = DBL_MAX;
 
-	Config config;
-	unit_test_init_config(&config);
+	Config config = *test_config;
 
 	// Read in test sources
 	Source *sources = NULL;
@@ -583,6 +3551,15 @@ double unit_test_generate_approximate_visibilities(void)
 		return error;
 	}
 
+	// One engine serves every prediction below
+	DFT_Engine *engine = create_dft_engine(&config);
+	if(engine == NULL)
+	{
+		fclose(file);
+		if(sources) free(sources);
+		return error;
+	}
+
 	fscanf(file, "%d\n", &(config.numVisibilities));
 
 	double u = 0.0;
@@ -616,7 +3593,7 @@ double unit_test_generate_approximate_visibilities(void)
 		};
 
 		// Measure one visibility brightness from n sources
-		extract_visibilities(&config, sources, approx_visibility, approx_vis_intensity, 1);
+		extract_visibilities(engine, &config, sources, approx_visibility, approx_vis_intensity, 1);
 
 		double current_difference = sqrt(pow(approx_vis_intensity[0].real
 			-test_vis_intensity.real, 2.0)
@@ -629,6 +3606,7 @@ double unit_test_generate_approximate_visibilities(void)
 
 	// Clean up
 	fclose(file);
+	destroy_dft_engine(engine);
 	if(sources) free(sources);
 
 	printf(">>> INFO: Measured maximum difference of evaluated visibilities is %f\n", difference);
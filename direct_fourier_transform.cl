@@ -26,36 +26,510 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+/* Compile-time specialisations, selected by the host through build options
+
+DFT_ZERO_W       w is disregarded (force_zero_w_term), dropping the w term
+                 from every phase
+DFT_TILE_SIZE    work-group size of the tiled kernels, which then require
+                 exactly that size and have constant tile loop bounds
+DFT_NUM_SOURCES  size of a small sky model; the source loops get a constant
+                 trip count and unroll into straight-line code, and the
+                 sourceCount argument is ignored
+DFT_CHANNEL_BLOCK channels accumulated in private memory by one work-item
+                 of the channelized kernel
+DFT_IMAGE_TILE   width and height of the pixel tile of one work-group of
+                 the imaging kernel
+DFT_SOA_PAD      padding of the structure-of-arrays blocks of the double
+                 kernels (DFT_STORAGE_PAD on the host)
+*/
+#ifdef DFT_ZERO_W
+	#define PHASE(u, v, w, src) fma((u), (src).x, (v) * (src).y)
+#else
+	#define PHASE(u, v, w, src) fma((u), (src).x, fma((v), (src).y, (w) * (src).z))
+#endif
+
+#ifdef DFT_TILE_SIZE
+	#define TILE_SIZE DFT_TILE_SIZE
+	#define TILED_KERNEL __kernel __attribute__((reqd_work_group_size(DFT_TILE_SIZE, 1, 1)))
+#else
+	#define TILE_SIZE ((int) get_local_size(0))
+	#define TILED_KERNEL __kernel
+#endif
+
+#ifndef DFT_CHANNEL_BLOCK
+	#define DFT_CHANNEL_BLOCK 16
+#endif
+
+#ifndef DFT_IMAGE_TILE
+	#define DFT_IMAGE_TILE 8
+#endif
+
+#ifndef DFT_SOA_PAD
+	#define DFT_SOA_PAD 8
+#endif
+
+// Distance between the fields of a structure-of-arrays block of count elements
+#define SOA_STRIDE(count) ((((count) + DFT_SOA_PAD - 1) / DFT_SOA_PAD) * DFT_SOA_PAD)
+
+#ifdef DFT_NUM_SOURCES
+	#define SOURCE_COUNT(runtime) DFT_NUM_SOURCES
+	#define UNROLL_SOURCES _Pragma("unroll")
+#else
+	#define SOURCE_COUNT(runtime) (runtime)
+	#define UNROLL_SOURCES
+#endif
+
+// The host defines DFT_ENABLE_FP64 only for devices exposing cl_khr_fp64,
+// so that the reduced precision kernels still build everywhere else
+#ifdef DFT_ENABLE_FP64
 #pragma OPENCL EXTENSION cl_khr_fp64 : enable
-typedef __global struct {double x,y,z;} double_3;
 typedef __global struct {double x,y;} double_2;
 
-__kernel void DFT_OpenCL(__global double_3* visibility, __global double_2* visIntensity, int visCount, __global double_3* sources, int sourceCount)
+/* Sources arrive packed by the host (see packSources): x, y and z hold l, m
+and the w correction pre-scaled by 2*pi, w holds the image-corrected flux.
+
+Visibilities and intensities are structure-of-arrays blocks (u, v, w and
+real, imaginary), each field SOA_STRIDE(visCount) apart, so that
+neighbouring work-items load neighbouring doubles.
+*/
+__kernel void DFT_OpenCL(__global double* visibility, __global double* visIntensity, int visCount, __global double4* sources, int sourceCount)
 {
 	int visibilityIndex = get_global_id(0);
 
 	if(visibilityIndex >= visCount)
 		return;
 
-	double term = 0.0;
-	double w_correction = 0.0;
-	double image_correction = 0.0;
+	const int stride = SOA_STRIDE(visCount);
+	const double u = visibility[visibilityIndex];
+	const double v = visibility[stride + visibilityIndex];
+	const double w = visibility[2 * stride + visibilityIndex];
 	double theta = 0.0;
-	double src_correction = 0.0;
-        
-	const double two_PI = 3.14159265358979323846 + 3.14159265358979323846;
+	const int numSources = SOURCE_COUNT(sourceCount);
 
 	// For all sources
-	for(int s = 0; s < sourceCount; ++s)
+	UNROLL_SOURCES
+	for(int s = 0; s < numSources; ++s)
+	{
+		theta = PHASE(u, v, w, sources[s]);
+
+		visIntensity[visibilityIndex] += cos(theta) * sources[s].w;
+		visIntensity[stride + visibilityIndex] += -sin(theta) * sources[s].w;
+	}
+}
+
+/* Tiled variant of DFT_OpenCL
+
+Each work-group cooperatively stages a tile of packed sources in local
+memory, one source per work-item. The accumulators live in private memory
+and are added to visIntensity once at the end.
+
+The tile is sized by the host to the work-group size (TILE_SIZE). Work-items past
+visCount still help load tiles so that every barrier is reached by the
+whole work-group.
+*/
+TILED_KERNEL void DFT_OpenCL_Tiled(__global double* visibility, __global double* visIntensity, int visCount,
+	__global double4* sources, int sourceCount, __local double4* sourceTile)
+{
+	const int visibilityIndex = get_global_id(0);
+	const int localIndex = get_local_id(0);
+	const int tileSize = TILE_SIZE;
+	const int numSources = SOURCE_COUNT(sourceCount);
+	const int active = visibilityIndex < visCount;
+	const int stride = SOA_STRIDE(visCount);
+
+	double u = 0.0;
+	double v = 0.0;
+	double w = 0.0;
+	if(active)
 	{
-		term = 0.5 * (sources[s].x * sources[s].x + sources[s].y * sources[s].y);
-		w_correction = -term;
-		image_correction = 1.0 - term;
-		src_correction = sources[s].z / image_correction;
+		u = visibility[visibilityIndex];
+		v = visibility[stride + visibilityIndex];
+		w = visibility[2 * stride + visibilityIndex];
+	}
 
-		theta = (visibility[visibilityIndex].x * sources[s].x + visibility[visibilityIndex].y * sources[s].y + visibility[visibilityIndex].z * w_correction) * two_PI;
+	double real = 0.0;
+	double imaginary = 0.0;
 
-		visIntensity[visibilityIndex].x += cos(theta) * src_correction;
-		visIntensity[visibilityIndex].y += -sin(theta) * src_correction;
+	for(int tileStart = 0; tileStart < numSources; tileStart += tileSize)
+	{
+		const int s = tileStart + localIndex;
+		if(s < numSources)
+			sourceTile[localIndex] = sources[s];
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int tileCount = min(tileSize, numSources - tileStart);
+		UNROLL_SOURCES
+		for(int t = 0; t < tileCount; ++t)
+		{
+			const double4 src = sourceTile[t];
+			const double theta = PHASE(u, v, w, src);
+			double cos_theta;
+			const double sin_theta = sincos(theta, &cos_theta);
+			real = fma(cos_theta, src.w, real);
+			imaginary = fma(-sin_theta, src.w, imaginary);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
 	}
+
+	if(active)
+	{
+		visIntensity[visibilityIndex] += real;
+		visIntensity[stride + visibilityIndex] += imaginary;
+	}
+}
+
+/* Source-split variant of DFT_OpenCL, for few visibilities
+
+Dimension 1 picks the visibility and dimension 0 spans sliceCount
+work-groups, each summing one slice of sliceSources sources. Its
+work-items stride through the slice and then combine their sums by a tree
+reduction in local memory, in which every work-item adds a fixed partner,
+so the order of additions never varies. One partial sum per slice and
+visibility is written to partials, sliceCount structure-of-arrays blocks
+of SOA_STRIDE(visCount) reals then imaginaries; DFT_Reduce_Slices adds them.
+*/
+TILED_KERNEL void DFT_OpenCL_Split(__global double* visibility, __global double* partials, int visCount,
+	__global double4* sources, int sourceCount, __local double2* sums, int sliceSources)
+{
+	const int visibilityIndex = get_global_id(1);
+	const int slice = get_group_id(0);
+	const int localIndex = get_local_id(0);
+	const int tileSize = TILE_SIZE;
+	const int numSources = SOURCE_COUNT(sourceCount);
+	const int stride = SOA_STRIDE(visCount);
+
+	const double u = visibility[visibilityIndex];
+	const double v = visibility[stride + visibilityIndex];
+	const double w = visibility[2 * stride + visibilityIndex];
+
+	double real = 0.0;
+	double imaginary = 0.0;
+	const int last = min((slice + 1) * sliceSources, numSources);
+	for(int s = slice * sliceSources + localIndex; s < last; s += tileSize)
+	{
+		const double4 src = sources[s];
+		const double theta = PHASE(u, v, w, src);
+		double cos_theta;
+		const double sin_theta = sincos(theta, &cos_theta);
+		real = fma(cos_theta, src.w, real);
+		imaginary = fma(-sin_theta, src.w, imaginary);
+	}
+
+	sums[localIndex] = (double2)(real, imaginary);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Halve the live sums each step, rounding up for odd widths
+	for(int width = tileSize; width > 1; width = (width + 1) / 2)
+	{
+		const int half = (width + 1) / 2;
+		if(localIndex < width / 2)
+			sums[localIndex] += sums[localIndex + half];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if(localIndex == 0)
+	{
+		partials[2 * slice * stride + visibilityIndex] = sums[0].x;
+		partials[(2 * slice + 1) * stride + visibilityIndex] = sums[0].y;
+	}
+}
+
+/* Add the slices of DFT_OpenCL_Split to visIntensity, in slice order */
+__kernel void DFT_Reduce_Slices(__global double* partials, __global double* visIntensity, int visCount,
+	int sliceCount)
+{
+	const int visibilityIndex = get_global_id(0);
+
+	if(visibilityIndex >= visCount)
+		return;
+
+	const int stride = SOA_STRIDE(visCount);
+	double real = 0.0;
+	double imaginary = 0.0;
+	for(int slice = 0; slice < sliceCount; ++slice)
+	{
+		real += partials[2 * slice * stride + visibilityIndex];
+		imaginary += partials[(2 * slice + 1) * stride + visibilityIndex];
+	}
+
+	visIntensity[visibilityIndex] += real;
+	visIntensity[stride + visibilityIndex] += imaginary;
+}
+
+/* Channelized variant of DFT_OpenCL
+
+Visibilities hold u, v and w in metres (a structure-of-arrays block as for
+DFT_OpenCL), and channelScale the frequency of
+each channel over the speed of light, so the phase of a source in channel
+k is its phase per metre times channelScale[k]. Each work-item handles one
+visibility (dimension 0) and DFT_CHANNEL_BLOCK channels (dimension 1),
+writing channel-major sums into visIntensity.
+
+When the channels are regularly spaced, channelStep is the scale between
+neighbours: the phasor of each next channel is then the previous one
+rotated by a fixed step, costing a complex multiply in place of a sincos.
+A channelStep of 0 evaluates every channel's phasor directly.
+*/
+__kernel void DFT_OpenCL_Channels(__global double* visibility, __global double_2* visIntensity, int visCount,
+	__global double4* sources, int sourceCount, __global double* channelScale, int channelCount,
+	double channelStep)
+{
+	const int visibilityIndex = get_global_id(0);
+	const int firstChannel = get_global_id(1) * DFT_CHANNEL_BLOCK;
+
+	if(visibilityIndex >= visCount || firstChannel >= channelCount)
+		return;
+
+	const int count = min(DFT_CHANNEL_BLOCK, channelCount - firstChannel);
+	const int stride = SOA_STRIDE(visCount);
+	const double u = visibility[visibilityIndex];
+	const double v = visibility[stride + visibilityIndex];
+	const double w = visibility[2 * stride + visibilityIndex];
+	const int numSources = SOURCE_COUNT(sourceCount);
+
+	double2 sums[DFT_CHANNEL_BLOCK];
+	for(int k = 0; k < DFT_CHANNEL_BLOCK; ++k)
+		sums[k] = (double2)(0.0);
+
+	UNROLL_SOURCES
+	for(int s = 0; s < numSources; ++s)
+	{
+		const double4 src = sources[s];
+		const double theta = PHASE(u, v, w, src);
+
+		if(channelStep != 0.0)
+		{
+			double cos_theta, cos_step;
+			const double sin_theta = sincos(theta * channelScale[firstChannel], &cos_theta);
+			const double sin_step = sincos(theta * channelStep, &cos_step);
+			double2 phasor = (double2)(cos_theta, -sin_theta) * src.w;
+			const double2 step = (double2)(cos_step, -sin_step);
+
+			for(int k = 0; k < count; ++k)
+			{
+				sums[k] += phasor;
+				phasor = (double2)(phasor.x * step.x - phasor.y * step.y, fma(phasor.x, step.y, phasor.y * step.x));
+			}
+		}
+		else
+		{
+			for(int k = 0; k < count; ++k)
+			{
+				double cos_theta;
+				const double sin_theta = sincos(theta * channelScale[firstChannel + k], &cos_theta);
+				sums[k] += (double2)(cos_theta, -sin_theta) * src.w;
+			}
+		}
+	}
+
+	for(int k = 0; k < count; ++k)
+	{
+		const size_t index = (size_t) (firstChannel + k) * visCount + visibilityIndex;
+		visIntensity[index].x = sums[k].x;
+		visIntensity[index].y = sums[k].y;
+	}
+}
+/* Inverse DFT: the dirty image of a set of visibilities
+
+The adjoint of DFT_OpenCL. Each work-group computes one square tile of
+DFT_IMAGE_TILE x DFT_IMAGE_TILE pixels, one pixel per work-item, staging
+visibilities through local memory one per work-item. Visibilities arrive
+with u, v and w pre-scaled by 2*pi and values already weighted. Pixel
+(x, y) is at l = (x - gridSize / 2) * cellSize and m likewise, and sums
+the real part of every value rotated by the visibility's phase, scaled by
+normalisation (one over the weight sum) and by the same image correction
+packSources divides out, so that a point source images at its flux.
+*/
+__kernel __attribute__((reqd_work_group_size(DFT_IMAGE_TILE, DFT_IMAGE_TILE, 1)))
+void DFT_OpenCL_Image(__global double4* visibility, __global double2* values, int visCount,
+	__global double* image, int gridSize, double cellSize, double normalisation,
+	__local double4* visibilityTile, __local double2* valueTile)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const int localIndex = get_local_id(1) * DFT_IMAGE_TILE + get_local_id(0);
+	const int tileSize = DFT_IMAGE_TILE * DFT_IMAGE_TILE;
+
+	const double l = (x - gridSize / 2) * cellSize;
+	const double m = (y - gridSize / 2) * cellSize;
+	const double term = 0.5 * (l * l + m * m);
+	const double4 pixel = (double4)(l, m, -term, 0.0);
+
+	double sum = 0.0;
+	for(int tileStart = 0; tileStart < visCount; tileStart += tileSize)
+	{
+		const int k = tileStart + localIndex;
+		if(k < visCount)
+		{
+			visibilityTile[localIndex] = visibility[k];
+			valueTile[localIndex] = values[k];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int tileCount = min(tileSize, visCount - tileStart);
+		for(int t = 0; t < tileCount; ++t)
+		{
+			const double4 vis = visibilityTile[t];
+			const double theta = PHASE(vis.x, vis.y, vis.z, pixel);
+			double cos_theta;
+			const double sin_theta = sincos(theta, &cos_theta);
+			sum = fma(valueTile[t].x, cos_theta, fma(-valueTile[t].y, sin_theta, sum));
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if(x < gridSize && y < gridSize)
+		image[(size_t) y * gridSize + x] = sum * normalisation * (1.0 - term);
+}
+#endif /* DFT_ENABLE_FP64 */
+
+/* Single precision variant of DFT_OpenCL_Tiled
+
+Sources and visibilities are converted to float by the host after all of
+their terms have been computed in double. l, m and n are expressed in
+turns rather than radians, so the phase is reduced exactly to [-0.5, 0.5]
+turns before sinpi/cospi; only the dot product itself is evaluated in
+float. visIntensity is overwritten, the host adds it to its own totals.
+*/
+TILED_KERNEL void DFT_OpenCL_Single(__global float4* visibility, __global float2* visIntensity, int visCount,
+	__global float4* sources, int sourceCount, __local float4* sourceTile)
+{
+	const int visibilityIndex = get_global_id(0);
+	const int localIndex = get_local_id(0);
+	const int tileSize = TILE_SIZE;
+	const int numSources = SOURCE_COUNT(sourceCount);
+	const int active = visibilityIndex < visCount;
+
+	float4 vis = (float4)(0.0f);
+	if(active)
+		vis = visibility[visibilityIndex];
+
+	float real = 0.0f;
+	float imaginary = 0.0f;
+
+	for(int tileStart = 0; tileStart < numSources; tileStart += tileSize)
+	{
+		const int s = tileStart + localIndex;
+		if(s < numSources)
+			sourceTile[localIndex] = sources[s];
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int tileCount = min(tileSize, numSources - tileStart);
+		UNROLL_SOURCES
+		for(int t = 0; t < tileCount; ++t)
+		{
+			const float4 src = sourceTile[t];
+			const float turns = PHASE(vis.x, vis.y, vis.z, src);
+			const float reduced = 2.0f * (turns - rint(turns));
+			real = fma(cospi(reduced), src.w, real);
+			imaginary = fma(-sinpi(reduced), src.w, imaginary);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if(active)
+		visIntensity[visibilityIndex] = (float2)(real, imaginary);
+}
+
+/* Double-single ("float-float") arithmetic
+
+A value is carried as an unevaluated sum hi + lo of two floats, giving
+roughly 48 bits of significand using only fp32 instructions.
+*/
+typedef struct {float4 hi; float4 lo;} float4_ds;
+
+inline float2 ds_two_sum(float a, float b)
+{
+	const float s = a + b;
+	const float bb = s - a;
+	return (float2)(s, (a - (s - bb)) + (b - bb));
+}
+
+inline float2 ds_quick_two_sum(float a, float b)
+{
+	const float s = a + b;
+	return (float2)(s, b - (s - a));
+}
+
+inline float2 ds_add(float2 a, float2 b)
+{
+	float2 s = ds_two_sum(a.x, b.x);
+	s.y += a.y + b.y;
+	return ds_quick_two_sum(s.x, s.y);
+}
+
+inline float2 ds_mul(float2 a, float2 b)
+{
+	const float p = a.x * b.x;
+	float e = fma(a.x, b.x, -p);
+	e = fma(a.x, b.y, e);
+	e = fma(a.y, b.x, e);
+	return ds_quick_two_sum(p, e);
+}
+
+/* Exact product of two floats as a double-single value */
+inline float2 ds_two_prod(float a, float b)
+{
+	const float p = a * b;
+	return (float2)(p, fma(a, b, -p));
+}
+
+/* Double-single variant of DFT_OpenCL_Tiled
+
+The phase in turns is accumulated in double-single arithmetic and reduced
+to [-0.5, 0.5] turns before the float sinpi/cospi, so its error does not
+grow with the size of the baseline. Sums are kept in double-single too and
+written as (real hi, real lo, imaginary hi, imaginary lo).
+*/
+TILED_KERNEL void DFT_OpenCL_DoubleSingle(__global float4_ds* visibility, __global float4* visIntensity, int visCount,
+	__global float4_ds* sources, int sourceCount, __local float4_ds* sourceTile)
+{
+	const int visibilityIndex = get_global_id(0);
+	const int localIndex = get_local_id(0);
+	const int tileSize = TILE_SIZE;
+	const int numSources = SOURCE_COUNT(sourceCount);
+	const int active = visibilityIndex < visCount;
+
+	float2 u = (float2)(0.0f);
+	float2 v = (float2)(0.0f);
+	float2 w = (float2)(0.0f);
+	if(active)
+	{
+		const float4_ds vis = visibility[visibilityIndex];
+		u = (float2)(vis.hi.x, vis.lo.x);
+		v = (float2)(vis.hi.y, vis.lo.y);
+		w = (float2)(vis.hi.z, vis.lo.z);
+	}
+
+	float2 real = (float2)(0.0f);
+	float2 imaginary = (float2)(0.0f);
+
+	for(int tileStart = 0; tileStart < numSources; tileStart += tileSize)
+	{
+		const int s = tileStart + localIndex;
+		if(s < numSources)
+			sourceTile[localIndex] = sources[s];
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int tileCount = min(tileSize, numSources - tileStart);
+		UNROLL_SOURCES
+		for(int t = 0; t < tileCount; ++t)
+		{
+			const float4_ds src = sourceTile[t];
+			float2 turns = ds_mul(u, (float2)(src.hi.x, src.lo.x));
+			turns = ds_add(turns, ds_mul(v, (float2)(src.hi.y, src.lo.y)));
+#ifndef DFT_ZERO_W
+			turns = ds_add(turns, ds_mul(w, (float2)(src.hi.z, src.lo.z)));
+#endif
+			turns = ds_add(turns, (float2)(-rint(turns.x), 0.0f));
+
+			const float reduced = 2.0f * (turns.x + turns.y);
+			real = ds_add(real, ds_two_prod(cospi(reduced), src.hi.w));
+			imaginary = ds_add(imaginary, ds_two_prod(-sinpi(reduced), src.hi.w));
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if(active)
+		visIntensity[visibilityIndex] = (float4)(real.x, real.y, imaginary.x, imaginary.y);
 }
@@ -29,6 +29,16 @@
 #ifndef CONFIG_H_
 #define CONFIG_H_
 
+#include <stddef.h>
+#include <stdio.h>
+#ifdef MAC
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "dft_types.h"
+
 //=========================//
 // Algorithm Configurables //
 //=========================//
@@ -42,52 +52,140 @@
 //        Structures       //
 //=========================//
 
-
-typedef struct Config {
-	int numVisibilities;
-	int numSources;
-	const char *source_file;
-	const char *vis_src_file;
-	const char *vis_file;
-	int force_zero_w_term;
-	int synthetic_sources;
-	int synthetic_visibilities;
-	int gaussian_distribution_sources;
-	double min_u;
-	double max_u;
-	double min_v;
-	double max_v;
-	double grid_size;
-	double cell_size;
-	double uv_scale;
-	double frequency_hz;
-	int enable_messages;
-} Config;
-
-typedef struct Complex {
-	double real;
-	double imaginary;
-} Complex;
-
-typedef struct Source {
+// Source terms which do not depend on the visibility, computed once per sky
+// model by packSources. l, m and n are pre-scaled by 2*pi so that the phase
+// is a single dot product with (u, v, w); n carries the w correction
+// -(l^2 + m^2) / 2 and flux the image-corrected intensity.
+typedef struct PackedSource {
 	double l;
 	double m;
-	double intensity;
-} Source;
-
-typedef struct Visibility {
-	double u;
-	double v;
-	double w;
-} Visibility;
-
-typedef struct {
-	double x,y,z;
-} double_3;
-
-typedef struct {
-	double x,y;
-} double_2;
+	double n;
+	double flux;
+} PackedSource;
+
+// Host layouts of the reduced precision kernels. Coordinates are in turns
+// (not pre-scaled by 2*pi) so that the kernels can reduce the phase exactly.
+typedef struct PackedSourceSingle {
+	float l;
+	float m;
+	float n;
+	float flux;
+} PackedSourceSingle;
+
+typedef struct VisibilitySingle {
+	float u;
+	float v;
+	float w;
+	float pad;
+} VisibilitySingle;
+
+// Double-single values are split as hi = (float) x, lo = (float) (x - hi)
+typedef struct PackedSourceDoubleSingle {
+	float l_hi, m_hi, n_hi, flux;
+	float l_lo, m_lo, n_lo, pad;
+} PackedSourceDoubleSingle;
+
+typedef struct VisibilityDoubleSingle {
+	float u_hi, v_hi, w_hi, pad_hi;
+	float u_lo, v_lo, w_lo, pad_lo;
+} VisibilityDoubleSingle;
+
+// Outcome of looking up the compiled program in the kernel binary cache
+typedef struct KernelCacheStats {
+	int hits;    // built from a cached binary
+	int misses;  // no entry, built from source
+	int stale;   // entry rejected by the driver or corrupt, built from source
+	int stores;  // entries written
+} KernelCacheStats;
+
+// Long-lived OpenCL execution state, created once and reused across
+// predictions so that repeated calls only pay for transfers and kernel time.
+// Device buffers grow on demand and are never shrunk until destruction.
+typedef struct DFT_Engine {
+	int backend;
+	int numThreads;
+	int precision;
+	char deviceName[128];
+	struct DFT_Engine **workers; // per-device engines of a multi-device engine
+	int numWorkers;
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue queue;
+	cl_command_queue uploadQueue;
+	cl_command_queue readbackQueue;
+	cl_program program;
+	KernelCacheStats kernelCache;
+	cl_kernel kernel;
+	cl_kernel tiledKernel;
+	cl_kernel singleKernel;
+	cl_kernel doubleSingleKernel;
+	cl_kernel channelKernel;
+	cl_kernel imageKernel;
+	cl_kernel splitKernel;
+	cl_kernel reduceKernel;
+	int fp64;
+	int zeroW;
+	size_t tileSize;         // work-group size the tiled kernels are compiled for
+	int specializedSources;  // sky model size the kernels are compiled for, 0 when general
+	cl_uint computeUnits;
+	int kernelVariant;       // Config.kernel_variant, or the device's tuning profile
+	int sourceSplit;         // Config.source_split, or the device's tuning profile
+	double kernelSeconds;    // compute time of the last extract_visibilities call
+	PackedSource *packedSources;
+	int numPackedSources;
+	int packedSourceCapacity;
+	unsigned long long skyModelChecksum;
+	int skyModelValid;
+	void *reducedSources;
+	size_t reducedSourceCapacity;
+	cl_event sourceUpload;   // pending sky model transfer, which reads packedSources or reducedSources
+	void *stagingVisibilities;
+	size_t stagingVisibilityCapacity;
+	void *stagingIntensities;
+	size_t stagingIntensityCapacity;
+	int zeroCopy;            // device buffers are host memory and are mapped rather than copied
+	int pinnedStaging;       // staging arrays are mapped CL_MEM_ALLOC_HOST_PTR buffers
+	cl_mem pinnedVisibilities;
+	cl_mem pinnedIntensities;
+	cl_mem deviceVisibilities;
+	cl_mem deviceSources;
+	cl_mem deviceIntensities;
+	cl_mem deviceChannels;
+	cl_mem deviceImage;
+	cl_mem devicePartials;   // per-slice sums of the source-split kernel
+	size_t visibilityCapacity;
+	size_t sourceCapacity;
+	size_t intensityCapacity;
+	size_t channelCapacity;
+	size_t imageCapacity;
+	size_t partialCapacity;
+} DFT_Engine;
+
+// Predicted visibilities kept current across edits of the sky model. Each
+// update evaluates only the sources that were added, removed or re-fluxed,
+// adding or subtracting their contribution in place. On an fp64 OpenCL
+// engine the visibilities stay resident on the device between updates.
+typedef struct DFT_Prediction {
+	DFT_Engine *engine;
+	Visibility *visibilities;    // caller's coordinates, not copied
+	Complex *visIntensity;       // current after read_dft_prediction
+	int numVisibilities;
+	Source *sources;             // sky model held by the prediction, sorted by position
+	int numSources;
+	size_t sourceCapacity;
+	Source *nextSources;         // scratch for the incoming sky model
+	size_t nextSourceCapacity;
+	Source *delta;               // scratch for the sources evaluated by an update
+	size_t deltaCapacity;
+	int updatesSinceRecompute;
+	int stale;                   // a failed update left visIntensity incomplete
+	int resident;                // visIntensity lives in deviceIntensities
+	int deviceDirty;             // device holds updates not yet read back
+	cl_mem deviceVisibilities;
+	cl_mem deviceIntensities;
+	size_t visibilityCapacity;
+	size_t intensityCapacity;
+} DFT_Prediction;
 
 //=========================//
 //     Function Headers    //
@@ -95,10 +193,33 @@ typedef struct {
 void initConfig (Config *config);
 void loadSources(Config *config, Source **sources);
 void loadVisibilities(Config *config, Visibility **visibilities, Complex **visIntensity);
-void extract_visibilities(Config *config, Source *sources, Visibility *visibilities, Complex *vis_intensity, int num_visibilities);
+int readVisibilityRows(Config *config, FILE *file, Visibility *visibilities, int count);
+void packSources(Source *sources, PackedSource *packed, int numSources);
+int pruneSources(Config *config, Source *sources, Visibility *visibilities, int numVisibilities, double *bound);
+int find_backend_devices(Config *config, cl_device_id *devices, int max_devices);
+int create_device_engine(Config *config, cl_device_id device, DFT_Engine **created);
+int try_create_dft_engine(Config *config, DFT_Engine **engine);
+DFT_Engine* create_dft_engine(Config *config);
+void destroy_dft_engine(DFT_Engine *engine);
+int extract_visibilities(DFT_Engine *engine, Config *config, Source *sources, Visibility *visibilities, Complex *vis_intensity, int num_visibilities);
+int stream_visibilities(DFT_Engine *engine, Config *config, Source *sources);
+int loadChannels(Config *config, double **frequencies);
+int extract_channel_visibilities(DFT_Engine *engine, Config *config, Source *sources, Visibility *visibilities,
+	int num_visibilities, const double *frequencies, int num_channels, Complex *vis_intensity, size_t channel_stride);
+void saveChannelVisibilities(Config *config, Visibility *visibilities, const double *frequencies, int num_channels,
+	Complex *vis_intensity);
+int extract_image(DFT_Engine *engine, Config *config, Visibility *visibilities, Complex *vis_intensity,
+	const double *weights, int num_visibilities, double *image);
+DFT_Prediction* create_dft_prediction(DFT_Engine *engine, Config *config, Source *sources, Visibility *visibilities,
+	int num_visibilities);
+int update_dft_prediction(DFT_Prediction *prediction, Config *config, Source *sources);
+Complex* read_dft_prediction(DFT_Prediction *prediction);
+void destroy_dft_prediction(DFT_Prediction *prediction);
+double measure_precision_error(DFT_Engine *engine, Config *config, Visibility *visibilities, Complex *vis_intensity, int num_visibilities);
 void saveVisibilities(Config *config, Visibility *visibilities, Complex *visIntensity);
+void writeVisibilityRows(Config *config, FILE *file, Visibility *visibilities, Complex *visIntensity, int count);
 double randomInRange(double min, double max);
 double sampleNormal();
 void unit_test_init_config(Config *config);
-double unit_test_generate_approximate_visibilities();
+double unit_test_generate_approximate_visibilities(Config *test_config);
 #endif /* CONFIG_H_ */
@@ -28,10 +28,88 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <sys/time.h>
 
 #include "direct_fourier_transform.h"
+#include "dft_api.h"
+#include "dft_binary_io.h"
+#include "dft_trace.h"
+#include "dft_batch.h"
+#include "dft_tune.h"
+
+// Predicts every channel of config->channel_file, keeping the visibility
+// coordinates in metres so that each channel can scale them itself
+static int run_channels(Config *config, Source *sources)
+{
+	double *frequencies = NULL;
+	int numChannels = loadChannels(config, &frequencies);
+	if(numChannels <= 0)
+		return EXIT_FAILURE;
+
+	// A frequency of C makes the metres to wavelengths scale exactly one
+	Config metres = *config;
+	metres.frequency_hz = C;
+	Visibility *visibilities = NULL;
+	Complex *visIntensity = NULL;
+	DFT_Mapping mapping = { NULL, 0 };
+	double loading = trace_now();
+	if(!metres.synthetic_visibilities && is_binary_file(metres.vis_src_file))
+	{
+		load_binary_visibilities(&metres, metres.vis_src_file, &mapping, &visibilities, &visIntensity);
+		trace_host("map binary visibilities", TRACE_IO, loading);
+	}
+	else
+		loadVisibilities(&metres, &visibilities, &visIntensity);
+	config->numVisibilities = metres.numVisibilities;
+
+	Complex *channelIntensity = NULL;
+	if(visibilities != NULL)
+		channelIntensity = (Complex*)calloc((size_t) numChannels * config->numVisibilities, sizeof(Complex));
+	if(channelIntensity == NULL)
+	{
+		printf(">>> ERROR: Visibility memory was unable to be allocated...\n\n");
+		if(visibilities && mapping.address == NULL) free(visibilities);
+		if(visIntensity) free(visIntensity);
+		unmap_file(&mapping);
+		free(frequencies);
+		return EXIT_FAILURE;
+	}
+
+	double creating = trace_now();
+	DFT_Engine *engine = create_dft_engine(config);
+	trace_host("create engine", TRACE_HOST, creating);
+	if(engine == NULL)
+	{
+		printf(">>> ERROR: Unable to create the DFT engine...\n\n");
+		if(visibilities && mapping.address == NULL) free(visibilities);
+		if(visIntensity) free(visIntensity);
+		unmap_file(&mapping);
+		free(channelIntensity);
+		free(frequencies);
+		return EXIT_FAILURE;
+	}
+	int status = extract_channel_visibilities(engine, config, sources, visibilities, config->numVisibilities,
+		frequencies, numChannels, channelIntensity, config->numVisibilities);
+	destroy_dft_engine(engine);
+
+	if(status == DFT_SUCCESS)
+	{
+		double saving = trace_now();
+		saveChannelVisibilities(config, visibilities, frequencies, numChannels, channelIntensity);
+		trace_host("save visibilities", TRACE_IO, saving);
+	}
+	else
+		printf(">>> ERROR: Prediction failed: %s...\n\n", dft_status_string(status));
+
+	if(visibilities && mapping.address == NULL) free(visibilities);
+	unmap_file(&mapping);
+	if(visIntensity) free(visIntensity);
+	free(channelIntensity);
+	free(frequencies);
+	return (status == DFT_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
 int main(int argc, char **argv)
 {
@@ -41,37 +119,177 @@ int main(int argc, char **argv)
 	Config config;
 	initConfig(&config);
 
+	// `dft --batch <manifest>` runs many observations on one engine
+	if(argc == 3 && strcmp(argv[1], "--batch") == 0)
+		config.batch_manifest = argv[2];
+	// `dft --tune` searches the launch parameters of each device and stores them
+	else if(argc == 2 && strcmp(argv[1], "--tune") == 0)
+	{
+		int status = autotune_devices(&config);
+		printf(">>> INFO: Direct Fourier Transform operations complete, exiting...\n\n");
+		return (status == DFT_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	else if(argc != 1)
+	{
+		printf(">>> INFO: Usage: %s [--batch <manifest> | --tune]\n\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(config.trace_file != NULL)
+		trace_start(config.trace_file);
+
+	if(config.batch_manifest != NULL)
+	{
+		int failed = run_batch(&config);
+		trace_finish();
+		printf(">>> INFO: Direct Fourier Transform operations complete, exiting...\n\n");
+		return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	Source *sources = NULL;
-	loadSources(&config, &sources);
+	double loading = trace_now();
+	if(!config.synthetic_sources && is_binary_file(config.source_file))
+	{
+		load_binary_sources(&config, config.source_file, &sources);
+		trace_host("map binary sources", TRACE_IO, loading);
+	}
+	else
+		loadSources(&config, &sources);
 	if(sources == NULL)
 	{	
 		printf(">>> ERROR: Source memory was unable to be allocated...\n\n");
 		return EXIT_FAILURE;
 	}
 
+	// Without the visibilities up front the faint tail can only be dropped, not merged
+	if(config.channel_file != NULL || (config.stream_chunk_size > 0 && !config.synthetic_visibilities
+		&& !is_binary_file(config.vis_src_file)))
+	{
+		double pruning = trace_now();
+		double bound;
+		if(pruneSources(&config, sources, NULL, 0, &bound) != DFT_SUCCESS)
+			printf(">>> WARNING: Unable to prune the sky model, keeping every source...\n\n");
+		trace_host("prune sky model", TRACE_HOST, pruning);
+	}
+
+	// Channelized mode: every channel of the same visibilities in one prediction
+	if(config.channel_file != NULL)
+	{
+		int status = run_channels(&config, sources);
+		if(sources) free(sources);
+		trace_finish();
+		printf(">>> INFO: Direct Fourier Transform operations complete, exiting...\n\n");
+		return status;
+	}
+
+	// Out-of-core mode: visibilities flow from file to file one chunk at a time.
+	// Binary inputs are paged in by the mapping instead.
+	if(config.stream_chunk_size > 0 && !config.synthetic_visibilities
+		&& !is_binary_file(config.vis_src_file))
+	{
+		double creating = trace_now();
+		DFT_Engine *engine = create_dft_engine(&config);
+		trace_host("create engine", TRACE_HOST, creating);
+		int streamed = DFT_ERROR_NO_DEVICE;
+		if(engine != NULL)
+			streamed = stream_visibilities(engine, &config, sources);
+		else
+			printf(">>> ERROR: Unable to create the DFT engine...\n\n");
+		if(engine != NULL && streamed < 0)
+			printf(">>> ERROR: Streaming failed: %s...\n\n", dft_status_string(streamed));
+		destroy_dft_engine(engine);
+		if(sources) free(sources);
+		trace_finish();
+		printf(">>> INFO: Direct Fourier Transform operations complete, exiting...\n\n");
+		return (streamed >= 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Binary visibilities may be used in place from the file mapping
 	Visibility *visibilities = NULL;
 	Complex *visIntensity = NULL;
-	loadVisibilities(&config, &visibilities, &visIntensity);
+	DFT_Mapping mapping = { NULL, 0 };
+	loading = trace_now();
+	if(!config.synthetic_visibilities && is_binary_file(config.vis_src_file))
+	{
+		load_binary_visibilities(&config, config.vis_src_file, &mapping, &visibilities, &visIntensity);
+		trace_host("map binary visibilities", TRACE_IO, loading);
+	}
+	else
+		loadVisibilities(&config, &visibilities, &visIntensity);
 
 	if(visibilities == NULL || visIntensity == NULL)
 	{	
 		printf(">>> ERROR: Visibility memory was unable to be allocated...\n\n");
 		if(sources)      	   free(sources);
-		if(visibilities)       free(visibilities);
+		if(visibilities && mapping.address == NULL) free(visibilities);
 		if(visIntensity)      free(visIntensity);
+		unmap_file(&mapping);
 		return EXIT_FAILURE;
 	}
 
-	extract_visibilities(&config, sources, visibilities, visIntensity, config.numVisibilities);
+	double pruning = trace_now();
+	double bound;
+	if(pruneSources(&config, sources, visibilities, config.numVisibilities, &bound) != DFT_SUCCESS)
+		printf(">>> WARNING: Unable to prune the sky model, keeping every source...\n\n");
+	trace_host("prune sky model", TRACE_HOST, pruning);
+
+	// The prediction itself goes through the library, as any in-process caller's would
+	double creating = trace_now();
+	DFT_Handle *dft = NULL;
+	int status = dft_create(&dft, &config);
+	trace_host("create engine", TRACE_HOST, creating);
+	if(status == DFT_SUCCESS)
+		status = dft_set_sources(dft, sources, config.numSources);
+	if(status == DFT_SUCCESS)
+		status = dft_predict(dft, visibilities, config.numVisibilities, visIntensity);
+
+	// Report the accuracy given up for speed by the reduced precision kernels
+	double error = 0.0;
+	if(status == DFT_SUCCESS)
+		status = dft_precision_error(dft, visibilities, visIntensity, config.numVisibilities, &error);
+
+	// Dirty image of the prediction, naturally weighted
+	if(status == DFT_SUCCESS && config.image_file != NULL)
+	{
+		double *image = (double*)malloc((size_t) config.grid_size * (size_t) config.grid_size * sizeof(double));
+		if(image != NULL)
+		{
+			status = dft_image(dft, visibilities, visIntensity, NULL, config.numVisibilities, image);
+			if(status == DFT_SUCCESS)
+				saveImage(&config, image);
+			free(image);
+		}
+		else
+			printf(">>> ERROR: Image memory was unable to be allocated...\n\n");
+	}
+	dft_destroy(dft);
+
+	if(status != DFT_SUCCESS)
+	{
+		printf(">>> ERROR: Prediction failed: %s...\n\n", dft_status_string(status));
+		if(visibilities && mapping.address == NULL) free(visibilities);
+		unmap_file(&mapping);
+		if(sources)       free(sources);
+		if(visIntensity) free(visIntensity);
+		trace_finish();
+		return EXIT_FAILURE;
+	}
 
 	// Save visibilities to file
-	saveVisibilities(&config, visibilities, visIntensity);
+	double saving = trace_now();
+	if(config.binary_output)
+		saveVisibilitiesBinary(&config, visibilities, visIntensity);
+	else
+		saveVisibilities(&config, visibilities, visIntensity);
+	trace_host("save visibilities", TRACE_IO, saving);
 
 	// Clean up
-	if(visibilities)  free(visibilities);
+	if(visibilities && mapping.address == NULL) free(visibilities);
+	unmap_file(&mapping);
 	if(sources)       free(sources);
 	if(visIntensity) free(visIntensity);
 
+	trace_finish();
 	printf(">>> INFO: Direct Fourier Transform operations complete, exiting...\n\n");
 
 	return EXIT_SUCCESS;
@@ -28,10 +28,17 @@
 
 #include <cstdlib>
 #include <cstdio>
+#include <unistd.h>
 #include <gtest/gtest.h>
 
 #include "direct_fourier_transform.h"
 #include "direct_fourier_transform.c"
+#include "dft_binary_io.h"
+#include "dft_batch.h"
+#include "dft_text_io.h"
+#include "dft_storage.h"
+#include "dft_api.h"
+#include "dft_tune.h"
 
 // Test performs DFT on a fixed set of sources, produces a set of visibilities using said sources
 // and compares these visibilities against a set of correct visibilities for these sources.
@@ -41,13 +48,923 @@
 //      UNIT TESTING FUNCTIONALITY      //
 //**************************************//
 
+// Tests of the OpenCL kernels must not pass through the CPU fallback of
+// DFT_BACKEND_AUTO, so they force the OpenCL backend and are skipped on
+// hosts without a device
+#define REQUIRE_OPENCL_DEVICE(config) \
+	do { \
+		(config).compute_backend = DFT_BACKEND_OPENCL; \
+		if (create_device() == NULL) \
+			GTEST_SKIP() << "No OpenCL device"; \
+	} while (0)
+
 TEST(DFTTest, VisibilitiesApproximatelyEqual)
 {
+	Config config;
+	unit_test_init_config(&config);
+
+	double threshold = 1e-5; // 0.00001
+	double difference = unit_test_generate_approximate_visibilities(&config);
+	ASSERT_LE(difference, threshold); // diff <= threshold
+}
+
+TEST(DFTTest, TiledKernelVisibilitiesApproximatelyEqual)
+{
+	Config config;
+	unit_test_init_config(&config);
+	REQUIRE_OPENCL_DEVICE(config);
+	config.kernel_variant = DFT_KERNEL_TILED;
+
+	double threshold = 1e-5; // 0.00001
+	double difference = unit_test_generate_approximate_visibilities(&config);
+	ASSERT_LE(difference, threshold); // diff <= threshold
+}
+
+TEST(DFTTest, BasicKernelVisibilitiesApproximatelyEqual)
+{
+	Config config;
+	unit_test_init_config(&config);
+	REQUIRE_OPENCL_DEVICE(config);
+	config.kernel_variant = DFT_KERNEL_BASIC;
+
+	double threshold = 1e-5; // 0.00001
+	double difference = unit_test_generate_approximate_visibilities(&config);
+	ASSERT_LE(difference, threshold); // diff <= threshold
+}
+
+TEST(DFTTest, DoubleSinglePrecisionVisibilitiesApproximatelyEqual)
+{
+	Config config;
+	unit_test_init_config(&config);
+	REQUIRE_OPENCL_DEVICE(config);
+	config.precision_mode = DFT_PRECISION_DOUBLE_SINGLE;
+
+	double threshold = 1e-5; // 0.00001
+	double difference = unit_test_generate_approximate_visibilities(&config);
+	ASSERT_LE(difference, threshold); // diff <= threshold
+}
+
+// Single precision trades accuracy for speed, so it is held to a looser bound
+TEST(DFTTest, SinglePrecisionVisibilitiesApproximatelyEqual)
+{
+	Config config;
+	unit_test_init_config(&config);
+	REQUIRE_OPENCL_DEVICE(config);
+	config.precision_mode = DFT_PRECISION_SINGLE;
+
+	double threshold = 1e-3; // 0.001
+	double difference = unit_test_generate_approximate_visibilities(&config);
+	ASSERT_LE(difference, threshold); // diff <= threshold
+}
+
+TEST(DFTTest, CpuBackendVisibilitiesApproximatelyEqual)
+{
+	Config config;
+	unit_test_init_config(&config);
+	config.compute_backend = DFT_BACKEND_CPU;
+
+	double threshold = 1e-5; // 0.00001
+	double difference = unit_test_generate_approximate_visibilities(&config);
+	ASSERT_LE(difference, threshold); // diff <= threshold
+}
+
+// Every instruction set the host supports must agree with the scalar kernel
+// to rounding, whichever one cpu_simd_level would pick
+TEST(DFTTest, CpuSimdWidthsMatchScalar)
+{
+	Config config;
+	unit_test_init_config(&config);
+
+	Source *sources = NULL;
+	Visibility *visibilities = NULL;
+	Complex *visIntensity = NULL;
+	loadSources(&config, &sources);
+	loadVisibilities(&config, &visibilities, &visIntensity);
+	ASSERT_TRUE(sources != NULL && visibilities != NULL);
+
+	PackedSource *packed = (PackedSource*) malloc(config.numSources * sizeof(PackedSource));
+	Complex *scalar = (Complex*) calloc(config.numVisibilities, sizeof(Complex));
+	Complex *vector = (Complex*) calloc(config.numVisibilities, sizeof(Complex));
+	ASSERT_TRUE(packed != NULL && scalar != NULL && vector != NULL);
+	packSources(sources, packed, config.numSources);
+
+	ASSERT_TRUE(cpu_limit_simd_level("scalar"));
+	ASSERT_EQ(cpu_extract_visibilities(packed, config.numSources, visibilities, scalar,
+		config.numVisibilities, 0), DFT_SUCCESS);
+
+	const char *levels[2] = { "avx2", "avx512" };
+	for (int l = 0; l < 2; ++l)
+	{
+		if (!cpu_limit_simd_level(levels[l]))
+			continue;
+		memset(vector, 0, config.numVisibilities * sizeof(Complex));
+		ASSERT_EQ(cpu_extract_visibilities(packed, config.numSources, visibilities, vector,
+			config.numVisibilities, 0), DFT_SUCCESS);
+		for (int i = 0; i < config.numVisibilities; ++i)
+		{
+			ASSERT_NEAR(vector[i].real, scalar[i].real, 1e-10) << levels[l];
+			ASSERT_NEAR(vector[i].imaginary, scalar[i].imaginary, 1e-10) << levels[l];
+		}
+	}
+	cpu_limit_simd_level(NULL);
+
+	free(packed);
+	free(scalar);
+	free(vector);
+	free(sources);
+	free(visibilities);
+	free(visIntensity);
+}
+
+// Small chunks force the scheduler to spread the 500 test visibilities
+// over every device, including through steals. Without a GPU or
+// accelerator only the CPU worker would run, so the test is skipped.
+TEST(DFTTest, MultiDeviceVisibilitiesApproximatelyEqual)
+{
+	Config config;
+	unit_test_init_config(&config);
+	cl_device_id devices[MULTI_MAX_DEVICES];
+	if (enumerate_devices(devices, MULTI_MAX_DEVICES) == 0)
+		GTEST_SKIP() << "No OpenCL device";
+	config.compute_backend = DFT_BACKEND_MULTI;
+	config.multi_chunk_size = 16;
+
+	double threshold = 1e-5; // 0.00001
+	double difference = unit_test_generate_approximate_visibilities(&config);
+	ASSERT_LE(difference, threshold); // diff <= threshold
+}
+
+// Streams the test visibilities through the chunked pipeline (with a final
+// partial chunk) and compares the written file against the expected values
+TEST(DFTTest, StreamedVisibilitiesApproximatelyEqual)
+{
+	Config config;
+	unit_test_init_config(&config);
+	config.stream_chunk_size = 64;
+
+	Source *sources = NULL;
+	loadSources(&config, &sources);
+	ASSERT_TRUE(sources != NULL);
+
+	DFT_Engine *engine = create_dft_engine(&config);
+	int streamed = stream_visibilities(engine, &config, sources);
+	destroy_dft_engine(engine);
+	free(sources);
+	ASSERT_EQ(streamed, 500);
+
+	FILE *expected = fopen(config.vis_src_file, "r");
+	FILE *produced = fopen(config.vis_file, "r");
+	ASSERT_TRUE(expected != NULL && produced != NULL);
+
+	int expected_count = 0, produced_count = 0;
+	ASSERT_EQ(fscanf(expected, "%d\n", &expected_count), 1);
+	ASSERT_EQ(fscanf(produced, "%d\n", &produced_count), 1);
+	ASSERT_EQ(expected_count, produced_count);
+
+	double difference = 0.0;
+	double e[6], p[6];
+	for(int i = 0; i < expected_count; ++i)
+	{
+		ASSERT_EQ(fscanf(expected, "%lf %lf %lf %lf %lf %lf\n", &e[0], &e[1], &e[2], &e[3], &e[4], &e[5]), 6);
+		ASSERT_EQ(fscanf(produced, "%lf %lf %lf %lf %lf %lf\n", &p[0], &p[1], &p[2], &p[3], &p[4], &p[5]), 6);
+		double current_difference = sqrt(pow(p[3] - e[3], 2.0) + pow(p[4] - e[4], 2.0));
+		if(current_difference > difference)
+			difference = current_difference;
+	}
+	fclose(expected);
+	fclose(produced);
+
 	double threshold = 1e-5; // 0.00001
-	double difference = unit_test_generate_approximate_visibilities();
 	ASSERT_LE(difference, threshold); // diff <= threshold
 }
 
+// A sky model is packed once and reused, but edits to the sources must
+// still be picked up by the next prediction
+TEST(DFTTest, SkyModelCacheFollowsSourceChanges)
+{
+	Config config;
+	unit_test_init_config(&config);
+	config.compute_backend = DFT_BACKEND_CPU;
+
+	Source sources[2] = { { 0.0, 0.0, 1.0 }, { 1e-3, -2e-3, 0.5 } };
+	Visibility visibility = { 100.0, -50.0, 5.0 };
+	config.numSources = 2;
+
+	DFT_Engine *engine = create_dft_engine(&config);
+
+	Complex first = { 0.0, 0.0 };
+	extract_visibilities(engine, &config, sources, &visibility, &first, 1);
+	unsigned long long checksum = engine->skyModelChecksum;
+
+	Complex repeat = { 0.0, 0.0 };
+	extract_visibilities(engine, &config, sources, &visibility, &repeat, 1);
+	ASSERT_EQ(checksum, engine->skyModelChecksum);
+	ASSERT_DOUBLE_EQ(first.real, repeat.real);
+	ASSERT_DOUBLE_EQ(first.imaginary, repeat.imaginary);
+
+	sources[0].intensity = 2.0;
+	Complex changed = { 0.0, 0.0 };
+	extract_visibilities(engine, &config, sources, &visibility, &changed, 1);
+	ASSERT_NEAR(changed.real - first.real, 1.0, 1e-9);
+
+	destroy_dft_engine(engine);
+}
+
+// The binary container must hand back exactly what the text loaders produce,
+// mapped in place when the configuration matches and rescaled otherwise
+TEST(DFTTest, BinaryContainerRoundTripsVisibilities)
+{
+	Config config;
+	unit_test_init_config(&config);
+
+	Visibility *visibilities = NULL;
+	Complex *visIntensity = NULL;
+	loadVisibilities(&config, &visibilities, &visIntensity);
+	ASSERT_TRUE(visibilities != NULL);
+	int count = config.numVisibilities;
+
+	const char *path = "unit_test_visibilities.bin";
+	ASSERT_TRUE(write_binary_visibilities(path, &config, DFT_BINARY_VISIBILITIES,
+		visibilities, NULL, count));
+	ASSERT_TRUE(is_binary_file(path));
+	ASSERT_FALSE(is_binary_file(config.vis_src_file));
+
+	DFT_Mapping mapping;
+	Visibility *mapped = NULL;
+	Complex *mappedIntensity = NULL;
+	ASSERT_EQ(load_binary_visibilities(&config, path, &mapping, &mapped, &mappedIntensity), count);
+	ASSERT_TRUE(mapping.address != NULL);
+	ASSERT_EQ(memcmp(mapped, visibilities, count * sizeof(Visibility)), 0);
+	unmap_file(&mapping);
+	free(mappedIntensity);
+
+	// A different observing frequency forces a converted copy
+	Config halved = config;
+	halved.frequency_hz = config.frequency_hz / 2.0;
+	ASSERT_EQ(load_binary_visibilities(&halved, path, &mapping, &mapped, &mappedIntensity), count);
+	ASSERT_TRUE(mapping.address == NULL);
+	for (int i = 0; i < count; ++i)
+		ASSERT_DOUBLE_EQ(mapped[i].u, visibilities[i].u / 2.0);
+	free(mapped);
+	free(mappedIntensity);
+
+	// A records offset whose end wraps around past 2^64 must be rejected,
+	// as must a container without an observing frequency
+	DFT_BinaryHeader header;
+	FILE *file = fopen(path, "r+b");
+	ASSERT_TRUE(file != NULL);
+	ASSERT_EQ(fread(&header, sizeof(header), 1, file), 1u);
+	DFT_BinaryHeader crafted = header;
+	crafted.records_offset = sizeof(header) - (uint64_t) count * sizeof(Visibility);
+	rewind(file);
+	fwrite(&crafted, sizeof(crafted), 1, file);
+	fflush(file);
+	ASSERT_EQ(load_binary_visibilities(&config, path, &mapping, &mapped, &mappedIntensity), -1);
+	crafted = header;
+	crafted.frequency_hz = 0.0;
+	rewind(file);
+	fwrite(&crafted, sizeof(crafted), 1, file);
+	fclose(file);
+	ASSERT_EQ(load_binary_visibilities(&halved, path, &mapping, &mapped, &mappedIntensity), -1);
+
+	free(visibilities);
+	free(visIntensity);
+	remove(path);
+}
+
+// The parallel text loader must reproduce the values fscanf produced bit for bit
+TEST(DFTTest, TextParserMatchesScanf)
+{
+	Config config;
+	unit_test_init_config(&config);
+	config.num_threads = 4;
+
+	Visibility *visibilities = NULL;
+	Complex *visIntensity = NULL;
+	loadVisibilities(&config, &visibilities, &visIntensity);
+	ASSERT_TRUE(visibilities != NULL);
+
+	FILE *file = fopen(config.vis_src_file, "r");
+	ASSERT_TRUE(file != NULL);
+	int count = 0;
+	ASSERT_EQ(fscanf(file, "%d\n", &count), 1);
+	ASSERT_EQ(count, config.numVisibilities);
+	Visibility *expected = (Visibility*) calloc(count, sizeof(Visibility));
+	ASSERT_EQ(readVisibilityRows(&config, file, expected, count), count);
+	fclose(file);
+	ASSERT_EQ(memcmp(visibilities, expected, count * sizeof(Visibility)), 0);
+
+	const char *tokens[] = { "0.1", "-86478.043968", "2.8E-05", "1e23", "-0.0",
+		"123456789012345678901234", "4.9406564584124654e-324", "0.30000000000000004", "inf" };
+	for (const char *token : tokens)
+	{
+		double parsed = 0.0;
+		const char *cursor = token;
+		ASSERT_TRUE(parse_text_double(&cursor, token + strlen(token), &parsed));
+		double reference = strtod(token, NULL);
+		ASSERT_EQ(memcmp(&parsed, &reference, sizeof(double)), 0) << token;
+	}
+
+	free(expected);
+	free(visibilities);
+	free(visIntensity);
+}
+
+TEST(DFTTest, TextParserReportsMalformedLine)
+{
+	const char *path = "unit_test_malformed.txt";
+	FILE *file = fopen(path, "w");
+	ASSERT_TRUE(file != NULL);
+	fprintf(file, "3\n1.0 2.0 3.0\n\n4.0 5.O 6.0\n7.0 8.0 9.0\n");
+	fclose(file);
+
+	Config config;
+	unit_test_init_config(&config);
+	config.source_file = path;
+	Source *sources = NULL;
+	loadSources(&config, &sources);
+	ASSERT_TRUE(sources == NULL);
+
+	Source parsed[3];
+	SourceRowContext context = { &config, parsed };
+	TextFile text;
+	ASSERT_TRUE(open_text_file(path, &text));
+	ASSERT_EQ(text.count, 3);
+	ASSERT_FALSE(parse_text_rows(&text, 3, store_source_row, &context, 1, "source"));
+	ASSERT_EQ(text.errorLine, 4);
+	close_text_file(&text);
+	remove(path);
+}
+
+// Written values must read back to the same doubles, whether the rows are
+// written in the foreground or queued to the background writer
+TEST(DFTTest, TextWriterRoundTripsValues)
+{
+	Config config;
+	unit_test_init_config(&config);
+
+	const int count = 10000;
+	Visibility *visibilities = (Visibility*) calloc(count, sizeof(Visibility));
+	Complex *visIntensity = (Complex*) calloc(count, sizeof(Complex));
+	for (int n = 0; n < count; ++n)
+	{
+		visibilities[n] = { randomInRange(-1e5, 1e5), randomInRange(-1e5, 1e5), randomInRange(-1e3, 1e3) };
+		visIntensity[n] = { randomInRange(-1.0, 1.0) * 1e-9, randomInRange(-1e3, 1e3) };
+	}
+
+	const char *path = "unit_test_writer_output.txt";
+	FILE *file = fopen(path, "w");
+	ASSERT_TRUE(file != NULL);
+	fprintf(file, "%d\n", count);
+	TextWriter writer;
+	text_writer_start(&writer, &config, file, 1);
+	text_writer_submit(&writer, visibilities, visIntensity, count / 2);
+	text_writer_submit(&writer, visibilities + count / 2, visIntensity + count / 2, count - count / 2);
+	ASSERT_TRUE(text_writer_finish(&writer));
+	fclose(file);
+
+	Complex *parsed = (Complex*) calloc(count, sizeof(Complex));
+	TextFile text;
+	ASSERT_TRUE(open_text_file(path, &text));
+	ASSERT_TRUE(parse_text_rows(&text, 6, [](void *context, int row, const double *values) {
+		((Complex*) context)[row] = { values[3], values[4] };
+	}, parsed, 0, "visibility"));
+	close_text_file(&text);
+	ASSERT_EQ(memcmp(parsed, visIntensity, count * sizeof(Complex)), 0);
+
+	char number[TEXT_MAX_NUMBER];
+	ASSERT_EQ(format_text_double(number, 2.8e-05, 0), 8);
+	ASSERT_EQ(strncmp(number, "0.000028", 8), 0);
+
+	free(parsed);
+	free(visibilities);
+	free(visIntensity);
+	remove(path);
+}
+
+// Largest intensity difference between the expected and produced text files,
+// or a negative value when they cannot be compared
+static double max_text_file_difference(const char *expected_path, const char *produced_path)
+{
+	FILE *expected = fopen(expected_path, "r");
+	FILE *produced = fopen(produced_path, "r");
+	int expected_count = -1, produced_count = -2;
+	if (expected != NULL && fscanf(expected, "%d\n", &expected_count) != 1)
+		expected_count = -1;
+	if (produced != NULL && fscanf(produced, "%d\n", &produced_count) != 1)
+		produced_count = -2;
+
+	double difference = (expected_count == produced_count) ? 0.0 : -1.0;
+	double e[6], p[6];
+	for (int i = 0; difference >= 0.0 && i < expected_count; ++i)
+	{
+		if (fscanf(expected, "%lf %lf %lf %lf %lf %lf\n", &e[0], &e[1], &e[2], &e[3], &e[4], &e[5]) != 6
+			|| fscanf(produced, "%lf %lf %lf %lf %lf %lf\n", &p[0], &p[1], &p[2], &p[3], &p[4], &p[5]) != 6)
+			difference = -1.0;
+		else
+			difference = fmax(difference, sqrt(pow(p[3] - e[3], 2.0) + pow(p[4] - e[4], 2.0)));
+	}
+
+	if (expected) fclose(expected);
+	if (produced) fclose(produced);
+	return difference;
+}
+
+// Two good jobs and one with a missing input: the good ones must still be
+// predicted correctly and the bad one reported as failed
+TEST(DFTTest, BatchRunsEveryJobOnOneEngine)
+{
+	Config config;
+	unit_test_init_config(&config);
+	config.batch_manifest = "unit_test_batch_manifest.txt";
+
+	FILE *manifest = fopen(config.batch_manifest, "w");
+	ASSERT_TRUE(manifest != NULL);
+	fprintf(manifest, "# sources, visibilities, output, frequency_hz\n");
+	fprintf(manifest, "%s, %s, unit_test_batch_0.txt, %.1f\n", config.source_file, config.vis_src_file, config.frequency_hz);
+	fprintf(manifest, "missing_sources.txt, %s, unit_test_batch_1.txt, %.1f\n", config.vis_src_file, config.frequency_hz);
+	fprintf(manifest, "%s %s unit_test_batch_2.txt %.1f\n", config.source_file, config.vis_src_file, config.frequency_hz);
+	fclose(manifest);
+
+	ASSERT_EQ(run_batch(&config), 1);
+
+	double threshold = 1e-5; // 0.00001
+	for (int job = 0; job <= 2; job += 2)
+	{
+		char output[64];
+		snprintf(output, sizeof(output), "unit_test_batch_%d.txt", job);
+		double difference = max_text_file_difference(config.vis_src_file, output);
+		ASSERT_GE(difference, 0.0);
+		ASSERT_LE(difference, threshold);
+		remove(output);
+	}
+	remove(config.batch_manifest);
+}
+
+// One channelized prediction must match predicting each channel on its own,
+// both through the phasor recurrence (regular channels, across a resync)
+// and the direct evaluation (irregular channels)
+static void check_channelized_matches_per_channel(Config &config)
+{
+	Source *sources = NULL;
+	Visibility *visibilities = NULL;
+	Complex *visIntensity = NULL;
+	loadSources(&config, &sources);
+	loadVisibilities(&config, &visibilities, &visIntensity);
+	ASSERT_TRUE(sources != NULL && visibilities != NULL);
+
+	const int num_visibilities = 64;
+	const int num_channels = 70;
+	double wavelengths_to_meters = C / config.frequency_hz;
+	for (int i = 0; i < num_visibilities; ++i)
+	{
+		visibilities[i].u *= wavelengths_to_meters;
+		visibilities[i].v *= wavelengths_to_meters;
+		visibilities[i].w *= wavelengths_to_meters;
+	}
+
+	DFT_Engine *engine = create_dft_engine(&config);
+	double frequencies[num_channels];
+	Complex channelized[num_channels * num_visibilities];
+	Complex expected[num_visibilities];
+	Visibility scaled[num_visibilities];
+
+	for (int irregular = 0; irregular <= 1; ++irregular)
+	{
+		for (int k = 0; k < num_channels; ++k)
+			frequencies[k] = 3e8 + k * 1e6 + (irregular ? 37e3 * (k % 3) : 0.0);
+		memset(channelized, 0, sizeof(channelized));
+		ASSERT_EQ(extract_channel_visibilities(engine, &config, sources, visibilities, num_visibilities,
+			frequencies, num_channels, channelized, num_visibilities), DFT_SUCCESS);
+
+		double difference = 0.0;
+		for (int k = 0; k < num_channels; ++k)
+		{
+			for (int i = 0; i < num_visibilities; ++i)
+			{
+				scaled[i].u = visibilities[i].u * frequencies[k] / C;
+				scaled[i].v = visibilities[i].v * frequencies[k] / C;
+				scaled[i].w = visibilities[i].w * frequencies[k] / C;
+			}
+			memset(expected, 0, sizeof(expected));
+			extract_visibilities(engine, &config, sources, scaled, expected, num_visibilities);
+			for (int i = 0; i < num_visibilities; ++i)
+			{
+				Complex produced = channelized[k * num_visibilities + i];
+				double current_difference = sqrt(pow(produced.real - expected[i].real, 2.0)
+					+ pow(produced.imaginary - expected[i].imaginary, 2.0));
+				if (current_difference > difference)
+					difference = current_difference;
+			}
+		}
+		ASSERT_LE(difference, 1e-8);
+	}
+
+	destroy_dft_engine(engine);
+	free(sources);
+	free(visibilities);
+	free(visIntensity);
+}
+
+TEST(DFTTest, ChannelizedVisibilitiesMatchPerChannel)
+{
+	Config config;
+	unit_test_init_config(&config);
+	config.compute_backend = DFT_BACKEND_CPU;
+	check_channelized_matches_per_channel(config);
+}
+
+TEST(DFTTest, ChannelizedKernelMatchesPerChannel)
+{
+	Config config;
+	unit_test_init_config(&config);
+	REQUIRE_OPENCL_DEVICE(config);
+	check_channelized_matches_per_channel(config);
+}
+
+// Incremental updates of a prediction must agree with predicting the edited
+// sky model from scratch, whether the update was a delta or a recompute
+TEST(DFTTest, IncrementalSkyModelUpdatesMatchFullPrediction)
+{
+	Config config;
+	unit_test_init_config(&config);
+	config.compute_backend = DFT_BACKEND_CPU;
+	config.sky_update_recompute_interval = 3;
+
+	Source *sources = NULL;
+	Visibility *visibilities = NULL;
+	Complex *visIntensity = NULL;
+	loadSources(&config, &sources);
+	loadVisibilities(&config, &visibilities, &visIntensity);
+	ASSERT_TRUE(sources != NULL && visibilities != NULL);
+	ASSERT_GE(config.numSources, 12);
+
+	int num_visibilities = config.numVisibilities;
+	int num_sources = config.numSources;
+	Source *edited = (Source*) malloc((num_sources + 2) * sizeof(Source));
+	memcpy(edited, sources, num_sources * sizeof(Source));
+
+	DFT_Engine *engine = create_dft_engine(&config);
+	DFT_Prediction *prediction = create_dft_prediction(engine, &config, edited, visibilities, num_visibilities);
+	ASSERT_TRUE(prediction != NULL);
+
+	for (int update = 0; update < 4; ++update)
+	{
+		// Re-flux one source, move the last and move (at first, add) an extra
+		// one, each move being a removal plus an addition
+		edited[update].intensity *= 1.5;
+		edited[num_sources - 1].l += 1e-4;
+		edited[num_sources] = edited[update + 1];
+		edited[num_sources].m -= 2e-4 * (update + 1);
+		config.numSources = num_sources + 1;
+		int evaluated = update_dft_prediction(prediction, &config, edited);
+		if (update == 2)
+			ASSERT_EQ(evaluated, num_sources + 1); // recompute interval reached
+		else
+			ASSERT_EQ(evaluated, (update == 0) ? 4 : 5);
+
+		Complex *expected = (Complex*) calloc(num_visibilities, sizeof(Complex));
+		extract_visibilities(engine, &config, edited, visibilities, expected, num_visibilities);
+		Complex *produced = read_dft_prediction(prediction);
+		ASSERT_TRUE(produced != NULL);
+		double difference = 0.0;
+		for (int i = 0; i < num_visibilities; ++i)
+		{
+			double current_difference = sqrt(pow(produced[i].real - expected[i].real, 2.0)
+				+ pow(produced[i].imaginary - expected[i].imaginary, 2.0));
+			if (current_difference > difference)
+				difference = current_difference;
+		}
+		free(expected);
+		ASSERT_LE(difference, 1e-9);
+	}
+	ASSERT_EQ(update_dft_prediction(prediction, &config, edited), 0);
+
+	destroy_dft_prediction(prediction);
+	destroy_dft_engine(engine);
+	free(edited);
+	free(sources);
+	free(visibilities);
+	free(visIntensity);
+}
+
+// The dirty image of a point source's visibilities must peak at the source
+// with its flux, from both the kernel's adjoint and the binary container
+TEST(DFTTest, DirtyImagePeaksAtPointSource)
+{
+	Config config;
+	unit_test_init_config(&config);
+	config.compute_backend = DFT_BACKEND_CPU;
+	config.grid_size = 32.0;
+	config.image_file = "unit_test_image.bin";
+
+	Source *sources = NULL;
+	Visibility *visibilities = NULL;
+	Complex *visIntensity = NULL;
+	loadSources(&config, &sources);
+	loadVisibilities(&config, &visibilities, &visIntensity);
+	ASSERT_TRUE(sources != NULL && visibilities != NULL);
+
+	const int grid = 32;
+	const int peak_x = 21, peak_y = 9;
+	Source point = { (peak_x - grid / 2) * config.cell_size, (peak_y - grid / 2) * config.cell_size, 2.5 };
+	config.numSources = 1;
+
+	DFT_Engine *engine = create_dft_engine(&config);
+	extract_visibilities(engine, &config, &point, visibilities, visIntensity, config.numVisibilities);
+	double *image = (double*) malloc(grid * grid * sizeof(double));
+	ASSERT_EQ(extract_image(engine, &config, visibilities, visIntensity, NULL, config.numVisibilities, image),
+		DFT_SUCCESS);
+	destroy_dft_engine(engine);
+
+	int brightest = 0;
+	for (int p = 1; p < grid * grid; ++p)
+		if (image[p] > image[brightest])
+			brightest = p;
+	ASSERT_EQ(brightest, peak_y * grid + peak_x);
+	ASSERT_NEAR(image[brightest], 2.5, 1e-9);
+
+	saveImage(&config, image);
+	FILE *file = fopen(config.image_file, "rb");
+	ASSERT_TRUE(file != NULL);
+	DFT_BinaryHeader header;
+	ASSERT_EQ(fread(&header, sizeof(header), 1, file), 1u);
+	ASSERT_EQ(header.kind, (uint32_t) DFT_BINARY_IMAGE);
+	ASSERT_EQ(header.width, (uint32_t) grid);
+	ASSERT_EQ(header.height, (uint32_t) grid);
+	double stored = 0.0;
+	fseek(file, (long) (header.records_offset + brightest * sizeof(double)), SEEK_SET);
+	ASSERT_EQ(fread(&stored, sizeof(double), 1, file), 1u);
+	ASSERT_EQ(stored, image[brightest]);
+	fclose(file);
+	remove(config.image_file);
+
+	free(image);
+	free(sources);
+	free(visibilities);
+	free(visIntensity);
+}
+
+// The gridded prediction must stay within its accuracy target of the DFT,
+// relative to the summed flux of the sky model
+TEST(DFTTest, GriddedPredictionMeetsAccuracy)
+{
+	Config config;
+	unit_test_init_config(&config);
+	config.compute_backend = DFT_BACKEND_CPU;
+	config.grid_cross_check = 0;
+
+	Source *sources = NULL;
+	Visibility *visibilities = NULL;
+	Complex *exact = NULL;
+	loadSources(&config, &sources);
+	loadVisibilities(&config, &visibilities, &exact);
+	ASSERT_TRUE(sources != NULL && visibilities != NULL);
+
+	// A shorter baseline set keeps the grid small
+	for (int i = 0; i < config.numVisibilities; ++i)
+	{
+		visibilities[i].u /= 8.0;
+		visibilities[i].v /= 8.0;
+		visibilities[i].w /= 8.0;
+	}
+
+	DFT_Engine *engine = create_dft_engine(&config);
+	extract_visibilities(engine, &config, sources, visibilities, exact, config.numVisibilities);
+
+	double flux = 0.0;
+	for (int s = 0; s < engine->numPackedSources; ++s)
+		flux += fabs(engine->packedSources[s].flux);
+
+	const double accuracies[] = { 1e-4, 1e-9 };
+	for (double accuracy : accuracies)
+	{
+		config.prediction_mode = DFT_PREDICT_GRIDDED;
+		config.grid_accuracy = accuracy;
+		Complex *gridded = (Complex*) calloc(config.numVisibilities, sizeof(Complex));
+		extract_visibilities(engine, &config, sources, visibilities, gridded, config.numVisibilities);
+
+		double difference = 0.0;
+		for (int i = 0; i < config.numVisibilities; ++i)
+			difference = fmax(difference, hypot(gridded[i].real - exact[i].real,
+				gridded[i].imaginary - exact[i].imaginary));
+		ASSERT_LE(difference, accuracy * flux);
+		free(gridded);
+	}
+
+	destroy_dft_engine(engine);
+	free(sources);
+	free(visibilities);
+	free(exact);
+}
+
+// Pruning the faint tail must reduce the sky model, and the prediction must
+// stay within the reported bound, itself within the tolerance
+TEST(DFTTest, PrunedSkyModelStaysWithinErrorBound)
+{
+	Config config;
+	unit_test_init_config(&config);
+	config.compute_backend = DFT_BACKEND_CPU;
+
+	Source *loaded = NULL;
+	Visibility *visibilities = NULL;
+	Complex *exact = NULL;
+	loadSources(&config, &loaded);
+	loadVisibilities(&config, &visibilities, &exact);
+	ASSERT_TRUE(loaded != NULL && visibilities != NULL);
+
+	// The bright sources, a faint tail and faint pairs a fraction of a cell apart
+	const int bright = config.numSources;
+	const int faint = 40;
+	const int num_sources = bright + 2 * faint;
+	Source *sources = (Source*) malloc(num_sources * sizeof(Source));
+	for (int s = 0; s < bright; ++s)
+		sources[s] = loaded[s];
+	for (int f = 0; f < faint; ++f)
+	{
+		double l = (f - faint / 2) * 3.0 * config.cell_size;
+		sources[bright + 2 * f] = (Source) { l, -l, 1e-4 * (f + 1) };
+		sources[bright + 2 * f + 1] = (Source) { l + 1e-3 * config.cell_size, -l, 5e-3 };
+	}
+	config.numSources = num_sources;
+
+	DFT_Engine *engine = create_dft_engine(&config);
+	extract_visibilities(engine, &config, sources, visibilities, exact, config.numVisibilities);
+
+	double flux = 0.0;
+	for (int s = 0; s < engine->numPackedSources; ++s)
+		flux += fabs(engine->packedSources[s].flux);
+
+	config.sky_prune_tolerance = 1e-2;
+	double bound = 0.0;
+	ASSERT_EQ(pruneSources(&config, sources, visibilities, config.numVisibilities, &bound), DFT_SUCCESS);
+	ASSERT_LT(config.numSources, num_sources);
+	ASSERT_GE(config.numSources, bright);
+	ASSERT_LE(bound, config.sky_prune_tolerance * flux);
+
+	Complex *pruned = (Complex*) calloc(config.numVisibilities, sizeof(Complex));
+	extract_visibilities(engine, &config, sources, visibilities, pruned, config.numVisibilities);
+	double difference = 0.0;
+	for (int i = 0; i < config.numVisibilities; ++i)
+		difference = fmax(difference, hypot(pruned[i].real - exact[i].real,
+			pruned[i].imaginary - exact[i].imaginary));
+	ASSERT_LE(difference, bound * (1.0 + 1e-9));
+
+	destroy_dft_engine(engine);
+	free(pruned);
+	free(sources);
+	free(loaded);
+	free(visibilities);
+	free(exact);
+}
+
+// Loaded arrays and structure-of-arrays blocks must be aligned and padded,
+// and the blocks must convert to and from the AoS views exactly
+TEST(DFTTest, StructureOfArraysStorageIsAlignedAndPadded)
+{
+	Config config;
+	unit_test_init_config(&config);
+
+	Visibility *visibilities = NULL;
+	Complex *visIntensity = NULL;
+	loadVisibilities(&config, &visibilities, &visIntensity);
+	ASSERT_TRUE(visibilities != NULL && visIntensity != NULL);
+	ASSERT_EQ((uintptr_t) visibilities % DFT_STORAGE_ALIGNMENT, 0u);
+	ASSERT_EQ((uintptr_t) visIntensity % DFT_STORAGE_ALIGNMENT, 0u);
+
+	const int count = config.numVisibilities;
+	ASSERT_EQ(dft_padded_count(count) % DFT_STORAGE_PAD, 0);
+	double *block = (double*) dft_aligned_alloc(visibility_arrays_bytes(count));
+	VisibilityArrays arrays;
+	visibility_arrays_view(&arrays, block, count);
+	gather_visibilities(&arrays, visibilities, count);
+	ASSERT_EQ((uintptr_t) arrays.v % DFT_STORAGE_ALIGNMENT, 0u);
+	ASSERT_EQ((uintptr_t) arrays.w % DFT_STORAGE_ALIGNMENT, 0u);
+	for (int i = 0; i < count; ++i)
+	{
+		ASSERT_EQ(arrays.u[i], visibilities[i].u);
+		ASSERT_EQ(arrays.v[i], visibilities[i].v);
+		ASSERT_EQ(arrays.w[i], visibilities[i].w);
+	}
+	for (int i = count; i < arrays.padded; ++i)
+		ASSERT_EQ(arrays.w[i], 0.0);
+
+	double *sums = (double*) dft_aligned_alloc(intensity_arrays_bytes(count));
+	IntensityArrays intensities;
+	intensity_arrays_view(&intensities, sums, count);
+	for (int i = 0; i < count; ++i)
+	{
+		intensities.real[i] = i;
+		intensities.imaginary[i] = -i;
+	}
+	add_intensities(&intensities, visIntensity, count);
+	add_intensities(&intensities, visIntensity, count);
+	for (int i = 0; i < count; ++i)
+	{
+		ASSERT_EQ(visIntensity[i].real, 2.0 * i);
+		ASSERT_EQ(visIntensity[i].imaginary, -2.0 * i);
+	}
+
+	free(block);
+	free(sums);
+	free(visibilities);
+	free(visIntensity);
+}
+
+// The library must predict into the caller's buffer exactly what the engine
+// computes, overwriting rather than accumulating, and reject bad arguments
+TEST(DFTTest, LibraryPredictsIntoCallerBuffers)
+{
+	Config config;
+	dft_default_config(&config);
+	config.compute_backend = DFT_BACKEND_CPU;
+
+	Source sources[2] = { { 0.0, 0.0, 1.0 }, { 1e-3, -2e-3, 0.5 } };
+	Visibility visibilities[3] = { { 100.0, -50.0, 5.0 }, { -300.0, 20.0, 0.0 }, { 0.0, 0.0, 0.0 } };
+
+	DFT_Handle *dft = NULL;
+	ASSERT_EQ(dft_create(&dft, &config), DFT_SUCCESS);
+	ASSERT_EQ(dft_set_sources(dft, sources, 2), DFT_SUCCESS);
+
+	Complex predicted[3] = { { 7.0, 7.0 }, { 7.0, 7.0 }, { 7.0, 7.0 } };
+	ASSERT_EQ(dft_predict(dft, visibilities, 3, predicted), DFT_SUCCESS);
+
+	config.numSources = 2;
+	DFT_Engine *engine = create_dft_engine(&config);
+	Complex expected[3] = { { 0.0, 0.0 }, { 0.0, 0.0 }, { 0.0, 0.0 } };
+	ASSERT_EQ(extract_visibilities(engine, &config, sources, visibilities, expected, 3), DFT_SUCCESS);
+	destroy_dft_engine(engine);
+	for (int i = 0; i < 3; ++i)
+	{
+		ASSERT_DOUBLE_EQ(predicted[i].real, expected[i].real);
+		ASSERT_DOUBLE_EQ(predicted[i].imaginary, expected[i].imaginary);
+	}
+	ASSERT_DOUBLE_EQ(predicted[2].real, 1.0 + 0.5 / (1.0 - 2.5e-6));
+
+	ASSERT_EQ(dft_predict(dft, NULL, 3, predicted), DFT_ERROR_INVALID_ARGUMENT);
+	ASSERT_EQ(dft_set_sources(dft, NULL, 1), DFT_ERROR_INVALID_ARGUMENT);
+	ASSERT_EQ(dft_predict(NULL, visibilities, 3, predicted), DFT_ERROR_INVALID_ARGUMENT);
+	dft_destroy(dft);
+}
+
+// A single visibility against a large sky model must spread the sources
+// over enough work-groups to fill the device, within the sources there are
+TEST(DFTTest, SourceSplitOnlyForFewVisibilities)
+{
+	int slices = choose_source_slices(0, 16, 64, 1, 100000);
+	ASSERT_EQ(256, slices);
+	ASSERT_EQ(2, choose_source_slices(0, 16, 64, 1, 100));
+	ASSERT_EQ(0, choose_source_slices(0, 16, 64, 100000, 100000));
+	ASSERT_EQ(0, choose_source_slices(0, 16, 64, 1, 10));
+	ASSERT_EQ(0, choose_source_slices(-1, 16, 64, 1, 100000));
+	ASSERT_EQ(1, choose_source_slices(1, 16, 64, 100000, 100000));
+}
+
+// Forcing the split runs every test visibility through DFT_OpenCL_Split and
+// DFT_Reduce_Slices
+TEST(DFTTest, SourceSplitKernelVisibilitiesApproximatelyEqual)
+{
+	Config config;
+	unit_test_init_config(&config);
+	REQUIRE_OPENCL_DEVICE(config);
+	config.source_split = 1;
+	config.work_group_size = 32;
+
+	double threshold = 1e-5; // 0.00001
+	double difference = unit_test_generate_approximate_visibilities(&config);
+	ASSERT_LE(difference, threshold); // diff <= threshold
+}
+
+// A tuning profile must read back as written, and one missing a launch
+// parameter must not be applied
+TEST(DFTTest, TuningProfileRoundTrips)
+{
+	// A fresh directory in the build tree, as tune_profile_dir would be
+	char directory[] = "unit_test_tuning_XXXXXX";
+	ASSERT_TRUE(mkdtemp(directory) != NULL);
+	char path[64];
+	snprintf(path, sizeof(path), "%s/profile.txt", directory);
+	TuneProfile written = { "Test Device 9000", DFT_PRECISION_DOUBLE, DFT_KERNEL_TILED, 256, -1, 0.125, 3e-16 };
+	ASSERT_TRUE(tune_profile_write(path, &written));
+
+	TuneProfile profile;
+	ASSERT_TRUE(tune_profile_read(path, &profile));
+	ASSERT_STREQ(profile.device, written.device);
+	ASSERT_EQ(profile.precision, DFT_PRECISION_DOUBLE);
+	ASSERT_EQ(profile.kernelVariant, DFT_KERNEL_TILED);
+	ASSERT_EQ(profile.workGroupSize, 256);
+	ASSERT_EQ(profile.sourceSplit, -1);
+	ASSERT_DOUBLE_EQ(profile.seconds, 0.125);
+
+	FILE *file = fopen(path, "w");
+	ASSERT_TRUE(file != NULL);
+	fprintf(file, "precision 0\nkernel_variant 1\nsource_split 0\n");
+	fclose(file);
+	ASSERT_FALSE(tune_profile_read(path, &profile));
+	remove(path);
+	rmdir(directory);
+}
+
 int main(int argc, char **argv) {
 	testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();